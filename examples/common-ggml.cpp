@@ -1,7 +1,9 @@
 #include "common-ggml.h"
 
+#include <algorithm>
 #include <regex>
 #include <map>
+#include <thread>
 
 static const std::map<std::string, enum ggml_ftype> GGML_FTYPE_MAP = {
     {"q4_0", GGML_FTYPE_MOSTLY_Q4_0},
@@ -38,12 +40,91 @@ enum ggml_ftype ggml_parse_ftype(const char * str) {
     return ftype;
 }
 
+enum ggml_type ggml_parse_cache_type(const std::string & str) {
+    static const std::map<std::string, enum ggml_type> types = {
+        {"f32",  GGML_TYPE_F32},
+        {"f16",  GGML_TYPE_F16},
+        {"q8_0", GGML_TYPE_Q8_0},
+        {"q4_0", GGML_TYPE_Q4_0},
+    };
+
+    const auto it = types.find(str);
+    if (it == types.end()) {
+        fprintf(stderr, "%s: unsupported KV cache type '%s'\n", __func__, str.c_str());
+        return GGML_TYPE_COUNT;
+    }
+
+    return it->second;
+}
+
+struct ggml_tensor * ggml_common_sample_top_k_top_p_repeat(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * logits,
+        struct ggml_tensor  * penalty_ids,
+        struct ggml_tensor  * u,
+        int   top_k,
+        float top_p,
+        float temp,
+        float repeat_penalty) {
+    const int64_t n_vocab = logits->ne[0];
+    const int64_t n       = logits->ne[1];
+
+    if (temp <= 0.0f) {
+        // select the token with the highest logit directly
+        return ggml_argmax(ctx, logits);
+    }
+
+    struct ggml_tensor * cur = logits;
+
+    if (penalty_ids && repeat_penalty != 1.0f) {
+        // repetition penalty from ctrl paper (https://arxiv.org/abs/1909.05858)
+        // positive logits are divided by the penalty, negative ones are multiplied by it
+
+        // all the logits as rows of one element
+        // [1, n_vocab*n]
+        struct ggml_tensor * rows = ggml_reshape_2d(ctx, cur, 1, n_vocab*n);
+
+        // [1, n_penalty]
+        struct ggml_tensor * penalized = ggml_get_rows(ctx, rows, penalty_ids);
+
+        struct ggml_tensor * pos = ggml_relu(ctx, penalized);
+        struct ggml_tensor * neg = ggml_sub(ctx, penalized, pos);
+
+        struct ggml_tensor * delta =
+            ggml_add(ctx,
+                    ggml_scale(ctx, pos, 1.0f/repeat_penalty - 1.0f),
+                    ggml_scale(ctx, neg, repeat_penalty - 1.0f));
+
+        // scatter the change of the penalized logits back to their positions, the positions are distinct
+        cur = ggml_add(ctx, cur, ggml_reshape_2d(ctx, ggml_get_rows_back(ctx, delta, penalty_ids, rows), n_vocab, n));
+    }
+
+    cur = ggml_scale(ctx, cur, 1.0f/temp);
+
+    top_k = std::max(1, std::min(top_k, (int) n_vocab));
+
+    // [top_k, n]
+    struct ggml_tensor * ids = ggml_top_k(ctx, cur, top_k);
+
+    // the logits of the top k tokens, gathered as rows of one element
+    // [top_k, n]
+    struct ggml_tensor * probs =
+        ggml_reshape_2d(ctx,
+                ggml_get_rows(ctx, ggml_reshape_3d(ctx, cur, 1, n_vocab, n), ids),
+                top_k, n);
+
+    probs = ggml_soft_max(ctx, probs);
+
+    return ggml_reshape_1d(ctx, ggml_sample_top_p(ctx, probs, ids, u, top_p), n);
+}
+
 bool ggml_common_quantize_0(
         std::ifstream & finp,
         std::ofstream & fout,
         const ggml_ftype ftype,
         const std::vector<std::string> & to_quant,
-        const std::vector<std::string> & to_skip) {
+        const std::vector<std::string> & to_skip,
+        int n_threads) {
 
     ggml_type qtype = GGML_TYPE_F32;
 
@@ -83,6 +164,10 @@ bool ggml_common_quantize_0(
         return false;
     }
 
+    if (n_threads <= 0) {
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
     size_t total_size_org = 0;
     size_t total_size_new = 0;
 
@@ -188,7 +273,7 @@ bool ggml_common_quantize_0(
                 case GGML_TYPE_Q5_K:
                 case GGML_TYPE_Q6_K:
                     {
-                        cur_size = ggml_quantize_chunk((ggml_type) ttype, data_f32.data(), work.data(), 0, nelements/ne[0], ne[0], nullptr);
+                        ggml_quantize_chunk_mt((ggml_type) ttype, data_f32.data(), work.data(), 0, nelements/ne[0], ne[0], nullptr, n_threads, nullptr, nullptr, &cur_size);
                     } break;
                 case GGML_TYPE_F32:
                 case GGML_TYPE_F16:
@@ -10,9 +10,29 @@ enum ggml_ftype ggml_parse_ftype(const char * str);
 
 void ggml_print_ftypes(FILE * fp = stderr);
 
+// parse a KV cache data type: f32, f16, q8_0 or q4_0
+// returns GGML_TYPE_COUNT if the type is not supported
+enum ggml_type ggml_parse_cache_type(const std::string & str);
+
+// build the sampling of one token per column of logits [n_vocab, n], as done on the host by gpt_sample_top_k_top_p_repeat:
+// repetition penalty, temperature, top-k, softmax, top-p and a categorical draw with the uniform random numbers u [n]
+// penalty_ids [n_penalty] (I32, can be NULL) are the distinct positions i*n_vocab + id of the tokens id penalized in column i
+// temp <= 0 selects the token with the highest logit
+// returns the sampled token ids [n] (I32)
+struct ggml_tensor * ggml_common_sample_top_k_top_p_repeat(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * logits,
+        struct ggml_tensor  * penalty_ids,
+        struct ggml_tensor  * u,
+        int   top_k,
+        float top_p,
+        float temp,
+        float repeat_penalty);
+
 bool ggml_common_quantize_0(
         std::ifstream & finp,
         std::ofstream & fout,
         const ggml_ftype ftype,
         const std::vector<std::string> & to_quant,
-        const std::vector<std::string> & to_skip);
+        const std::vector<std::string> & to_skip,
+        int n_threads = 0); // 0 = number of hardware threads
@@ -2,10 +2,14 @@
 
 #include "common.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <codecvt>
 #include <cstring>
 #include <fstream>
+#include <limits>
 #include <locale>
 #include <regex>
 #include <sstream>
@@ -57,8 +61,18 @@ bool gpt_params_parse(int argc, char ** argv, gpt_params & params) {
             params.n_gpu_layers = std::stoi(get_next_arg(i, argc, argv, arg, params));
         } else if (arg == "--ignore-eos") {
             params.ignore_eos = true;
+        } else if (arg == "-fa" || arg == "--flash-attn") {
+            params.flash_attn = true;
+        } else if (arg == "-ctk" || arg == "--cache-type-k") {
+            params.cache_type_k = get_next_arg(i, argc, argv, arg, params);
+        } else if (arg == "-ctv" || arg == "--cache-type-v") {
+            params.cache_type_v = get_next_arg(i, argc, argv, arg, params);
         } else if (arg == "-m" || arg == "--model") {
             params.model = get_next_arg(i, argc, argv, arg, params);
+        } else if (arg == "-md" || arg == "--model-draft") {
+            params.model_draft = get_next_arg(i, argc, argv, arg, params);
+        } else if (arg == "--draft") {
+            params.n_draft = std::stoi(get_next_arg(i, argc, argv, arg, params));
         } else if (arg == "-i" || arg == "--interactive") {
             params.interactive = true;
         } else if (arg == "-ip" || arg == "--interactive-port") {
@@ -113,9 +127,17 @@ void gpt_print_usage(int /*argc*/, char ** argv, const gpt_params & params) {
     fprintf(stderr, "  -b N, --batch_size N  batch size for prompt processing (default: %d)\n", params.n_batch);
     fprintf(stderr, "  -c N, --context N     context / KV cache size (default: %d)\n", params.n_ctx);
     fprintf(stderr, "  --ignore-eos          ignore EOS token during generation\n");
+    fprintf(stderr, "  -fa, --flash-attn     use flash attention on supported models (default: %s)\n", params.flash_attn ? "enabled" : "disabled");
+    fprintf(stderr, "  -ctk TYPE, --cache-type-k TYPE\n");
+    fprintf(stderr, "                        KV cache data type for K on supported models: f32, f16, q8_0, q4_0 (default: %s)\n", params.cache_type_k.c_str());
+    fprintf(stderr, "  -ctv TYPE, --cache-type-v TYPE\n");
+    fprintf(stderr, "                        KV cache data type for V on supported models: f32, f16, q8_0, q4_0 (default: %s)\n", params.cache_type_v.c_str());
     fprintf(stderr, "  -ngl N, --gpu-layers N  number of layers to offload to GPU on supported models (default: %d)\n", params.n_gpu_layers);
     fprintf(stderr, "  -m FNAME, --model FNAME\n");
     fprintf(stderr, "                        model path (default: %s)\n", params.model.c_str());
+    fprintf(stderr, "  -md FNAME, --model-draft FNAME\n");
+    fprintf(stderr, "                        draft model for speculative decoding on supported models (default: none)\n");
+    fprintf(stderr, "  --draft N             number of tokens to draft for speculative decoding (default: %d)\n", params.n_draft);
     fprintf(stderr, "\n");
 }
 
@@ -258,7 +280,507 @@ std::wstring convert_to_wstring(const std::string & input) {
     return converter.from_bytes(input);
 }
 
+// character classes of the GPT-2 pre-tokenizer pattern
+enum gpt_char_class {
+    GPT_CHAR_OTHER  = 0,
+    GPT_CHAR_LETTER = 1, // \p{L}
+    GPT_CHAR_NUMBER = 2, // \p{N}
+    GPT_CHAR_SPACE  = 3, // \s
+};
+
+struct gpt_char_range {
+    uint32_t first;
+    uint32_t last;
+    uint8_t  cls;
+};
+
+// the non-ASCII code points that are letters, numbers or white space, all others are GPT_CHAR_OTHER
+// generated from the Unicode 14.0 character database
+static const gpt_char_range k_char_ranges[] = {
+    {0x00085, 0x00085, 3}, {0x000A0, 0x000A0, 3}, {0x000AA, 0x000AA, 1}, {0x000B2, 0x000B3, 2},
+    {0x000B5, 0x000B5, 1}, {0x000B9, 0x000B9, 2}, {0x000BA, 0x000BA, 1}, {0x000BC, 0x000BE, 2},
+    {0x000C0, 0x000D6, 1}, {0x000D8, 0x000F6, 1}, {0x000F8, 0x002C1, 1}, {0x002C6, 0x002D1, 1},
+    {0x002E0, 0x002E4, 1}, {0x002EC, 0x002EC, 1}, {0x002EE, 0x002EE, 1}, {0x00370, 0x00374, 1},
+    {0x00376, 0x00377, 1}, {0x0037A, 0x0037D, 1}, {0x0037F, 0x0037F, 1}, {0x00386, 0x00386, 1},
+    {0x00388, 0x0038A, 1}, {0x0038C, 0x0038C, 1}, {0x0038E, 0x003A1, 1}, {0x003A3, 0x003F5, 1},
+    {0x003F7, 0x00481, 1}, {0x0048A, 0x0052F, 1}, {0x00531, 0x00556, 1}, {0x00559, 0x00559, 1},
+    {0x00560, 0x00588, 1}, {0x005D0, 0x005EA, 1}, {0x005EF, 0x005F2, 1}, {0x00620, 0x0064A, 1},
+    {0x00660, 0x00669, 2}, {0x0066E, 0x0066F, 1}, {0x00671, 0x006D3, 1}, {0x006D5, 0x006D5, 1},
+    {0x006E5, 0x006E6, 1}, {0x006EE, 0x006EF, 1}, {0x006F0, 0x006F9, 2}, {0x006FA, 0x006FC, 1},
+    {0x006FF, 0x006FF, 1}, {0x00710, 0x00710, 1}, {0x00712, 0x0072F, 1}, {0x0074D, 0x007A5, 1},
+    {0x007B1, 0x007B1, 1}, {0x007C0, 0x007C9, 2}, {0x007CA, 0x007EA, 1}, {0x007F4, 0x007F5, 1},
+    {0x007FA, 0x007FA, 1}, {0x00800, 0x00815, 1}, {0x0081A, 0x0081A, 1}, {0x00824, 0x00824, 1},
+    {0x00828, 0x00828, 1}, {0x00840, 0x00858, 1}, {0x00860, 0x0086A, 1}, {0x00870, 0x00887, 1},
+    {0x00889, 0x0088E, 1}, {0x008A0, 0x008C9, 1}, {0x00904, 0x00939, 1}, {0x0093D, 0x0093D, 1},
+    {0x00950, 0x00950, 1}, {0x00958, 0x00961, 1}, {0x00966, 0x0096F, 2}, {0x00971, 0x00980, 1},
+    {0x00985, 0x0098C, 1}, {0x0098F, 0x00990, 1}, {0x00993, 0x009A8, 1}, {0x009AA, 0x009B0, 1},
+    {0x009B2, 0x009B2, 1}, {0x009B6, 0x009B9, 1}, {0x009BD, 0x009BD, 1}, {0x009CE, 0x009CE, 1},
+    {0x009DC, 0x009DD, 1}, {0x009DF, 0x009E1, 1}, {0x009E6, 0x009EF, 2}, {0x009F0, 0x009F1, 1},
+    {0x009F4, 0x009F9, 2}, {0x009FC, 0x009FC, 1}, {0x00A05, 0x00A0A, 1}, {0x00A0F, 0x00A10, 1},
+    {0x00A13, 0x00A28, 1}, {0x00A2A, 0x00A30, 1}, {0x00A32, 0x00A33, 1}, {0x00A35, 0x00A36, 1},
+    {0x00A38, 0x00A39, 1}, {0x00A59, 0x00A5C, 1}, {0x00A5E, 0x00A5E, 1}, {0x00A66, 0x00A6F, 2},
+    {0x00A72, 0x00A74, 1}, {0x00A85, 0x00A8D, 1}, {0x00A8F, 0x00A91, 1}, {0x00A93, 0x00AA8, 1},
+    {0x00AAA, 0x00AB0, 1}, {0x00AB2, 0x00AB3, 1}, {0x00AB5, 0x00AB9, 1}, {0x00ABD, 0x00ABD, 1},
+    {0x00AD0, 0x00AD0, 1}, {0x00AE0, 0x00AE1, 1}, {0x00AE6, 0x00AEF, 2}, {0x00AF9, 0x00AF9, 1},
+    {0x00B05, 0x00B0C, 1}, {0x00B0F, 0x00B10, 1}, {0x00B13, 0x00B28, 1}, {0x00B2A, 0x00B30, 1},
+    {0x00B32, 0x00B33, 1}, {0x00B35, 0x00B39, 1}, {0x00B3D, 0x00B3D, 1}, {0x00B5C, 0x00B5D, 1},
+    {0x00B5F, 0x00B61, 1}, {0x00B66, 0x00B6F, 2}, {0x00B71, 0x00B71, 1}, {0x00B72, 0x00B77, 2},
+    {0x00B83, 0x00B83, 1}, {0x00B85, 0x00B8A, 1}, {0x00B8E, 0x00B90, 1}, {0x00B92, 0x00B95, 1},
+    {0x00B99, 0x00B9A, 1}, {0x00B9C, 0x00B9C, 1}, {0x00B9E, 0x00B9F, 1}, {0x00BA3, 0x00BA4, 1},
+    {0x00BA8, 0x00BAA, 1}, {0x00BAE, 0x00BB9, 1}, {0x00BD0, 0x00BD0, 1}, {0x00BE6, 0x00BF2, 2},
+    {0x00C05, 0x00C0C, 1}, {0x00C0E, 0x00C10, 1}, {0x00C12, 0x00C28, 1}, {0x00C2A, 0x00C39, 1},
+    {0x00C3D, 0x00C3D, 1}, {0x00C58, 0x00C5A, 1}, {0x00C5D, 0x00C5D, 1}, {0x00C60, 0x00C61, 1},
+    {0x00C66, 0x00C6F, 2}, {0x00C78, 0x00C7E, 2}, {0x00C80, 0x00C80, 1}, {0x00C85, 0x00C8C, 1},
+    {0x00C8E, 0x00C90, 1}, {0x00C92, 0x00CA8, 1}, {0x00CAA, 0x00CB3, 1}, {0x00CB5, 0x00CB9, 1},
+    {0x00CBD, 0x00CBD, 1}, {0x00CDD, 0x00CDE, 1}, {0x00CE0, 0x00CE1, 1}, {0x00CE6, 0x00CEF, 2},
+    {0x00CF1, 0x00CF2, 1}, {0x00D04, 0x00D0C, 1}, {0x00D0E, 0x00D10, 1}, {0x00D12, 0x00D3A, 1},
+    {0x00D3D, 0x00D3D, 1}, {0x00D4E, 0x00D4E, 1}, {0x00D54, 0x00D56, 1}, {0x00D58, 0x00D5E, 2},
+    {0x00D5F, 0x00D61, 1}, {0x00D66, 0x00D78, 2}, {0x00D7A, 0x00D7F, 1}, {0x00D85, 0x00D96, 1},
+    {0x00D9A, 0x00DB1, 1}, {0x00DB3, 0x00DBB, 1}, {0x00DBD, 0x00DBD, 1}, {0x00DC0, 0x00DC6, 1},
+    {0x00DE6, 0x00DEF, 2}, {0x00E01, 0x00E30, 1}, {0x00E32, 0x00E33, 1}, {0x00E40, 0x00E46, 1},
+    {0x00E50, 0x00E59, 2}, {0x00E81, 0x00E82, 1}, {0x00E84, 0x00E84, 1}, {0x00E86, 0x00E8A, 1},
+    {0x00E8C, 0x00EA3, 1}, {0x00EA5, 0x00EA5, 1}, {0x00EA7, 0x00EB0, 1}, {0x00EB2, 0x00EB3, 1},
+    {0x00EBD, 0x00EBD, 1}, {0x00EC0, 0x00EC4, 1}, {0x00EC6, 0x00EC6, 1}, {0x00ED0, 0x00ED9, 2},
+    {0x00EDC, 0x00EDF, 1}, {0x00F00, 0x00F00, 1}, {0x00F20, 0x00F33, 2}, {0x00F40, 0x00F47, 1},
+    {0x00F49, 0x00F6C, 1}, {0x00F88, 0x00F8C, 1}, {0x01000, 0x0102A, 1}, {0x0103F, 0x0103F, 1},
+    {0x01040, 0x01049, 2}, {0x01050, 0x01055, 1}, {0x0105A, 0x0105D, 1}, {0x01061, 0x01061, 1},
+    {0x01065, 0x01066, 1}, {0x0106E, 0x01070, 1}, {0x01075, 0x01081, 1}, {0x0108E, 0x0108E, 1},
+    {0x01090, 0x01099, 2}, {0x010A0, 0x010C5, 1}, {0x010C7, 0x010C7, 1}, {0x010CD, 0x010CD, 1},
+    {0x010D0, 0x010FA, 1}, {0x010FC, 0x01248, 1}, {0x0124A, 0x0124D, 1}, {0x01250, 0x01256, 1},
+    {0x01258, 0x01258, 1}, {0x0125A, 0x0125D, 1}, {0x01260, 0x01288, 1}, {0x0128A, 0x0128D, 1},
+    {0x01290, 0x012B0, 1}, {0x012B2, 0x012B5, 1}, {0x012B8, 0x012BE, 1}, {0x012C0, 0x012C0, 1},
+    {0x012C2, 0x012C5, 1}, {0x012C8, 0x012D6, 1}, {0x012D8, 0x01310, 1}, {0x01312, 0x01315, 1},
+    {0x01318, 0x0135A, 1}, {0x01369, 0x0137C, 2}, {0x01380, 0x0138F, 1}, {0x013A0, 0x013F5, 1},
+    {0x013F8, 0x013FD, 1}, {0x01401, 0x0166C, 1}, {0x0166F, 0x0167F, 1}, {0x01680, 0x01680, 3},
+    {0x01681, 0x0169A, 1}, {0x016A0, 0x016EA, 1}, {0x016EE, 0x016F0, 2}, {0x016F1, 0x016F8, 1},
+    {0x01700, 0x01711, 1}, {0x0171F, 0x01731, 1}, {0x01740, 0x01751, 1}, {0x01760, 0x0176C, 1},
+    {0x0176E, 0x01770, 1}, {0x01780, 0x017B3, 1}, {0x017D7, 0x017D7, 1}, {0x017DC, 0x017DC, 1},
+    {0x017E0, 0x017E9, 2}, {0x017F0, 0x017F9, 2}, {0x01810, 0x01819, 2}, {0x01820, 0x01878, 1},
+    {0x01880, 0x01884, 1}, {0x01887, 0x018A8, 1}, {0x018AA, 0x018AA, 1}, {0x018B0, 0x018F5, 1},
+    {0x01900, 0x0191E, 1}, {0x01946, 0x0194F, 2}, {0x01950, 0x0196D, 1}, {0x01970, 0x01974, 1},
+    {0x01980, 0x019AB, 1}, {0x019B0, 0x019C9, 1}, {0x019D0, 0x019DA, 2}, {0x01A00, 0x01A16, 1},
+    {0x01A20, 0x01A54, 1}, {0x01A80, 0x01A89, 2}, {0x01A90, 0x01A99, 2}, {0x01AA7, 0x01AA7, 1},
+    {0x01B05, 0x01B33, 1}, {0x01B45, 0x01B4C, 1}, {0x01B50, 0x01B59, 2}, {0x01B83, 0x01BA0, 1},
+    {0x01BAE, 0x01BAF, 1}, {0x01BB0, 0x01BB9, 2}, {0x01BBA, 0x01BE5, 1}, {0x01C00, 0x01C23, 1},
+    {0x01C40, 0x01C49, 2}, {0x01C4D, 0x01C4F, 1}, {0x01C50, 0x01C59, 2}, {0x01C5A, 0x01C7D, 1},
+    {0x01C80, 0x01C88, 1}, {0x01C90, 0x01CBA, 1}, {0x01CBD, 0x01CBF, 1}, {0x01CE9, 0x01CEC, 1},
+    {0x01CEE, 0x01CF3, 1}, {0x01CF5, 0x01CF6, 1}, {0x01CFA, 0x01CFA, 1}, {0x01D00, 0x01DBF, 1},
+    {0x01E00, 0x01F15, 1}, {0x01F18, 0x01F1D, 1}, {0x01F20, 0x01F45, 1}, {0x01F48, 0x01F4D, 1},
+    {0x01F50, 0x01F57, 1}, {0x01F59, 0x01F59, 1}, {0x01F5B, 0x01F5B, 1}, {0x01F5D, 0x01F5D, 1},
+    {0x01F5F, 0x01F7D, 1}, {0x01F80, 0x01FB4, 1}, {0x01FB6, 0x01FBC, 1}, {0x01FBE, 0x01FBE, 1},
+    {0x01FC2, 0x01FC4, 1}, {0x01FC6, 0x01FCC, 1}, {0x01FD0, 0x01FD3, 1}, {0x01FD6, 0x01FDB, 1},
+    {0x01FE0, 0x01FEC, 1}, {0x01FF2, 0x01FF4, 1}, {0x01FF6, 0x01FFC, 1}, {0x02000, 0x0200A, 3},
+    {0x02028, 0x02029, 3}, {0x0202F, 0x0202F, 3}, {0x0205F, 0x0205F, 3}, {0x02070, 0x02070, 2},
+    {0x02071, 0x02071, 1}, {0x02074, 0x02079, 2}, {0x0207F, 0x0207F, 1}, {0x02080, 0x02089, 2},
+    {0x02090, 0x0209C, 1}, {0x02102, 0x02102, 1}, {0x02107, 0x02107, 1}, {0x0210A, 0x02113, 1},
+    {0x02115, 0x02115, 1}, {0x02119, 0x0211D, 1}, {0x02124, 0x02124, 1}, {0x02126, 0x02126, 1},
+    {0x02128, 0x02128, 1}, {0x0212A, 0x0212D, 1}, {0x0212F, 0x02139, 1}, {0x0213C, 0x0213F, 1},
+    {0x02145, 0x02149, 1}, {0x0214E, 0x0214E, 1}, {0x02150, 0x02182, 2}, {0x02183, 0x02184, 1},
+    {0x02185, 0x02189, 2}, {0x02460, 0x0249B, 2}, {0x024EA, 0x024FF, 2}, {0x02776, 0x02793, 2},
+    {0x02C00, 0x02CE4, 1}, {0x02CEB, 0x02CEE, 1}, {0x02CF2, 0x02CF3, 1}, {0x02CFD, 0x02CFD, 2},
+    {0x02D00, 0x02D25, 1}, {0x02D27, 0x02D27, 1}, {0x02D2D, 0x02D2D, 1}, {0x02D30, 0x02D67, 1},
+    {0x02D6F, 0x02D6F, 1}, {0x02D80, 0x02D96, 1}, {0x02DA0, 0x02DA6, 1}, {0x02DA8, 0x02DAE, 1},
+    {0x02DB0, 0x02DB6, 1}, {0x02DB8, 0x02DBE, 1}, {0x02DC0, 0x02DC6, 1}, {0x02DC8, 0x02DCE, 1},
+    {0x02DD0, 0x02DD6, 1}, {0x02DD8, 0x02DDE, 1}, {0x02E2F, 0x02E2F, 1}, {0x03000, 0x03000, 3},
+    {0x03005, 0x03006, 1}, {0x03007, 0x03007, 2}, {0x03021, 0x03029, 2}, {0x03031, 0x03035, 1},
+    {0x03038, 0x0303A, 2}, {0x0303B, 0x0303C, 1}, {0x03041, 0x03096, 1}, {0x0309D, 0x0309F, 1},
+    {0x030A1, 0x030FA, 1}, {0x030FC, 0x030FF, 1}, {0x03105, 0x0312F, 1}, {0x03131, 0x0318E, 1},
+    {0x03192, 0x03195, 2}, {0x031A0, 0x031BF, 1}, {0x031F0, 0x031FF, 1}, {0x03220, 0x03229, 2},
+    {0x03248, 0x0324F, 2}, {0x03251, 0x0325F, 2}, {0x03280, 0x03289, 2}, {0x032B1, 0x032BF, 2},
+    {0x03400, 0x04DBF, 1}, {0x04E00, 0x0A48C, 1}, {0x0A4D0, 0x0A4FD, 1}, {0x0A500, 0x0A60C, 1},
+    {0x0A610, 0x0A61F, 1}, {0x0A620, 0x0A629, 2}, {0x0A62A, 0x0A62B, 1}, {0x0A640, 0x0A66E, 1},
+    {0x0A67F, 0x0A69D, 1}, {0x0A6A0, 0x0A6E5, 1}, {0x0A6E6, 0x0A6EF, 2}, {0x0A717, 0x0A71F, 1},
+    {0x0A722, 0x0A788, 1}, {0x0A78B, 0x0A7CA, 1}, {0x0A7D0, 0x0A7D1, 1}, {0x0A7D3, 0x0A7D3, 1},
+    {0x0A7D5, 0x0A7D9, 1}, {0x0A7F2, 0x0A801, 1}, {0x0A803, 0x0A805, 1}, {0x0A807, 0x0A80A, 1},
+    {0x0A80C, 0x0A822, 1}, {0x0A830, 0x0A835, 2}, {0x0A840, 0x0A873, 1}, {0x0A882, 0x0A8B3, 1},
+    {0x0A8D0, 0x0A8D9, 2}, {0x0A8F2, 0x0A8F7, 1}, {0x0A8FB, 0x0A8FB, 1}, {0x0A8FD, 0x0A8FE, 1},
+    {0x0A900, 0x0A909, 2}, {0x0A90A, 0x0A925, 1}, {0x0A930, 0x0A946, 1}, {0x0A960, 0x0A97C, 1},
+    {0x0A984, 0x0A9B2, 1}, {0x0A9CF, 0x0A9CF, 1}, {0x0A9D0, 0x0A9D9, 2}, {0x0A9E0, 0x0A9E4, 1},
+    {0x0A9E6, 0x0A9EF, 1}, {0x0A9F0, 0x0A9F9, 2}, {0x0A9FA, 0x0A9FE, 1}, {0x0AA00, 0x0AA28, 1},
+    {0x0AA40, 0x0AA42, 1}, {0x0AA44, 0x0AA4B, 1}, {0x0AA50, 0x0AA59, 2}, {0x0AA60, 0x0AA76, 1},
+    {0x0AA7A, 0x0AA7A, 1}, {0x0AA7E, 0x0AAAF, 1}, {0x0AAB1, 0x0AAB1, 1}, {0x0AAB5, 0x0AAB6, 1},
+    {0x0AAB9, 0x0AABD, 1}, {0x0AAC0, 0x0AAC0, 1}, {0x0AAC2, 0x0AAC2, 1}, {0x0AADB, 0x0AADD, 1},
+    {0x0AAE0, 0x0AAEA, 1}, {0x0AAF2, 0x0AAF4, 1}, {0x0AB01, 0x0AB06, 1}, {0x0AB09, 0x0AB0E, 1},
+    {0x0AB11, 0x0AB16, 1}, {0x0AB20, 0x0AB26, 1}, {0x0AB28, 0x0AB2E, 1}, {0x0AB30, 0x0AB5A, 1},
+    {0x0AB5C, 0x0AB69, 1}, {0x0AB70, 0x0ABE2, 1}, {0x0ABF0, 0x0ABF9, 2}, {0x0AC00, 0x0D7A3, 1},
+    {0x0D7B0, 0x0D7C6, 1}, {0x0D7CB, 0x0D7FB, 1}, {0x0F900, 0x0FA6D, 1}, {0x0FA70, 0x0FAD9, 1},
+    {0x0FB00, 0x0FB06, 1}, {0x0FB13, 0x0FB17, 1}, {0x0FB1D, 0x0FB1D, 1}, {0x0FB1F, 0x0FB28, 1},
+    {0x0FB2A, 0x0FB36, 1}, {0x0FB38, 0x0FB3C, 1}, {0x0FB3E, 0x0FB3E, 1}, {0x0FB40, 0x0FB41, 1},
+    {0x0FB43, 0x0FB44, 1}, {0x0FB46, 0x0FBB1, 1}, {0x0FBD3, 0x0FD3D, 1}, {0x0FD50, 0x0FD8F, 1},
+    {0x0FD92, 0x0FDC7, 1}, {0x0FDF0, 0x0FDFB, 1}, {0x0FE70, 0x0FE74, 1}, {0x0FE76, 0x0FEFC, 1},
+    {0x0FF10, 0x0FF19, 2}, {0x0FF21, 0x0FF3A, 1}, {0x0FF41, 0x0FF5A, 1}, {0x0FF66, 0x0FFBE, 1},
+    {0x0FFC2, 0x0FFC7, 1}, {0x0FFCA, 0x0FFCF, 1}, {0x0FFD2, 0x0FFD7, 1}, {0x0FFDA, 0x0FFDC, 1},
+    {0x10000, 0x1000B, 1}, {0x1000D, 0x10026, 1}, {0x10028, 0x1003A, 1}, {0x1003C, 0x1003D, 1},
+    {0x1003F, 0x1004D, 1}, {0x10050, 0x1005D, 1}, {0x10080, 0x100FA, 1}, {0x10107, 0x10133, 2},
+    {0x10140, 0x10178, 2}, {0x1018A, 0x1018B, 2}, {0x10280, 0x1029C, 1}, {0x102A0, 0x102D0, 1},
+    {0x102E1, 0x102FB, 2}, {0x10300, 0x1031F, 1}, {0x10320, 0x10323, 2}, {0x1032D, 0x10340, 1},
+    {0x10341, 0x10341, 2}, {0x10342, 0x10349, 1}, {0x1034A, 0x1034A, 2}, {0x10350, 0x10375, 1},
+    {0x10380, 0x1039D, 1}, {0x103A0, 0x103C3, 1}, {0x103C8, 0x103CF, 1}, {0x103D1, 0x103D5, 2},
+    {0x10400, 0x1049D, 1}, {0x104A0, 0x104A9, 2}, {0x104B0, 0x104D3, 1}, {0x104D8, 0x104FB, 1},
+    {0x10500, 0x10527, 1}, {0x10530, 0x10563, 1}, {0x10570, 0x1057A, 1}, {0x1057C, 0x1058A, 1},
+    {0x1058C, 0x10592, 1}, {0x10594, 0x10595, 1}, {0x10597, 0x105A1, 1}, {0x105A3, 0x105B1, 1},
+    {0x105B3, 0x105B9, 1}, {0x105BB, 0x105BC, 1}, {0x10600, 0x10736, 1}, {0x10740, 0x10755, 1},
+    {0x10760, 0x10767, 1}, {0x10780, 0x10785, 1}, {0x10787, 0x107B0, 1}, {0x107B2, 0x107BA, 1},
+    {0x10800, 0x10805, 1}, {0x10808, 0x10808, 1}, {0x1080A, 0x10835, 1}, {0x10837, 0x10838, 1},
+    {0x1083C, 0x1083C, 1}, {0x1083F, 0x10855, 1}, {0x10858, 0x1085F, 2}, {0x10860, 0x10876, 1},
+    {0x10879, 0x1087F, 2}, {0x10880, 0x1089E, 1}, {0x108A7, 0x108AF, 2}, {0x108E0, 0x108F2, 1},
+    {0x108F4, 0x108F5, 1}, {0x108FB, 0x108FF, 2}, {0x10900, 0x10915, 1}, {0x10916, 0x1091B, 2},
+    {0x10920, 0x10939, 1}, {0x10980, 0x109B7, 1}, {0x109BC, 0x109BD, 2}, {0x109BE, 0x109BF, 1},
+    {0x109C0, 0x109CF, 2}, {0x109D2, 0x109FF, 2}, {0x10A00, 0x10A00, 1}, {0x10A10, 0x10A13, 1},
+    {0x10A15, 0x10A17, 1}, {0x10A19, 0x10A35, 1}, {0x10A40, 0x10A48, 2}, {0x10A60, 0x10A7C, 1},
+    {0x10A7D, 0x10A7E, 2}, {0x10A80, 0x10A9C, 1}, {0x10A9D, 0x10A9F, 2}, {0x10AC0, 0x10AC7, 1},
+    {0x10AC9, 0x10AE4, 1}, {0x10AEB, 0x10AEF, 2}, {0x10B00, 0x10B35, 1}, {0x10B40, 0x10B55, 1},
+    {0x10B58, 0x10B5F, 2}, {0x10B60, 0x10B72, 1}, {0x10B78, 0x10B7F, 2}, {0x10B80, 0x10B91, 1},
+    {0x10BA9, 0x10BAF, 2}, {0x10C00, 0x10C48, 1}, {0x10C80, 0x10CB2, 1}, {0x10CC0, 0x10CF2, 1},
+    {0x10CFA, 0x10CFF, 2}, {0x10D00, 0x10D23, 1}, {0x10D30, 0x10D39, 2}, {0x10E60, 0x10E7E, 2},
+    {0x10E80, 0x10EA9, 1}, {0x10EB0, 0x10EB1, 1}, {0x10F00, 0x10F1C, 1}, {0x10F1D, 0x10F26, 2},
+    {0x10F27, 0x10F27, 1}, {0x10F30, 0x10F45, 1}, {0x10F51, 0x10F54, 2}, {0x10F70, 0x10F81, 1},
+    {0x10FB0, 0x10FC4, 1}, {0x10FC5, 0x10FCB, 2}, {0x10FE0, 0x10FF6, 1}, {0x11003, 0x11037, 1},
+    {0x11052, 0x1106F, 2}, {0x11071, 0x11072, 1}, {0x11075, 0x11075, 1}, {0x11083, 0x110AF, 1},
+    {0x110D0, 0x110E8, 1}, {0x110F0, 0x110F9, 2}, {0x11103, 0x11126, 1}, {0x11136, 0x1113F, 2},
+    {0x11144, 0x11144, 1}, {0x11147, 0x11147, 1}, {0x11150, 0x11172, 1}, {0x11176, 0x11176, 1},
+    {0x11183, 0x111B2, 1}, {0x111C1, 0x111C4, 1}, {0x111D0, 0x111D9, 2}, {0x111DA, 0x111DA, 1},
+    {0x111DC, 0x111DC, 1}, {0x111E1, 0x111F4, 2}, {0x11200, 0x11211, 1}, {0x11213, 0x1122B, 1},
+    {0x11280, 0x11286, 1}, {0x11288, 0x11288, 1}, {0x1128A, 0x1128D, 1}, {0x1128F, 0x1129D, 1},
+    {0x1129F, 0x112A8, 1}, {0x112B0, 0x112DE, 1}, {0x112F0, 0x112F9, 2}, {0x11305, 0x1130C, 1},
+    {0x1130F, 0x11310, 1}, {0x11313, 0x11328, 1}, {0x1132A, 0x11330, 1}, {0x11332, 0x11333, 1},
+    {0x11335, 0x11339, 1}, {0x1133D, 0x1133D, 1}, {0x11350, 0x11350, 1}, {0x1135D, 0x11361, 1},
+    {0x11400, 0x11434, 1}, {0x11447, 0x1144A, 1}, {0x11450, 0x11459, 2}, {0x1145F, 0x11461, 1},
+    {0x11480, 0x114AF, 1}, {0x114C4, 0x114C5, 1}, {0x114C7, 0x114C7, 1}, {0x114D0, 0x114D9, 2},
+    {0x11580, 0x115AE, 1}, {0x115D8, 0x115DB, 1}, {0x11600, 0x1162F, 1}, {0x11644, 0x11644, 1},
+    {0x11650, 0x11659, 2}, {0x11680, 0x116AA, 1}, {0x116B8, 0x116B8, 1}, {0x116C0, 0x116C9, 2},
+    {0x11700, 0x1171A, 1}, {0x11730, 0x1173B, 2}, {0x11740, 0x11746, 1}, {0x11800, 0x1182B, 1},
+    {0x118A0, 0x118DF, 1}, {0x118E0, 0x118F2, 2}, {0x118FF, 0x11906, 1}, {0x11909, 0x11909, 1},
+    {0x1190C, 0x11913, 1}, {0x11915, 0x11916, 1}, {0x11918, 0x1192F, 1}, {0x1193F, 0x1193F, 1},
+    {0x11941, 0x11941, 1}, {0x11950, 0x11959, 2}, {0x119A0, 0x119A7, 1}, {0x119AA, 0x119D0, 1},
+    {0x119E1, 0x119E1, 1}, {0x119E3, 0x119E3, 1}, {0x11A00, 0x11A00, 1}, {0x11A0B, 0x11A32, 1},
+    {0x11A3A, 0x11A3A, 1}, {0x11A50, 0x11A50, 1}, {0x11A5C, 0x11A89, 1}, {0x11A9D, 0x11A9D, 1},
+    {0x11AB0, 0x11AF8, 1}, {0x11C00, 0x11C08, 1}, {0x11C0A, 0x11C2E, 1}, {0x11C40, 0x11C40, 1},
+    {0x11C50, 0x11C6C, 2}, {0x11C72, 0x11C8F, 1}, {0x11D00, 0x11D06, 1}, {0x11D08, 0x11D09, 1},
+    {0x11D0B, 0x11D30, 1}, {0x11D46, 0x11D46, 1}, {0x11D50, 0x11D59, 2}, {0x11D60, 0x11D65, 1},
+    {0x11D67, 0x11D68, 1}, {0x11D6A, 0x11D89, 1}, {0x11D98, 0x11D98, 1}, {0x11DA0, 0x11DA9, 2},
+    {0x11EE0, 0x11EF2, 1}, {0x11FB0, 0x11FB0, 1}, {0x11FC0, 0x11FD4, 2}, {0x12000, 0x12399, 1},
+    {0x12400, 0x1246E, 2}, {0x12480, 0x12543, 1}, {0x12F90, 0x12FF0, 1}, {0x13000, 0x1342E, 1},
+    {0x14400, 0x14646, 1}, {0x16800, 0x16A38, 1}, {0x16A40, 0x16A5E, 1}, {0x16A60, 0x16A69, 2},
+    {0x16A70, 0x16ABE, 1}, {0x16AC0, 0x16AC9, 2}, {0x16AD0, 0x16AED, 1}, {0x16B00, 0x16B2F, 1},
+    {0x16B40, 0x16B43, 1}, {0x16B50, 0x16B59, 2}, {0x16B5B, 0x16B61, 2}, {0x16B63, 0x16B77, 1},
+    {0x16B7D, 0x16B8F, 1}, {0x16E40, 0x16E7F, 1}, {0x16E80, 0x16E96, 2}, {0x16F00, 0x16F4A, 1},
+    {0x16F50, 0x16F50, 1}, {0x16F93, 0x16F9F, 1}, {0x16FE0, 0x16FE1, 1}, {0x16FE3, 0x16FE3, 1},
+    {0x17000, 0x187F7, 1}, {0x18800, 0x18CD5, 1}, {0x18D00, 0x18D08, 1}, {0x1AFF0, 0x1AFF3, 1},
+    {0x1AFF5, 0x1AFFB, 1}, {0x1AFFD, 0x1AFFE, 1}, {0x1B000, 0x1B122, 1}, {0x1B150, 0x1B152, 1},
+    {0x1B164, 0x1B167, 1}, {0x1B170, 0x1B2FB, 1}, {0x1BC00, 0x1BC6A, 1}, {0x1BC70, 0x1BC7C, 1},
+    {0x1BC80, 0x1BC88, 1}, {0x1BC90, 0x1BC99, 1}, {0x1D2E0, 0x1D2F3, 2}, {0x1D360, 0x1D378, 2},
+    {0x1D400, 0x1D454, 1}, {0x1D456, 0x1D49C, 1}, {0x1D49E, 0x1D49F, 1}, {0x1D4A2, 0x1D4A2, 1},
+    {0x1D4A5, 0x1D4A6, 1}, {0x1D4A9, 0x1D4AC, 1}, {0x1D4AE, 0x1D4B9, 1}, {0x1D4BB, 0x1D4BB, 1},
+    {0x1D4BD, 0x1D4C3, 1}, {0x1D4C5, 0x1D505, 1}, {0x1D507, 0x1D50A, 1}, {0x1D50D, 0x1D514, 1},
+    {0x1D516, 0x1D51C, 1}, {0x1D51E, 0x1D539, 1}, {0x1D53B, 0x1D53E, 1}, {0x1D540, 0x1D544, 1},
+    {0x1D546, 0x1D546, 1}, {0x1D54A, 0x1D550, 1}, {0x1D552, 0x1D6A5, 1}, {0x1D6A8, 0x1D6C0, 1},
+    {0x1D6C2, 0x1D6DA, 1}, {0x1D6DC, 0x1D6FA, 1}, {0x1D6FC, 0x1D714, 1}, {0x1D716, 0x1D734, 1},
+    {0x1D736, 0x1D74E, 1}, {0x1D750, 0x1D76E, 1}, {0x1D770, 0x1D788, 1}, {0x1D78A, 0x1D7A8, 1},
+    {0x1D7AA, 0x1D7C2, 1}, {0x1D7C4, 0x1D7CB, 1}, {0x1D7CE, 0x1D7FF, 2}, {0x1DF00, 0x1DF1E, 1},
+    {0x1E100, 0x1E12C, 1}, {0x1E137, 0x1E13D, 1}, {0x1E140, 0x1E149, 2}, {0x1E14E, 0x1E14E, 1},
+    {0x1E290, 0x1E2AD, 1}, {0x1E2C0, 0x1E2EB, 1}, {0x1E2F0, 0x1E2F9, 2}, {0x1E7E0, 0x1E7E6, 1},
+    {0x1E7E8, 0x1E7EB, 1}, {0x1E7ED, 0x1E7EE, 1}, {0x1E7F0, 0x1E7FE, 1}, {0x1E800, 0x1E8C4, 1},
+    {0x1E8C7, 0x1E8CF, 2}, {0x1E900, 0x1E943, 1}, {0x1E94B, 0x1E94B, 1}, {0x1E950, 0x1E959, 2},
+    {0x1EC71, 0x1ECAB, 2}, {0x1ECAD, 0x1ECAF, 2}, {0x1ECB1, 0x1ECB4, 2}, {0x1ED01, 0x1ED2D, 2},
+    {0x1ED2F, 0x1ED3D, 2}, {0x1EE00, 0x1EE03, 1}, {0x1EE05, 0x1EE1F, 1}, {0x1EE21, 0x1EE22, 1},
+    {0x1EE24, 0x1EE24, 1}, {0x1EE27, 0x1EE27, 1}, {0x1EE29, 0x1EE32, 1}, {0x1EE34, 0x1EE37, 1},
+    {0x1EE39, 0x1EE39, 1}, {0x1EE3B, 0x1EE3B, 1}, {0x1EE42, 0x1EE42, 1}, {0x1EE47, 0x1EE47, 1},
+    {0x1EE49, 0x1EE49, 1}, {0x1EE4B, 0x1EE4B, 1}, {0x1EE4D, 0x1EE4F, 1}, {0x1EE51, 0x1EE52, 1},
+    {0x1EE54, 0x1EE54, 1}, {0x1EE57, 0x1EE57, 1}, {0x1EE59, 0x1EE59, 1}, {0x1EE5B, 0x1EE5B, 1},
+    {0x1EE5D, 0x1EE5D, 1}, {0x1EE5F, 0x1EE5F, 1}, {0x1EE61, 0x1EE62, 1}, {0x1EE64, 0x1EE64, 1},
+    {0x1EE67, 0x1EE6A, 1}, {0x1EE6C, 0x1EE72, 1}, {0x1EE74, 0x1EE77, 1}, {0x1EE79, 0x1EE7C, 1},
+    {0x1EE7E, 0x1EE7E, 1}, {0x1EE80, 0x1EE89, 1}, {0x1EE8B, 0x1EE9B, 1}, {0x1EEA1, 0x1EEA3, 1},
+    {0x1EEA5, 0x1EEA9, 1}, {0x1EEAB, 0x1EEBB, 1}, {0x1F100, 0x1F10C, 2}, {0x1FBF0, 0x1FBF9, 2},
+    {0x20000, 0x2A6DF, 1}, {0x2A700, 0x2B738, 1}, {0x2B740, 0x2B81D, 1}, {0x2B820, 0x2CEA1, 1},
+    {0x2CEB0, 0x2EBE0, 1}, {0x2F800, 0x2FA1D, 1}, {0x30000, 0x3134A, 1},
+};
+
+static int gpt_char_class(uint32_t cp) {
+    if (cp < 0x80) {
+        if ((cp >= 'a' && cp <= 'z') || (cp >= 'A' && cp <= 'Z')) {
+            return GPT_CHAR_LETTER;
+        }
+        if (cp >= '0' && cp <= '9') {
+            return GPT_CHAR_NUMBER;
+        }
+        if (cp == ' ' || (cp >= '\t' && cp <= '\r')) {
+            return GPT_CHAR_SPACE;
+        }
+        return GPT_CHAR_OTHER;
+    }
+
+    const gpt_char_range * end = k_char_ranges + sizeof(k_char_ranges)/sizeof(k_char_ranges[0]);
+    const gpt_char_range * it  = std::upper_bound(k_char_ranges, end, cp,
+            [](uint32_t cp, const gpt_char_range & r) { return cp < r.first; });
+
+    if (it == k_char_ranges || cp > (it - 1)->last) {
+        return GPT_CHAR_OTHER;
+    }
+
+    return (it - 1)->cls;
+}
+
+// the class of the UTF-8 character at s[i], and its length in len
+// an invalid UTF-8 sequence is a single character of one byte
+static int gpt_char_class_at(const std::string & s, size_t i, size_t end, size_t & len) {
+    const uint8_t c = s[i];
+
+    uint32_t cp = c;
+    len = 1;
+
+    if      ((c & 0xE0) == 0xC0) { cp = c & 0x1F; len = 2; }
+    else if ((c & 0xF0) == 0xE0) { cp = c & 0x0F; len = 3; }
+    else if ((c & 0xF8) == 0xF0) { cp = c & 0x07; len = 4; }
+
+    if (len > 1) {
+        if (i + len > end) {
+            len = 1;
+            return GPT_CHAR_OTHER;
+        }
+        for (size_t k = 1; k < len; ++k) {
+            const uint8_t ck = s[i + k];
+            if ((ck & 0xC0) != 0x80) {
+                len = 1;
+                return GPT_CHAR_OTHER;
+            }
+            cp = (cp << 6) | (ck & 0x3F);
+        }
+    } else if (c >= 0x80) {
+        return GPT_CHAR_OTHER;
+    }
+
+    return gpt_char_class(cp);
+}
+
+// split s[begin, end) into words with the GPT-2 pattern, as (offset, length) pairs
+// this is a state machine equivalent to the regex:
+//
+//   's|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+
+//
+static void gpt_pre_tokenize(const std::string & s, size_t begin, size_t end, std::vector<std::pair<size_t, size_t>> & words) {
+    size_t i = begin;
+    size_t len;
+
+    while (i < end) {
+        // 's|'t|'re|'ve|'m|'ll|'d
+        if (s[i] == '\'' && i + 1 < end) {
+            const char c1 = s[i + 1];
+            const char c2 = i + 2 < end ? s[i + 2] : 0;
+
+            if (c1 == 's' || c1 == 't' || c1 == 'm' || c1 == 'd') {
+                words.emplace_back(i, 2);
+                i += 2;
+                continue;
+            }
+            if ((c1 == 'r' && c2 == 'e') || (c1 == 'v' && c2 == 'e') || (c1 == 'l' && c2 == 'l')) {
+                words.emplace_back(i, 3);
+                i += 3;
+                continue;
+            }
+        }
+
+        // ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+
+        size_t j = i;
+        int cls = gpt_char_class_at(s, j, end, len);
+
+        if (s[i] == ' ' && i + 1 < end) {
+            const int cls_next = gpt_char_class_at(s, i + 1, end, len);
+            if (cls_next != GPT_CHAR_SPACE) {
+                j   = i + 1;
+                cls = cls_next;
+            }
+        }
+
+        if (cls != GPT_CHAR_SPACE) {
+            while (j < end && gpt_char_class_at(s, j, end, len) == cls) {
+                j += len;
+            }
+
+            words.emplace_back(i, j - i);
+            i = j;
+            continue;
+        }
+
+        // \s+(?!\S)|\s+
+        // when the white space is followed by another character, its last character starts the next word
+        size_t last = i;
+        while (j < end && gpt_char_class_at(s, j, end, len) == GPT_CHAR_SPACE) {
+            last = j;
+            j += len;
+        }
+
+        if (j < end && last > i) {
+            j = last;
+        }
+
+        words.emplace_back(i, j - i);
+        i = j;
+    }
+}
+
 void gpt_split_words(std::string str, std::vector<std::string>& words) {
+    std::vector<std::pair<size_t, size_t>> spans;
+    gpt_pre_tokenize(str, 0, str.size(), spans);
+
+    for (const auto & span : spans) {
+        words.push_back(str.substr(span.first, span.second));
+    }
+}
+
+// byte pair encoding of a single word
+// the rank of a merge is the id of the merged token, the vocab of byte-level BPE models is in merge order
+static void gpt_bpe_word(
+        const gpt_vocab & vocab,
+        const std::string & s,
+        size_t offs,
+        size_t n,
+        std::vector<gpt_vocab::id> & tokens,
+        std::vector<size_t> & parts,
+        std::vector<gpt_vocab::id> & ranks,
+        std::string & buf) {
+    const gpt_vocab::id rank_none = std::numeric_limits<gpt_vocab::id>::max();
+
+    buf.assign(s, offs, n);
+    {
+        const auto it = vocab.token_to_id.find(buf);
+        if (it != vocab.token_to_id.end()) {
+            tokens.push_back(it->second);
+            return;
+        }
+    }
+
+    // the rank of merging parts i and i + 1
+    auto rank = [&](size_t i) {
+        if (i + 2 >= parts.size()) {
+            return rank_none;
+        }
+        buf.assign(s, offs + parts[i], parts[i + 2] - parts[i]);
+        const auto it = vocab.token_to_id.find(buf);
+        return it == vocab.token_to_id.end() ? rank_none : it->second;
+    };
+
+    // start from single bytes
+    parts.resize(n + 1);
+    for (size_t i = 0; i <= n; ++i) {
+        parts[i] = i;
+    }
+
+    ranks.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        ranks[i] = rank(i);
+    }
+
+    // merge the pair with the lowest rank until no pair can be merged
+    while (parts.size() > 2) {
+        size_t i_min = 0;
+        for (size_t i = 1; i + 2 < parts.size(); ++i) {
+            if (ranks[i] < ranks[i_min]) {
+                i_min = i;
+            }
+        }
+
+        if (ranks[i_min] == rank_none) {
+            break;
+        }
+
+        parts.erase(parts.begin() + i_min + 1);
+        ranks.erase(ranks.begin() + i_min + 1);
+
+        ranks[i_min] = rank(i_min);
+        if (i_min > 0) {
+            ranks[i_min - 1] = rank(i_min - 1);
+        }
+    }
+
+    for (size_t i = 0; i + 1 < parts.size(); ++i) {
+        buf.assign(s, offs + parts[i], parts[i + 1] - parts[i]);
+        const auto it = vocab.token_to_id.find(buf);
+        if (it != vocab.token_to_id.end()) {
+            tokens.push_back(it->second);
+        } else {
+            fprintf(stderr, "%s: unknown token '%s'\n", __func__, buf.c_str());
+        }
+    }
+}
+
+std::vector<gpt_vocab::id> gpt_tokenize(const gpt_vocab & vocab, const std::string & text) {
+    std::vector<std::pair<size_t, size_t>> words;
+
+    // first split the text into words, the special tokens are words on their own
+    {
+        size_t pos = 0;
+
+        while (pos < text.size()) {
+            size_t sp_pos = std::string::npos;
+            size_t sp_len = 0;
+
+            // the first occurrence of a special token, the earliest in the list wins at the same position
+            for (const auto & token : vocab.special_tokens) {
+                if (token.empty()) {
+                    continue;
+                }
+                const size_t p = text.find(token, pos);
+                if (p < sp_pos) {
+                    sp_pos = p;
+                    sp_len = token.size();
+                }
+            }
+
+            if (sp_pos == std::string::npos) {
+                gpt_pre_tokenize(text, pos, text.size(), words);
+                break;
+            }
+
+            gpt_pre_tokenize(text, pos, sp_pos, words);
+            words.emplace_back(sp_pos, sp_len);
+
+            pos = sp_pos + sp_len;
+        }
+    }
+
+    // then encode each word
+    std::vector<gpt_vocab::id> tokens;
+    tokens.reserve(text.size()/2);
+
+    std::vector<size_t>        parts;
+    std::vector<gpt_vocab::id> ranks;
+    std::string                buf;
+
+    for (const auto & word : words) {
+        gpt_bpe_word(vocab, text, word.first, word.second, tokens, parts, ranks, buf);
+    }
+
+    return tokens;
+}
+
+std::vector<std::vector<gpt_vocab::id>> gpt_tokenize_batch(const gpt_vocab & vocab, const std::vector<std::string> & texts, int n_threads) {
+    std::vector<std::vector<gpt_vocab::id>> result(texts.size());
+
+    n_threads = std::max(1, std::min(n_threads, (int) texts.size()));
+
+    std::atomic<size_t> next(0);
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < texts.size(); i = next++) {
+            result[i] = gpt_tokenize(vocab, texts[i]);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < n_threads; ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+
+    for (auto & w : workers) {
+        w.join();
+    }
+
+    return result;
+}
+
+static void gpt_split_words_regex(std::string str, std::vector<std::string>& words) {
     const std::string pattern = R"('s|'t|'re|'ve|'m|'ll|'d| ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+|\s+(?!\S)|\s+)";
     const std::regex re(pattern);
     std::smatch m;
@@ -271,7 +793,9 @@ void gpt_split_words(std::string str, std::vector<std::string>& words) {
     }
 }
 
-std::vector<gpt_vocab::id> gpt_tokenize(const gpt_vocab & vocab, const std::string & text) {
+// the previous implementation of gpt_tokenize: std::regex pre-tokenizer and greedy longest match
+// only used as a reference for the benchmark in test_gpt_tokenizer
+static std::vector<gpt_vocab::id> gpt_tokenize_regex(const gpt_vocab & vocab, const std::string & text) {
     std::vector<std::string> words;
 
     // first split the text into words
@@ -294,7 +818,7 @@ std::vector<gpt_vocab::id> gpt_tokenize(const gpt_vocab & vocab, const std::stri
             // Split the text by special tokens.
             while (std::regex_search(str, m, re)) {
                 // Split the substrings in-between special tokens into words.
-                gpt_split_words(m.prefix(), words);
+                gpt_split_words_regex(m.prefix(), words);
                 // Add matched special tokens as words.
                 for (auto x : m) {
                     words.push_back(x);
@@ -304,7 +828,7 @@ std::vector<gpt_vocab::id> gpt_tokenize(const gpt_vocab & vocab, const std::stri
             // Remaining text without special tokens will be handled below.
         }
 
-        gpt_split_words(str, words);
+        gpt_split_words_regex(str, words);
     }
 
     // find the longest token that forms each word in words:
@@ -392,12 +916,68 @@ void test_gpt_tokenizer(gpt_vocab & vocab, const std::string & fpath_test){
     }
 
     fprintf(stderr, "%s : %zu tests failed out of %zu tests.\n", __func__, n_fails, tests.size());
+
+    if (tests.empty()) {
+        return;
+    }
+
+    // benchmark against the std::regex tokenizer
+    {
+        const int n_iter    = 10;
+        const int n_threads = std::max(1, (int) std::thread::hardware_concurrency());
+
+        std::vector<std::string> texts;
+        size_t n_bytes = 0;
+        for (const auto & test : tests) {
+            texts.push_back(test.first);
+            n_bytes += test.first.size();
+        }
+
+        size_t n_fails_regex = 0;
+
+        int64_t t_regex_us = 0;
+        int64_t t_bpe_us   = 0;
+        int64_t t_batch_us = 0;
+
+        for (int it = 0; it < n_iter; ++it) {
+            auto t_start = std::chrono::steady_clock::now();
+            for (const auto & test : tests) {
+                if (gpt_tokenize_regex(vocab, test.first) != test.second && it == 0) {
+                    n_fails_regex++;
+                }
+            }
+            auto t_end = std::chrono::steady_clock::now();
+            t_regex_us += std::chrono::duration_cast<std::chrono::microseconds>(t_end - t_start).count();
+
+            t_start = std::chrono::steady_clock::now();
+            for (const auto & text : texts) {
+                gpt_tokenize(vocab, text);
+            }
+            t_end = std::chrono::steady_clock::now();
+            t_bpe_us += std::chrono::duration_cast<std::chrono::microseconds>(t_end - t_start).count();
+
+            t_start = std::chrono::steady_clock::now();
+            gpt_tokenize_batch(vocab, texts, n_threads);
+            t_end = std::chrono::steady_clock::now();
+            t_batch_us += std::chrono::duration_cast<std::chrono::microseconds>(t_end - t_start).count();
+        }
+
+        const double mb = n_iter*n_bytes/1024.0/1024.0;
+
+        fprintf(stderr, "%s : std::regex tokenizer: %zu tests failed out of %zu tests.\n", __func__, n_fails_regex, tests.size());
+        fprintf(stderr, "%s : std::regex tokenizer: %8.2f ms, %8.2f MB/s\n", __func__, t_regex_us/1000.0, mb/(t_regex_us/1e6));
+        fprintf(stderr, "%s : gpt_tokenize:         %8.2f ms, %8.2f MB/s\n", __func__, t_bpe_us/1000.0,   mb/(t_bpe_us/1e6));
+        fprintf(stderr, "%s : gpt_tokenize_batch:   %8.2f ms, %8.2f MB/s (%d threads)\n", __func__, t_batch_us/1000.0, mb/(t_batch_us/1e6), n_threads);
+    }
 }
 
 bool gpt_vocab_init(const std::string & fname, gpt_vocab & vocab) {
     printf("%s: loading vocab from '%s'\n", __func__, fname.c_str());
 
-    vocab.token_to_id = ::json_parse(fname);
+    {
+        const auto tokens = ::json_parse(fname);
+        vocab.token_to_id.insert(tokens.begin(), tokens.end());
+    }
 
     for (const auto & kv : vocab.token_to_id) {
         vocab.id_to_token[kv.second] = kv.first;
@@ -493,7 +1073,7 @@ gpt_vocab::id gpt_sample_top_k_top_p(
     return logits_id[idx].second;
 }
 
-gpt_vocab::id gpt_sample_top_k_top_p_repeat(
+std::vector<std::pair<double, gpt_vocab::id>> gpt_probs_top_k_top_p_repeat(
         const gpt_vocab & vocab,
         const float * logits,
         const int32_t * last_n_tokens_data,
@@ -502,8 +1082,7 @@ gpt_vocab::id gpt_sample_top_k_top_p_repeat(
         double top_p,
         double temp,
         int repeat_last_n,
-        float repeat_penalty,
-        std::mt19937 & rng) {
+        float repeat_penalty) {
 
     int n_logits = vocab.id_to_token.size();
 
@@ -522,7 +1101,7 @@ gpt_vocab::id gpt_sample_top_k_top_p_repeat(
                 max_id = i;
             }
         }
-        return max_id;
+        return { std::make_pair(1.0, max_id) };
     }
 
 
@@ -596,17 +1175,106 @@ gpt_vocab::id gpt_sample_top_k_top_p_repeat(
         }
     }
 
-//    printf("\n");
-//    for (int i = 0; i < (int) probs.size(); i++) {
-//    for (int i = 0; i < 10; i++) {
-//        printf("%d: '%s' %f\n", i, vocab.id_to_token.at(logits_id[i].second).c_str(), probs[i]);
-//    }
+    logits_id.resize(probs.size());
+    for (int i = 0; i < (int) probs.size(); i++) {
+        logits_id[i].first = probs[i];
+    }
 
-    std::discrete_distribution<> dist(probs.begin(), probs.end());
+    return logits_id;
+}
+
+gpt_vocab::id gpt_sample_top_k_top_p_repeat(
+        const gpt_vocab & vocab,
+        const float * logits,
+        const int32_t * last_n_tokens_data,
+        size_t last_n_tokens_data_size,
+        int    top_k,
+        double top_p,
+        double temp,
+        int repeat_last_n,
+        float repeat_penalty,
+        std::mt19937 & rng) {
+    const auto probs = gpt_probs_top_k_top_p_repeat(
+            vocab, logits, last_n_tokens_data, last_n_tokens_data_size,
+            top_k, top_p, temp, repeat_last_n, repeat_penalty);
+
+    if (temp <= 0) {
+        return probs[0].second;
+    }
+
+    return gpt_sample_probs(probs, rng);
+}
+
+gpt_vocab::id gpt_sample_probs(
+        const std::vector<std::pair<double, gpt_vocab::id>> & probs,
+        std::mt19937 & rng) {
+    std::vector<double> weights;
+    weights.reserve(probs.size());
+
+    for (const auto & kv : probs) {
+        weights.push_back(kv.first);
+    }
+
+    std::discrete_distribution<> dist(weights.begin(), weights.end());
     int idx = dist(rng);
 
-    return logits_id[idx].second;
+    return probs[idx].second;
+}
+
+int gpt_speculative_accept(
+        const std::vector<gpt_vocab::id> & draft,
+        const std::vector<std::vector<std::pair<double, gpt_vocab::id>>> & q,
+        const std::vector<std::vector<std::pair<double, gpt_vocab::id>>> & p,
+        gpt_vocab::id & id_next,
+        std::mt19937 & rng) {
+    const int n_draft = draft.size();
+
+    if ((int) q.size() != n_draft || (int) p.size() != n_draft + 1) {
+        fprintf(stderr, "%s: expected %d draft and %d target distributions\n", __func__, n_draft, n_draft + 1);
+        return -1;
+    }
+
+    // probability of token id in a distribution, 0 outside of its top tokens
+    auto prob = [](const std::vector<std::pair<double, gpt_vocab::id>> & probs, gpt_vocab::id id) {
+        for (const auto & kv : probs) {
+            if (kv.second == id) {
+                return kv.first;
+            }
+        }
+        return 0.0;
+    };
+
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+
+    for (int i = 0; i < n_draft; ++i) {
+        const double p_i = prob(p[i], draft[i]);
+        const double q_i = prob(q[i], draft[i]);
+
+        // accept the draft token with probability min(1, p/q)
+        if (p_i >= q_i || dist(rng)*q_i < p_i) {
+            continue;
+        }
+
+        // rejected - sample the next token from the residual distribution max(0, p - q)
+        std::vector<std::pair<double, gpt_vocab::id>> residual;
+        residual.reserve(p[i].size());
+
+        for (const auto & kv : p[i]) {
+            const double r = kv.first - prob(q[i], kv.second);
+            if (r > 0.0) {
+                residual.push_back(std::make_pair(r, kv.second));
+            }
+        }
+
+        id_next = residual.empty() ? gpt_sample_probs(p[i], rng) : gpt_sample_probs(residual, rng);
+
+        return i;
+    }
+
+    // all draft tokens were accepted - sample one more token from the target
+    id_next = gpt_sample_probs(p[n_draft], rng);
 
+    return n_draft;
 }
 
 void high_pass_filter(std::vector<float> & data, float cutoff, float sample_rate) {
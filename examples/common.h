@@ -4,6 +4,7 @@
 
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <random>
 #include <thread>
@@ -23,8 +24,14 @@ struct gpt_params {
     int32_t n_batch      = 32;   // batch size for prompt processing
     int32_t n_ctx        = 2048; // context size (this is the KV cache max size)
     int32_t n_gpu_layers = 0;    // number of layers to offlload to the GPU
+    int32_t n_draft      = 8;    // number of tokens to draft for speculative decoding
 
     bool ignore_eos = false; // ignore EOS token when generating text
+    bool flash_attn = false; // use flash attention
+
+    // KV cache data types
+    std::string cache_type_k = "f32";
+    std::string cache_type_v = "f32";
 
     // sampling parameters
     int32_t top_k          = 40;
@@ -33,7 +40,8 @@ struct gpt_params {
     int32_t repeat_last_n  = 64;
     float   repeat_penalty = 1.00f;
 
-    std::string model      = "models/gpt-2-117M/ggml-model.bin"; // model path
+    std::string model       = "models/gpt-2-117M/ggml-model.bin"; // model path
+    std::string model_draft = "";                                 // draft model path for speculative decoding
     std::string prompt     = "";
     std::string token_test = "";
 
@@ -62,8 +70,8 @@ struct gpt_vocab {
     using id    = int32_t;
     using token = std::string;
 
-    std::map<token, id> token_to_id;
-    std::map<id, token> id_to_token;
+    std::unordered_map<token, id> token_to_id;
+    std::unordered_map<id, token> id_to_token;
     std::vector<std::string> special_tokens;
 
     void add_special_token(const std::string & token);
@@ -82,20 +90,26 @@ void gpt_split_words(std::string str, std::vector<std::string>& words);
 //
 // ref: https://github.com/openai/gpt-2/blob/a74da5d99abaaba920de8131d64da2862a8f213b/src/encoder.py#L53
 //
-// Regex (Python):
+// the text is split into words by the special tokens, and by a state machine implementing the regex (Python):
 // r"""'s|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+"""
 //
-// Regex (C++):
-// R"('s|'t|'re|'ve|'m|'ll|'d| ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+|\s+(?!\S)|\s+)"
+// each word is then encoded with byte pair encoding, merging first the pair that forms the token with the lowest id
 //
 std::vector<gpt_vocab::id> gpt_tokenize(const gpt_vocab & vocab, const std::string & text);
 
+// tokenize multiple texts using n_threads threads
+std::vector<std::vector<gpt_vocab::id>> gpt_tokenize_batch(
+        const gpt_vocab & vocab,
+        const std::vector<std::string> & texts,
+        int n_threads);
+
 // test outputs of gpt_tokenize
 //
 //   - compare with tokens generated by the huggingface tokenizer
 //   - test cases are chosen based on the model's main language (under 'prompt' directory)
 //   - if all sentences are tokenized identically, print 'All tests passed.'
 //   - otherwise, print sentence, huggingface tokens, ggml tokens
+//   - benchmark gpt_tokenize and gpt_tokenize_batch against the previous std::regex based tokenizer
 //
 void test_gpt_tokenizer(gpt_vocab & vocab, const std::string & fpath_test);
 
@@ -130,6 +144,41 @@ gpt_vocab::id gpt_sample_top_k_top_p_repeat(
         float repeat_penalty,
         std::mt19937 & rng);
 
+// the distribution sampled by gpt_sample_top_k_top_p_repeat, as (probability, token id) pairs
+// sorted by decreasing probability - with temp <= 0 it contains only the most likely token
+std::vector<std::pair<double, gpt_vocab::id>> gpt_probs_top_k_top_p_repeat(
+        const gpt_vocab & vocab,
+        const float * logits,
+        const int32_t * last_n_tokens_data,
+        size_t last_n_tokens_data_size,
+        int    top_k,
+        double top_p,
+        double temp,
+        int repeat_last_n,
+        float repeat_penalty);
+
+// sample a token from (probability, token id) pairs
+gpt_vocab::id gpt_sample_probs(
+        const std::vector<std::pair<double, gpt_vocab::id>> & probs,
+        std::mt19937 & rng);
+
+// speculative sampling (https://arxiv.org/abs/2211.17192)
+//
+//   - draft : the tokens proposed by the draft model
+//   - q     : the distributions of the draft model the draft tokens were sampled from, one per draft token
+//   - p     : the distributions of the target model after each prefix of the draft, one more than the draft tokens
+//
+// the draft tokens are accepted in order with probability min(1, p/q)
+// returns the number of accepted draft tokens, and in id_next the token that follows them:
+// sampled from max(0, p - q) after a rejection, or from the last target distribution when all are accepted
+// the generated tokens follow the distribution of the target model, and match its greedy output with temp <= 0
+int gpt_speculative_accept(
+        const std::vector<gpt_vocab::id> & draft,
+        const std::vector<std::vector<std::pair<double, gpt_vocab::id>>> & q,
+        const std::vector<std::vector<std::pair<double, gpt_vocab::id>>> & p,
+        gpt_vocab::id & id_next,
+        std::mt19937 & rng);
+
 //
 // Audio utils
 //
@@ -87,6 +87,9 @@ struct gpt2_model {
     struct ggml_tensor * memory_k;
     struct ggml_tensor * memory_v;
 
+    // compute the attention with ggml_flash_attn_ext, reading K and V in the memory type
+    bool flash_attn = false;
+
     //
     struct ggml_context * ctx_w;
     struct ggml_context * ctx_kv;
@@ -100,7 +103,8 @@ struct gpt2_model {
 };
 
 // load the model's weights from a file
-bool gpt2_model_load(const std::string & fname, gpt2_model & model, gpt_vocab & vocab, int n_ctx, int n_gpu_layers) {
+bool gpt2_model_load(const std::string & fname, gpt2_model & model, gpt_vocab & vocab, int n_ctx, int n_gpu_layers,
+        ggml_type type_k, ggml_type type_v) {
     printf("%s: loading model from '%s'\n", __func__, fname.c_str());
 
     auto fin = std::ifstream(fname, std::ios::binary);
@@ -337,16 +341,26 @@ bool gpt2_model_load(const std::string & fname, gpt2_model & model, gpt_vocab &
         const int n_mem      = n_layer*n_ctx;
         const int n_elements = n_embd*n_mem;
 
-        // k and v here can also be GGML_TYPE_F16 to save memory and speed up the computation
-        // if backend supports it
-        model.memory_k = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_elements);
-        model.memory_v = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_elements);
+        // the heads are viewed separately, so each of them must hold whole blocks
+        for (ggml_type type : { type_k, type_v }) {
+            if ((n_embd/hparams.n_head) % ggml_blck_size(type) != 0) {
+                fprintf(stderr, "%s: KV cache type %s requires the head size (%d) to be a multiple of %d\n",
+                        __func__, ggml_type_name(type), n_embd/hparams.n_head, (int) ggml_blck_size(type));
+                return false;
+            }
+        }
+
+        // k and v can be GGML_TYPE_F16 or quantized to save memory and speed up the computation
+        // if backend supports it - they are converted when the new tokens are copied in
+        model.memory_k = ggml_new_tensor_1d(ctx, type_k, n_elements);
+        model.memory_v = ggml_new_tensor_1d(ctx, type_v, n_elements);
 
         // allocate the KV memory in a backend buffer
         model.buffer_kv = ggml_backend_alloc_ctx_tensors(ctx, model.backend);
 
         const size_t memory_size = ggml_backend_buffer_get_size(model.buffer_kv);
-        printf("%s: memory size = %8.2f MB, n_mem = %d\n", __func__, memory_size/1024.0/1024.0, n_mem);
+        printf("%s: memory size = %8.2f MB, n_mem = %d, type_k = %s, type_v = %s\n", __func__, memory_size/1024.0/1024.0, n_mem,
+                ggml_type_name(type_k), ggml_type_name(type_v));
     }
 
     // load weights
@@ -456,6 +470,9 @@ struct ggml_cgraph * gpt2_graph(
     const int n_ctx   = hparams.n_ctx;
     const int n_head  = hparams.n_head;
 
+    const size_t row_size_k = ggml_row_size(model.memory_k->type, n_embd);
+    const size_t row_size_v = ggml_row_size(model.memory_v->type, n_embd);
+
     // since we are using ggml-alloc, this buffer only needs enough space to hold the ggml_tensor and ggml_cgraph structs, but not the tensor data
     static size_t buf_size = ggml_tensor_overhead()*GPT2_MAX_NODES + ggml_graph_overhead_custom(GPT2_MAX_NODES, false);
     static std::vector<uint8_t> buf(buf_size);
@@ -488,6 +505,14 @@ struct ggml_cgraph * gpt2_graph(
                 ggml_get_rows(ctx, model.wte, embd),
                 ggml_get_rows(ctx, model.wpe, position));
 
+    // KQ_mask (causal mask for flash attention, padded to GGML_KQ_MASK_PAD rows)
+    struct ggml_tensor * KQ_mask = nullptr;
+    if (model.flash_attn) {
+        KQ_mask = ggml_new_tensor_2d(ctx, GGML_TYPE_F16, n_past + N, GGML_PAD(N, GGML_KQ_MASK_PAD));
+        ggml_set_name(KQ_mask, "KQ_mask");
+        ggml_set_input(KQ_mask);
+    }
+
     for (int il = 0; il < n_layer; ++il) {
         struct ggml_tensor * cur;
 
@@ -531,8 +556,8 @@ struct ggml_cgraph * gpt2_graph(
 
             // store key and value to memory
             if (N >= 1) {
-                struct ggml_tensor * k = ggml_view_1d(ctx, model.memory_k, N*n_embd, (ggml_element_size(model.memory_k)*n_embd)*(il*n_ctx + n_past));
-                struct ggml_tensor * v = ggml_view_1d(ctx, model.memory_v, N*n_embd, (ggml_element_size(model.memory_v)*n_embd)*(il*n_ctx + n_past));
+                struct ggml_tensor * k = ggml_view_1d(ctx, model.memory_k, N*n_embd, row_size_k*(il*n_ctx + n_past));
+                struct ggml_tensor * v = ggml_view_1d(ctx, model.memory_v, N*n_embd, row_size_v*(il*n_ctx + n_past));
 
                 ggml_build_forward_expand(gf, ggml_cpy(ctx, Kcur, k));
                 ggml_build_forward_expand(gf, ggml_cpy(ctx, Vcur, v));
@@ -545,68 +570,87 @@ struct ggml_cgraph * gpt2_graph(
                         ggml_cont_3d(ctx, Qcur, n_embd/n_head, n_head, N),
                         0, 2, 1, 3);
 
-            // K = Kmem.view(n_embd/n_head, n_head, n_past + N).permute(0, 2, 1, 3)
-            // [64, n_past + N, 12]
-            struct ggml_tensor * K =
-                ggml_permute(ctx,
-                        ggml_reshape_3d(ctx,
-                            ggml_view_1d(ctx, model.memory_k, (n_past + N)*n_embd, il*n_ctx*ggml_element_size(model.memory_k)*n_embd),
-                            n_embd/n_head, n_head, n_past + N),
-                        0, 2, 1, 3);
-
-            // GG: flash attention
-            //struct ggml_tensor * V =
-            //    ggml_cpy(ctx0,
-            //            ggml_permute(ctx0,
-            //                ggml_reshape_3d(ctx0,
-            //                    ggml_view_1d(ctx0, model.memory_v, (n_past + N)*n_embd, il*n_ctx*ggml_element_size(model.memory_v)*n_embd),
-            //                    n_embd/n_head, n_head, n_past + N),
-            //                1, 2, 0, 3),
-            //            ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_past + N, n_embd/n_head, n_head));
-
-            //struct ggml_tensor * KQV = ggml_flash_attn(ctx0, Q, K, V, true);
-
-            // K * Q
-            // [n_past + N, N, 12]
-            struct ggml_tensor * KQ = ggml_mul_mat(ctx, K, Q);
-
-            // KQ_scaled = KQ / sqrt(n_embd/n_head)
-            // [n_past + N, N, 12]
-            struct ggml_tensor * KQ_scaled =
-                ggml_scale(ctx,
-                        KQ,
-                        1.0f/sqrtf(float(n_embd)/n_head));
-
-            // KQ_masked = mask_past(KQ_scaled)
-            // [n_past + N, N, 12]
-            struct ggml_tensor * KQ_masked = ggml_diag_mask_inf(ctx, KQ_scaled, n_past);
-
-            // KQ = soft_max(KQ_masked)
-            // [n_past + N, N, 12]
-            struct ggml_tensor * KQ_soft_max = ggml_soft_max(ctx, KQ_masked);
-
-            // V_trans = Vmem.view(n_embd/n_head, n_head, n_past + N).permute(1, 2, 0, 3).contiguous()
-            // [n_past + N, 64, 12]
-            struct ggml_tensor * V_trans =
-                ggml_cont_3d(ctx,
-                        ggml_permute(ctx,
+            if (model.flash_attn) {
+                // K = Kmem.view(n_embd/n_head, n_head, n_past + N).permute(0, 2, 1, 3)
+                // [64, n_past + N, 12]
+                struct ggml_tensor * K =
+                    ggml_view_3d(ctx, model.memory_k,
+                            n_embd/n_head, n_past + N, n_head,
+                            row_size_k, ggml_row_size(model.memory_k->type, n_embd/n_head),
+                            il*n_ctx*row_size_k);
+
+                // V = Vmem.view(n_embd/n_head, n_head, n_past + N).permute(0, 2, 1, 3)
+                // [64, n_past + N, 12]
+                struct ggml_tensor * V =
+                    ggml_view_3d(ctx, model.memory_v,
+                            n_embd/n_head, n_past + N, n_head,
+                            row_size_v, ggml_row_size(model.memory_v->type, n_embd/n_head),
+                            il*n_ctx*row_size_v);
+
+                // softmax(K*Q/sqrt(n_embd/n_head) + mask)*V, dequantizing K and V on the fly
+                // [64, 12, N]
+                struct ggml_tensor * KQV = ggml_flash_attn_ext(ctx, Q, K, V, KQ_mask, 1.0f/sqrtf(float(n_embd)/n_head), 0.0f, 0.0f);
+
+                // [768, N]
+                cur = ggml_reshape_2d(ctx, KQV, n_embd, N);
+            } else {
+                // K = Kmem.view(n_embd/n_head, n_head, n_past + N).permute(0, 2, 1, 3)
+                // [64, n_past + N, 12]
+                struct ggml_tensor * K =
+                    ggml_permute(ctx,
                             ggml_reshape_3d(ctx,
-                                ggml_view_1d(ctx, model.memory_v, (n_past + N)*n_embd, il*n_ctx*ggml_element_size(model.memory_v)*n_embd),
+                                ggml_view_1d(ctx, model.memory_k, (n_past + N)*n_embd, il*n_ctx*row_size_k),
                                 n_embd/n_head, n_head, n_past + N),
-                            1, 2, 0, 3),
-                        n_past + N, n_embd/n_head, n_head);
-
-            // KQV = transpose(V) * KQ_soft_max
-            // [64, N, 12]
-            struct ggml_tensor * KQV = ggml_mul_mat(ctx, V_trans, KQ_soft_max);
-
-            // KQV_merged = KQV.permute(0, 2, 1, 3)
-            // [64, 12, N]
-            struct ggml_tensor * KQV_merged = ggml_permute(ctx, KQV, 0, 2, 1, 3);
+                            0, 2, 1, 3);
+
+                // K * Q
+                // [n_past + N, N, 12]
+                struct ggml_tensor * KQ = ggml_mul_mat(ctx, K, Q);
+
+                // KQ_scaled = KQ / sqrt(n_embd/n_head)
+                // [n_past + N, N, 12]
+                struct ggml_tensor * KQ_scaled =
+                    ggml_scale(ctx,
+                            KQ,
+                            1.0f/sqrtf(float(n_embd)/n_head));
+
+                // KQ_masked = mask_past(KQ_scaled)
+                // [n_past + N, N, 12]
+                struct ggml_tensor * KQ_masked = ggml_diag_mask_inf(ctx, KQ_scaled, n_past);
+
+                // KQ = soft_max(KQ_masked)
+                // [n_past + N, N, 12]
+                struct ggml_tensor * KQ_soft_max = ggml_soft_max(ctx, KQ_masked);
+
+                // quantized V cannot be transposed directly, convert it to F32 first
+                struct ggml_tensor * Vmem = ggml_view_1d(ctx, model.memory_v, (n_past + N)*n_embd, il*n_ctx*row_size_v);
+                if (ggml_is_quantized(Vmem->type)) {
+                    Vmem = ggml_cast(ctx, Vmem, GGML_TYPE_F32);
+                }
 
-            // cur = KQV_merged.contiguous().view(n_embd, N)
-            // [768, N]
-            cur = ggml_cont_2d(ctx, KQV_merged, n_embd, N);
+                // V_trans = Vmem.view(n_embd/n_head, n_head, n_past + N).permute(1, 2, 0, 3).contiguous()
+                // [n_past + N, 64, 12]
+                struct ggml_tensor * V_trans =
+                    ggml_cont_3d(ctx,
+                            ggml_permute(ctx,
+                                ggml_reshape_3d(ctx,
+                                    Vmem,
+                                    n_embd/n_head, n_head, n_past + N),
+                                1, 2, 0, 3),
+                            n_past + N, n_embd/n_head, n_head);
+
+                // KQV = transpose(V) * KQ_soft_max
+                // [64, N, 12]
+                struct ggml_tensor * KQV = ggml_mul_mat(ctx, V_trans, KQ_soft_max);
+
+                // KQV_merged = KQV.permute(0, 2, 1, 3)
+                // [64, 12, N]
+                struct ggml_tensor * KQV_merged = ggml_permute(ctx, KQV, 0, 2, 1, 3);
+
+                // cur = KQV_merged.contiguous().view(n_embd, N)
+                // [768, N]
+                cur = ggml_cont_2d(ctx, KQV_merged, n_embd, N);
+            }
         }
 
         // projection
@@ -757,6 +801,20 @@ bool gpt2_eval(
         ggml_backend_tensor_set(position, &v, i*sizeof(int32_t), sizeof(v));
     }
 
+    if (model.flash_attn) {
+        struct ggml_tensor * KQ_mask = ggml_graph_get_tensor(gf, "KQ_mask");
+
+        // token i sees the positions up to n_past + i, the padding rows see nothing
+        std::vector<ggml_fp16_t> mask(ggml_nelements(KQ_mask), ggml_fp32_to_fp16(-INFINITY));
+        for (int i = 0; i < N; ++i) {
+            for (int j = 0; j <= n_past + i; ++j) {
+                mask[i*(n_past + N) + j] = ggml_fp32_to_fp16(0.0f);
+            }
+        }
+
+        ggml_backend_tensor_set(KQ_mask, mask.data(), 0, ggml_nbytes(KQ_mask));
+    }
+
     // set backend options
     if (ggml_backend_is_cpu(model.backend)) {
         ggml_backend_cpu_set_n_threads(model.backend, n_threads);
@@ -811,11 +869,25 @@ int main(int argc, char ** argv) {
     gpt_vocab vocab;
     gpt2_model model;
 
+    const ggml_type type_k = ggml_parse_cache_type(params.cache_type_k);
+    const ggml_type type_v = ggml_parse_cache_type(params.cache_type_v);
+    if (type_k == GGML_TYPE_COUNT || type_v == GGML_TYPE_COUNT) {
+        return 1;
+    }
+
+    // flash attention reads K and V in their storage type, which cannot be F32
+    if (params.flash_attn && (type_k == GGML_TYPE_F32 || type_v == GGML_TYPE_F32)) {
+        fprintf(stderr, "%s: flash attention requires an F16 or quantized KV cache (-ctk, -ctv)\n", __func__);
+        return 1;
+    }
+
+    model.flash_attn = params.flash_attn;
+
     // load the model
     {
         const int64_t t_start_us = ggml_time_us();
 
-        if (!gpt2_model_load(params.model, model, vocab, params.n_ctx, params.n_gpu_layers)) {
+        if (!gpt2_model_load(params.model, model, vocab, params.n_ctx, params.n_gpu_layers, type_k, type_v)) {
             fprintf(stderr, "%s: failed to load model from '%s'\n", __func__, params.model.c_str());
             return 1;
         }
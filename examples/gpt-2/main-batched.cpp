@@ -14,13 +14,13 @@
 #include "common.h"
 #include "common-ggml.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <map>
-#include <set>
 #include <string>
 #include <vector>
 
@@ -74,30 +74,40 @@ struct gpt2_layer {
     struct ggml_tensor * c_mlp_proj_b;
 };
 
-struct gpt2_kv_cell {
-    gpt2_pos pos   = -1;
-    gpt2_pos delta = 0;
+// number of tokens stored in one block of the KV cache
+#define GPT2_KV_BLOCK_SIZE 16
 
-    std::set<gpt2_seq_id> seq_id;
+struct gpt2_kv_block {
+    int32_t ref    = 0; // number of sequences whose block table contains this block
+    int32_t n_used = 0; // number of rows written so far
+};
 
-    bool has_seq_id(const gpt2_seq_id & id) const {
-        return seq_id.find(id) != seq_id.end();
-    }
+// a sequence maps its positions to cache rows through a block table:
+// position p is stored in row p % GPT2_KV_BLOCK_SIZE of block blocks[p / GPT2_KV_BLOCK_SIZE]
+struct gpt2_kv_seq {
+    std::vector<int32_t> blocks;
+
+    gpt2_pos n_pos = 0;
 };
 
 struct gpt2_kv_cache {
-    // key + value memory
+    // key + value memory, n_layer x n_block x GPT2_KV_BLOCK_SIZE rows of n_embd
     struct ggml_tensor * k;
     struct ggml_tensor * v;
     //
 
-    uint32_t head = 0;
-    uint32_t size = 0;
+    uint32_t n_block = 0;
+
+    std::vector<gpt2_kv_block> blocks;
+    std::vector<int32_t>       blocks_free;
+
+    std::map<gpt2_seq_id, gpt2_kv_seq> seqs;
 
     // computed before each graph build
     uint32_t n = 0;
 
-    std::vector<gpt2_kv_cell> cells;
+    std::vector<int32_t> rows_dst; // cache row written by each token of the batch
+    std::vector<int32_t> rows_kv;  // cache rows gathered for the attention
 
     ggml_backend_buffer_t buffer;
 };
@@ -146,8 +156,31 @@ struct gpt2_batch {
     int8_t         * logits = {};
 };
 
+// Sampling done by the backend, after the LM head
+// When passed to gpt2_decode, the sampled token ids are returned instead of the logits
+//
+// - out_ids        : the batch index of the token to sample from, per output (an index can be repeated)
+// - u              : a uniform random number in [0, 1), per output
+// - penalty_tokens : the distinct tokens to penalize, at most repeat_last_n per output (used when repeat_penalty != 1)
+// - tokens         : the sampled token ids, per output
+//
+struct gpt2_sampler {
+    int32_t top_k          = 40;
+    float   top_p          = 0.9f;
+    float   temp           = 0.9f;
+    float   repeat_penalty = 1.0f;
+    int32_t repeat_last_n  = 64;
+
+    std::vector<int32_t>                    out_ids;
+    std::vector<float>                      u;
+    std::vector<std::vector<gpt_vocab::id>> penalty_tokens;
+
+    std::vector<gpt_vocab::id> tokens;
+};
+
 // load the model's weights from a file
-bool gpt2_model_load(const std::string & fname, gpt2_model & model, gpt_vocab & vocab, int n_ctx, int n_gpu_layers) {
+bool gpt2_model_load(const std::string & fname, gpt2_model & model, gpt_vocab & vocab, int n_ctx, int n_gpu_layers,
+        ggml_type type_k, ggml_type type_v) {
     printf("%s: loading model from '%s'\n", __func__, fname.c_str());
 
     auto fin = std::ifstream(fname, std::ios::binary);
@@ -401,20 +434,35 @@ bool gpt2_model_load(const std::string & fname, gpt2_model & model, gpt_vocab &
         const int n_layer = hparams.n_layer;
         const int n_ctx   = hparams.n_ctx;
 
-        const int n_mem      = n_layer*n_ctx;
-        const int n_elements = n_embd*n_mem;
+        // the n_ctx rows are shared by all sequences, in blocks of GPT2_KV_BLOCK_SIZE
+        const int n_block    = (n_ctx + GPT2_KV_BLOCK_SIZE - 1)/GPT2_KV_BLOCK_SIZE;
+        const int n_mem      = n_layer*n_block*GPT2_KV_BLOCK_SIZE;
+
+        // the rows can be F16 or quantized, they are converted when stored and dequantized when gathered
+        for (ggml_type type : { type_k, type_v }) {
+            if (n_embd % ggml_blck_size(type) != 0) {
+                fprintf(stderr, "%s: KV cache type %s requires n_embd (%d) to be a multiple of %d\n",
+                        __func__, ggml_type_name(type), n_embd, (int) ggml_blck_size(type));
+                return false;
+            }
+        }
 
-        model.kv_cache.k = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_elements);
-        model.kv_cache.v = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_elements);
+        model.kv_cache.k = ggml_new_tensor_2d(ctx, type_k, n_embd, n_mem);
+        model.kv_cache.v = ggml_new_tensor_2d(ctx, type_v, n_embd, n_mem);
 
-        model.kv_cache.head      = 0;
-        model.kv_cache.size      = n_ctx;
+        model.kv_cache.n_block = n_block;
 
-        model.kv_cache.cells.resize(n_ctx);
+        model.kv_cache.blocks.resize(n_block);
+
+        // hand out the blocks in increasing order, so that consecutive tokens tend to land in consecutive rows
+        for (int i = n_block - 1; i >= 0; --i) {
+            model.kv_cache.blocks_free.push_back(i);
+        }
 
         const size_t memory_size = ggml_nbytes(model.kv_cache.k) + ggml_nbytes(model.kv_cache.v);
 
-        printf("%s: memory size = %8.2f MB, n_mem = %d\n", __func__, memory_size/1024.0/1024.0, n_mem);
+        printf("%s: memory size = %8.2f MB, n_mem = %d, n_block = %d, type_k = %s, type_v = %s\n", __func__, memory_size/1024.0/1024.0, n_mem, n_block,
+                ggml_type_name(type_k), ggml_type_name(type_v));
 
         // create a backend buffer (can be in host or device memory)
         model.kv_cache.buffer = ggml_backend_alloc_buffer(model.backend, memory_size + 256);
@@ -535,25 +583,34 @@ bool gpt2_model_load(const std::string & fname, gpt2_model & model, gpt_vocab &
 
 // build the computation graph
 struct ggml_cgraph * gpt2_graph(
-        const  gpt2_model  & model,
-        const  gpt2_batch  & batch,
-                     bool    measure) {
+        const  gpt2_model   & model,
+        const  gpt2_batch   & batch,
+        const  gpt2_sampler * sampler,
+                     bool     measure) {
     const auto & hparams = model.hparams;
 
     const int n_embd  = hparams.n_embd;
     const int n_layer = hparams.n_layer;
-    const int n_ctx   = hparams.n_ctx;
     const int n_head  = hparams.n_head;
 
     const auto & kv_cache = model.kv_cache;
 
     const int32_t n_tokens = batch.n_tokens;
-    const int32_t n_kv     = measure ? n_ctx            : kv_cache.n;
-    const int32_t kv_head  = measure ? n_ctx - n_tokens : kv_cache.head;
+    const int32_t n_rows   = kv_cache.n_block*GPT2_KV_BLOCK_SIZE;
+    const int32_t n_kv     = measure ? n_rows : kv_cache.n;
+
+    const size_t row_size_k = ggml_row_size(kv_cache.k->type, n_embd);
+    const size_t row_size_v = ggml_row_size(kv_cache.v->type, n_embd);
+
+    // the K/V of the batch are stored with one copy per run of consecutive cache rows, at most one per token
+    const int max_nodes = GPT2_MAX_NODES + 6*n_layer*n_tokens;
 
     // since we are using ggml-alloc, this buffer only needs enough space to hold the ggml_tensor and ggml_cgraph structs, but not the tensor data
-    static size_t buf_size = ggml_tensor_overhead()*GPT2_MAX_NODES + ggml_graph_overhead_custom(GPT2_MAX_NODES, false);
-    static std::vector<uint8_t> buf(buf_size);
+    const size_t buf_size = ggml_tensor_overhead()*max_nodes + ggml_graph_overhead_custom(max_nodes, false);
+    static std::vector<uint8_t> buf;
+    if (buf.size() < buf_size) {
+        buf.resize(buf_size);
+    }
 
     struct ggml_init_params params = {
         /*.mem_size   =*/ buf_size,
@@ -563,7 +620,7 @@ struct ggml_cgraph * gpt2_graph(
 
     struct ggml_context * ctx = ggml_init(params);
 
-    struct ggml_cgraph  * gf = ggml_new_graph_custom(ctx, GPT2_MAX_NODES, false);
+    struct ggml_cgraph  * gf = ggml_new_graph_custom(ctx, max_nodes, false);
 
     struct ggml_tensor * inpL;
     if (batch.token) {
@@ -593,6 +650,11 @@ struct ggml_cgraph * gpt2_graph(
     ggml_set_name(KQ_mask, "KQ_mask");
     ggml_set_input(KQ_mask);
 
+    // cache rows (within a layer) visible to the batch, gathered through the block tables
+    struct ggml_tensor * KQ_rows = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, n_kv);
+    ggml_set_name(KQ_rows, "KQ_rows");
+    ggml_set_input(KQ_rows);
+
 
     for (int il = 0; il < n_layer; ++il) {
         struct ggml_tensor * cur;
@@ -636,14 +698,28 @@ struct ggml_cgraph * gpt2_graph(
             struct ggml_tensor * Vcur = ggml_view_2d(ctx, cur, n_embd, n_tokens, cur->nb[1], 2*sizeof(float)*n_embd);
 
             // store key and value to memory
-            if (n_tokens >= 1) {
-                struct ggml_tensor * k = ggml_view_1d(ctx, model.kv_cache.k, n_tokens*n_embd, (ggml_element_size(model.kv_cache.k)*n_embd)*(il*n_ctx + kv_head));
-                struct ggml_tensor * v = ggml_view_1d(ctx, model.kv_cache.v, n_tokens*n_embd, (ggml_element_size(model.kv_cache.v)*n_embd)*(il*n_ctx + kv_head));
+            for (int32_t j0 = 0; j0 < n_tokens; ) {
+                int32_t j1 = j0 + 1;
+                while (j1 < n_tokens && (measure || kv_cache.rows_dst[j1] == kv_cache.rows_dst[j1 - 1] + 1)) {
+                    j1++;
+                }
+
+                const int32_t row = il*n_rows + (measure ? 0 : kv_cache.rows_dst[j0]);
 
-                ggml_build_forward_expand(gf, ggml_cpy(ctx, Kcur, k));
-                ggml_build_forward_expand(gf, ggml_cpy(ctx, Vcur, v));
+                struct ggml_tensor * k = ggml_view_1d(ctx, kv_cache.k, (j1 - j0)*n_embd, row_size_k*row);
+                struct ggml_tensor * v = ggml_view_1d(ctx, kv_cache.v, (j1 - j0)*n_embd, row_size_v*row);
+
+                ggml_build_forward_expand(gf, ggml_cpy(ctx, ggml_view_2d(ctx, Kcur, n_embd, j1 - j0, cur->nb[1], j0*cur->nb[1]), k));
+                ggml_build_forward_expand(gf, ggml_cpy(ctx, ggml_view_2d(ctx, Vcur, n_embd, j1 - j0, cur->nb[1], j0*cur->nb[1]), v));
+
+                j0 = j1;
             }
 
+            // gather the K/V rows of the batch's block tables
+            // [768, n_kv]
+            struct ggml_tensor * Kmem = ggml_get_rows(ctx, ggml_view_2d(ctx, kv_cache.k, n_embd, n_rows, row_size_k, row_size_k*il*n_rows), KQ_rows);
+            struct ggml_tensor * Vmem = ggml_get_rows(ctx, ggml_view_2d(ctx, kv_cache.v, n_embd, n_rows, row_size_v, row_size_v*il*n_rows), KQ_rows);
+
             // Q = Qcur.contiguous().view(n_embd/n_head, n_head, N).permute(0, 2, 1, 3)
             // [64, N, 12]
             struct ggml_tensor * Q =
@@ -658,7 +734,7 @@ struct ggml_cgraph * gpt2_graph(
             struct ggml_tensor * K =
                 ggml_permute(ctx,
                         ggml_reshape_3d(ctx,
-                            ggml_view_1d(ctx, model.kv_cache.k, n_kv*n_embd, il*n_ctx*ggml_element_size(model.kv_cache.k)*n_embd),
+                            Kmem,
                             n_embd/n_head, n_head, n_kv),
                         0, 2, 1, 3);
 
@@ -699,7 +775,7 @@ struct ggml_cgraph * gpt2_graph(
                 ggml_cont_3d(ctx,
                         ggml_permute(ctx,
                             ggml_reshape_3d(ctx,
-                                ggml_view_1d(ctx, model.kv_cache.v, n_kv*n_embd, il*n_ctx*ggml_element_size(model.kv_cache.v)*n_embd),
+                                Vmem,
                                 n_embd/n_head, n_head, n_kv),
                             1, 2, 0, 3),
                         n_kv, n_embd/n_head, n_head);
@@ -810,6 +886,17 @@ struct ggml_cgraph * gpt2_graph(
                 model.ln_f_b);
     }
 
+    const int32_t n_outputs = sampler ? (measure ? n_tokens : (int32_t) sampler->out_ids.size()) : 0;
+
+    // only the rows that are sampled from go through the LM head
+    if (sampler) {
+        struct ggml_tensor * out_ids = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, n_outputs);
+        ggml_set_name(out_ids, "out_ids");
+        ggml_set_input(out_ids);
+
+        inpL = ggml_get_rows(ctx, inpL, out_ids);
+    }
+
     // inpL = WTE * inpL
     // [ 768, 50257] - model.lm_head
     // [ 768, N]     - inpL
@@ -818,6 +905,35 @@ struct ggml_cgraph * gpt2_graph(
     // logits -> probs
     //inpL = ggml_soft_max(ctx0, inpL);
 
+    // logits -> token ids
+    if (sampler) {
+        // only the ids of the penalized tokens are uploaded, the penalty is applied to the logits by the backend
+        struct ggml_tensor * penalty_ids = nullptr;
+        if (sampler->repeat_penalty != 1.0f) {
+            int32_t n_penalty = 0;
+            if (measure) {
+                n_penalty = n_outputs*std::max(sampler->repeat_last_n, 0);
+            } else {
+                for (const auto & penalty_tokens : sampler->penalty_tokens) {
+                    n_penalty += penalty_tokens.size();
+                }
+            }
+
+            if (n_penalty > 0) {
+                penalty_ids = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, n_penalty);
+                ggml_set_name(penalty_ids, "penalty_ids");
+                ggml_set_input(penalty_ids);
+            }
+        }
+
+        struct ggml_tensor * u = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_outputs);
+        ggml_set_name(u, "u");
+        ggml_set_input(u);
+
+        inpL = ggml_common_sample_top_k_top_p_repeat(ctx, inpL, penalty_ids, u,
+                sampler->top_k, sampler->top_p, sampler->temp, sampler->repeat_penalty);
+    }
+
     ggml_build_forward_expand(gf, inpL);
 
     ggml_free(ctx);
@@ -825,6 +941,100 @@ struct ggml_cgraph * gpt2_graph(
     return gf;
 }
 
+// returns the index of a free block, or -1 if the cache is full
+static int32_t gpt2_kv_cache_block_alloc(struct gpt2_kv_cache & cache) {
+    if (cache.blocks_free.empty()) {
+        return -1;
+    }
+
+    const int32_t ib = cache.blocks_free.back();
+    cache.blocks_free.pop_back();
+
+    cache.blocks[ib].ref    = 1;
+    cache.blocks[ib].n_used = 0;
+
+    return ib;
+}
+
+static void gpt2_kv_cache_block_release(struct gpt2_kv_cache & cache, int32_t ib) {
+    GGML_ASSERT(cache.blocks[ib].ref > 0);
+
+    if (--cache.blocks[ib].ref == 0) {
+        cache.blocks_free.push_back(ib);
+    }
+}
+
+// copy the first n rows of block src into block dst, for all layers
+static void gpt2_kv_cache_block_copy(struct gpt2_kv_cache & cache, int32_t ib_src, int32_t ib_dst, int32_t n) {
+    const int64_t n_rows  = (int64_t) cache.n_block*GPT2_KV_BLOCK_SIZE;
+    const int64_t n_layer = cache.k->ne[1]/n_rows;
+
+    std::vector<uint8_t> tmp;
+
+    for (struct ggml_tensor * t : { cache.k, cache.v }) {
+        const size_t row_size = t->nb[1];
+
+        tmp.resize(n*row_size);
+
+        for (int64_t il = 0; il < n_layer; ++il) {
+            const size_t offs = il*n_rows*row_size;
+
+            ggml_backend_tensor_get(t, tmp.data(), offs + ib_src*GPT2_KV_BLOCK_SIZE*row_size, tmp.size());
+            ggml_backend_tensor_set(t, tmp.data(), offs + ib_dst*GPT2_KV_BLOCK_SIZE*row_size, tmp.size());
+        }
+    }
+
+    cache.blocks[ib_dst].n_used = n;
+}
+
+// remove the positions [p0, p1) of seq_id, p0 < 0 and p1 < 0 mean the start and the end of the sequence
+// only suffixes can be removed (p1 == end), e.g. to roll back the tokens of a rejected draft
+static void gpt2_kv_cache_seq_rm(
+        struct gpt2_kv_cache & cache,
+                 gpt2_seq_id   seq_id,
+                    gpt2_pos   p0,
+                    gpt2_pos   p1) {
+    auto it = cache.seqs.find(seq_id);
+    if (it == cache.seqs.end()) {
+        return;
+    }
+
+    gpt2_kv_seq & seq = it->second;
+
+    if (p0 < 0) p0 = 0;
+    if (p1 < 0 || p1 > seq.n_pos) p1 = seq.n_pos;
+
+    GGML_ASSERT(p1 == seq.n_pos && "only suffixes can be removed");
+
+    if (p0 >= p1) {
+        return;
+    }
+
+    const int32_t n_blocks = (p0 + GPT2_KV_BLOCK_SIZE - 1)/GPT2_KV_BLOCK_SIZE;
+
+    for (size_t i = n_blocks; i < seq.blocks.size(); ++i) {
+        gpt2_kv_cache_block_release(cache, seq.blocks[i]);
+    }
+
+    seq.blocks.resize(n_blocks);
+    seq.n_pos = p0;
+
+    if (n_blocks == 0) {
+        cache.seqs.erase(it);
+        return;
+    }
+
+    // the removed rows of a private block are overwritten by the next tokens of the sequence
+    // a shared block keeps its rows for the other sequences, and is copied on the next write
+    gpt2_kv_block & last = cache.blocks[seq.blocks.back()];
+    if (last.ref == 1 && p0 % GPT2_KV_BLOCK_SIZE != 0) {
+        last.n_used = p0 % GPT2_KV_BLOCK_SIZE;
+    }
+}
+
+// share the positions [p0, p1) of seq_id_src with seq_id_dst, without copying any data
+// only prefixes can be shared (p0 == 0), and seq_id_dst is replaced
+// a partially filled block becomes private to a sequence again (copy-on-write) when it appends to it
 static void gpt2_kv_cache_seq_cp(
         struct gpt2_kv_cache & cache,
                  gpt2_seq_id   seq_id_src,
@@ -832,12 +1042,23 @@ static void gpt2_kv_cache_seq_cp(
                     gpt2_pos   p0,
                     gpt2_pos   p1) {
     if (p0 < 0) p0 = 0;
-    if (p1 < 0) p1 = std::numeric_limits<gpt2_pos>::max();
 
-    for (uint32_t i = 0; i < cache.size; ++i) {
-        if (cache.cells[i].has_seq_id(seq_id_src) && cache.cells[i].pos >= p0 && cache.cells[i].pos < p1) {
-            cache.cells[i].seq_id.insert(seq_id_dst);
-        }
+    GGML_ASSERT(p0 == 0 && "only prefixes can be shared");
+
+    gpt2_kv_cache_seq_rm(cache, seq_id_dst, -1, -1);
+
+    const gpt2_kv_seq & src = cache.seqs[seq_id_src];
+    gpt2_kv_seq       & dst = cache.seqs[seq_id_dst];
+
+    if (p1 < 0 || p1 > src.n_pos) p1 = src.n_pos;
+
+    const int32_t n_blocks = (p1 + GPT2_KV_BLOCK_SIZE - 1)/GPT2_KV_BLOCK_SIZE;
+
+    dst.blocks.assign(src.blocks.begin(), src.blocks.begin() + n_blocks);
+    dst.n_pos = p1;
+
+    for (int32_t ib : dst.blocks) {
+        cache.blocks[ib].ref++;
     }
 }
 
@@ -865,6 +1086,7 @@ void gpt2_batch_free(struct gpt2_batch batch) {
     if (batch.logits) free(batch.logits);
 }
 
+// If sampler is not NULL, the tokens are sampled by the backend and returned in sampler->tokens, and logits is not used
 // Positive return values does not mean a fatal error, but rather a warning.
 //   0 - success
 // < 0 - error
@@ -873,7 +1095,8 @@ int gpt2_decode(
         ggml_gallocr_t       allocr,
         struct gpt2_batch    batch,
         int                  n_threads,
-        std::vector<float> & logits) {
+        std::vector<float> & logits,
+        gpt2_sampler       * sampler = nullptr) {
     const int32_t n_tokens = batch.n_tokens;
     const auto &  hparams  = model.hparams;
     const int     n_vocab  = hparams.n_vocab;
@@ -887,14 +1110,94 @@ int gpt2_decode(
 
     auto & cache = model.kv_cache;
 
+    // count the blocks the batch needs before changing any sequence, so that a full cache leaves them untouched
+    // a shared block is counted as copied even if another sequence of the batch copies it first
+    {
+        std::map<gpt2_seq_id, gpt2_pos> n_pos;
+
+        size_t n_blocks_needed = 0;
+
+        for (int i = 0; i < n_tokens; i++) {
+            const gpt2_seq_id seq_id = batch.seq_id[i];
+
+            auto it = cache.seqs.find(seq_id);
+
+            if (n_pos.find(seq_id) == n_pos.end()) {
+                n_pos[seq_id] = it == cache.seqs.end() ? 0 : it->second.n_pos;
+
+                // copy-on-write of the partially filled last block
+                const gpt2_pos p = n_pos[seq_id];
+                if (p % GPT2_KV_BLOCK_SIZE != 0 && cache.blocks[it->second.blocks[p / GPT2_KV_BLOCK_SIZE]].ref > 1) {
+                    n_blocks_needed++;
+                }
+            }
+
+            if (n_pos[seq_id]++ % GPT2_KV_BLOCK_SIZE == 0) {
+                n_blocks_needed++;
+            }
+        }
+
+        if (n_blocks_needed > cache.blocks_free.size()) {
+            printf("%s: the KV cache is full\n", __func__);
+            return -2;
+        }
+    }
+
+    // find the cache row of each token through the block table of its sequence
+    cache.rows_dst.resize(n_tokens);
+
     for (int i = 0; i < n_tokens; i++) {
-        cache.cells[cache.head + i].pos = batch.pos[i];
-        cache.cells[cache.head + i].seq_id.insert(batch.seq_id[i]);
+        gpt2_kv_seq & seq = cache.seqs[batch.seq_id[i]];
+
+        GGML_ASSERT(batch.pos[i] == seq.n_pos && "tokens must be appended to their sequence in order");
+
+        const int32_t ib = seq.n_pos / GPT2_KV_BLOCK_SIZE;
+        const int32_t ir = seq.n_pos % GPT2_KV_BLOCK_SIZE;
+
+        if (ib == (int32_t) seq.blocks.size()) {
+            const int32_t ib_new = gpt2_kv_cache_block_alloc(cache);
+            GGML_ASSERT(ib_new >= 0);
+
+            seq.blocks.push_back(ib_new);
+        } else if (cache.blocks[seq.blocks[ib]].ref > 1) {
+            // copy-on-write of a shared, partially filled block
+            const int32_t ib_new = gpt2_kv_cache_block_alloc(cache);
+            GGML_ASSERT(ib_new >= 0);
+
+            gpt2_kv_cache_block_copy(cache, seq.blocks[ib], ib_new, ir);
+            gpt2_kv_cache_block_release(cache, seq.blocks[ib]);
+
+            seq.blocks[ib] = ib_new;
+        }
+
+        cache.blocks[seq.blocks[ib]].n_used = ir + 1;
+        cache.rows_dst[i] = seq.blocks[ib]*GPT2_KV_BLOCK_SIZE + ir;
+
+        seq.n_pos++;
     }
 
-    cache.n = cache.head + n_tokens;
+    // gather the blocks of the sequences in the batch, each shared block only once
+    std::vector<int32_t> block_offs(cache.n_block, -1);
 
-    struct ggml_cgraph * gf = gpt2_graph(model, batch, false);
+    cache.rows_kv.clear();
+
+    for (int i = 0; i < n_tokens; i++) {
+        for (int32_t ib : cache.seqs[batch.seq_id[i]].blocks) {
+            if (block_offs[ib] >= 0) {
+                continue;
+            }
+
+            block_offs[ib] = cache.rows_kv.size();
+
+            for (int32_t ir = 0; ir < cache.blocks[ib].n_used; ++ir) {
+                cache.rows_kv.push_back(ib*GPT2_KV_BLOCK_SIZE + ir);
+            }
+        }
+    }
+
+    cache.n = cache.rows_kv.size();
+
+    struct ggml_cgraph * gf = gpt2_graph(model, batch, sampler, false);
 
     // allocate tensors
     ggml_gallocr_alloc_graph(allocr, gf);
@@ -914,32 +1217,65 @@ int gpt2_decode(
         ggml_backend_tensor_set(embd, batch.embd, 0, n_tokens * hparams.n_embd * ggml_element_size(embd));
     }
 
+    {
+        struct ggml_tensor * KQ_rows = ggml_graph_get_tensor(gf, "KQ_rows");
+        ggml_backend_tensor_set(KQ_rows, cache.rows_kv.data(), 0, cache.rows_kv.size()*sizeof(int32_t));
+    }
+
     {
         struct ggml_tensor * KQ_mask = ggml_graph_get_tensor(gf, "KQ_mask");
         const auto & kv_cache = model.kv_cache;
         const int32_t n_tokens = batch.n_tokens;
         const int32_t n_kv     = kv_cache.n;
 
-        std::vector<float> data_buf(n_kv*n_tokens);
-        const float neg_inf_v = -INFINITY;
+        std::vector<float> data_buf(n_kv*n_tokens, -INFINITY);
 
-        for (int h = 0; h < 1; ++h) {
-            int h_offset = h*(n_kv*n_tokens);
-            for (int j = 0; j < n_tokens; ++j) {
-                const gpt2_pos    pos    = batch.pos[j];
-                const gpt2_seq_id seq_id = batch.seq_id[j];
+        for (int j = 0; j < n_tokens; ++j) {
+            const gpt2_pos      pos = batch.pos[j];
+            const gpt2_kv_seq & seq = kv_cache.seqs.at(batch.seq_id[j]);
 
-                for (int i = 0; i < n_kv; ++i) {
-                    if (!kv_cache.cells[i].has_seq_id(seq_id) || kv_cache.cells[i].pos > pos) {
-                        data_buf[h_offset + j*n_kv + i] = neg_inf_v;
-                    }
-                }
+            // position p of the sequence is row p % GPT2_KV_BLOCK_SIZE of its block
+            for (gpt2_pos p = 0; p <= pos; ++p) {
+                const int32_t ib = seq.blocks[p / GPT2_KV_BLOCK_SIZE];
+                data_buf[j*n_kv + block_offs[ib] + p % GPT2_KV_BLOCK_SIZE] = 0.0f;
             }
         }
 
         ggml_backend_tensor_set(KQ_mask, data_buf.data(), 0, data_buf.size() * sizeof(float));
     }
 
+    if (sampler) {
+        const int32_t n_outputs = sampler->out_ids.size();
+
+        GGML_ASSERT((int32_t) sampler->u.size() == n_outputs);
+
+        struct ggml_tensor * out_ids = ggml_graph_get_tensor(gf, "out_ids");
+        ggml_backend_tensor_set(out_ids, sampler->out_ids.data(), 0, n_outputs*sizeof(int32_t));
+
+        // not part of the graph with greedy sampling
+        struct ggml_tensor * u = ggml_graph_get_tensor(gf, "u");
+        if (u) {
+            ggml_backend_tensor_set(u, sampler->u.data(), 0, n_outputs*sizeof(float));
+        }
+
+        // the position of each penalized token in the logits of all the outputs
+        struct ggml_tensor * penalty_ids = ggml_graph_get_tensor(gf, "penalty_ids");
+        if (penalty_ids) {
+            GGML_ASSERT((int32_t) sampler->penalty_tokens.size() == n_outputs);
+
+            std::vector<int32_t> data_buf;
+            data_buf.reserve(ggml_nelements(penalty_ids));
+            for (int32_t i = 0; i < n_outputs; ++i) {
+                for (gpt_vocab::id id : sampler->penalty_tokens[i]) {
+                    data_buf.push_back(i*n_vocab + id);
+                }
+            }
+            GGML_ASSERT((int64_t) data_buf.size() == ggml_nelements(penalty_ids));
+
+            ggml_backend_tensor_set(penalty_ids, data_buf.data(), 0, data_buf.size()*sizeof(int32_t));
+        }
+    }
+
     // run the computation
     if (ggml_backend_is_cpu(model.backend)) {
         ggml_backend_cpu_set_n_threads(model.backend, n_threads);
@@ -954,7 +1290,11 @@ int gpt2_decode(
     // in this case, the output tensor is the last one in the graph
     struct ggml_tensor * inpL = ggml_graph_node(gf, -1);
 
-    if (batch.logits) {
+    if (sampler) {
+        // return only the sampled token ids
+        sampler->tokens.resize(sampler->out_ids.size());
+        ggml_backend_tensor_get(inpL, sampler->tokens.data(), 0, sampler->tokens.size()*sizeof(gpt_vocab::id));
+    } else if (batch.logits) {
         // return logits for all tokens
         logits.resize(n_vocab*n_tokens);
         for (int32_t i = 0; i < n_tokens; i++) {
@@ -969,15 +1309,283 @@ int gpt2_decode(
         ggml_backend_tensor_get(inpL, logits.data(), (n_vocab*(n_tokens-1))*sizeof(float), sizeof(float)*n_vocab);
     }
 
-    // update the kv ring buffer
-    cache.head += n_tokens;
+    return 0;
+}
+
+static void gpt2_model_free(struct gpt2_model & model) {
+    ggml_free(model.ctx_w);
+
+    ggml_backend_buffer_free(model.buffer_w);
+    ggml_backend_buffer_free(model.kv_cache.buffer);
+    ggml_backend_free(model.backend);
+}
+
+// speculative decoding of a single sequence
+// the draft model proposes n_draft tokens, one at a time, then the target model scores all of them in a single batch
+// the accepted tokens are kept in the KV cache of both models, and the rejected ones are removed
+static int gpt2_speculative(const gpt_params & params, std::mt19937 & rng) {
+    const int64_t t_main_start_us = ggml_time_us();
+
+    int64_t t_load_us = 0;
+
+    const ggml_type type_k = ggml_parse_cache_type(params.cache_type_k);
+    const ggml_type type_v = ggml_parse_cache_type(params.cache_type_v);
+    if (type_k == GGML_TYPE_COUNT || type_v == GGML_TYPE_COUNT) {
+        return 1;
+    }
+
+    gpt_vocab vocab;
+    gpt_vocab vocab_dft;
+
+    gpt2_model model_tgt;
+    gpt2_model model_dft;
+
+    // load the target and the draft models
+    {
+        const int64_t t_start_us = ggml_time_us();
+
+        if (!gpt2_model_load(params.model, model_tgt, vocab, params.n_ctx, params.n_gpu_layers, type_k, type_v)) {
+            fprintf(stderr, "%s: failed to load model from '%s'\n", __func__, params.model.c_str());
+            return 1;
+        }
+
+        if (!gpt2_model_load(params.model_draft, model_dft, vocab_dft, params.n_ctx, params.n_gpu_layers, type_k, type_v)) {
+            fprintf(stderr, "%s: failed to load draft model from '%s'\n", __func__, params.model_draft.c_str());
+            return 1;
+        }
+
+        t_load_us = ggml_time_us() - t_start_us;
+    }
+
+    const int n_vocab = model_tgt.hparams.n_vocab;
 
-    // ensure kv cache head points to a valid index.
-    if (cache.head >= cache.size) {
-        printf("%s: cache.head >= cache.size\n", __func__);
-        return -2;
+    if (model_dft.hparams.n_vocab != n_vocab) {
+        fprintf(stderr, "%s: the draft model vocab size (%d) does not match the target model (%d)\n",
+                __func__, model_dft.hparams.n_vocab, n_vocab);
+        return 1;
     }
 
+    const int n_ctx   = std::min(model_tgt.hparams.n_ctx, model_dft.hparams.n_ctx);
+    const int n_draft = std::max(params.n_draft, 1);
+
+    // tokenize the prompt
+    std::vector<gpt_vocab::id> tokens = ::gpt_tokenize(vocab, params.prompt);
+
+    const int n_prompt = tokens.size();
+
+    if (n_prompt >= n_ctx) {
+        fprintf(stderr, "%s: the prompt is too long (%d tokens, n_ctx = %d)\n", __func__, n_prompt, n_ctx);
+        return 1;
+    }
+
+    // the draft model evaluates the whole prompt in its first batch, the target model evaluates the last token with the draft
+    gpt2_batch batch = gpt2_batch_init(std::max(n_prompt, n_draft) + 1, 0);
+
+    // prepare required memory and allocate the compute buffers of both models
+    ggml_gallocr_t allocr_tgt = ggml_gallocr_new(ggml_backend_get_default_buffer_type(model_tgt.backend));
+    ggml_gallocr_t allocr_dft = ggml_gallocr_new(ggml_backend_get_default_buffer_type(model_dft.backend));
+
+    batch.n_tokens = std::max(n_prompt, n_draft) + 1;
+
+    ggml_gallocr_reserve(allocr_tgt, gpt2_graph(model_tgt, batch, nullptr, true));
+    ggml_gallocr_reserve(allocr_dft, gpt2_graph(model_dft, batch, nullptr, true));
+
+    fprintf(stderr, "%s: compute buffer size: %.2f MB (target), %.2f MB (draft)\n", __func__,
+            ggml_gallocr_get_buffer_size(allocr_tgt, 0)/1024.0/1024.0,
+            ggml_gallocr_get_buffer_size(allocr_dft, 0)/1024.0/1024.0);
+
+    int64_t t_sample_us  = 0;
+    int64_t t_draft_us   = 0;
+    int64_t t_predict_us = 0;
+
+    // append inp to the sequence, starting at position p0, and compute the logits of the last n_out tokens
+    auto eval = [&](gpt2_model & model, ggml_gallocr_t allocr, const std::vector<gpt_vocab::id> & inp, gpt2_pos p0, int n_out, std::vector<float> & logits) {
+        batch.n_tokens = inp.size();
+
+        for (int32_t i = 0; i < batch.n_tokens; i++) {
+            batch.token[i]  = inp[i];
+            batch.pos[i]    = p0 + i;
+            batch.seq_id[i] = 0;
+            batch.logits[i] = i >= batch.n_tokens - n_out;
+        }
+
+        return gpt2_decode(model, allocr, batch, params.n_threads, logits, nullptr);
+    };
+
+    // the sampling distribution after the tokens in prev
+    auto probs = [&](const float * logits, const std::vector<gpt_vocab::id> & prev) {
+        const int64_t t_start_sample_us = ggml_time_us();
+
+        const size_t n_last = std::min(prev.size(), (size_t) std::max(params.repeat_last_n, 0));
+
+        auto res = gpt_probs_top_k_top_p_repeat(vocab, logits, prev.data() + prev.size() - n_last, n_last,
+                params.top_k, params.top_p, params.temp, n_last, params.repeat_penalty);
+
+        t_sample_us += ggml_time_us() - t_start_sample_us;
+
+        return res;
+    };
+
+    printf("%s: prompt: '%s'\n", __func__, params.prompt.c_str());
+    printf("%s: number of tokens in prompt = %d, drafting %d tokens per step\n\n", __func__, n_prompt, n_draft);
+    printf("%s", params.prompt.c_str());
+
+    std::vector<float> logits_tgt;
+    std::vector<float> logits_dft;
+
+    // evaluate the prompt with the target model and sample the first token
+    {
+        const int64_t t_start_us = ggml_time_us();
+
+        if (eval(model_tgt, allocr_tgt, tokens, 0, 1, logits_tgt) != 0) {
+            fprintf(stderr, "%s: gpt2_decode() failed\n", __func__);
+            return 1;
+        }
+
+        t_predict_us += ggml_time_us() - t_start_us;
+    }
+
+    tokens.push_back(gpt_sample_probs(probs(logits_tgt.data() + (n_prompt - 1)*n_vocab, tokens), rng));
+
+    const int n_len = std::min(n_prompt + params.n_predict, n_ctx);
+
+    int n_past    = n_prompt; // tokens in the KV cache of the target model, all but the last one
+    int n_printed = n_prompt;
+    int n_decoded = 0;
+    int n_steps   = 0;
+    int n_drafted = 0;
+    int n_accept  = 0;
+
+    bool has_eos = false;
+
+    std::vector<gpt_vocab::id> draft;
+    std::vector<std::vector<std::pair<double, gpt_vocab::id>>> q;
+    std::vector<std::vector<std::pair<double, gpt_vocab::id>>> p;
+
+    while (true) {
+        // print the tokens committed in the last step
+        for (int i = n_printed; i < (int) tokens.size(); ++i) {
+            if (!params.ignore_eos && tokens[i] == 50256) {
+                has_eos = true;
+                break;
+            }
+            printf("%s", vocab.id_to_token[tokens[i]].c_str());
+            n_decoded += 1;
+        }
+        fflush(stdout);
+
+        n_printed = tokens.size();
+
+        n_past = tokens.size() - 1;
+
+        if (has_eos || (int) tokens.size() >= n_len) {
+            break;
+        }
+
+        // do not draft past the end of the generation, the target model always adds one more token
+        const int n_draft_cur = std::min(n_draft, n_len - (int) tokens.size() - 1);
+
+        draft.clear();
+        q.clear();
+        p.clear();
+
+        // the draft model catches up with the committed tokens, then proposes the draft tokens one by one
+        {
+            const int64_t t_start_us = ggml_time_us();
+
+            gpt2_pos n_past_dft = model_dft.kv_cache.seqs[0].n_pos;
+
+            std::vector<gpt_vocab::id> prev(tokens);
+            std::vector<gpt_vocab::id> inp(tokens.begin() + n_past_dft, tokens.end());
+
+            for (int i = 0; i < n_draft_cur; ++i) {
+                if (eval(model_dft, allocr_dft, inp, n_past_dft, 1, logits_dft) != 0) {
+                    fprintf(stderr, "%s: gpt2_decode() failed for the draft model\n", __func__);
+                    return 1;
+                }
+
+                n_past_dft += inp.size();
+
+                q.push_back(probs(logits_dft.data() + (inp.size() - 1)*n_vocab, prev));
+
+                const gpt_vocab::id id = gpt_sample_probs(q.back(), rng);
+
+                draft.push_back(id);
+                prev.push_back(id);
+
+                inp = { id };
+            }
+
+            t_draft_us += ggml_time_us() - t_start_us;
+        }
+
+        // the target model scores the last committed token and the draft tokens in a single batch
+        {
+            const int64_t t_start_us = ggml_time_us();
+
+            std::vector<gpt_vocab::id> inp(1, tokens.back());
+            inp.insert(inp.end(), draft.begin(), draft.end());
+
+            if (eval(model_tgt, allocr_tgt, inp, n_past, inp.size(), logits_tgt) != 0) {
+                fprintf(stderr, "%s: gpt2_decode() failed\n", __func__);
+                return 1;
+            }
+
+            t_predict_us += ggml_time_us() - t_start_us;
+        }
+
+        {
+            std::vector<gpt_vocab::id> prev(tokens);
+
+            for (int i = 0; i <= n_draft_cur; ++i) {
+                p.push_back(probs(logits_tgt.data() + i*n_vocab, prev));
+
+                if (i < n_draft_cur) {
+                    prev.push_back(draft[i]);
+                }
+            }
+        }
+
+        gpt_vocab::id id_next = -1;
+
+        const int n_acc = gpt_speculative_accept(draft, q, p, id_next, rng);
+
+        n_steps   += 1;
+        n_drafted += n_draft_cur;
+        n_accept  += n_acc;
+
+        tokens.insert(tokens.end(), draft.begin(), draft.begin() + n_acc);
+        tokens.push_back(id_next);
+
+        // roll back the KV cache of both models to the committed tokens, all but the last one
+        gpt2_kv_cache_seq_rm(model_tgt.kv_cache, 0, tokens.size() - 1, -1);
+        gpt2_kv_cache_seq_rm(model_dft.kv_cache, 0, tokens.size() - 1, -1);
+    }
+
+    // report timing
+    {
+        const int64_t t_main_end_us = ggml_time_us();
+
+        printf("\n\n");
+        printf("%s:     n_decoded = %8d\n",      __func__, n_decoded);
+        printf("%s:       n_steps = %8d\n",      __func__, n_steps);
+        printf("%s:     n_drafted = %8d\n",      __func__, n_drafted);
+        printf("%s:      n_accept = %8d (%.1f%%)\n", __func__, n_accept, n_drafted > 0 ? 100.0f*n_accept/n_drafted : 0.0f);
+        printf("%s:     load time = %8.2f ms\n", __func__, t_load_us/1000.0f);
+        printf("%s:   sample time = %8.2f ms\n", __func__, t_sample_us/1000.0f);
+        printf("%s:    draft time = %8.2f ms\n", __func__, t_draft_us/1000.0f);
+        printf("%s:  predict time = %8.2f ms / %.2f ms per token\n", __func__, t_predict_us/1000.0f, t_predict_us/1000.0f/std::max(n_decoded, 1));
+        printf("%s:    total time = %8.2f ms\n", __func__, (t_main_end_us - t_main_start_us)/1000.0f);
+    }
+
+    gpt2_batch_free(batch);
+
+    ggml_gallocr_free(allocr_tgt);
+    ggml_gallocr_free(allocr_dft);
+
+    gpt2_model_free(model_tgt);
+    gpt2_model_free(model_dft);
+
     return 0;
 }
 
@@ -1003,16 +1611,34 @@ int main(int argc, char ** argv) {
         params.prompt = gpt_random_prompt(rng);
     }
 
+    if (!params.model_draft.empty()) {
+        if (params.n_parallel > 1) {
+            fprintf(stderr, "%s: speculative decoding supports a single stream, ignoring -np\n", __func__);
+        }
+
+        return gpt2_speculative(params, rng);
+    }
+
     int64_t t_load_us = 0;
 
     gpt_vocab vocab;
     gpt2_model model;
 
+    const ggml_type type_k = ggml_parse_cache_type(params.cache_type_k);
+    const ggml_type type_v = ggml_parse_cache_type(params.cache_type_v);
+    if (type_k == GGML_TYPE_COUNT || type_v == GGML_TYPE_COUNT) {
+        return 1;
+    }
+
+    if (params.flash_attn) {
+        fprintf(stderr, "%s: flash attention is not supported with the paged KV cache, ignoring -fa\n", __func__);
+    }
+
     // load the model
     {
         const int64_t t_start_us = ggml_time_us();
 
-        if (!gpt2_model_load(params.model, model, vocab, params.n_ctx, params.n_gpu_layers)) {
+        if (!gpt2_model_load(params.model, model, vocab, params.n_ctx, params.n_gpu_layers, type_k, type_v)) {
             fprintf(stderr, "%s: failed to load model from '%s'\n", __func__, params.model.c_str());
             return 1;
         }
@@ -1032,6 +1658,30 @@ int main(int argc, char ** argv) {
     // we use this object to submit token data for decoding
     gpt2_batch batch = gpt2_batch_init(n_batch_max, 0);
 
+    // when the backend supports the sampling ops, the tokens are sampled by the backend and only their ids are copied back
+    // otherwise, the logits are copied back and the tokens are sampled on the host
+    gpt2_sampler sampler;
+    sampler.top_k          = params.top_k;
+    sampler.top_p          = params.top_p;
+    sampler.temp           = params.temp;
+    sampler.repeat_penalty = params.repeat_penalty;
+    sampler.repeat_last_n  = params.repeat_last_n;
+
+    bool sample_on_backend = true;
+    {
+        batch.n_tokens = n_batch_max;
+        struct ggml_cgraph * gf = gpt2_graph(model, batch, &sampler, true);
+
+        for (int i = 0; i < ggml_graph_n_nodes(gf); ++i) {
+            struct ggml_tensor * node = ggml_graph_node(gf, i);
+            if (!ggml_backend_supports_op(model.backend, node)) {
+                fprintf(stderr, "%s: %s is not supported by the backend, sampling on the host\n", __func__, ggml_op_desc(node));
+                sample_on_backend = false;
+                break;
+            }
+        }
+    }
+
     // prepare required memory and allocate the compute buffer
     ggml_gallocr_t allocr = NULL;
     {
@@ -1040,7 +1690,7 @@ int main(int argc, char ** argv) {
 
         // create the worst case graph for memory usage estimation
         batch.n_tokens = n_batch_max;
-        struct ggml_cgraph * gf = gpt2_graph(model, batch, true);
+        struct ggml_cgraph * gf = gpt2_graph(model, batch, sample_on_backend ? &sampler : nullptr, true);
 
         // pre-allocate the compute buffer for the worst case (optional)
         ggml_gallocr_reserve(allocr, gf);
@@ -1053,6 +1703,62 @@ int main(int argc, char ** argv) {
 
     std::vector<float> logits;
 
+    // the tokens of each parallel sequence, for the repetition penalty
+    std::vector<std::vector<gpt_vocab::id>> tokens(n_parallel, embd_inp);
+
+    // set the random numbers and the penalized tokens of the outputs, given the sequence of each output
+    auto sampler_prepare = [&](const std::vector<int32_t> & out_seq) {
+        const int64_t t_start_sample_us = ggml_time_us();
+
+        std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+        sampler.u.resize(out_seq.size());
+        sampler.penalty_tokens.resize(out_seq.size());
+
+        for (size_t i = 0; i < out_seq.size(); ++i) {
+            sampler.u[i] = dist(rng);
+
+            const auto & seq_tokens = tokens[out_seq[i]];
+            const size_t n_last = std::min(seq_tokens.size(), (size_t) std::max(params.repeat_last_n, 0));
+            // a token is penalized once, however often it was repeated
+            auto & penalty_tokens = sampler.penalty_tokens[i];
+            penalty_tokens.assign(seq_tokens.end() - n_last, seq_tokens.end());
+            std::sort(penalty_tokens.begin(), penalty_tokens.end());
+            penalty_tokens.erase(std::unique(penalty_tokens.begin(), penalty_tokens.end()), penalty_tokens.end());
+        }
+
+        t_sample_us += ggml_time_us() - t_start_sample_us;
+    };
+
+    // evaluate the batch and sample one token for each of sampler.out_ids
+    auto decode_sample = [&]() {
+        if (sample_on_backend) {
+            return gpt2_decode(model, allocr, batch, params.n_threads, logits, &sampler);
+        }
+
+        const int ret = gpt2_decode(model, allocr, batch, params.n_threads, logits);
+        if (ret != 0) {
+            return ret;
+        }
+
+        const int64_t t_start_sample_us = ggml_time_us();
+
+        const int n_vocab = model.hparams.n_vocab;
+
+        sampler.tokens.resize(sampler.out_ids.size());
+        for (size_t i = 0; i < sampler.out_ids.size(); ++i) {
+            const auto & penalty_tokens = sampler.penalty_tokens[i];
+
+            sampler.tokens[i] = gpt_sample_top_k_top_p_repeat(vocab, logits.data() + sampler.out_ids[i]*n_vocab,
+                    penalty_tokens.data(), penalty_tokens.size(),
+                    params.top_k, params.top_p, params.temp, penalty_tokens.size(), params.repeat_penalty, rng);
+        }
+
+        t_sample_us += ggml_time_us() - t_start_sample_us;
+
+        return 0;
+    };
+
     // evaluate the initial prompt
     batch.n_tokens = embd_inp.size();
 
@@ -1066,13 +1772,23 @@ int main(int argc, char ** argv) {
     // gpt2_decode will output logits only for the last token of the prompt
     batch.logits[batch.n_tokens - 1] = true;
 
-    if (gpt2_decode(model, allocr, batch, params.n_threads, logits) != 0) {
+    // all parallel sequences sample their first token from the last token of the prompt
+    std::vector<int32_t> out_seq(n_parallel);
+    for (int32_t i = 0; i < n_parallel; ++i) {
+        out_seq[i] = i;
+    }
+
+    sampler.out_ids.assign(n_parallel, batch.n_tokens - 1);
+    sampler_prepare(out_seq);
+
+    if (decode_sample() != 0) {
         printf("%s: gpt2_decode() failed\n", __func__);
         return 1;
     }
 
     // assign the system KV cache to all parallel sequences
     // this way, the parallel sequences will "reuse" the prompt tokens without having to copy them
+    // they share the blocks of the prompt, and the last one is copied only when a sequence appends to it
     for (int32_t i = 1; i < n_parallel; ++i) {
         gpt2_kv_cache_seq_cp(model.kv_cache, 0, i, 0, batch.n_tokens);
     }
@@ -1092,42 +1808,33 @@ int main(int argc, char ** argv) {
 
     std::vector<gpt_vocab::token> streams(n_parallel);
 
-    // remember the batch index of the last token for each parallel sequence
-    // we need this to determine which logits to sample from
-    std::vector<int32_t> i_batch(n_parallel, batch.n_tokens - 1);
+    // the token sampled for each parallel sequence, -1 once the stream has finished
+    std::vector<gpt_vocab::id> next(sampler.tokens);
 
     int n_cur     = batch.n_tokens;
     int n_len     = batch.n_tokens + params.n_predict;
     int n_decoded = 0;
 
-    const int   n_vocab = model.hparams.n_vocab;
-    const int   top_k = params.top_k;
-    const float top_p = params.top_p;
-    const float temp  = params.temp;
-
     while (n_cur < n_len) {
         batch.n_tokens = 0;
 
+        out_seq.clear();
+
         for (int32_t i = 0; i < n_parallel; ++i) {
-            if (i_batch[i] < 0) {
+            if (next[i] < 0) {
                 // the stream has already finished
                 continue;
             }
 
-            auto * logits_i = logits.data() + i_batch[i]*n_vocab;
-
-            gpt_vocab::id id = 0;
-            {
-                const int64_t t_start_sample_us = ggml_time_us();
-
-                id = gpt_sample_top_k_top_p(vocab, logits_i, top_k, top_p, temp, rng);
-
-                t_sample_us += ggml_time_us() - t_start_sample_us;
-            }
+            const gpt_vocab::id id = next[i];
 
             // is it an end of stream? -> mark the stream as finished
             if ((!params.ignore_eos && id == 50256) || n_cur == n_len - 1) {
-                i_batch[i] = -1;
+                next[i] = -1;
+
+                // return the blocks of the stream to the cache
+                gpt2_kv_cache_seq_rm(model.kv_cache, i, -1, -1);
+
                 printf("\n");
                 if (n_parallel > 1) {
                     printf("%s: stream %d finished at n_cur = %d", __func__, i, n_cur);
@@ -1143,6 +1850,7 @@ int main(int argc, char ** argv) {
             }
 
             streams[i] += token;
+            tokens[i].push_back(id);
 
             // push this new token for next evaluation
             batch.token [batch.n_tokens] = id;
@@ -1150,7 +1858,7 @@ int main(int argc, char ** argv) {
             batch.seq_id[batch.n_tokens] = i;
             batch.logits[batch.n_tokens] = true;
 
-            i_batch[i] = batch.n_tokens;
+            out_seq.push_back(i);
 
             batch.n_tokens += 1;
 
@@ -1164,11 +1872,19 @@ int main(int argc, char ** argv) {
 
         n_cur += 1;
 
+        // each token of the batch is sampled from once
+        sampler.out_ids.resize(batch.n_tokens);
+        for (int32_t i = 0; i < batch.n_tokens; ++i) {
+            sampler.out_ids[i] = i;
+        }
+
+        sampler_prepare(out_seq);
+
         {
             const int64_t t_start_us = ggml_time_us();
 
-            // evaluate the current batch with the transformer model
-            int ret_code = gpt2_decode(model, allocr, batch, params.n_threads, logits);
+            // evaluate the current batch with the transformer model and sample the next tokens
+            int ret_code = decode_sample();
             if (ret_code != 0) {
                 fprintf(stderr, "%s : failed to eval, return code %d\n", __func__, ret_code);
                 return 1;
@@ -1176,6 +1892,10 @@ int main(int argc, char ** argv) {
 
             t_predict_us += ggml_time_us() - t_start_us;
         }
+
+        for (size_t i = 0; i < out_seq.size(); ++i) {
+            next[out_seq[i]] = sampler.tokens[i];
+        }
     }
 
     if (n_parallel > 1) {
@@ -1199,12 +1919,10 @@ int main(int argc, char ** argv) {
     }
 
     gpt2_batch_free(batch);
-    ggml_free(model.ctx_w);
 
     ggml_gallocr_free(allocr);
-    ggml_backend_buffer_free(model.buffer_w);
-    ggml_backend_buffer_free(model.kv_cache.buffer);
-    ggml_backend_free(model.backend);
+
+    gpt2_model_free(model);
 
     return 0;
 }
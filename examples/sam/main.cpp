@@ -1351,7 +1351,7 @@ struct ggml_cgraph  * sam_encode_image(
 
     cur = sam_layer_norm_2d(ctx0, cur, n_enc_out_chans, enc.neck_norm_0_w, enc.neck_norm_0_b, hparams.eps);
 
-    cur = ggml_conv_2d_s1_ph(ctx0, enc.neck_conv_1, cur);
+    cur = ggml_conv_2d_direct(ctx0, enc.neck_conv_1, cur, 1, 1, enc.neck_conv_1->ne[0]/2, enc.neck_conv_1->ne[1]/2, 1, 1);
 
     cur = sam_layer_norm_2d(ctx0, cur, n_enc_out_chans, enc.neck_norm_1_w, enc.neck_norm_1_b, hparams.eps);
 
@@ -36,6 +36,7 @@ struct conv2d_layer {
     int padding = 1;
     bool batch_normalize = true;
     bool activate = true; // true for leaky relu, false for linear
+    bool direct = false;  // use the im2col-free convolution (CPU backend only)
 };
 
 struct yolo_model {
@@ -153,6 +154,7 @@ static bool load_model(const std::string & fname, yolo_model & model) {
         model.conv2d_layers[i].weights = ggml_get_tensor(model.ctx, name);
         snprintf(name, sizeof(name), "l%d_biases", i);
         model.conv2d_layers[i].biases = ggml_get_tensor(model.ctx, name);
+        model.conv2d_layers[i].direct = ggml_backend_is_cpu(model.backend);
         if (model.conv2d_layers[i].batch_normalize) {
             snprintf(name, sizeof(name), "l%d_scales", i);
             model.conv2d_layers[i].scales = ggml_get_tensor(model.ctx, name);
@@ -197,7 +199,9 @@ static bool load_alphabet(std::vector<yolo_image> & alphabet)
 
 static ggml_tensor * apply_conv2d(ggml_context * ctx, ggml_tensor * input, const conv2d_layer & layer)
 {
-    struct ggml_tensor * result = ggml_conv_2d(ctx, layer.weights, input, 1, 1, layer.padding, layer.padding, 1, 1);
+    struct ggml_tensor * result = layer.direct
+        ? ggml_conv_2d_direct(ctx, layer.weights, input, 1, 1, layer.padding, layer.padding, 1, 1)
+        : ggml_conv_2d       (ctx, layer.weights, input, 1, 1, layer.padding, layer.padding, 1, 1);
     if (layer.batch_normalize) {
         result = ggml_sub(ctx, result, ggml_repeat(ctx, layer.rolling_mean, result));
         result = ggml_div(ctx, result, ggml_sqrt(ctx, ggml_repeat(ctx, layer.rolling_variance, result)));
@@ -66,6 +66,10 @@ GGML_API bool ggml_gallocr_alloc_graph(ggml_gallocr_t galloc, struct ggml_cgraph
 
 GGML_API size_t ggml_gallocr_get_buffer_size(ggml_gallocr_t galloc, int buffer_id);
 
+// compute the total buffer size needed to allocate a graph without allocating the buffers or modifying the graph
+// e.g. to compare the memory use of different versions of a graph, the result of a previous reserve is invalidated
+GGML_API size_t ggml_gallocr_measure(ggml_gallocr_t galloc, struct ggml_cgraph * graph);
+
 // Utils
 // Create a buffer and allocate all the tensors in a ggml_context
 GGML_API struct ggml_backend_buffer * ggml_backend_alloc_ctx_tensors_from_buft(struct ggml_context * ctx, ggml_backend_buffer_type_t buft);
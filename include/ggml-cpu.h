@@ -13,6 +13,12 @@ extern "C" {
         size_t    work_size; // size of work buffer, calculated by `ggml_graph_plan()`
         uint8_t * work_data; // work buffer, to be allocated by caller before calling to `ggml_graph_compute()`
 
+        // part of the work buffer (at its end) used to convert the src1 shared by consecutive MUL_MATs only once
+        // set by `ggml_graph_plan()` and included in work_size; it may be set to 0 to disable the cache,
+        // any other change is invalid. The cache does not outlive a `ggml_graph_compute()` call, and it is dropped
+        // when a node writes to the data of the cached src1 (e.g. an inplace op), so it never returns stale data
+        size_t    src1_cache_size;
+
         int n_threads;
         struct ggml_threadpool * threadpool;
 
@@ -131,6 +137,20 @@ extern "C" {
     GGML_BACKEND_API void ggml_backend_cpu_set_threadpool    (ggml_backend_t backend_cpu, ggml_threadpool_t threadpool);
     GGML_BACKEND_API void ggml_backend_cpu_set_abort_callback(ggml_backend_t backend_cpu, ggml_abort_callback abort_callback, void * abort_callback_data);
 
+    // persistent cache of the weights repacked by the CPU_AARCH64 extra buffer type
+    // open it before loading the weights and close it after: tensors found in the cache point to the read-only mapping
+    // of the file instead of being repacked, so processes using the same cache share that memory; the mapping stays
+    // alive until the buffers of these tensors are freed
+    // if there is no valid cache at path, the repacked tensors are written to it on close
+    // model_key must identify the model file (e.g. a hash of its path, size and modification time), the CPU features are
+    // checked automatically; the tensors are looked up by name, type, shape and a hash of a sample of their original data,
+    // which does not detect every change of the data
+    // the cache can be opened and closed while other threads load tensors
+    GGML_BACKEND_API bool   ggml_backend_cpu_repack_cache_open  (const char * path, uint64_t model_key);
+    GGML_BACKEND_API void   ggml_backend_cpu_repack_cache_close (void);
+    // number of tensors loaded from the cache since it was last opened
+    GGML_BACKEND_API size_t ggml_backend_cpu_repack_cache_n_hits(void);
+
     GGML_BACKEND_API ggml_backend_reg_t ggml_backend_cpu_reg(void);
 
 #ifdef __cplusplus
@@ -41,9 +41,36 @@ extern "C" {
             int64_t ne_label,     // number of elements per label
             int64_t ndata,        // total number of datapoints/labels
             int64_t ndata_shard); // number of datapoints/labels per shard (unit at which the dataset is shuffled/copied)
+
+    // callback to read the datapoints/labels of shard ishard for a streaming dataset
+    // data has space for ne_datapoint*ndata_shard values, labels for ne_label*ndata_shard values (NULL if ne_label == 0)
+    // it is called from a background thread but never concurrently, return false on error
+    typedef bool (*ggml_opt_dataset_read_shard)(void * userdata, int64_t ishard, float * data, float * labels);
+
+    // streaming datasets do not hold the data in memory, the next batch is assembled by a background thread
+    // while the current batch is being evaluated, use them for datasets that are larger than the available memory
+    GGML_API ggml_opt_dataset_t ggml_opt_dataset_init_callback(
+            int64_t                     ne_datapoint,
+            int64_t                     ne_label,
+            int64_t                     ndata,
+            int64_t                     ndata_shard,
+            ggml_opt_dataset_read_shard read_shard,
+            void                      * userdata);
+
+    // streaming dataset with the data and labels mapped from files that contain raw F32 values, returns NULL on error
+    // fname_labels must be NULL if ne_label == 0
+    GGML_API ggml_opt_dataset_t ggml_opt_dataset_init_mmap(
+            int64_t      ne_datapoint,
+            int64_t      ne_label,
+            int64_t      ndata,
+            int64_t      ndata_shard,
+            const char * fname_data,
+            const char * fname_labels);
+
     GGML_API void ggml_opt_dataset_free(ggml_opt_dataset_t dataset);
 
     // get underlying tensors that store the data
+    // for streaming datasets the data of these tensors is NULL (callback) or a read-only mapping of the file (mmap)
     GGML_API struct ggml_tensor * ggml_opt_dataset_data  (ggml_opt_dataset_t dataset); // shape = [ne_datapoint, ndata]
     GGML_API struct ggml_tensor * ggml_opt_dataset_labels(ggml_opt_dataset_t dataset); // shape = [nd_label,     ndata]
 
@@ -51,12 +78,21 @@ extern "C" {
     GGML_API void ggml_opt_dataset_shuffle(ggml_opt_context_t opt_ctx, ggml_opt_dataset_t dataset, int64_t idata);
 
     // get batch at position ibatch from dataset and copy the data to data_batch and labels_batch
+    // for streaming datasets this also starts prefetching batch ibatch+1 in the background
     GGML_API void ggml_opt_dataset_get_batch(
             ggml_opt_dataset_t   dataset,
             struct ggml_tensor * data_batch,   // shape = [ne_datapoint, ndata_batch]
             struct ggml_tensor * labels_batch, // shape = [ne_label,     ndata_batch]
             int64_t              ibatch);
 
+    // like ggml_opt_dataset_get_batch but copy the data to host memory, e.g. to upload it with ggml_opt_set_batch_async
+    GGML_API void ggml_opt_dataset_get_batch_host(
+            ggml_opt_dataset_t   dataset,
+            void               * data_batch,
+            size_t               nb_data_batch,
+            void               * labels_batch,
+            int64_t              ibatch);
+
     // ====== Model / Context ======
 
     enum ggml_opt_build_type {
@@ -103,6 +139,23 @@ extern "C" {
 
         ggml_opt_get_optimizer_params get_opt_pars; // callback for calculating optimizer parameters
         void * get_opt_pars_ud;                     // userdata for calculating optimizer parameters
+
+        // gradient checkpointing: only the checkpoint activations are kept for the backward pass,
+        // all other activations of the forward graph are recomputed from them during the backward pass
+        // ctx_compute needs space for the recomputed tensors, use n_checkpoints == 0 to disable
+        struct ggml_tensor ** checkpoints;
+        int32_t               n_checkpoints;
+
+        // mixed precision: GGML_TYPE_F16 or GGML_TYPE_BF16 to let the matrix multiplications use copies of the F32 parameters
+        // cast to this type in every forward pass, gradients and optimizer steps still use the F32 parameters
+        // only parameters that are exclusively used as src0 of ggml_mul_mat are cast, GGML_TYPE_F32 disables it
+        // limitations: the activations and their gradients stay F32, so activation memory is not reduced,
+        // and there is no loss scaling, which F32 gradients do not need but which would be required for F16 ones
+        enum ggml_type compute_type;
+
+        // type of the AdamW first moment: GGML_TYPE_F32 or GGML_TYPE_BF16 to save a quarter of the optimizer state,
+        // the second moment is always F32 since it would stop decaying in BF16
+        enum ggml_type moment_type;
     };
 
     // get parameters for an optimization context with defaults set where possible
@@ -150,6 +203,18 @@ extern "C" {
     // do forward pass, increment result if not NULL, do backward pass
     GGML_API void ggml_opt_forward_backward(ggml_opt_context_t opt_ctx, ggml_opt_result_t result);
 
+    // asynchronous versions of the above: the evaluation is only queued on the backends where they support it,
+    // the loss and predictions are read back asynchronously and result is only incremented by ggml_opt_synchronize
+    GGML_API void ggml_opt_forward_async(ggml_opt_context_t opt_ctx, ggml_opt_result_t result);
+    GGML_API void ggml_opt_forward_backward_async(ggml_opt_context_t opt_ctx, ggml_opt_result_t result);
+
+    // queue the copy of a batch from host memory to the inputs and labels after the previously queued evaluations
+    // the memory of a batch must stay valid until the next call of this function or ggml_opt_synchronize returns
+    GGML_API void ggml_opt_set_batch_async(ggml_opt_context_t opt_ctx, const void * data_batch, const void * labels_batch);
+
+    // wait for all queued evaluations and copies, then increment the results of the asynchronous evaluations
+    GGML_API void ggml_opt_synchronize(ggml_opt_context_t opt_ctx);
+
     // ############################################################################
     // ## The high-level functions start here. They do not depend on any private ##
     // ## functions or structs and can be copied to and adapted for user code.   ##
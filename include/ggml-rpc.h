@@ -13,6 +13,26 @@ extern "C" {
 GGML_BACKEND_API ggml_backend_t ggml_backend_rpc_init(const char * endpoint);
 GGML_BACKEND_API bool ggml_backend_is_rpc(ggml_backend_t backend);
 
+// load the data of a tensor in an RPC buffer from a file on the server host (e.g. a GGUF file on a shared filesystem)
+// instead of uploading it; the server must be started with GGML_RPC_FILE_ROOT set to a directory containing the file
+// if data is not NULL, it must be the expected content, and is used to verify the checksum of the data read by the server
+// returns false if the server could not read the file or the checksum does not match; the data must then be uploaded
+GGML_BACKEND_API bool ggml_backend_rpc_tensor_set_from_file(struct ggml_tensor * tensor, const char * path, size_t file_offset, size_t offset, size_t size, const void * data);
+
+// the uploads of the tensors of weight buffers (GGML_BACKEND_BUFFER_USAGE_WEIGHTS) are always compressed losslessly
+
+// convert F32 activations transferred to and from this backend to a smaller type on the wire:
+// GGML_TYPE_F16, GGML_TYPE_BF16 or GGML_TYPE_Q8_0 (lossy), GGML_TYPE_F32 disables it
+// this applies to the async set/get functions and to the copies made by ggml_backend_sched, including the copies
+// sent directly from another RPC server, of the tensors selected with ggml_backend_rpc_set_tensor_transfer
+// weights are never converted, and data that the type cannot represent (e.g. -INF in a mask) is sent unconverted
+GGML_BACKEND_API void ggml_backend_rpc_set_transfer_type(ggml_backend_t backend, enum ggml_type type);
+
+// select the tensors named name for conversion, a copy of a tensor is selected by the name of either tensor
+// (e.g. the name of the output of the last layer of a split, which ggml_backend_sched copies to this backend)
+// the selection applies to every graph built afterwards, name = NULL selects all the tensors
+GGML_BACKEND_API void ggml_backend_rpc_set_tensor_transfer(ggml_backend_t backend, const char * name, bool convert);
+
 GGML_BACKEND_API ggml_backend_buffer_type_t ggml_backend_rpc_buffer_type(const char * endpoint);
 
 GGML_BACKEND_API void ggml_backend_rpc_get_device_memory(const char * endpoint, size_t * free, size_t * total);
@@ -480,6 +480,7 @@ extern "C" {
         GGML_OP_CONV_TRANSPOSE_1D,
         GGML_OP_IM2COL,
         GGML_OP_IM2COL_BACK,
+        GGML_OP_CONV_2D,
         GGML_OP_CONV_TRANSPOSE_2D,
         GGML_OP_POOL_1D,
         GGML_OP_POOL_2D,
@@ -520,6 +521,8 @@ extern "C" {
         GGML_OP_CROSS_ENTROPY_LOSS_BACK,
         GGML_OP_OPT_STEP_ADAMW,
 
+        GGML_OP_SAMPLE_TOP_P,
+
         GGML_OP_COUNT,
     };
 
@@ -1625,6 +1628,21 @@ extern "C" {
             int                   d0,  // dilation dimension 0
             int                   d1); // dilation dimension 1
 
+    // convolution without an intermediate im2col buffer
+    // a:   [OC, IC, KH, KW]
+    // b:   [N,  IC, IH, IW]
+    // res: [N,  OC, OH, OW] (F32)
+    GGML_API struct ggml_tensor * ggml_conv_2d_direct(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,   // convolution kernel
+            struct ggml_tensor  * b,   // data
+            int                   s0,  // stride dimension 0
+            int                   s1,  // stride dimension 1
+            int                   p0,  // padding dimension 0
+            int                   p1,  // padding dimension 1
+            int                   d0,  // dilation dimension 0
+            int                   d1); // dilation dimension 1
+
     // kernel size is a->ne[0] x a->ne[1]
     // stride is equal to kernel size
     // padding is zero
@@ -1775,6 +1793,19 @@ extern "C" {
             struct ggml_tensor  * a,
             int                   k);
 
+    // draw one element per row of ids, given the probabilities a of the elements sorted in descending order (e.g. softmax of the top k)
+    // only the smallest prefix of the row with a cumulative probability >= p is kept (top-p / nucleus sampling)
+    // a:      [k, n, ...] F32
+    // ids:    [k, n, ...] I32
+    // u:      [n, ...]    F32, uniform random numbers in [0, 1)
+    // result: [1, n, ...] I32
+    GGML_API struct ggml_tensor * ggml_sample_top_p(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * ids,
+            struct ggml_tensor  * u,
+            float                 p);
+
 #define GGML_KQ_MASK_PAD 64
 
     // q:    [n_embd, n_batch,     n_head,    1]
@@ -2040,6 +2071,7 @@ extern "C" {
     // AdamW optimizer step
     // Paper: https://arxiv.org/pdf/1711.05101v3.pdf
     // PyTorch: https://pytorch.org/docs/stable/generated/torch.optim.AdamW.html
+    // the first moment m can be stored as F32 or BF16, the second moment v must be F32
     GGML_API struct ggml_tensor * ggml_opt_step_adamw(
             struct ggml_context * ctx,
             struct ggml_tensor  * a,
@@ -2128,6 +2160,27 @@ extern "C" {
                    int64_t   n_per_row,
                const float * imatrix);
 
+    // called by ggml_quantize_chunk_mt after each chunk with the number of rows quantized so far
+    // calls are serialized, but can come from any of the worker threads
+    // return false to cancel the quantization
+    typedef bool (*ggml_quantize_progress_callback)(int64_t rows_done, int64_t nrows, void * user_data);
+
+    // same as ggml_quantize_chunk, with the rows split in chunks that are quantized by n_threads threads
+    // the number of bytes written is stored in size
+    // returns false if the quantization was cancelled by progress_cb, size is then 0 and dst is partially written
+    GGML_API bool ggml_quantize_chunk_mt(
+            enum ggml_type   type,
+               const float * src,
+                      void * dst,
+                   int64_t   start,
+                   int64_t   nrows,
+                   int64_t   n_per_row,
+               const float * imatrix,
+                       int   n_threads,
+            ggml_quantize_progress_callback progress_cb,
+                      void * progress_cb_user_data,
+                    size_t * size);
+
 #ifdef __cplusplus
     // restrict not standard in C++
 #    if defined(__GNUC__)
@@ -15,8 +15,11 @@
 #include <cfloat>
 #include <cstdlib> // for qsort
 #include <cstdio>  // for GGML_ASSERT
+#include <mutex>
+#include <unordered_map>
 
 #include "ggml-cpu-aarch64.h"
+#include "ggml-cpu-repack-cache.h"
 
 // TODO: move to include file?
 template <int K> constexpr int QK_0() {
@@ -52,6 +55,27 @@ struct block_iq4_nlx4 {
 
 static_assert(sizeof(block_iq4_nlx4) == 4 * sizeof(ggml_half) + QK4_NL * 2, "wrong iq4_nlx4 block size/padding");
 
+// K-quant and Q8_0 blocks of 8 rows, the quants of the rows are interleaved in blocks of 4 bytes
+// so that a single 256 bit vector holds 4 consecutive quants of each of the 8 rows
+struct block_q4_Kx8 {
+    ggml_half d[8];                     // super-block scales of the 8 rows
+    ggml_half dmin[8];                  // super-block mins of the 8 rows
+    uint8_t   scales[8 * K_SCALE_SIZE]; // 6-bit scales and mins of each row, same encoding as block_q4_K
+    uint8_t   qs[QK_K * 4];             // 4-bit quants, interleaved in blocks of 4 bytes
+};
+
+static_assert(sizeof(block_q4_Kx8) == 8 * sizeof(block_q4_K), "wrong q4_Kx8 block size/padding");
+
+struct block_q6_Kx8 {
+    ggml_half d[8];                 // super-block scales of the 8 rows
+    int8_t    scales[QK_K / 16 * 8]; // 8-bit scales, [sub-block][row]
+    uint8_t   ql[QK_K * 4];         // lower 4 bits of the quants, interleaved in blocks of 4 bytes
+    uint8_t   qh[QK_K * 2];         // upper 2 bits of the quants, interleaved in blocks of 4 bytes
+};
+
+static_assert(sizeof(block_q6_Kx8) == 8 * sizeof(block_q6_K), "wrong q6_Kx8 block size/padding");
+static_assert(sizeof(block_q8_0x8) == 8 * sizeof(block_q8_0), "wrong q8_0x8 block size/padding");
+
 #if defined(__GNUC__)
 #pragma GCC diagnostic ignored "-Woverlength-strings"
 #elif defined(_MSC_VER)
@@ -3591,6 +3615,385 @@ static void ggml_gemm_iq4_nl_4x4_q8_0(int n, float * GGML_RESTRICT s, size_t bs,
     }
 }
 
+static inline void get_scale_min_k4(int j, const uint8_t * GGML_RESTRICT q, uint8_t * GGML_RESTRICT d, uint8_t * GGML_RESTRICT m) {
+    if (j < 4) {
+        *d = q[j] & 63; *m = q[j + 4] & 63;
+    } else {
+        *d = (q[j+4] & 0xF) | ((q[j-4] >> 6) << 4);
+        *m = (q[j+4] >>  4) | ((q[j-0] >> 6) << 4);
+    }
+}
+
+// Kernels for the K-quant and Q8_0 blocks of 8 interleaved rows
+//
+// The quants of the 8 rows are interleaved in blocks of 4 bytes: 32 bytes contain 4 consecutive quants of each row.
+// src1 is quantized row by row to the vec_dot_type of src0 (block_q8_K or block_q8_0), the 4 activations that belong
+// to a block of quants are broadcast to all 8 rows so that one 8x32 bit accumulator holds the dot products of all rows.
+// The gemm kernels process 4 rows of src1 at once to reuse the unpacked quants of src0.
+
+static void ggml_mul_mat_q4_K_8x4_q8_K_generic(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int nb = n / QK_K;
+    const int ncols_interleaved = 8;
+    const int blocklen = 4;
+
+    for (int y = 0; y < nr; y++) {
+        const block_q8_K * a_ptr = (const block_q8_K *) vy + y * nb;
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q4_Kx8 * b_ptr = (const block_q4_Kx8 *) vx + x * nb;
+
+            float sumf[8];
+            for (int j = 0; j < ncols_interleaved; j++) sumf[j] = 0.0f;
+            for (int l = 0; l < nb; l++) {
+                for (int j = 0; j < ncols_interleaved; j++) {
+                    uint8_t sc[8];
+                    uint8_t mn[8];
+                    for (int is = 0; is < 8; is++) {
+                        get_scale_min_k4(is, b_ptr[l].scales + j * K_SCALE_SIZE, &sc[is], &mn[is]);
+                    }
+
+                    int sumi = 0;
+                    for (int k = 0; k < QK_K / (2 * blocklen); k++) {
+                        // the low nibbles belong to sub-block 2*(k/8), the high nibbles to the following one
+                        const int k0 = (k / 8) * 64 + (k % 8) * blocklen;
+                        for (int i = 0; i < blocklen; ++i) {
+                            const uint8_t q = b_ptr[l].qs[k * ncols_interleaved * blocklen + j * blocklen + i];
+                            sumi += (q & 0xF) * sc[k0 / 32 + 0] * a_ptr[l].qs[k0 + i];
+                            sumi += (q >>  4) * sc[k0 / 32 + 1] * a_ptr[l].qs[k0 + i + 32];
+                        }
+                    }
+                    int summ = 0;
+                    for (int is = 0; is < 8; is++) {
+                        summ += mn[is] * (a_ptr[l].bsums[2 * is] + a_ptr[l].bsums[2 * is + 1]);
+                    }
+                    sumf[j] += a_ptr[l].d * (GGML_FP16_TO_FP32(b_ptr[l].d[j]) * sumi - GGML_FP16_TO_FP32(b_ptr[l].dmin[j]) * summ);
+                }
+            }
+            for (int j = 0; j < ncols_interleaved; j++) s[y * bs + x * ncols_interleaved + j] = sumf[j];
+        }
+    }
+}
+
+static void ggml_mul_mat_q6_K_8x4_q8_K_generic(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int nb = n / QK_K;
+    const int ncols_interleaved = 8;
+    const int blocklen = 4;
+
+    for (int y = 0; y < nr; y++) {
+        const block_q8_K * a_ptr = (const block_q8_K *) vy + y * nb;
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q6_Kx8 * b_ptr = (const block_q6_Kx8 *) vx + x * nb;
+
+            float sumf[8];
+            for (int j = 0; j < ncols_interleaved; j++) sumf[j] = 0.0f;
+            for (int l = 0; l < nb; l++) {
+                for (int j = 0; j < ncols_interleaved; j++) {
+                    int sumi = 0;
+                    for (int k = 0; k < QK_K / (2 * blocklen); k++) {
+                        // same order as block_q6_K: the high nibbles of ql are 64 quants after the low nibbles,
+                        // each byte of qh contains the upper bits of 4 quants that are 32 apart
+                        const int k0 = (k / 16) * 128 + (k % 16) * blocklen;
+                        const int kh = (k / 16) * 8 + (k % 8);
+                        const int shift = (k % 16) < 8 ? 0 : 2;
+                        for (int i = 0; i < blocklen; ++i) {
+                            const uint8_t ql = b_ptr[l].ql[k  * ncols_interleaved * blocklen + j * blocklen + i];
+                            const uint8_t qh = b_ptr[l].qh[kh * ncols_interleaved * blocklen + j * blocklen + i];
+                            const int q0 = ((ql & 0xF) | (((qh >> (shift + 0)) & 3) << 4)) - 32;
+                            const int q1 = ((ql >>  4) | (((qh >> (shift + 4)) & 3) << 4)) - 32;
+                            sumi += q0 * b_ptr[l].scales[((k0 +  0) / 16) * ncols_interleaved + j] * a_ptr[l].qs[k0 + i];
+                            sumi += q1 * b_ptr[l].scales[((k0 + 64) / 16) * ncols_interleaved + j] * a_ptr[l].qs[k0 + i + 64];
+                        }
+                    }
+                    sumf[j] += a_ptr[l].d * GGML_FP16_TO_FP32(b_ptr[l].d[j]) * sumi;
+                }
+            }
+            for (int j = 0; j < ncols_interleaved; j++) s[y * bs + x * ncols_interleaved + j] = sumf[j];
+        }
+    }
+}
+
+static void ggml_mul_mat_q8_0_8x4_q8_0_generic(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 4;
+
+    for (int y = 0; y < nr; y++) {
+        const block_q8_0 * a_ptr = (const block_q8_0 *) vy + y * nb;
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q8_0x8 * b_ptr = (const block_q8_0x8 *) vx + x * nb;
+
+            float sumf[8];
+            for (int j = 0; j < ncols_interleaved; j++) sumf[j] = 0.0f;
+            for (int l = 0; l < nb; l++) {
+                for (int j = 0; j < ncols_interleaved; j++) {
+                    int sumi = 0;
+                    for (int k = 0; k < qk / blocklen; k++) {
+                        for (int i = 0; i < blocklen; ++i) {
+                            sumi += b_ptr[l].qs[k * ncols_interleaved * blocklen + j * blocklen + i] * a_ptr[l].qs[k * blocklen + i];
+                        }
+                    }
+                    sumf[j] += sumi * GGML_FP16_TO_FP32(b_ptr[l].d[j]) * GGML_FP16_TO_FP32(a_ptr[l].d);
+                }
+            }
+            for (int j = 0; j < ncols_interleaved; j++) s[y * bs + x * ncols_interleaved + j] = sumf[j];
+        }
+    }
+}
+
+#if defined(__AVX2__)
+// broadcast 4 int8 activations to all 8 rows
+static inline __m256i ggml_broadcast_i8x4(const int8_t * x) {
+    int32_t v;
+    memcpy(&v, x, sizeof(v));
+    return _mm256_set1_epi32(v);
+}
+
+template <int NROWS>
+static void ggml_mul_mat_q4_K_8x4_q8_K_avx2(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nc) {
+    const int nb = n / QK_K;
+    const __m256i m4 = _mm256_set1_epi8(0x0F);
+
+    for (int x = 0; x < nc / 8; x++) {
+        const block_q4_Kx8 * b_ptr = (const block_q4_Kx8 *) vx + x * nb;
+
+        __m256 acc[NROWS];
+        for (int r = 0; r < NROWS; r++) acc[r] = _mm256_setzero_ps();
+
+        for (int l = 0; l < nb; l++) {
+            // 6-bit scales and mins as [sub-block][row]
+            uint8_t sc[8][8];
+            uint8_t mn[8][8];
+            for (int j = 0; j < 8; j++) {
+                for (int is = 0; is < 8; is++) {
+                    get_scale_min_k4(is, b_ptr[l].scales + j * K_SCALE_SIZE, &sc[is][j], &mn[is][j]);
+                }
+            }
+
+            __m256i isum[NROWS];
+            for (int r = 0; r < NROWS; r++) isum[r] = _mm256_setzero_si256();
+
+            for (int p = 0; p < 4; p++) {
+                __m256i acc_lo[NROWS];
+                __m256i acc_hi[NROWS];
+                for (int r = 0; r < NROWS; r++) {
+                    acc_lo[r] = _mm256_setzero_si256();
+                    acc_hi[r] = _mm256_setzero_si256();
+                }
+                for (int t = 0; t < 8; t++) {
+                    const __m256i q    = _mm256_loadu_si256((const __m256i *) (b_ptr[l].qs + (p * 8 + t) * 32));
+                    const __m256i q_lo = _mm256_and_si256(q, m4);
+                    const __m256i q_hi = _mm256_and_si256(_mm256_srli_epi16(q, 4), m4);
+                    for (int r = 0; r < NROWS; r++) {
+                        const int8_t * a = ((const block_q8_K *) vy + r * nb + l)->qs + p * 64 + t * 4;
+                        acc_lo[r] = _mm256_add_epi32(acc_lo[r], mul_sum_us8_pairs_int32x8(q_lo, ggml_broadcast_i8x4(a)));
+                        acc_hi[r] = _mm256_add_epi32(acc_hi[r], mul_sum_us8_pairs_int32x8(q_hi, ggml_broadcast_i8x4(a + 32)));
+                    }
+                }
+                const __m256i sc_lo = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) sc[2 * p + 0]));
+                const __m256i sc_hi = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) sc[2 * p + 1]));
+                for (int r = 0; r < NROWS; r++) {
+                    isum[r] = _mm256_add_epi32(isum[r], _mm256_mullo_epi32(acc_lo[r], sc_lo));
+                    isum[r] = _mm256_add_epi32(isum[r], _mm256_mullo_epi32(acc_hi[r], sc_hi));
+                }
+            }
+
+            const __m256 d    = GGML_F32Cx8_LOAD(b_ptr[l].d);
+            const __m256 dmin = GGML_F32Cx8_LOAD(b_ptr[l].dmin);
+            for (int r = 0; r < NROWS; r++) {
+                const block_q8_K * a = (const block_q8_K *) vy + r * nb + l;
+
+                __m256i msum = _mm256_setzero_si256();
+                for (int is = 0; is < 8; is++) {
+                    const __m256i mins = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) mn[is]));
+                    msum = _mm256_add_epi32(msum, _mm256_mullo_epi32(mins, _mm256_set1_epi32(a->bsums[2 * is] + a->bsums[2 * is + 1])));
+                }
+                const __m256 v = _mm256_sub_ps(_mm256_mul_ps(d, _mm256_cvtepi32_ps(isum[r])), _mm256_mul_ps(dmin, _mm256_cvtepi32_ps(msum)));
+                acc[r] = _mm256_fmadd_ps(_mm256_set1_ps(a->d), v, acc[r]);
+            }
+        }
+        for (int r = 0; r < NROWS; r++) _mm256_storeu_ps(s + r * bs + x * 8, acc[r]);
+    }
+}
+
+template <int NROWS>
+static void ggml_mul_mat_q6_K_8x4_q8_K_avx2(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nc) {
+    const int nb = n / QK_K;
+    const __m256i m4 = _mm256_set1_epi8(0x0F);
+    const __m256i m2 = _mm256_set1_epi8(0x03);
+
+    for (int x = 0; x < nc / 8; x++) {
+        const block_q6_Kx8 * b_ptr = (const block_q6_Kx8 *) vx + x * nb;
+
+        __m256 acc[NROWS];
+        for (int r = 0; r < NROWS; r++) acc[r] = _mm256_setzero_ps();
+
+        for (int l = 0; l < nb; l++) {
+            __m256i isum[NROWS];
+            for (int r = 0; r < NROWS; r++) isum[r] = _mm256_setzero_si256();
+
+            for (int h = 0; h < 2; h++) {
+                for (int g = 0; g < 4; g++) {
+                    // the quants of sub-blocks 8*h + g (low nibbles) and 8*h + g + 4 (high nibbles)
+                    const __m128i shift = _mm_cvtsi32_si128(g < 2 ? 0 : 2);
+
+                    __m256i acc_lo[NROWS];
+                    __m256i acc_hi[NROWS];
+                    for (int r = 0; r < NROWS; r++) {
+                        acc_lo[r] = _mm256_setzero_si256();
+                        acc_hi[r] = _mm256_setzero_si256();
+                    }
+                    for (int u = 4 * g; u < 4 * g + 4; u++) {
+                        const __m256i ql = _mm256_loadu_si256((const __m256i *) (b_ptr[l].ql + (16 * h + u) * 32));
+                        const __m256i qh = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i *) (b_ptr[l].qh + (8 * h + u % 8) * 32)), shift);
+
+                        const __m256i q_lo = _mm256_or_si256(_mm256_and_si256(ql, m4),
+                            _mm256_slli_epi16(_mm256_and_si256(qh, m2), 4));
+                        const __m256i q_hi = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql, 4), m4),
+                            _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 4), m2), 4));
+                        for (int r = 0; r < NROWS; r++) {
+                            const int8_t * a = ((const block_q8_K *) vy + r * nb + l)->qs + h * 128 + u * 4;
+                            acc_lo[r] = _mm256_add_epi32(acc_lo[r], mul_sum_us8_pairs_int32x8(q_lo, ggml_broadcast_i8x4(a)));
+                            acc_hi[r] = _mm256_add_epi32(acc_hi[r], mul_sum_us8_pairs_int32x8(q_hi, ggml_broadcast_i8x4(a + 64)));
+                        }
+                    }
+                    const __m256i sc_lo = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *) (b_ptr[l].scales + (8 * h + g + 0) * 8)));
+                    const __m256i sc_hi = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *) (b_ptr[l].scales + (8 * h + g + 4) * 8)));
+                    for (int r = 0; r < NROWS; r++) {
+                        isum[r] = _mm256_add_epi32(isum[r], _mm256_mullo_epi32(acc_lo[r], sc_lo));
+                        isum[r] = _mm256_add_epi32(isum[r], _mm256_mullo_epi32(acc_hi[r], sc_hi));
+                    }
+                }
+            }
+
+            const __m256 d = GGML_F32Cx8_LOAD(b_ptr[l].d);
+            for (int r = 0; r < NROWS; r++) {
+                const block_q8_K * a = (const block_q8_K *) vy + r * nb + l;
+
+                // the quants were used without their offset of 32
+                __m256i osum = _mm256_setzero_si256();
+                for (int is = 0; is < QK_K / 16; is++) {
+                    const __m256i scales = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *) (b_ptr[l].scales + is * 8)));
+                    osum = _mm256_add_epi32(osum, _mm256_mullo_epi32(scales, _mm256_set1_epi32(a->bsums[is])));
+                }
+                const __m256i sumi = _mm256_sub_epi32(isum[r], _mm256_slli_epi32(osum, 5));
+                acc[r] = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_set1_ps(a->d), d), _mm256_cvtepi32_ps(sumi), acc[r]);
+            }
+        }
+        for (int r = 0; r < NROWS; r++) _mm256_storeu_ps(s + r * bs + x * 8, acc[r]);
+    }
+}
+
+template <int NROWS>
+static void ggml_mul_mat_q8_0_8x4_q8_0_avx2(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nc) {
+    const int nb = n / QK8_0;
+
+    for (int x = 0; x < nc / 8; x++) {
+        const block_q8_0x8 * b_ptr = (const block_q8_0x8 *) vx + x * nb;
+
+        __m256 acc[NROWS];
+        for (int r = 0; r < NROWS; r++) acc[r] = _mm256_setzero_ps();
+
+        for (int l = 0; l < nb; l++) {
+            __m256i sumi[NROWS];
+            for (int r = 0; r < NROWS; r++) sumi[r] = _mm256_setzero_si256();
+
+            for (int k = 0; k < QK8_0 / 4; k++) {
+                const __m256i q = _mm256_loadu_si256((const __m256i *) (b_ptr[l].qs + k * 32));
+                for (int r = 0; r < NROWS; r++) {
+                    const int8_t * a = ((const block_q8_0 *) vy + r * nb + l)->qs + k * 4;
+                    sumi[r] = _mm256_add_epi32(sumi[r], mul_sum_i8_pairs_int32x8(q, ggml_broadcast_i8x4(a)));
+                }
+            }
+
+            const __m256 d = GGML_F32Cx8_LOAD(b_ptr[l].d);
+            for (int r = 0; r < NROWS; r++) {
+                const float da = GGML_FP16_TO_FP32(((const block_q8_0 *) vy + r * nb + l)->d);
+                acc[r] = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_set1_ps(da), d), _mm256_cvtepi32_ps(sumi[r]), acc[r]);
+            }
+        }
+        for (int r = 0; r < NROWS; r++) _mm256_storeu_ps(s + r * bs + x * 8, acc[r]);
+    }
+}
+#endif // #if defined(__AVX2__)
+
+static void ggml_gemv_q4_K_8x4_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    assert (n % QK_K == 0);
+    assert (nc % 8 == 0);
+    UNUSED(nr);
+
+#if defined(__AVX2__)
+    ggml_mul_mat_q4_K_8x4_q8_K_avx2<1>(n, s, bs, vx, vy, nc);
+#else
+    ggml_mul_mat_q4_K_8x4_q8_K_generic(n, s, bs, vx, vy, 1, nc);
+#endif
+}
+
+static void ggml_gemv_q6_K_8x4_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    assert (n % QK_K == 0);
+    assert (nc % 8 == 0);
+    UNUSED(nr);
+
+#if defined(__AVX2__)
+    ggml_mul_mat_q6_K_8x4_q8_K_avx2<1>(n, s, bs, vx, vy, nc);
+#else
+    ggml_mul_mat_q6_K_8x4_q8_K_generic(n, s, bs, vx, vy, 1, nc);
+#endif
+}
+
+static void ggml_gemv_q8_0_8x4_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    assert (n % QK8_0 == 0);
+    assert (nc % 8 == 0);
+    UNUSED(nr);
+
+#if defined(__AVX2__)
+    ggml_mul_mat_q8_0_8x4_q8_0_avx2<1>(n, s, bs, vx, vy, nc);
+#else
+    ggml_mul_mat_q8_0_8x4_q8_0_generic(n, s, bs, vx, vy, 1, nc);
+#endif
+}
+
+static void ggml_gemm_q4_K_8x4_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    assert (n % QK_K == 0);
+    assert (nr % 4 == 0);
+    assert (nc % 8 == 0);
+
+#if defined(__AVX2__)
+    for (int y = 0; y < nr; y += 4) {
+        ggml_mul_mat_q4_K_8x4_q8_K_avx2<4>(n, s + y * bs, bs, vx, (const block_q8_K *) vy + y * (n / QK_K), nc);
+    }
+#else
+    ggml_mul_mat_q4_K_8x4_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+static void ggml_gemm_q6_K_8x4_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    assert (n % QK_K == 0);
+    assert (nr % 4 == 0);
+    assert (nc % 8 == 0);
+
+#if defined(__AVX2__)
+    for (int y = 0; y < nr; y += 4) {
+        ggml_mul_mat_q6_K_8x4_q8_K_avx2<4>(n, s + y * bs, bs, vx, (const block_q8_K *) vy + y * (n / QK_K), nc);
+    }
+#else
+    ggml_mul_mat_q6_K_8x4_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+static void ggml_gemm_q8_0_8x4_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    assert (n % QK8_0 == 0);
+    assert (nr % 4 == 0);
+    assert (nc % 8 == 0);
+
+#if defined(__AVX2__)
+    for (int y = 0; y < nr; y += 4) {
+        ggml_mul_mat_q8_0_8x4_q8_0_avx2<4>(n, s + y * bs, bs, vx, (const block_q8_0 *) vy + y * (n / QK8_0), nc);
+    }
+#else
+    ggml_mul_mat_q8_0_8x4_q8_0_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
 static block_q4_0x4 make_block_q4_0x4(block_q4_0 * in, unsigned int blck_size_interleave) {
     block_q4_0x4 out;
 
@@ -3789,6 +4192,93 @@ static int repack_iq4_nl_to_iq4_nl_4_bl(struct ggml_tensor * t, int interleave_b
     GGML_UNUSED(data_size);
 }
 
+// interleave the quants of 8 rows in blocks of 4 bytes, src_size bytes per row
+static void interleave_8x4(uint8_t * GGML_RESTRICT dst, const uint8_t * const * src, int src_size) {
+    for (int i = 0; i < src_size / 4; ++i) {
+        for (int j = 0; j < 8; ++j) {
+            memcpy(dst + (i * 8 + j) * 4, src[j] + i * 4, 4);
+        }
+    }
+}
+
+static block_q4_Kx8 make_block_q4_Kx8(const block_q4_K * in) {
+    block_q4_Kx8 out;
+
+    const uint8_t * qs[8];
+    for (int i = 0; i < 8; i++) {
+        out.d[i]    = in[i].GGML_COMMON_AGGR_U.GGML_COMMON_AGGR_S.d;
+        out.dmin[i] = in[i].GGML_COMMON_AGGR_U.GGML_COMMON_AGGR_S.dmin;
+        memcpy(out.scales + i * K_SCALE_SIZE, in[i].scales, K_SCALE_SIZE);
+        qs[i] = in[i].qs;
+    }
+    interleave_8x4(out.qs, qs, QK_K / 2);
+
+    return out;
+}
+
+static block_q6_Kx8 make_block_q6_Kx8(const block_q6_K * in) {
+    block_q6_Kx8 out;
+
+    const uint8_t * ql[8];
+    const uint8_t * qh[8];
+    for (int i = 0; i < 8; i++) {
+        out.d[i] = in[i].d;
+        for (int is = 0; is < QK_K / 16; is++) {
+            out.scales[is * 8 + i] = in[i].scales[is];
+        }
+        ql[i] = in[i].ql;
+        qh[i] = in[i].qh;
+    }
+    interleave_8x4(out.ql, ql, QK_K / 2);
+    interleave_8x4(out.qh, qh, QK_K / 4);
+
+    return out;
+}
+
+static block_q8_0x8 make_block_q8_0x8(const block_q8_0 * in) {
+    block_q8_0x8 out;
+
+    const uint8_t * qs[8];
+    for (int i = 0; i < 8; i++) {
+        out.d[i] = in[i].d;
+        qs[i] = (const uint8_t *) in[i].qs;
+    }
+    interleave_8x4((uint8_t *) out.qs, qs, QK8_0);
+
+    return out;
+}
+
+// repack the blocks of 8 consecutive rows into BLOCK_X8 blocks
+template <typename BLOCK, typename BLOCK_X8, BLOCK_X8 (*MAKE_BLOCK)(const BLOCK *)>
+static int repack_8_rows(struct ggml_tensor * t, const void * GGML_RESTRICT data, size_t data_size) {
+    constexpr int nrows_interleaved = 8;
+
+    BLOCK_X8 * dst = (BLOCK_X8 *) t->data;
+    const BLOCK * src = (const BLOCK *) data;
+    BLOCK dst_tmp[8];
+    int nrow = ggml_nrows(t);
+    int nblocks = t->ne[0] / ggml_blck_size(t->type);
+
+    GGML_ASSERT(data_size == nrow * nblocks * sizeof(BLOCK));
+
+    if (t->ne[1] % nrows_interleaved != 0) {
+        return -1;
+    }
+
+    for (int b = 0; b < nrow; b += nrows_interleaved) {
+        for (int64_t x = 0; x < nblocks; x++) {
+            for (int i = 0; i < nrows_interleaved; i++) {
+                dst_tmp[i] = src[x + i * nblocks];
+            }
+            *dst++ = MAKE_BLOCK(dst_tmp);
+        }
+        src += nrows_interleaved * nblocks;
+    }
+    return 0;
+
+    GGML_UNUSED(data_size);
+}
+
 namespace ggml::cpu::aarch64 {
 // repack
 template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS>
@@ -3811,6 +4301,21 @@ template <> int repack<block_iq4_nl, 4, 4>(struct ggml_tensor * t, const void *
     return repack_iq4_nl_to_iq4_nl_4_bl(t, 4, data, data_size);
 }
 
+template <> int repack<block_q4_K, 4, 8>(struct ggml_tensor * t, const void * data, size_t data_size) {
+    GGML_ASSERT(t->type == GGML_TYPE_Q4_K);
+    return repack_8_rows<block_q4_K, block_q4_Kx8, make_block_q4_Kx8>(t, data, data_size);
+}
+
+template <> int repack<block_q6_K, 4, 8>(struct ggml_tensor * t, const void * data, size_t data_size) {
+    GGML_ASSERT(t->type == GGML_TYPE_Q6_K);
+    return repack_8_rows<block_q6_K, block_q6_Kx8, make_block_q6_Kx8>(t, data, data_size);
+}
+
+template <> int repack<block_q8_0, 4, 8>(struct ggml_tensor * t, const void * data, size_t data_size) {
+    GGML_ASSERT(t->type == GGML_TYPE_Q8_0);
+    return repack_8_rows<block_q8_0, block_q8_0x8, make_block_q8_0x8>(t, data, data_size);
+}
+
 // TODO: needs to be revisited
 //template <> int repack<block_iq4_nl, 8, 4>(struct ggml_tensor * t, const void * data, size_t data_size) {
 //    return repack_iq4_nl_to_iq4_nl_4_bl(t, 8, data, data_size);
@@ -3837,6 +4342,18 @@ void gemv<block_iq4_nl, 4, 4>(int n, float * s, size_t bs, const void * vx, cons
     ggml_gemv_iq4_nl_4x4_q8_0(n, s, bs, vx, vy, nr, nc);
 }
 
+template <> void gemv<block_q4_K, 4, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemv_q4_K_8x4_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemv<block_q6_K, 4, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemv_q6_K_8x4_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemv<block_q8_0, 4, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemv_q8_0_8x4_q8_0(n, s, bs, vx, vy, nr, nc);
+}
+
 // gemm
 template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS>
 void gemm(int, float *, size_t, const void *, const void *, int, int);
@@ -3858,6 +4375,25 @@ void gemm<block_iq4_nl, 4, 4>(int n, float * s, size_t bs, const void * vx, cons
     ggml_gemm_iq4_nl_4x4_q8_0(n, s, bs, vx, vy, nr, nc);
 }
 
+template <> void gemm<block_q4_K, 4, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemm_q4_K_8x4_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemm<block_q6_K, 4, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemm_q6_K_8x4_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemm<block_q8_0, 4, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemm_q8_0_8x4_q8_0(n, s, bs, vx, vy, nr, nc);
+}
+
+// whether gemm expects 4 rows of src1 quantized to Q8_0 and interleaved (block_q8_0x4),
+// otherwise the rows of src1 are quantized one by one to the vec_dot_type of src0
+template <typename BLOC_TYPE> constexpr bool interleaved_src1() { return true; }
+template <> constexpr bool interleaved_src1<block_q4_K>() { return false; }
+template <> constexpr bool interleaved_src1<block_q6_K>() { return false; }
+template <> constexpr bool interleaved_src1<block_q8_0>() { return false; }
+
 class tensor_traits_base : public ggml::cpu::tensor_traits {
   public:
     virtual int repack(struct ggml_tensor * t, const void * data, size_t data_size) = 0;
@@ -3867,12 +4403,13 @@ template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS> class tensor_
 
     bool work_size(int /* n_threads */, const struct ggml_tensor * op, size_t & size) override {
         // not realy a GGML_TYPE_Q8_0 but same size.
+        const ggml_type vec_dot_type = ggml_get_type_traits_cpu(op->src[0]->type)->vec_dot_type;
         switch (op->op) {
         case GGML_OP_MUL_MAT:
-            size = ggml_row_size(GGML_TYPE_Q8_0, ggml_nelements(op->src[1]));
+            size = ggml_row_size(vec_dot_type, ggml_nelements(op->src[1]));
             return true;
         case GGML_OP_MUL_MAT_ID:
-            size = ggml_row_size(GGML_TYPE_Q8_0, ggml_nelements(op->src[1]));
+            size = ggml_row_size(vec_dot_type, ggml_nelements(op->src[1]));
             size = GGML_PAD(size, sizeof(int64_t));  // + padding for next bloc.
             size += sizeof(int64_t) * (1+op->src[0]->ne[2]) * op->src[1]->ne[2];
             return true;
@@ -3924,19 +4461,23 @@ template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS> class tensor_
         GGML_ASSERT(ggml_n_dims(op->src[0]) == 2);
         // GGML_ASSERT(ggml_n_dims(op->src[1]) == 2);
 
+        const ggml_type vec_dot_type = ggml_get_type_traits_cpu(src0->type)->vec_dot_type;
+
         char *       wdata = static_cast<char *>(params->wdata);
-        const size_t nbw1  = ggml_row_size(GGML_TYPE_Q8_0, ne10);
+        const size_t nbw1  = ggml_row_size(vec_dot_type, ne10);
 
         assert(params->wsize >= nbw1 * ne11);
 
-        const ggml_from_float_t from_float = ggml_get_type_traits_cpu(GGML_TYPE_Q8_0)->from_float;
+        const ggml_from_float_t from_float = ggml_get_type_traits_cpu(vec_dot_type)->from_float;
 
         int64_t i11_processed = 0;
-        for (int64_t i11 = ith * 4; i11 < ne11 - ne11 % 4; i11 += nth * 4) {
-            quantize_mat_q8_0((float *) ((char *) src1->data + i11 * nb11), (void *) (wdata + i11 * nbw1), 4, ne10,
-                              INTER_SIZE);
+        if (interleaved_src1<BLOC_TYPE>()) {
+            for (int64_t i11 = ith * 4; i11 < ne11 - ne11 % 4; i11 += nth * 4) {
+                quantize_mat_q8_0((float *) ((char *) src1->data + i11 * nb11), (void *) (wdata + i11 * nbw1), 4, ne10,
+                                  INTER_SIZE);
+            }
+            i11_processed = ne11 - ne11 % 4;
         }
-        i11_processed = ne11 - ne11 % 4;
         for (int64_t i11 = i11_processed + ith; i11 < ne11; i11 += nth) {
             from_float((float *) ((char *) src1->data + i11 * nb11), (void *) (wdata + i11 * nbw1), ne10);
         }
@@ -3944,7 +4485,7 @@ template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS> class tensor_
         ggml_barrier(params->threadpool);
 
         const void * src1_wdata      = params->wdata;
-        const size_t src1_col_stride = ggml_row_size(GGML_TYPE_Q8_0, ne10);
+        const size_t src1_col_stride = nbw1;
         int64_t      src0_start      = (ith * ne01) / nth;
         int64_t      src0_end        = ((ith + 1) * ne01) / nth;
         src0_start = (src0_start % NB_COLS) ? src0_start + NB_COLS - (src0_start % NB_COLS) : src0_start;
@@ -3978,7 +4519,8 @@ template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS> class tensor_
         const int ith = params->ith;
         const int nth = params->nth;
 
-        const ggml_from_float_t from_float = ggml_get_type_traits_cpu(GGML_TYPE_Q8_0)->from_float;
+        const ggml_type         vec_dot_type = ggml_get_type_traits_cpu(src0->type)->vec_dot_type;
+        const ggml_from_float_t from_float   = ggml_get_type_traits_cpu(vec_dot_type)->from_float;
 
         // we don't support permuted src0 or src1
         GGML_ASSERT(nb00 == ggml_type_size(src0->type));
@@ -4000,7 +4542,7 @@ template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS> class tensor_
         const int n_ids = ids->ne[0]; // n_expert_used
         const int n_as  = ne02;       // n_expert
 
-        const size_t nbw1 = ggml_row_size(GGML_TYPE_Q8_0, ne10);
+        const size_t nbw1 = ggml_row_size(vec_dot_type, ne10);
         const size_t nbw2 = nbw1*ne11;
         const size_t nbw3 = nbw2*ne12;
 
@@ -4017,7 +4559,7 @@ template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS> class tensor_
         int64_t *                 matrix_row_counts = (int64_t *) (wdata_src1_end);                      // [n_as]
         struct mmid_row_mapping * matrix_rows = (struct mmid_row_mapping *) (matrix_row_counts + n_as);  // [n_as][ne12]
 
-        // src1: float32 => block_q8_0
+        // src1: float32 => vec_dot_type
         for (int64_t i12 = 0; i12 < ne12; ++i12) {
             for (int64_t i11 = ith; i11 < ne11; i11 += nth) {
                 from_float((float *)((char *) src1->data + i12 * nb12 + i11 * nb11),
@@ -4105,6 +4647,11 @@ static const tensor_traits<block_q4_0, 8, 8> q4_0_8x8_q8_0;
 // instance for IQ4
 static const tensor_traits<block_iq4_nl, 4, 4> iq4_nl_4x4_q8_0;
 
+// instances for K-quants and Q8
+static const tensor_traits<block_q4_K, 4, 8> q4_K_8x4_q8_K;
+static const tensor_traits<block_q6_K, 4, 8> q6_K_8x4_q8_K;
+static const tensor_traits<block_q8_0, 4, 8> q8_0_8x4_q8_0;
+
 }  // namespace ggml::cpu::aarch64
 
 static const ggml::cpu::tensor_traits * ggml_aarch64_get_optimal_repack_type(const struct ggml_tensor * cur) {
@@ -4130,6 +4677,24 @@ static const ggml::cpu::tensor_traits * ggml_aarch64_get_optimal_repack_type(con
                 return &ggml::cpu::aarch64::iq4_nl_4x4_q8_0;
             }
         }
+    } else if (cur->type == GGML_TYPE_Q4_K) {
+        if (ggml_cpu_has_avx2()) {
+            if (cur->ne[1] % 8 == 0) {
+                return &ggml::cpu::aarch64::q4_K_8x4_q8_K;
+            }
+        }
+    } else if (cur->type == GGML_TYPE_Q6_K) {
+        if (ggml_cpu_has_avx2()) {
+            if (cur->ne[1] % 8 == 0) {
+                return &ggml::cpu::aarch64::q6_K_8x4_q8_K;
+            }
+        }
+    } else if (cur->type == GGML_TYPE_Q8_0) {
+        if (ggml_cpu_has_avx2()) {
+            if (cur->ne[1] % 8 == 0) {
+                return &ggml::cpu::aarch64::q8_0_8x4_q8_0;
+            }
+        }
     }
 
     return nullptr;
@@ -4142,16 +4707,79 @@ static enum ggml_status ggml_backend_cpu_aarch64_buffer_init_tensor(ggml_backend
     return GGML_STATUS_SUCCESS;
 }
 
+// the tensors found in the repack cache point to its read-only mapping instead of to the buffer
+// the buffer keeps the mapping alive, and points the tensors back to their memory before they are written again
+struct ggml_backend_cpu_aarch64_mapped_tensor {
+    void                      * data; // memory of the tensor in the buffer
+    std::shared_ptr<const void> ref;
+};
+
+struct ggml_backend_cpu_aarch64_buffer_context {
+    void * data;
+    std::mutex mutex;
+    std::unordered_map<const ggml_tensor *, ggml_backend_cpu_aarch64_mapped_tensor> mapped;
+};
+
+static void ggml_backend_cpu_aarch64_buffer_unmap_tensor(ggml_backend_cpu_aarch64_buffer_context * ctx, struct ggml_tensor * tensor) {
+    std::lock_guard<std::mutex> lock(ctx->mutex);
+    auto it = ctx->mapped.find(tensor);
+    if (it != ctx->mapped.end()) {
+        tensor->data = it->second.data;
+        ctx->mapped.erase(it);
+    }
+}
+
+static void ggml_backend_cpu_aarch64_buffer_free_buffer(ggml_backend_buffer_t buffer) {
+    auto * ctx = (ggml_backend_cpu_aarch64_buffer_context *) buffer->context;
+    ggml_aligned_free(ctx->data, buffer->size);
+    delete ctx;
+}
+
+static void * ggml_backend_cpu_aarch64_buffer_get_base(ggml_backend_buffer_t buffer) {
+    auto * ctx = (ggml_backend_cpu_aarch64_buffer_context *) buffer->context;
+    return (void *) GGML_PAD((uintptr_t) ctx->data, TENSOR_ALIGNMENT);
+}
+
+static void ggml_backend_cpu_aarch64_buffer_memset_tensor(ggml_backend_buffer_t buffer, struct ggml_tensor * tensor, uint8_t value, size_t offset, size_t size) {
+    ggml_backend_cpu_aarch64_buffer_unmap_tensor((ggml_backend_cpu_aarch64_buffer_context *) buffer->context, tensor);
+    memset((char *) tensor->data + offset, value, size);
+}
+
 static void ggml_backend_cpu_aarch64_buffer_set_tensor(ggml_backend_buffer_t buffer, struct ggml_tensor * tensor,
                                                        const void * data, size_t offset, size_t size) {
     GGML_ASSERT(offset == 0);
     GGML_ASSERT(size == ggml_nbytes(tensor));
 
+    auto * ctx = (ggml_backend_cpu_aarch64_buffer_context *) buffer->context;
+    ggml_backend_cpu_aarch64_buffer_unmap_tensor(ctx, tensor);
+
+    const uint64_t src_hash = ggml_cpu_repack_cache_hash(data, size);
+    std::shared_ptr<const void> ref;
+    if (const void * cached = ggml_cpu_repack_cache_find(tensor, src_hash, size, ref)) {
+        std::lock_guard<std::mutex> lock(ctx->mutex);
+        ctx->mapped[tensor] = { tensor->data, std::move(ref) };
+        tensor->data = const_cast<void *>(cached);
+        return;
+    }
+
     auto tensor_traits = (ggml::cpu::aarch64::tensor_traits_base *) tensor->extra;
     auto OK            = tensor_traits->repack(tensor, data, size);
 
     GGML_ASSERT(OK == 0);
-    GGML_UNUSED(buffer);
+
+    ggml_cpu_repack_cache_add(tensor, src_hash, tensor->data, size);
+}
+
+static void ggml_backend_cpu_aarch64_buffer_clear(ggml_backend_buffer_t buffer, uint8_t value) {
+    auto * ctx = (ggml_backend_cpu_aarch64_buffer_context *) buffer->context;
+    {
+        std::lock_guard<std::mutex> lock(ctx->mutex);
+        for (auto & it : ctx->mapped) {
+            const_cast<ggml_tensor *>(it.first)->data = it.second.data;
+        }
+        ctx->mapped.clear();
+    }
+    memset(ctx->data, value, buffer->size);
 }
 
 static const char * ggml_backend_cpu_aarch64_buffer_type_get_name(ggml_backend_buffer_type_t buft) {
@@ -4161,18 +4789,28 @@ static const char * ggml_backend_cpu_aarch64_buffer_type_get_name(ggml_backend_b
 }
 
 static ggml_backend_buffer_t ggml_backend_cpu_aarch64_buffer_type_alloc_buffer(ggml_backend_buffer_type_t buft, size_t size) {
-    ggml_backend_buffer_t buffer = ggml_backend_buft_alloc_buffer(ggml_backend_cpu_buffer_type(), size);
+    void * data = ggml_aligned_malloc(size);
 
-    if (buffer == nullptr) {
+    if (data == nullptr) {
+        GGML_LOG_ERROR("%s: failed to allocate buffer of size %zu\n", __func__, size);
         return nullptr;
     }
 
-    buffer->buft              = buft;
-    buffer->iface.init_tensor = ggml_backend_cpu_aarch64_buffer_init_tensor;
-    buffer->iface.set_tensor  = ggml_backend_cpu_aarch64_buffer_set_tensor;
-    buffer->iface.get_tensor  = nullptr;
-    buffer->iface.cpy_tensor  = nullptr;
-    return buffer;
+    static const struct ggml_backend_buffer_i ggml_backend_cpu_aarch64_buffer_i = {
+        /* .free_buffer     = */ ggml_backend_cpu_aarch64_buffer_free_buffer,
+        /* .get_base        = */ ggml_backend_cpu_aarch64_buffer_get_base,
+        /* .init_tensor     = */ ggml_backend_cpu_aarch64_buffer_init_tensor,
+        /* .memset_tensor   = */ ggml_backend_cpu_aarch64_buffer_memset_tensor,
+        /* .set_tensor      = */ ggml_backend_cpu_aarch64_buffer_set_tensor,
+        /* .get_tensor      = */ nullptr,
+        /* .cpy_tensor      = */ nullptr,
+        /* .clear           = */ ggml_backend_cpu_aarch64_buffer_clear,
+        /* .reset           = */ nullptr,
+    };
+
+    auto * ctx = new ggml_backend_cpu_aarch64_buffer_context;
+    ctx->data = data;
+    return ggml_backend_buffer_init(buft, ggml_backend_cpu_aarch64_buffer_i, ctx, size);
 }
 
 static size_t ggml_backend_cpu_aarch64_buffer_type_get_alignment(ggml_backend_buffer_type_t buft) {
@@ -0,0 +1,418 @@
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+#include "ggml-impl.h"
+
+#include "ggml-cpu-repack-cache.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+    #define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// repack cache
+//
+// the cache file is a header followed by a sequence of records, each one holding the repacked data of one tensor:
+//
+//   header | record | data | record | data | ...
+//
+// a cache is only used if its header matches the model key and the CPU features, otherwise it is rebuilt
+// the records are looked up by the tensor name, type and shape, and a hash of a sample of the original data
+// the sample catches a tensor replaced by different data, but not every small change, the model key must do that
+// on a hit the tensor points to the read-only mapping of the cache, so that processes loading the same model share
+// the repacked data in the page cache instead of each one holding a private copy of it
+// a new cache is written to a temporary file that is renamed to the final path when the cache is closed,
+// so that processes loading the same model concurrently never see a partially written cache
+
+#define GGML_REPACK_CACHE_MAGIC   "GGRC"
+// bump when the layout of any repacked type changes
+#define GGML_REPACK_CACHE_VERSION 3
+#define GGML_REPACK_CACHE_ALIGN   64
+
+struct ggml_repack_cache_header {
+    char     magic[4];
+    uint32_t version;
+    uint64_t model_key;
+    uint64_t features;
+    uint64_t pad[5];
+};
+
+struct ggml_repack_cache_record {
+    char     name[GGML_MAX_NAME];
+    int32_t  type;
+    uint32_t pad;
+    int64_t  ne[GGML_MAX_DIMS];
+    uint64_t src_hash;
+    uint64_t size;
+};
+
+static_assert(sizeof(ggml_repack_cache_header) % GGML_REPACK_CACHE_ALIGN == 0, "wrong repack cache header size");
+static_assert(sizeof(ggml_repack_cache_record) % 8 == 0, "wrong repack cache record size");
+
+struct ggml_repack_cache_entry {
+    const ggml_repack_cache_record * record;
+    const void * data;
+};
+
+// read-only mapping of a cache file, it stays mapped as long as the cache or a tensor loaded from it references it
+struct ggml_repack_cache_mapping {
+    void * addr = nullptr;
+    size_t size = 0;
+#if defined(_WIN32)
+    HANDLE hfile = INVALID_HANDLE_VALUE;
+    HANDLE hmap  = nullptr;
+#endif
+
+    bool map(const char * path);
+    ~ggml_repack_cache_mapping();
+};
+
+struct ggml_repack_cache {
+    std::string path;
+
+    // reading
+    std::shared_ptr<const ggml_repack_cache_mapping> mapping;
+    std::unordered_map<std::string, ggml_repack_cache_entry> entries;
+
+    // writing
+    FILE * file = nullptr;
+    std::string tmp_path;
+    size_t offset = 0;
+};
+
+// the cache can be opened and closed while other threads load tensors, all accesses are done with the lock held
+static std::mutex          g_repack_cache_mutex;
+static ggml_repack_cache * g_repack_cache = nullptr;
+
+// number of tensors loaded from the cache since it was last opened
+static std::atomic<size_t> g_repack_cache_n_hits{0};
+
+// the repacked layouts depend on the CPU features used to select them
+static uint64_t ggml_repack_cache_features(void) {
+    uint64_t features = 0;
+    features |= (uint64_t) (ggml_cpu_has_avx2()        != 0) << 0;
+    features |= (uint64_t) (ggml_cpu_has_avx512()      != 0) << 1;
+    features |= (uint64_t) (ggml_cpu_has_neon()        != 0) << 2;
+    features |= (uint64_t) (ggml_cpu_has_dotprod()     != 0) << 3;
+    features |= (uint64_t) (ggml_cpu_has_matmul_int8() != 0) << 4;
+    features |= (uint64_t) (ggml_cpu_has_sve()         != 0) << 5;
+    features |= (uint64_t) (ggml_cpu_has_riscv_v()     != 0) << 6;
+    features |= (uint64_t) ggml_cpu_get_sve_cnt()             << 32;
+    return features;
+}
+
+// hash of a sample of the original data: up to 4096 words spread evenly over it, plus the last one
+// reading all of the data would take about as long as repacking it
+static uint64_t ggml_repack_cache_src_hash(const void * data, size_t size) {
+    const uint8_t * p = (const uint8_t *) data;
+    uint64_t hash = 0xcbf29ce484222325ULL ^ size;
+    auto update = [&](uint64_t v) {
+        hash ^= v;
+        hash *= 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    };
+    if (size < sizeof(uint64_t)) {
+        for (size_t i = 0; i < size; ++i) {
+            update(p[i]);
+        }
+        return hash;
+    }
+    const size_t n_words = size/sizeof(uint64_t);
+    const size_t stride  = n_words > 4096 ? n_words/4096 : 1;
+    for (size_t i = 0; i < n_words; i += stride) {
+        uint64_t v;
+        memcpy(&v, p + i*sizeof(uint64_t), sizeof(v));
+        update(v);
+    }
+    uint64_t v;
+    memcpy(&v, p + size - sizeof(uint64_t), sizeof(v));
+    update(v);
+    return hash;
+}
+
+static std::string ggml_repack_cache_key(const char * name, size_t name_size, uint64_t src_hash) {
+    std::string key(name, strnlen(name, name_size));
+    key.append((const char *) &src_hash, sizeof(src_hash));
+    return key;
+}
+
+static bool ggml_repack_cache_record_matches(const ggml_repack_cache_record * record, const ggml_tensor * t, size_t size) {
+    if (record->type != (int32_t) t->type || record->size != size) {
+        return false;
+    }
+    for (int i = 0; i < GGML_MAX_DIMS; ++i) {
+        if (record->ne[i] != t->ne[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ggml_repack_cache_mapping::map(const char * path) {
+#if defined(_WIN32)
+    hfile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hfile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(hfile, &file_size) || file_size.QuadPart == 0) {
+        return false;
+    }
+    size = (size_t) file_size.QuadPart;
+    hmap = CreateFileMappingA(hfile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (hmap == nullptr) {
+        return false;
+    }
+    addr = MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
+    return addr != nullptr;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void * ptr = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+    addr = ptr;
+    size = (size_t) st.st_size;
+    return true;
+#endif
+}
+
+ggml_repack_cache_mapping::~ggml_repack_cache_mapping() {
+#if defined(_WIN32)
+    if (addr) {
+        UnmapViewOfFile(addr);
+    }
+    if (hmap) {
+        CloseHandle(hmap);
+    }
+    if (hfile != INVALID_HANDLE_VALUE) {
+        CloseHandle(hfile);
+    }
+#else
+    if (addr) {
+        munmap(addr, size);
+    }
+#endif
+}
+
+static void ggml_repack_cache_unmap(ggml_repack_cache * cache) {
+    cache->entries.clear();
+    cache->mapping.reset();
+}
+
+// maps an existing cache and indexes its records, returns false if there is no valid cache for this model and CPU
+static bool ggml_repack_cache_load(ggml_repack_cache * cache, uint64_t model_key) {
+    auto mapping = std::make_shared<ggml_repack_cache_mapping>();
+    if (!mapping->map(cache->path.c_str())) {
+        return false;
+    }
+    cache->mapping = mapping;
+
+    const uint8_t * base = (const uint8_t *) mapping->addr;
+    const size_t    size = mapping->size;
+    const ggml_repack_cache_header * header = (const ggml_repack_cache_header *) base;
+    if (size < sizeof(*header) ||
+        memcmp(header->magic, GGML_REPACK_CACHE_MAGIC, 4) != 0 ||
+        header->version   != GGML_REPACK_CACHE_VERSION ||
+        header->model_key != model_key ||
+        header->features  != ggml_repack_cache_features()) {
+        ggml_repack_cache_unmap(cache);
+        return false;
+    }
+
+    size_t offset = sizeof(*header);
+    while (offset + sizeof(ggml_repack_cache_record) <= size) {
+        const ggml_repack_cache_record * record = (const ggml_repack_cache_record *) (base + offset);
+        const size_t data_offset = GGML_PAD(offset + sizeof(*record), GGML_REPACK_CACHE_ALIGN);
+        if (record->size > size || data_offset + record->size > size) {
+            GGML_LOG_WARN("%s: %s is truncated, ignoring the records after offset %zu\n", __func__, cache->path.c_str(), offset);
+            break;
+        }
+        cache->entries[ggml_repack_cache_key(record->name, sizeof(record->name), record->src_hash)] = { record, base + data_offset };
+        offset = GGML_PAD(data_offset + record->size, GGML_REPACK_CACHE_ALIGN);
+    }
+
+    return true;
+}
+
+static bool ggml_repack_cache_create(ggml_repack_cache * cache, uint64_t model_key) {
+#if defined(_WIN32)
+    const unsigned long pid = GetCurrentProcessId();
+#else
+    const unsigned long pid = (unsigned long) getpid();
+#endif
+    cache->tmp_path = cache->path + ".tmp" + std::to_string(pid);
+    cache->file = fopen(cache->tmp_path.c_str(), "wb");
+    if (!cache->file) {
+        GGML_LOG_ERROR("%s: failed to create %s\n", __func__, cache->tmp_path.c_str());
+        return false;
+    }
+
+    ggml_repack_cache_header header = {};
+    memcpy(header.magic, GGML_REPACK_CACHE_MAGIC, 4);
+    header.version   = GGML_REPACK_CACHE_VERSION;
+    header.model_key = model_key;
+    header.features  = ggml_repack_cache_features();
+    if (fwrite(&header, sizeof(header), 1, cache->file) != 1) {
+        GGML_LOG_ERROR("%s: failed to write %s\n", __func__, cache->tmp_path.c_str());
+        fclose(cache->file);
+        cache->file = nullptr;
+        remove(cache->tmp_path.c_str());
+        return false;
+    }
+    cache->offset = sizeof(header);
+    return true;
+}
+
+static bool ggml_repack_cache_write_padding(ggml_repack_cache * cache) {
+    static const uint8_t zeros[GGML_REPACK_CACHE_ALIGN] = {0};
+    const size_t pad = GGML_PAD(cache->offset, GGML_REPACK_CACHE_ALIGN) - cache->offset;
+    if (pad > 0 && fwrite(zeros, 1, pad, cache->file) != pad) {
+        return false;
+    }
+    cache->offset += pad;
+    return true;
+}
+
+static void ggml_repack_cache_close(void) {
+    ggml_repack_cache * cache = g_repack_cache;
+    if (!cache) {
+        return;
+    }
+    g_repack_cache = nullptr;
+
+    ggml_repack_cache_unmap(cache);
+
+    if (cache->file) {
+        const bool ok = fclose(cache->file) == 0;
+        if (ok && rename(cache->tmp_path.c_str(), cache->path.c_str()) != 0) {
+            // rename does not replace an existing file on Windows
+            remove(cache->path.c_str());
+            if (rename(cache->tmp_path.c_str(), cache->path.c_str()) != 0) {
+                GGML_LOG_ERROR("%s: failed to rename %s to %s\n", __func__, cache->tmp_path.c_str(), cache->path.c_str());
+                remove(cache->tmp_path.c_str());
+            }
+        } else if (!ok) {
+            GGML_LOG_ERROR("%s: failed to write %s\n", __func__, cache->tmp_path.c_str());
+            remove(cache->tmp_path.c_str());
+        }
+    }
+
+    delete cache;
+}
+
+bool ggml_backend_cpu_repack_cache_open(const char * path, uint64_t model_key) {
+    std::lock_guard<std::mutex> lock(g_repack_cache_mutex);
+
+    ggml_repack_cache_close();
+
+    ggml_repack_cache * cache = new ggml_repack_cache;
+    cache->path = path;
+    g_repack_cache_n_hits = 0;
+
+    if (ggml_repack_cache_load(cache, model_key)) {
+        GGML_LOG_INFO("%s: using %zu repacked tensors from %s\n", __func__, cache->entries.size(), path);
+    } else if (ggml_repack_cache_create(cache, model_key)) {
+        GGML_LOG_INFO("%s: writing repacked tensors to %s\n", __func__, path);
+    } else {
+        delete cache;
+        return false;
+    }
+
+    g_repack_cache = cache;
+    return true;
+}
+
+void ggml_backend_cpu_repack_cache_close(void) {
+    std::lock_guard<std::mutex> lock(g_repack_cache_mutex);
+
+    ggml_repack_cache_close();
+}
+
+size_t ggml_backend_cpu_repack_cache_n_hits(void) {
+    return g_repack_cache_n_hits;
+}
+
+uint64_t ggml_cpu_repack_cache_hash(const void * src_data, size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(g_repack_cache_mutex);
+        if (!g_repack_cache) {
+            return 0;
+        }
+    }
+    return ggml_repack_cache_src_hash(src_data, size);
+}
+
+const void * ggml_cpu_repack_cache_find(const struct ggml_tensor * t, uint64_t src_hash, size_t size, std::shared_ptr<const void> & ref) {
+    std::lock_guard<std::mutex> lock(g_repack_cache_mutex);
+
+    ggml_repack_cache * cache = g_repack_cache;
+    if (!cache || !cache->mapping) {
+        return nullptr;
+    }
+
+    auto it = cache->entries.find(ggml_repack_cache_key(t->name, sizeof(t->name), src_hash));
+    if (it == cache->entries.end() || !ggml_repack_cache_record_matches(it->second.record, t, size)) {
+        return nullptr;
+    }
+    ref = cache->mapping;
+    g_repack_cache_n_hits++;
+    return it->second.data;
+}
+
+void ggml_cpu_repack_cache_add(const struct ggml_tensor * t, uint64_t src_hash, const void * data, size_t size) {
+    std::lock_guard<std::mutex> lock(g_repack_cache_mutex);
+
+    ggml_repack_cache * cache = g_repack_cache;
+    if (!cache || !cache->file) {
+        return;
+    }
+
+    ggml_repack_cache_record record = {};
+    memcpy(record.name, t->name, strnlen(t->name, sizeof(record.name) - 1));
+    record.type     = t->type;
+    for (int i = 0; i < GGML_MAX_DIMS; ++i) {
+        record.ne[i] = t->ne[i];
+    }
+    record.src_hash = src_hash;
+    record.size     = size;
+
+    bool ok = fwrite(&record, sizeof(record), 1, cache->file) == 1;
+    cache->offset += sizeof(record);
+    ok = ok && ggml_repack_cache_write_padding(cache);
+    ok = ok && fwrite(data, 1, size, cache->file) == size;
+    cache->offset += size;
+    ok = ok && ggml_repack_cache_write_padding(cache);
+
+    if (!ok) {
+        // drop the cache, the model itself is still loaded correctly
+        GGML_LOG_ERROR("%s: failed to write %s, disabling the repack cache\n", __func__, cache->tmp_path.c_str());
+        fclose(cache->file);
+        cache->file = nullptr;
+        remove(cache->tmp_path.c_str());
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "ggml.h"
+
+#include <memory>
+
+// GGML CPU internal header
+
+// hash of a sample of the original (not repacked) data of a tensor, used to look it up in the repack cache
+// returns 0 without reading the data if no cache is open
+uint64_t ggml_cpu_repack_cache_hash(const void * src_data, size_t size);
+
+// returns the repacked data of tensor t in the read-only mapping of the open repack cache, or NULL if it is not cached
+// ref is set to a reference that keeps the data mapped after the cache is closed
+const void * ggml_cpu_repack_cache_find(const struct ggml_tensor * t, uint64_t src_hash, size_t size, std::shared_ptr<const void> & ref);
+
+// stores the repacked data of tensor t in the repack cache, if one is being written
+void ggml_cpu_repack_cache_add(const struct ggml_tensor * t, uint64_t src_hash, const void * data, size_t size);
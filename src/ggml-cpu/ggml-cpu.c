@@ -454,6 +454,10 @@ const struct ggml_type_traits_cpu * ggml_get_type_traits_cpu(enum ggml_type type
 #define GGML_F32x4_FMA(a, b, c) vfmaq_f32(a, b, c)
 #define GGML_F32x4_ADD          vaddq_f32
 #define GGML_F32x4_MUL          vmulq_f32
+#if defined(__aarch64__)
+#define GGML_F32x4_SQRT         vsqrtq_f32
+#define GGML_F32x4_DIV          vdivq_f32
+#endif
 #define GGML_F32x4_REDUCE_ONE(x) vaddvq_f32(x)
 #define GGML_F32x4_REDUCE(res, x)                       \
 {                                                       \
@@ -480,6 +484,10 @@ const struct ggml_type_traits_cpu * ggml_get_type_traits_cpu(enum ggml_type type
 #define GGML_F32_VEC_FMA    GGML_F32x4_FMA
 #define GGML_F32_VEC_ADD    GGML_F32x4_ADD
 #define GGML_F32_VEC_MUL    GGML_F32x4_MUL
+#if defined(__aarch64__)
+#define GGML_F32_VEC_SQRT   GGML_F32x4_SQRT
+#define GGML_F32_VEC_DIV    GGML_F32x4_DIV
+#endif
 #define GGML_F32_VEC_REDUCE GGML_F32x4_REDUCE
 
 // F16 NEON
@@ -570,6 +578,8 @@ const struct ggml_type_traits_cpu * ggml_get_type_traits_cpu(enum ggml_type type
 #define GGML_F32x16_FMA(a, b, c) _mm512_fmadd_ps(b, c, a)
 #define GGML_F32x16_ADD     _mm512_add_ps
 #define GGML_F32x16_MUL     _mm512_mul_ps
+#define GGML_F32x16_SQRT    _mm512_sqrt_ps
+#define GGML_F32x16_DIV     _mm512_div_ps
 #define GGML_F32x16_REDUCE(res, x)                                    \
 do {                                                                  \
     int offset = GGML_F32_ARR >> 1;                                   \
@@ -597,6 +607,8 @@ do {                                                                  \
 #define GGML_F32_VEC_FMA    GGML_F32x16_FMA
 #define GGML_F32_VEC_ADD    GGML_F32x16_ADD
 #define GGML_F32_VEC_MUL    GGML_F32x16_MUL
+#define GGML_F32_VEC_SQRT   GGML_F32x16_SQRT
+#define GGML_F32_VEC_DIV    GGML_F32x16_DIV
 #define GGML_F32_VEC_REDUCE GGML_F32x16_REDUCE
 
 // F16 AVX512
@@ -668,6 +680,8 @@ do {                                                              \
 #endif
 #define GGML_F32x8_ADD     _mm256_add_ps
 #define GGML_F32x8_MUL     _mm256_mul_ps
+#define GGML_F32x8_SQRT    _mm256_sqrt_ps
+#define GGML_F32x8_DIV     _mm256_div_ps
 #define GGML_F32x8_REDUCE(res, x)                                 \
 do {                                                              \
     int offset = GGML_F32_ARR >> 1;                               \
@@ -697,6 +711,8 @@ do {                                                              \
 #define GGML_F32_VEC_FMA    GGML_F32x8_FMA
 #define GGML_F32_VEC_ADD    GGML_F32x8_ADD
 #define GGML_F32_VEC_MUL    GGML_F32x8_MUL
+#define GGML_F32_VEC_SQRT   GGML_F32x8_SQRT
+#define GGML_F32_VEC_DIV    GGML_F32x8_DIV
 #define GGML_F32_VEC_REDUCE GGML_F32x8_REDUCE
 
 // F16 AVX
@@ -768,6 +784,8 @@ static inline void __avx_f32cx8_store(ggml_fp16_t *x, __m256 y) {
 #define GGML_F32x4_FMA(a, b, c) vec_madd(b, c, a)
 #define GGML_F32x4_ADD          vec_add
 #define GGML_F32x4_MUL          vec_mul
+#define GGML_F32x4_SQRT         vec_sqrt
+#define GGML_F32x4_DIV          vec_div
 #define GGML_F32x4_REDUCE(res, x)              \
 {                                              \
     int offset = GGML_F32_ARR >> 1;            \
@@ -796,6 +814,8 @@ static inline void __avx_f32cx8_store(ggml_fp16_t *x, __m256 y) {
 #define GGML_F32_VEC_FMA    GGML_F32x4_FMA
 #define GGML_F32_VEC_ADD    GGML_F32x4_ADD
 #define GGML_F32_VEC_MUL    GGML_F32x4_MUL
+#define GGML_F32_VEC_SQRT   GGML_F32x4_SQRT
+#define GGML_F32_VEC_DIV    GGML_F32x4_DIV
 #define GGML_F32_VEC_REDUCE GGML_F32x4_REDUCE
 
 // F16 POWER9
@@ -836,6 +856,8 @@ static inline void __avx_f32cx8_store(ggml_fp16_t *x, __m256 y) {
 #define GGML_F32x4_FMA(a, b, c) wasm_f32x4_add(wasm_f32x4_mul(b, c), a)
 #define GGML_F32x4_ADD          wasm_f32x4_add
 #define GGML_F32x4_MUL          wasm_f32x4_mul
+#define GGML_F32x4_SQRT         wasm_f32x4_sqrt
+#define GGML_F32x4_DIV          wasm_f32x4_div
 #define GGML_F32x4_REDUCE(res, x)                  \
 {                                                  \
     int offset = GGML_F32_ARR >> 1;                \
@@ -864,6 +886,8 @@ static inline void __avx_f32cx8_store(ggml_fp16_t *x, __m256 y) {
 #define GGML_F32_VEC_FMA    GGML_F32x4_FMA
 #define GGML_F32_VEC_ADD    GGML_F32x4_ADD
 #define GGML_F32_VEC_MUL    GGML_F32x4_MUL
+#define GGML_F32_VEC_SQRT   GGML_F32x4_SQRT
+#define GGML_F32_VEC_DIV    GGML_F32x4_DIV
 #define GGML_F32_VEC_REDUCE GGML_F32x4_REDUCE
 
 // F16 WASM
@@ -953,6 +977,8 @@ inline static void __wasm_f16x4_store(ggml_fp16_t * p, v128_t x) {
 #endif
 #define GGML_F32x4_ADD     _mm_add_ps
 #define GGML_F32x4_MUL     _mm_mul_ps
+#define GGML_F32x4_SQRT    _mm_sqrt_ps
+#define GGML_F32x4_DIV     _mm_div_ps
 #define GGML_F32x4_REDUCE(res, x)                                 \
 {                                                                 \
     int offset = GGML_F32_ARR >> 1;                               \
@@ -980,6 +1006,8 @@ inline static void __wasm_f16x4_store(ggml_fp16_t * p, v128_t x) {
 #define GGML_F32_VEC_FMA    GGML_F32x4_FMA
 #define GGML_F32_VEC_ADD    GGML_F32x4_ADD
 #define GGML_F32_VEC_MUL    GGML_F32x4_MUL
+#define GGML_F32_VEC_SQRT   GGML_F32x4_SQRT
+#define GGML_F32_VEC_DIV    GGML_F32x4_DIV
 #define GGML_F32_VEC_REDUCE GGML_F32x4_REDUCE
 
 // F16 SSE
@@ -1045,6 +1073,8 @@ static inline void __sse_f16x4_store(ggml_fp16_t * x, __m128 y) {
 #define GGML_F32x8_FMA(a, b, c) __lasx_xvfmadd_s(b, c, a)
 #define GGML_F32x8_ADD     __lasx_xvfadd_s
 #define GGML_F32x8_MUL     __lasx_xvfmul_s
+#define GGML_F32x8_SQRT    __lasx_xvfsqrt_s
+#define GGML_F32x8_DIV     __lasx_xvfdiv_s
 #define GGML_F32x8_REDUCE(res, x)                                 \
 do {                                                              \
     int offset = GGML_F32_ARR >> 1;                               \
@@ -1072,6 +1102,8 @@ do {                                                              \
 #define GGML_F32_VEC_FMA    GGML_F32x8_FMA
 #define GGML_F32_VEC_ADD    GGML_F32x8_ADD
 #define GGML_F32_VEC_MUL    GGML_F32x8_MUL
+#define GGML_F32_VEC_SQRT   GGML_F32x8_SQRT
+#define GGML_F32_VEC_DIV    GGML_F32x8_DIV
 #define GGML_F32_VEC_REDUCE GGML_F32x8_REDUCE
 
 // F16 LASX
@@ -1132,6 +1164,8 @@ static inline void __lasx_f32cx8_store(ggml_fp16_t * x, __m256 y) {
 #define GGML_F32x4_FMA(a, b, c) __lsx_vfmadd_s(b, c, a)
 #define GGML_F32x4_ADD     __lsx_vfadd_s
 #define GGML_F32x4_MUL     __lsx_vfmul_s
+#define GGML_F32x4_SQRT    __lsx_vfsqrt_s
+#define GGML_F32x4_DIV     __lsx_vfdiv_s
 #define GGML_F32x4_REDUCE(res, x)                                                     \
 {                                                                                     \
     int offset = GGML_F32_ARR >> 1;                                                   \
@@ -1164,6 +1198,8 @@ static inline void __lasx_f32cx8_store(ggml_fp16_t * x, __m256 y) {
 #define GGML_F32_VEC_FMA    GGML_F32x4_FMA
 #define GGML_F32_VEC_ADD    GGML_F32x4_ADD
 #define GGML_F32_VEC_MUL    GGML_F32x4_MUL
+#define GGML_F32_VEC_SQRT   GGML_F32x4_SQRT
+#define GGML_F32_VEC_DIV    GGML_F32x4_DIV
 #define GGML_F32_VEC_REDUCE GGML_F32x4_REDUCE
 
 // F16 LSX
@@ -1230,6 +1266,8 @@ static inline void __lsx_f16x4_store(ggml_fp16_t * x, __m128 y) {
 #define GGML_F32x4_FMA(a, b, c) vec_madd(b, c, a)
 #define GGML_F32x4_ADD          vec_add
 #define GGML_F32x4_MUL          vec_mul
+#define GGML_F32x4_SQRT         vec_sqrt
+#define GGML_F32x4_DIV          vec_div
 #define GGML_F32x4_REDUCE(res, x)                   \
 {                                                   \
     int offset = GGML_F32_ARR >> 1;                 \
@@ -1258,6 +1296,8 @@ static inline void __lsx_f16x4_store(ggml_fp16_t * x, __m128 y) {
 #define GGML_F32_VEC_FMA    GGML_F32x4_FMA
 #define GGML_F32_VEC_ADD    GGML_F32x4_ADD
 #define GGML_F32_VEC_MUL    GGML_F32x4_MUL
+#define GGML_F32_VEC_SQRT   GGML_F32x4_SQRT
+#define GGML_F32_VEC_DIV    GGML_F32x4_DIV
 #define GGML_F32_VEC_REDUCE GGML_F32x4_REDUCE
 
 // F16 s390x
@@ -1387,6 +1427,10 @@ struct ggml_threadpool {
     int32_t      prio;        // Scheduling priority
     uint32_t     poll;        // Polling level (0 - no polling)
 
+    // src1 of a previous MUL_MAT, converted to src1_cache_type in the src1 cache region of the work buffer
+    const struct ggml_tensor * src1_cache;
+    enum ggml_type             src1_cache_type;
+
     enum ggml_status ec;
 };
 
@@ -6094,28 +6138,52 @@ static void ggml_compute_forward_sum_f32(
 
     const struct ggml_tensor * src0 = dst->src[0];
 
-    if (params->ith != 0) {
-        return;
-    }
-
     assert(ggml_is_scalar(dst));
     assert(src0->nb[0] == sizeof(float));
 
     GGML_TENSOR_LOCALS(int64_t, ne0, src0, ne)
     GGML_TENSOR_LOCALS(size_t,  nb0, src0, nb)
 
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t nr = ggml_nrows(src0);
+
+    // rows per thread
+    const int64_t dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    ggml_float * sums = (ggml_float *) params->wdata;
+
     ggml_float sum     = 0;
     ggml_float row_sum = 0;
 
-    for (int64_t i03 = 0; i03 < ne03; i03++) {
-        for (int64_t i02 = 0; i02 < ne02; i02++) {
-            for (int64_t i01 = 0; i01 < ne01; i01++) {
-                ggml_vec_sum_f32_ggf(ne00,
-                        &row_sum,
-                        (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03));
-                sum += row_sum;
-            }
-        }
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t i03 = ir/(ne02*ne01);
+        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+        const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+        ggml_vec_sum_f32_ggf(ne00,
+                &row_sum,
+                (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03));
+        sum += row_sum;
+    }
+
+    if (ith != 0) {
+        sums[ith] = sum;
+    }
+    ggml_barrier(params->threadpool);
+
+    if (ith != 0) {
+        return;
+    }
+
+    // reduce the partial sums in thread order so that the result does not depend on scheduling
+    for (int ith_other = 1; ith_other < nth; ++ith_other) {
+        sum += sums[ith_other];
     }
     ((float *) dst->data)[0] = sum;
 }
@@ -6330,10 +6398,6 @@ static void ggml_compute_forward_argmax_f32(
 
     const struct ggml_tensor * src0 = dst->src[0];
 
-    if (params->ith != 0) {
-        return;
-    }
-
     assert(src0->nb[0] == sizeof(float));
     assert(dst->nb[0] == sizeof(float));
 
@@ -6343,12 +6407,64 @@ static void ggml_compute_forward_argmax_f32(
     const size_t nb01 = src0->nb[1];
     const size_t nb0 = dst->nb[0];
 
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    if (ne01 >= nth) {
+        // enough rows: each thread computes the argmax of a range of rows
+        const int64_t dr = (ne01 + nth - 1)/nth;
+
+        const int64_t ir0 = dr*ith;
+        const int64_t ir1 = MIN(ir0 + dr, ne01);
+
+        for (int64_t i1 = ir0; i1 < ir1; i1++) {
+            float * src = (float *) ((char *) src0->data + i1*nb01);
+            int32_t * dst_ = (int32_t *) ((char *)  dst->data + i1*nb0);
+            int v = 0;
+            ggml_vec_argmax_f32(ne00, &v, src);
+            dst_[0] = v;
+        }
+        return;
+    }
+
+    // few long rows (e.g. the logits of a single token): split each row across the threads
+    float   * maxs = (float *) params->wdata;                        // [nth]
+    int32_t * idxs = (int32_t *) ((char *) params->wdata + nth*sizeof(float)); // [nth]
+
+    const int64_t dc = (ne00 + nth - 1)/nth;
+
+    const int64_t ic0 = MIN(dc*ith, ne00);
+    const int64_t ic1 = MIN(ic0 + dc, ne00);
+
     for (int64_t i1 = 0; i1 < ne01; i1++) {
-        float * src = (float *) ((char *) src0->data + i1*nb01);
-        int32_t * dst_ = (int32_t *) ((char *)  dst->data + i1*nb0);
-        int v = 0;
-        ggml_vec_argmax_f32(ne00, &v, src);
-        dst_[0] = v;
+        const float * src = (const float *) ((const char *) src0->data + i1*nb01);
+
+        if (ic0 < ic1) {
+            int v = 0;
+            ggml_vec_argmax_f32(ic1 - ic0, &v, src + ic0);
+            maxs[ith] = src[ic0 + v];
+            idxs[ith] = ic0 + v;
+        } else {
+            maxs[ith] = -INFINITY;
+            idxs[ith] = -1;
+        }
+
+        ggml_barrier(params->threadpool);
+
+        if (ith == 0) {
+            // like ggml_vec_argmax_f32, the last occurrence of the maximum wins
+            float max = -INFINITY;
+            int32_t idx = 0;
+            for (int i = 0; i < nth; i++) {
+                if (idxs[i] >= 0 && maxs[i] >= max) {
+                    max = maxs[i];
+                    idx = idxs[i];
+                }
+            }
+            *(int32_t *) ((char *) dst->data + i1*nb0) = idx;
+        }
+
+        ggml_barrier(params->threadpool);
     }
 }
 
@@ -6458,40 +6574,37 @@ static void ggml_compute_forward_repeat_f32(
 
     const struct ggml_tensor * src0 = dst->src[0];
 
-    if (params->ith != 0) {
-        return;
-    }
-
     GGML_ASSERT(ggml_can_repeat(src0, dst));
 
     GGML_TENSOR_UNARY_OP_LOCALS
 
     // guaranteed to be an integer due to the check in ggml_can_repeat
     const int nr0 = (int)(ne0/ne00);
-    const int nr1 = (int)(ne1/ne01);
-    const int nr2 = (int)(ne2/ne02);
-    const int nr3 = (int)(ne3/ne03);
 
     // TODO: support for transposed / permuted tensors
     GGML_ASSERT(nb0  == sizeof(float));
     GGML_ASSERT(nb00 == sizeof(float));
 
-    // TODO: maybe this is not optimal?
-    for                         (int i3 = 0; i3 < nr3;  i3++) {
-        for                     (int k3 = 0; k3 < ne03; k3++) {
-            for                 (int i2 = 0; i2 < nr2;  i2++) {
-                for             (int k2 = 0; k2 < ne02; k2++) {
-                    for         (int i1 = 0; i1 < nr1;  i1++) {
-                        for     (int k1 = 0; k1 < ne01; k1++) {
-                            for (int i0 = 0; i0 < nr0;  i0++) {
-                                ggml_vec_cpy_f32(ne00,
-                                        (float *) ((char *)  dst->data + (i3*ne03 + k3)*nb3  + (i2*ne02 + k2)*nb2  + (i1*ne01 + k1)*nb1  + (i0*ne00)*nb0),
-                                        (float *) ((char *) src0->data + (          k3)*nb03 + (          k2)*nb02 + (          k1)*nb01));
-                            }
-                        }
-                    }
-                }
-            }
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    // parallelize by dst rows
+    const int64_t nr = ne1*ne2*ne3;
+
+    const int64_t dr = (nr + nth - 1)/nth;
+
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t i3 = ir/(ne2*ne1);
+        const int64_t i2 = (ir - i3*ne2*ne1)/ne1;
+        const int64_t i1 = (ir - i3*ne2*ne1 - i2*ne1);
+
+        const float * x = (const float *) ((const char *) src0->data + (i3%ne03)*nb03 + (i2%ne02)*nb02 + (i1%ne01)*nb01);
+
+        for (int i0 = 0; i0 < nr0; i0++) {
+            ggml_vec_cpy_f32(ne00, (float *) ((char *) dst->data + i3*nb3 + i2*nb2 + i1*nb1 + (i0*ne00)*nb0), x);
         }
     }
 }
@@ -6502,43 +6615,38 @@ static void ggml_compute_forward_repeat_f16(
 
     const struct ggml_tensor * src0 = dst->src[0];
 
-    if (params->ith != 0) {
-        return;
-    }
-
     GGML_ASSERT(ggml_can_repeat(src0, dst));
 
     GGML_TENSOR_UNARY_OP_LOCALS
 
     // guaranteed to be an integer due to the check in ggml_can_repeat
     const int nr0 = (int)(ne0/ne00);
-    const int nr1 = (int)(ne1/ne01);
-    const int nr2 = (int)(ne2/ne02);
-    const int nr3 = (int)(ne3/ne03);
 
     // TODO: support for transposed / permuted tensors
     GGML_ASSERT(nb0  == sizeof(ggml_fp16_t));
     GGML_ASSERT(nb00 == sizeof(ggml_fp16_t));
 
-    // TODO: maybe this is not optimal?
-    for                         (int i3 = 0; i3 < nr3;  i3++) {
-        for                     (int k3 = 0; k3 < ne03; k3++) {
-            for                 (int i2 = 0; i2 < nr2;  i2++) {
-                for             (int k2 = 0; k2 < ne02; k2++) {
-                    for         (int i1 = 0; i1 < nr1;  i1++) {
-                        for     (int k1 = 0; k1 < ne01; k1++) {
-                            for (int i0 = 0; i0 < nr0;  i0++) {
-                                ggml_fp16_t * y = (ggml_fp16_t *) ((char *)  dst->data + (i3*ne03 + k3)*nb3  + (i2*ne02 + k2)*nb2  + (i1*ne01 + k1)*nb1  + (i0*ne00)*nb0);
-                                ggml_fp16_t * x = (ggml_fp16_t *) ((char *) src0->data + (          k3)*nb03 + (          k2)*nb02 + (          k1)*nb01);
-                                // ggml_vec_cpy_f16(ne00, y, x)
-                                for (int i = 0; i < ne00; ++i) {
-                                    y[i]  = x[i];
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    // parallelize by dst rows
+    const int64_t nr = ne1*ne2*ne3;
+
+    const int64_t dr = (nr + nth - 1)/nth;
+
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t i3 = ir/(ne2*ne1);
+        const int64_t i2 = (ir - i3*ne2*ne1)/ne1;
+        const int64_t i1 = (ir - i3*ne2*ne1 - i2*ne1);
+
+        const ggml_fp16_t * x = (const ggml_fp16_t *) ((const char *) src0->data + (i3%ne03)*nb03 + (i2%ne02)*nb02 + (i1%ne01)*nb01);
+
+        for (int i0 = 0; i0 < nr0; i0++) {
+            ggml_fp16_t * y = (ggml_fp16_t *) ((char *) dst->data + i3*nb3 + i2*nb2 + i1*nb1 + (i0*ne00)*nb0);
+            memcpy(y, x, ne00*sizeof(ggml_fp16_t));
         }
     }
 }
@@ -8551,14 +8659,14 @@ static void ggml_compute_forward_group_norm(
 // ggml_compute_forward_mul_mat
 
 static void ggml_compute_forward_mul_mat_one_chunk(
-    const struct ggml_compute_params * params,
     struct ggml_tensor * dst,
     const enum ggml_type type,
     const int64_t num_rows_per_vec_dot,
     const int64_t ir0_start,
     const int64_t ir0_end,
     const int64_t ir1_start,
-    const int64_t ir1_end) {
+    const int64_t ir1_end,
+    const void * src1_wdata) {
 
     const struct ggml_tensor * src0 = dst->src[0];
     const struct ggml_tensor * src1 = dst->src[1];
@@ -8581,7 +8689,7 @@ static void ggml_compute_forward_mul_mat_one_chunk(
         return;
     }
 
-    const void * wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
+    const void * wdata = (src1->type == vec_dot_type) ? src1->data : src1_wdata;
     const size_t row_size = ggml_row_size(vec_dot_type, ne10);
 
     assert(ne12 % ne02 == 0);
@@ -8702,15 +8810,27 @@ static void ggml_compute_forward_mul_mat(
 UseGgmlGemm1:;
 #endif
 
-    if (src1->type != vec_dot_type) {
-        char * wdata = params->wdata;
+    // src1 converted to vec_dot_type
+    // if it fits, it is stored in the src1 cache region of the work buffer, so that the following MUL_MATs
+    // with the same src1 (e.g. the Q, K and V projections) can reuse it instead of converting it again
+    char * wdata = params->wdata;
+    bool   quantize_src1 = src1->type != vec_dot_type;
+    bool   cache_src1    = false;
 
+    struct ggml_threadpool * tp = params->threadpool;
+    if (quantize_src1 && tp->cplan && tp->cplan->src1_cache_size >= ggml_row_size(vec_dot_type, ggml_nelements(src1))) {
+        wdata         = (char *) tp->cplan->work_data + tp->cplan->work_size - tp->cplan->src1_cache_size;
+        quantize_src1 = tp->src1_cache != src1 || tp->src1_cache_type != vec_dot_type;
+        cache_src1    = quantize_src1;
+    }
+
+    if (quantize_src1) {
         const size_t nbw0 = ggml_type_size(vec_dot_type);
         const size_t nbw1 = ggml_row_size(vec_dot_type, ne10);
         const size_t nbw2 = nbw1*ne11;
         const size_t nbw3 = nbw2*ne12;
 
-        assert(params->wsize >= ne13*nbw3);
+        assert(cache_src1 || params->wsize >= ne13*nbw3);
         GGML_ASSERT(src1->type == GGML_TYPE_F32);
 
     #if 0
@@ -8746,9 +8866,14 @@ UseGgmlGemm1:;
 
     ggml_barrier(params->threadpool);
 
+    if (cache_src1 && ith == 0) {
+        // the other threads only read this at the start of the next MUL_MAT, after the barrier at the end of this node
+        tp->src1_cache      = src1;
+        tp->src1_cache_type = vec_dot_type;
+    }
+
 #if GGML_USE_LLAMAFILE
     if (src1->type != vec_dot_type) {
-        const void* wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
         const size_t row_size = ggml_row_size(vec_dot_type, ne10);
 
         for (int64_t i13 = 0; i13 < ne13; i13++)
@@ -8824,7 +8949,7 @@ UseGgmlGemm2:;
         if ((nr0 % 2 != 0) || (ne11 % 2 != 0) || ((ir0_end - ir0_start) % 2 != 0) || ((ir1_end - ir1_start) % 2 != 0)) {
             num_rows_per_vec_dot = 1;
         }
-        ggml_compute_forward_mul_mat_one_chunk(params, dst, src0->type, num_rows_per_vec_dot, ir0_start, ir0_end, ir1_start, ir1_end);
+        ggml_compute_forward_mul_mat_one_chunk(dst, src0->type, num_rows_per_vec_dot, ir0_start, ir0_end, ir1_start, ir1_end, wdata);
 
         if (nth >= nchunk0 * nchunk1) {
             break;
@@ -8838,6 +8963,9 @@ UseGgmlGemm2:;
 
 #define MMID_MATRIX_ROW(row_id, i1) matrix_rows[(row_id)*ids->ne[0]*ids->ne[1] + (i1)]
 
+// experts that receive at least this many rows are computed as a grouped GEMM with llamafile_sgemm
+#define MMID_SGEMM_MIN_ROWS 32
+
 struct mmid_row_mapping {
     int32_t i1;
     int32_t i2;
@@ -8906,6 +9034,82 @@ static void ggml_compute_forward_mul_mat_id_one_chunk(
     }
 }
 
+#if GGML_USE_LLAMAFILE
+// gathers the rows routed to expert cur_a into a contiguous matrix, multiplies it with the expert weights using
+// the tiled llamafile kernels and scatters the result back into dst
+// all threads must call this together, since it synchronizes them between the gather, gemm and scatter steps
+// returns false if llamafile_sgemm does not support the types, in which case nothing has been written to dst
+static bool ggml_compute_forward_mul_mat_id_sgemm(
+    const struct ggml_compute_params * params,
+    struct ggml_tensor * dst,
+    const int64_t cur_a,
+    const int64_t cne1,
+    const char * src0_cur,
+    const struct mmid_row_mapping * matrix_rows,
+    const size_t row_size,
+    const bool src1_cont,
+    const void * wdata,
+    char * gather_b,
+    float * gather_c) {
+
+    const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+    const struct ggml_tensor * ids  = dst->src[2];
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const enum ggml_type type = src0->type;
+    const enum ggml_type vec_dot_type = type_traits_cpu[type].vec_dot_type;
+
+    // gather the src1 rows of this expert
+    for (int64_t ir1 = ith; ir1 < cne1; ir1 += nth) {
+        const struct mmid_row_mapping row_mapping = MMID_MATRIX_ROW(cur_a, ir1);
+
+        const int64_t i11 = row_mapping.i1 % ne11;
+        const int64_t i12 = row_mapping.i2;
+
+        const char * src1_col = (const char *) wdata +
+            (src1_cont || src1->type != vec_dot_type
+            ? (i11      + i12*ne11)*row_size
+            : (i11*nb11 + i12*nb12));
+
+        memcpy(gather_b + ir1*row_size, src1_col, row_size);
+    }
+
+    ggml_barrier(params->threadpool);
+
+    if (!llamafile_sgemm(params,
+                         ne01, cne1, ne00/ggml_blck_size(type),
+                         src0_cur,
+                         nb01/ggml_type_size(type),
+                         gather_b,
+                         row_size/ggml_type_size(vec_dot_type),
+                         gather_c,
+                         ne01,
+                         type,
+                         vec_dot_type,
+                         GGML_TYPE_F32)) {
+        return false;
+    }
+
+    ggml_barrier(params->threadpool);
+
+    // scatter the results to their dst rows
+    for (int64_t ir1 = ith; ir1 < cne1; ir1 += nth) {
+        const struct mmid_row_mapping row_mapping = MMID_MATRIX_ROW(cur_a, ir1);
+
+        float * dst_col = (float *) ((char *) dst->data + (row_mapping.i1*nb1 + row_mapping.i2*nb2));
+
+        memcpy(dst_col, gather_c + ir1*ne01, ne01*sizeof(float));
+    }
+
+    return true;
+}
+#endif
+
 static void * incr_ptr_aligned(void ** p, size_t size, size_t align) {
 
     void * ptr = *p;
@@ -8963,6 +9167,16 @@ static void ggml_compute_forward_mul_mat_id(
     char (*atomic_current_chunk)[CACHE_LINE_SIZE] = // [n_as]
         incr_ptr_aligned(&wdata_cur, CACHE_LINE_SIZE * n_as, CACHE_LINE_SIZE);
 
+#if GGML_USE_LLAMAFILE
+    char  * gather_b = NULL; // [ids->ne[1]][row_size]
+    float * gather_c = NULL; // [ids->ne[1]][ne01]
+
+    if (ids->ne[1] >= MMID_SGEMM_MIN_ROWS) {
+        gather_b = incr_ptr_aligned(&wdata_cur, ggml_row_size(vec_dot_type, ne10)*ids->ne[1], CACHE_LINE_SIZE);
+        gather_c = incr_ptr_aligned(&wdata_cur, ne01*ids->ne[1]*sizeof(float), CACHE_LINE_SIZE);
+    }
+#endif
+
     GGML_ASSERT(params->wsize >= (size_t)((char *) wdata_cur - (char *) params->wdata));
 
     if (src1->type != vec_dot_type) {
@@ -9038,6 +9252,16 @@ static void ggml_compute_forward_mul_mat_id(
         const void * wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
         const size_t row_size = ggml_row_size(vec_dot_type, ne10);
 
+#if GGML_USE_LLAMAFILE
+        // experts with enough rows are computed as a single gemm split across all threads
+        // (the gather buffers are sized for at most one row per token)
+        if (cne1 >= MMID_SGEMM_MIN_ROWS && cne1 <= ids->ne[1] &&
+            ggml_compute_forward_mul_mat_id_sgemm(params, dst, cur_a, cne1, src0_cur, matrix_rows,
+                                                  row_size, src1_cont, wdata, gather_b, gather_c)) {
+            continue;
+        }
+#endif
+
         const int64_t nr0 = ne01;
         const int64_t nr1 = cne1;
 
@@ -9334,14 +9558,11 @@ static void ggml_compute_forward_out_prod(
         case GGML_TYPE_IQ4_XS:
         case GGML_TYPE_IQ3_S:
         case GGML_TYPE_IQ2_S:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_BF16:
             {
                 ggml_compute_forward_out_prod_q_f32(params, dst);
             } break;
-        case GGML_TYPE_F16:
-            {
-                GGML_ABORT("fatal error"); // todo
-                // ggml_compute_forward_out_prod_f16_f32(params, dst);
-            }
         case GGML_TYPE_F32:
             {
                 ggml_compute_forward_out_prod_f32(params, dst);
@@ -11486,6 +11707,151 @@ static void ggml_compute_forward_im2col_back_f32(
     }
 }
 
+// ggml_compute_forward_conv_2d
+// src0: kernel [OC, IC, KH, KW]
+// src1: image  [N, IC, IH, IW]
+// dst:  result [N, OC, OH, OW]
+//
+// instead of materializing the full im2col matrix, the patches of a tile of output pixels are
+// gathered into wdata and multiplied with the kernel, then the next tile reuses the same buffer
+
+// number of output pixels per tile, chosen so that the patches of a tile take at most ~4 MB
+static int64_t ggml_conv_2d_tile_size(const struct ggml_tensor * dst) {
+    const struct ggml_tensor * src0 = dst->src[0];
+
+    const size_t patch_size = ggml_row_size(src0->type, src0->ne[0]*src0->ne[1]*src0->ne[2]);
+
+    const int64_t tile = MAX(16, (int64_t) (4*1024*1024/patch_size) & ~15);
+
+    return MIN(tile, dst->ne[0]*dst->ne[1]);
+}
+
+static void ggml_compute_forward_conv_2d(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst) {
+
+    const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+
+    GGML_ASSERT(src0->type == GGML_TYPE_F16 || src0->type == GGML_TYPE_F32);
+    GGML_ASSERT(src1->type == GGML_TYPE_F32);
+    GGML_ASSERT( dst->type == GGML_TYPE_F32);
+
+    GGML_TENSOR_BINARY_OP_LOCALS;
+
+    const int32_t s0 = ((const int32_t *)(dst->op_params))[0];
+    const int32_t s1 = ((const int32_t *)(dst->op_params))[1];
+    const int32_t p0 = ((const int32_t *)(dst->op_params))[2];
+    const int32_t p1 = ((const int32_t *)(dst->op_params))[3];
+    const int32_t d0 = ((const int32_t *)(dst->op_params))[4];
+    const int32_t d1 = ((const int32_t *)(dst->op_params))[5];
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t N  = ne13;
+    const int64_t IC = ne12;
+    const int64_t IH = ne11;
+    const int64_t IW = ne10;
+
+    const int64_t KH = ne01;
+    const int64_t KW = ne00;
+    const int64_t OC = ne03;
+
+    const int64_t OH = ne1;
+    const int64_t OW = ne0;
+
+    // length of a patch / kernel row
+    const int64_t K = IC*KH*KW;
+
+    GGML_ASSERT(ggml_is_contiguous(src0));
+    GGML_ASSERT(ggml_is_contiguous(dst));
+    GGML_ASSERT(nb10 == sizeof(float));
+
+    const enum ggml_type type = src0->type;
+    const size_t patch_size = ggml_row_size(type, K);
+
+    ggml_vec_dot_t const vec_dot = type_traits_cpu[type].vec_dot;
+
+    // patches of the current tile: [tile, IC, KH, KW]
+    char * wdata = params->wdata;
+
+    const int64_t tile = ggml_conv_2d_tile_size(dst);
+
+    for (int64_t in = 0; in < N; in++) {
+        for (int64_t ip0 = 0; ip0 < OH*OW; ip0 += tile) {
+            const int64_t np = MIN(tile, OH*OW - ip0);
+
+            // gather the patches of the tile
+            for (int64_t ip = ith; ip < np; ip += nth) {
+                const int64_t ioh = (ip0 + ip)/OW;
+                const int64_t iow = (ip0 + ip)%OW;
+
+                for (int64_t iic = 0; iic < IC; iic++) {
+                    const char * src_data = (const char *) src1->data + in*nb13 + iic*nb12;
+
+                    for (int64_t ikh = 0; ikh < KH; ikh++) {
+                        const int64_t iih = ioh*s1 + ikh*d1 - p1;
+                        const int64_t ik  = ip*K + iic*(KH*KW) + ikh*KW;
+
+                        for (int64_t ikw = 0; ikw < KW; ikw++) {
+                            const int64_t iiw = iow*s0 + ikw*d0 - p0;
+
+                            float v = 0.0f;
+                            if (iih >= 0 && iih < IH && iiw >= 0 && iiw < IW) {
+                                v = *(const float *) (src_data + iih*nb11 + iiw*nb10);
+                            }
+
+                            if (type == GGML_TYPE_F16) {
+                                ((ggml_fp16_t *) wdata)[ik + ikw] = GGML_FP32_TO_FP16(v);
+                            } else {
+                                ((float *) wdata)[ik + ikw] = v;
+                            }
+                        }
+                    }
+                }
+            }
+
+            ggml_barrier(params->threadpool);
+
+            // the output channels of the tile are rows of dst with stride nb2
+            float * dst_data = (float *) ((char *) dst->data + in*nb3) + ip0;
+
+#if GGML_USE_LLAMAFILE
+            if (llamafile_sgemm(params,
+                                np, OC, K,
+                                wdata,
+                                K,
+                                src0->data,
+                                K,
+                                dst_data,
+                                nb2/sizeof(float),
+                                type,
+                                type,
+                                GGML_TYPE_F32)) {
+                ggml_barrier(params->threadpool);
+                continue;
+            }
+#endif
+
+            // multiply the tile with the kernel, blocked over output channels to keep the kernel rows in cache
+            const int64_t blck_oc = 16;
+
+            for (int64_t ioc0 = 0; ioc0 < OC; ioc0 += blck_oc) {
+                for (int64_t ip = ith; ip < np; ip += nth) {
+                    for (int64_t ioc = ioc0; ioc < MIN(ioc0 + blck_oc, OC); ioc++) {
+                        vec_dot(K, (float *) ((char *) dst_data + ioc*nb2) + ip, 0,
+                                (const char *) src0->data + ioc*nb03, 0,
+                                wdata + ip*patch_size, 0, 1);
+                    }
+                }
+            }
+
+            ggml_barrier(params->threadpool);
+        }
+    }
+}
+
 // ggml_compute_forward_conv_transpose_2d
 
 static void ggml_compute_forward_conv_transpose_2d(
@@ -11594,18 +11960,22 @@ static void ggml_compute_forward_pool_1d_sk_p0(
 
     assert(src->type == GGML_TYPE_F32 || src->type == GGML_TYPE_F16);
 
-    if (params->ith != 0) {
-        return;
-    }
-
-    const char * cdata = (const char *)src->data;
-    const char * const data_end = cdata + ggml_nbytes(src);
-    float * drow = (float *)dst->data;
+    const int ith = params->ith;
+    const int nth = params->nth;
 
     const int64_t rs = dst->ne[0];
+    const int64_t nr = ggml_nrows(src);
 
-    while (cdata < data_end) {
-        const void * srow = (const void *)cdata;
+    // rows per thread
+    const int64_t dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const void * srow = (const void *)((const char *) src->data + ir*src->nb[1]);
+        float * drow = (float *) dst->data + ir*rs;
         int j = 0;
         for (int64_t i = 0; i < rs; ++i) {
             switch (op) {
@@ -11628,9 +11998,6 @@ static void ggml_compute_forward_pool_1d_sk_p0(
                 case GGML_OP_POOL_COUNT: GGML_ABORT("fatal error");
             }
         }
-
-        cdata += src->nb[1];
-        drow  += rs;
     }
 }
 
@@ -11661,9 +12028,8 @@ static void ggml_compute_forward_pool_2d(
 
     assert(src->type == GGML_TYPE_F32 || src->type == GGML_TYPE_F16);
 
-    if (params->ith != 0) {
-        return;
-    }
+    const int ith = params->ith;
+    const int nth = params->nth;
 
     const int32_t * opts = (const int32_t *)dst->op_params;
     enum ggml_op_pool op = opts[0];
@@ -11673,22 +12039,29 @@ static void ggml_compute_forward_pool_2d(
     const int s1 = opts[4];
     const int p0 = opts[5];
     const int p1 = opts[6];
-    const char * cdata = (const char*)src->data;
-    const char * const data_end = cdata + ggml_nbytes(src);
 
     const int64_t px = dst->ne[0];
     const int64_t py = dst->ne[1];
     const int64_t pa = px * py;
 
-    float * dplane = (float *)dst->data;
-
     const int ka = k0 * k1;
     const int offset0 = -p0;
     const int offset1 = -p1;
 
-    while (cdata < data_end) {
-        for (int oy = 0; oy < py; ++oy) {
-            float * const drow = dplane + oy * px;
+    // parallelize over the output rows of all planes
+    const int64_t nr = (ggml_nbytes(src)/src->nb[2])*py;
+
+    const int64_t dr = (nr + nth - 1)/nth;
+
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t ip = ir/py;
+        const int     oy = ir - ip*py;
+        {
+            const char * cdata = (const char *) src->data + ip*src->nb[2];
+            float * const drow = (float *) dst->data + ip*pa + oy * px;
             for (int ox = 0; ox < px; ++ox) {
                 float * const out =  drow + ox;
                 switch (op) {
@@ -11721,9 +12094,6 @@ static void ggml_compute_forward_pool_2d(
                 }
             }
         }
-
-        cdata  += src->nb[2];
-        dplane += pa;
     }
 }
 
@@ -11738,9 +12108,8 @@ static void ggml_compute_forward_pool_2d_back(
 
     assert(dst->type == GGML_TYPE_F32 || dst->type == GGML_TYPE_F16);
 
-    if (params->ith != 0) {
-        return;
-    }
+    const int ith = params->ith;
+    const int nth = params->nth;
 
     const int32_t * opts = (const int32_t *)dst->op_params;
     enum ggml_op_pool op = opts[0];
@@ -11751,24 +12120,29 @@ static void ggml_compute_forward_pool_2d_back(
     const int p0 = opts[5];
     const int p1 = opts[6];
 
-    char       * cdata  = (char       *) dst->data;
-    const char * cdataf = (const char *) dstf->data;
-    const char * const data_end = cdata + ggml_nbytes(dst);
-
-    GGML_ASSERT(params->ith == 0);
-    memset(cdata, 0, ggml_nbytes(dst));
-
     const int64_t px = src->ne[0];
     const int64_t py = src->ne[1];
     const int64_t pa = px * py;
 
-    const float * splane = (const float *) src->data;
-
     const int ka = k0 * k1;
     const int offset0 = -p0;
     const int offset1 = -p1;
 
-    while (cdata < data_end) {
+    // the pooling windows of a plane may overlap, so parallelize over whole planes
+    const int64_t np = ggml_nbytes(dst)/dst->nb[2];
+
+    const int64_t dp = (np + nth - 1)/nth;
+
+    const int64_t ip0 = dp*ith;
+    const int64_t ip1 = MIN(ip0 + dp, np);
+
+    for (int64_t ip = ip0; ip < ip1; ++ip) {
+        char        * cdata  = (char       *) dst->data  + ip*dst->nb[2];
+        const char  * cdataf = (const char *) dstf->data + ip*dst->nb[2];
+        const float * splane = (const float *) src->data + ip*pa;
+
+        memset(cdata, 0, dst->nb[2]);
+
         for (int oy = 0; oy < py; ++oy) {
             const float * const srow = splane + oy * px;
             for (int ox = 0; ox < px; ++ox) {
@@ -11842,10 +12216,6 @@ static void ggml_compute_forward_pool_2d_back(
                 }
             }
         }
-
-        cdata  += dst->nb[2];
-        cdataf += dst->nb[2];
-        splane += pa;
     }
 }
 
@@ -12111,24 +12481,52 @@ static void ggml_compute_forward_argsort_f32(
 
     enum ggml_sort_order order = (enum ggml_sort_order) ggml_get_op_params_i32(dst, 0);
 
+    // per-thread scratch: keys, keys and indices of the other half of each pass
+    uint32_t * wdata = (uint32_t *) params->wdata + ith*(3*ne0 + CACHE_LINE_SIZE_F32);
+
     for (int64_t i = ith; i < nr; i += nth) {
         int32_t * dst_data = (int32_t *)((char *) dst->data + i*nb1);
         const float * src_data = (float *)((char *) src0->data + i*nb01);
 
+        uint32_t * keys     = wdata;
+        uint32_t * keys_tmp = wdata + ne0;
+        int32_t  * idx      = dst_data;
+        int32_t  * idx_tmp  = (int32_t *) (wdata + 2*ne0);
+
+        // map the floats to unsigned keys with the same order, reversed for descending order
+        // -0 gets the key of +0, they compare equal and must keep their order like other ties
         for (int64_t j = 0; j < ne0; j++) {
-            dst_data[j] = j;
+            uint32_t b;
+            memcpy(&b, &src_data[j], sizeof(b));
+            b = b == 0x80000000u ? 0x80000000u : (b & 0x80000000u) ? ~b : (b | 0x80000000u);
+
+            keys[j] = order == GGML_SORT_ORDER_ASC ? b : ~b;
+            idx[j]  = j;
         }
 
-        // C doesn't have a functional sort, so we do a bubble sort instead
-        for (int64_t j = 0; j < ne0; j++) {
-            for (int64_t k = j + 1; k < ne0; k++) {
-                if ((order == GGML_SORT_ORDER_ASC  && src_data[dst_data[j]] > src_data[dst_data[k]]) ||
-                    (order == GGML_SORT_ORDER_DESC && src_data[dst_data[j]] < src_data[dst_data[k]])) {
-                    int32_t tmp = dst_data[j];
-                    dst_data[j] = dst_data[k];
-                    dst_data[k] = tmp;
-                }
+        // LSD radix sort, 8 bits per pass - it is stable, so equal elements keep their order
+        // after an even number of passes the sorted indices are back in dst_data
+        for (int shift = 0; shift < 32; shift += 8) {
+            int64_t offs[256] = { 0 };
+
+            for (int64_t j = 0; j < ne0; j++) {
+                offs[(keys[j] >> shift) & 0xFF]++;
+            }
+
+            for (int64_t b = 0, sum = 0; b < 256; b++) {
+                const int64_t cnt = offs[b];
+                offs[b] = sum;
+                sum += cnt;
+            }
+
+            for (int64_t j = 0; j < ne0; j++) {
+                const int64_t k = offs[(keys[j] >> shift) & 0xFF]++;
+                keys_tmp[k] = keys[j];
+                idx_tmp[k]  = idx[j];
             }
+
+            { uint32_t * t = keys; keys = keys_tmp; keys_tmp = t; }
+            { int32_t  * t = idx;  idx  = idx_tmp;  idx_tmp  = t; }
         }
     }
 }
@@ -12151,6 +12549,80 @@ static void ggml_compute_forward_argsort(
     }
 }
 
+// ggml_compute_forward_sample_top_p
+
+static void ggml_compute_forward_sample_top_p_f32(
+    const struct ggml_compute_params * params,
+    struct ggml_tensor * dst) {
+
+    const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+    const struct ggml_tensor * src2 = dst->src[2];
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t nr = ggml_nrows(src0);
+
+    const float p = ggml_get_op_params_f32(dst, 0);
+
+    const float * u = (const float *) src2->data;
+
+    for (int64_t ir = ith; ir < nr; ir += nth) {
+        const int64_t i03 = ir/(ne02*ne01);
+        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+        const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+        const char * probs = (const char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03;
+        const char * ids   = (const char *) src1->data + i01*nb11 + i02*nb12 + i03*nb13;
+
+        // keep the smallest prefix with a cumulative probability >= p
+        int64_t n   = ne00;
+        float   sum = 0.0f;
+        for (int64_t i = 0; i < ne00; i++) {
+            sum += *(const float *) (probs + i*nb00);
+            if (p < 1.0f && sum >= p) {
+                n = i + 1;
+                break;
+            }
+        }
+
+        // draw from the renormalized prefix
+        const float r = u[ir]*sum;
+
+        int64_t i   = 0;
+        float   cum = 0.0f;
+        for (; i < n - 1; i++) {
+            cum += *(const float *) (probs + i*nb00);
+            if (cum > r) {
+                break;
+            }
+        }
+
+        *(int32_t *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3) = *(const int32_t *) (ids + i*nb10);
+    }
+}
+
+static void ggml_compute_forward_sample_top_p(
+    const struct ggml_compute_params * params,
+    struct ggml_tensor * dst) {
+
+    const struct ggml_tensor * src0 = dst->src[0];
+
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_sample_top_p_f32(params, dst);
+            } break;
+        default:
+            {
+                GGML_ABORT("fatal error");
+            }
+    }
+}
+
 // ggml_compute_forward_flash_attn_ext
 
 static void ggml_compute_forward_flash_attn_ext_f16(
@@ -13974,6 +14446,79 @@ static void ggml_compute_forward_cross_entropy_loss_back(
     }
 }
 
+// AdamW update of n consecutive elements, pars are the 7 values of the adamw_params tensor
+static void ggml_vec_adamw_f32(const int64_t n, float * w, const float * g, float * m, float * v, const float * pars) {
+    const float alpha  = pars[0];
+    const float beta1  = pars[1];
+    const float beta2  = pars[2];
+    const float eps    = pars[3];
+    const float wd     = pars[4];
+    const float beta1h = pars[5];
+    const float beta2h = pars[6];
+
+    const float keep = 1.0f - alpha*wd;
+
+    int64_t i = 0;
+#if defined(GGML_SIMD) && defined(GGML_F32_VEC_SQRT)
+    const int64_t np = (n & ~(GGML_F32_EPR - 1));
+
+    const GGML_F32_VEC vbeta1  = GGML_F32_VEC_SET1(beta1);
+    const GGML_F32_VEC vbeta1c = GGML_F32_VEC_SET1(1.0f - beta1);
+    const GGML_F32_VEC vbeta2  = GGML_F32_VEC_SET1(beta2);
+    const GGML_F32_VEC vbeta2c = GGML_F32_VEC_SET1(1.0f - beta2);
+    const GGML_F32_VEC vbeta1h = GGML_F32_VEC_SET1(beta1h);
+    const GGML_F32_VEC vbeta2h = GGML_F32_VEC_SET1(beta2h);
+    const GGML_F32_VEC veps    = GGML_F32_VEC_SET1(eps);
+    const GGML_F32_VEC vnalpha = GGML_F32_VEC_SET1(-alpha);
+    const GGML_F32_VEC vkeep   = GGML_F32_VEC_SET1(keep);
+
+    for (; i < np; i += GGML_F32_EPR) {
+        const GGML_F32_VEC gi = GGML_F32_VEC_LOAD(g + i);
+        const GGML_F32_VEC mi = GGML_F32_VEC_FMA(GGML_F32_VEC_MUL(GGML_F32_VEC_LOAD(m + i), vbeta1), gi, vbeta1c);
+        const GGML_F32_VEC vi = GGML_F32_VEC_FMA(GGML_F32_VEC_MUL(GGML_F32_VEC_LOAD(v + i), vbeta2), GGML_F32_VEC_MUL(gi, gi), vbeta2c);
+        GGML_F32_VEC_STORE(m + i, mi);
+        GGML_F32_VEC_STORE(v + i, vi);
+
+        const GGML_F32_VEC mh = GGML_F32_VEC_MUL(mi, vbeta1h);
+        const GGML_F32_VEC vh = GGML_F32_VEC_ADD(GGML_F32_VEC_SQRT(GGML_F32_VEC_MUL(vi, vbeta2h)), veps);
+        GGML_F32_VEC_STORE(w + i, GGML_F32_VEC_FMA(GGML_F32_VEC_MUL(GGML_F32_VEC_LOAD(w + i), vkeep), GGML_F32_VEC_DIV(mh, vh), vnalpha));
+    }
+#endif
+    for (; i < n; ++i) {
+        m[i] = m[i]*beta1 +      g[i]*(1.0f - beta1);
+        v[i] = v[i]*beta2 + g[i]*g[i]*(1.0f - beta2);
+
+        const float mh =       m[i]*beta1h;
+        const float vh = sqrtf(v[i]*beta2h) + eps;
+
+        // The weight decay is applied independently of the Adam momenta m and v.
+        // This is NOT equivalent to l2 regularization that adds w[i]*w[i] to the loss.
+        // See: https://arxiv.org/pdf/1711.05101v3.pdf
+        w[i] = w[i]*keep - alpha*mh/vh;
+    }
+}
+
+// AdamW update of n consecutive elements with the momenta m and v stored as F32 or BF16
+// AdamW update of n consecutive elements with the first moment m stored as F32 or BF16, the second moment v is F32:
+// in BF16, beta2*v rounds back to v for beta2 close to 1 and v would never decay
+static void ggml_opt_step_adamw_elements(
+        const int64_t n, float * w, const float * g, void * m, enum ggml_type type_m, float * v, const float * pars) {
+    if (type_m == GGML_TYPE_F32) {
+        ggml_vec_adamw_f32(n, w, g, (float *) m, v, pars);
+        return;
+    }
+
+    GGML_ASSERT(type_m == GGML_TYPE_BF16);
+
+    float mf[256];
+    for (int64_t i = 0; i < n; i += 256) {
+        const int nc = MIN(256, n - i);
+        ggml_bf16_to_fp32_row((const ggml_bf16_t *) m + i, mf, nc);
+        ggml_vec_adamw_f32(nc, w + i, g + i, mf, v + i, pars);
+        ggml_fp32_to_bf16_row(mf, (ggml_bf16_t *) m + i, nc);
+    }
+}
+
 static void ggml_compute_forward_opt_step_adamw_f32(
         const struct ggml_compute_params * params,
         struct ggml_tensor * dst) {
@@ -14005,13 +14550,6 @@ static void ggml_compute_forward_opt_step_adamw_f32(
     const int ir1 = MIN(ir0 + dr, nr);
 
     const float * adamw_params_ptr = ggml_get_data_f32(adamw_params);
-    const float alpha  = adamw_params_ptr[0];
-    const float beta1  = adamw_params_ptr[1];
-    const float beta2  = adamw_params_ptr[2];
-    const float eps    = adamw_params_ptr[3];
-    const float wd     = adamw_params_ptr[4];
-    const float beta1h = adamw_params_ptr[5];
-    const float beta2h = adamw_params_ptr[6];
 
     for (int ir = ir0; ir < ir1; ++ir) {
         const int64_t i03 = ir/(ne02*ne01);
@@ -14020,23 +14558,13 @@ static void ggml_compute_forward_opt_step_adamw_f32(
 
         const size_t offset = i03*nb03 + i02*nb02 + i01*nb01;
 
-        float       * w = (float       *) ((char       *) src0->data        + offset); // weight
-        const float * g = (const float *) ((const char *) src0_grad->data   + offset); // grad
-        float       * m = (float       *) ((char       *) src0_grad_m->data + offset);
-        float       * v = (float       *) ((char       *) src0_grad_v->data + offset);
-
-        for (int i00 = 0; i00 < ne00; ++i00) {
-            m[i00] = m[i00]*beta1 +        g[i00]*(1.0f - beta1);
-            v[i00] = v[i00]*beta2 + g[i00]*g[i00]*(1.0f - beta2);
+        float       * w = (float       *) ((char       *) src0->data      + offset); // weight
+        const float * g = (const float *) ((const char *) src0_grad->data + offset); // grad
 
-            const float mh =       m[i00]*beta1h;
-            const float vh = sqrtf(v[i00]*beta2h) + eps;
+        void  * m = (char *) src0_grad_m->data + i03*src0_grad_m->nb[3] + i02*src0_grad_m->nb[2] + i01*src0_grad_m->nb[1];
+        float * v = (float *) ((char *) src0_grad_v->data + i03*src0_grad_v->nb[3] + i02*src0_grad_v->nb[2] + i01*src0_grad_v->nb[1]);
 
-            // The weight decay is applied independently of the Adam momenta m and v.
-            // This is NOT equivalent to l2 regularization that adds w[i00]*w[i00] to the loss.
-            // See: https://arxiv.org/pdf/1711.05101v3.pdf
-            w[i00] = w[i00]*(1.0f - alpha*wd) - alpha*mh/vh;
-        }
+        ggml_opt_step_adamw_elements(ne00, w, g, m, src0_grad_m->type, v, adamw_params_ptr);
     }
 }
 
@@ -14057,6 +14585,66 @@ static void ggml_compute_forward_opt_step_adamw(
             }
     }
 }
+
+// empty steps and steps claimed by an extra buffer type are left to ggml_compute_forward
+static bool ggml_opt_step_adamw_can_fuse(const struct ggml_tensor * node) {
+    return node->op == GGML_OP_OPT_STEP_ADAMW && node->src[0]->type == GGML_TYPE_F32 &&
+        ggml_is_contiguous(node->src[0]) && ggml_is_contiguous(node->src[1]) &&
+        ggml_is_contiguous(node->src[2]) && ggml_is_contiguous(node->src[3]) &&
+        !ggml_is_empty(node) && !ggml_cpu_extra_has_traits(node);
+}
+
+// end of the run of consecutive optimizer steps starting at node_start that can be computed by a single fused pass
+static int ggml_opt_step_adamw_fused_end(const struct ggml_cgraph * cgraph, int node_start) {
+    int node_end = node_start;
+    while (node_end < cgraph->n_nodes && ggml_opt_step_adamw_can_fuse(cgraph->nodes[node_end])) {
+        node_end++;
+    }
+    return node_end;
+}
+
+// compute the optimizer steps [node_start, node_end) as a single pass without barriers in between,
+// the elements of all parameters are distributed evenly among the threads regardless of the tensor shapes
+static void ggml_compute_forward_opt_step_adamw_fused(
+        const struct ggml_compute_params * params,
+        const struct ggml_cgraph * cgraph,
+        int node_start,
+        int node_end) {
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    int64_t ne_total = 0;
+    for (int i = node_start; i < node_end; ++i) {
+        ne_total += ggml_nelements(cgraph->nodes[i]->src[0]);
+    }
+
+    // element range for this thread, aligned to cache lines
+    const int64_t ie0 = ith == 0       ? 0        : (ne_total*ith      /nth) & ~(int64_t) (CACHE_LINE_SIZE_F32 - 1);
+    const int64_t ie1 = ith == nth - 1 ? ne_total : (ne_total*(ith + 1)/nth) & ~(int64_t) (CACHE_LINE_SIZE_F32 - 1);
+
+    int64_t offset = 0;
+    for (int i = node_start; i < node_end && offset < ie1; ++i) {
+        const struct ggml_tensor * node = cgraph->nodes[i];
+        const int64_t ne = ggml_nelements(node->src[0]);
+
+        const int64_t i0 = MAX(ie0 - offset, 0);
+        const int64_t i1 = MIN(ie1 - offset, ne);
+        offset += ne;
+
+        if (i0 >= i1) {
+            continue;
+        }
+
+        ggml_opt_step_adamw_elements(i1 - i0,
+            (float       *) node->src[0]->data + i0,
+            (const float *) node->src[1]->data + i0,
+            (char        *) node->src[2]->data + i0*ggml_type_size(node->src[2]->type),
+            node->src[2]->type,
+            (float       *) node->src[3]->data + i0,
+            ggml_get_data_f32(node->src[4]));
+    }
+}
 /////////////////////////////////
 
 static void ggml_compute_forward(struct ggml_compute_params * params, struct ggml_tensor * tensor) {
@@ -14266,6 +14854,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_im2col_back_f32(params, tensor);
             } break;
+        case GGML_OP_CONV_2D:
+            {
+                ggml_compute_forward_conv_2d(params, tensor);
+            } break;
         case GGML_OP_CONV_TRANSPOSE_2D:
             {
                 ggml_compute_forward_conv_transpose_2d(params, tensor);
@@ -14306,6 +14898,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_argsort(params, tensor);
             } break;
+        case GGML_OP_SAMPLE_TOP_P:
+            {
+                ggml_compute_forward_sample_top_p(params, tensor);
+            } break;
         case GGML_OP_LEAKY_RELU:
             {
                 ggml_compute_forward_leaky_relu(params, tensor);
@@ -14532,18 +15128,18 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
         case GGML_OP_LOG:
         case GGML_OP_SIN:
         case GGML_OP_COS:
-        case GGML_OP_SUM:
         case GGML_OP_SUM_ROWS:
         case GGML_OP_MEAN:
-        case GGML_OP_ARGMAX:
             {
                 n_tasks = 1;
             } break;
+        case GGML_OP_SUM:
+        case GGML_OP_ARGMAX:
         case GGML_OP_COUNT_EQUAL:
+        case GGML_OP_REPEAT:
             {
                 n_tasks = n_threads;
             } break;
-        case GGML_OP_REPEAT:
         case GGML_OP_REPEAT_BACK:
         case GGML_OP_LEAKY_RELU:
             {
@@ -14628,6 +15224,7 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
         case GGML_OP_IM2COL:
         case GGML_OP_IM2COL_BACK:
         case GGML_OP_CONV_TRANSPOSE_1D:
+        case GGML_OP_CONV_2D:
         case GGML_OP_CONV_TRANSPOSE_2D:
             {
                 n_tasks = n_threads;
@@ -14636,7 +15233,7 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
         case GGML_OP_POOL_2D:
         case GGML_OP_POOL_2D_BACK:
             {
-                n_tasks = 1;
+                n_tasks = n_threads;
             } break;
         case GGML_OP_UPSCALE:
         case GGML_OP_PAD:
@@ -14644,6 +15241,7 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
         case GGML_OP_ARANGE:
         case GGML_OP_TIMESTEP_EMBEDDING:
         case GGML_OP_ARGSORT:
+        case GGML_OP_SAMPLE_TOP_P:
         case GGML_OP_FLASH_ATTN_EXT:
         case GGML_OP_FLASH_ATTN_BACK:
         case GGML_OP_SSM_CONV:
@@ -15011,6 +15609,10 @@ struct ggml_cplan ggml_graph_plan(
 
     int max_tasks = 1;
 
+    // MUL_MATs with the same src1 as the previous MUL_MAT reuse its converted src1 from a separate region of the work buffer
+    size_t src1_cache_size = 0;
+    const struct ggml_tensor * prev_mul_mat = NULL;
+
     // thread scheduling for the different operations + work buffer size estimation
     for (int i = 0; i < cgraph->n_nodes; i++) {
         struct ggml_tensor * node = cgraph->nodes[i];
@@ -15047,6 +15649,14 @@ struct ggml_cplan ggml_graph_plan(
                             cur = ggml_type_size(GGML_TYPE_F32) * node->src[1]->ne[0] * n_tasks;
                         }
                     } break;
+                case GGML_OP_SUM:
+                    {
+                        cur = sizeof(ggml_float)*n_tasks;
+                    } break;
+                case GGML_OP_ARGMAX:
+                    {
+                        cur = (sizeof(float) + sizeof(int32_t))*n_tasks;
+                    } break;
                 case GGML_OP_COUNT_EQUAL:
                     {
                         cur = ggml_type_size(node->type)*n_tasks;
@@ -15057,7 +15667,13 @@ struct ggml_cplan ggml_graph_plan(
 
                         if (node->src[1]->type != vec_dot_type) {
                             cur = ggml_row_size(vec_dot_type, ggml_nelements(node->src[1]));
+
+                            if (prev_mul_mat && prev_mul_mat->src[1] == node->src[1] &&
+                                type_traits_cpu[prev_mul_mat->src[0]->type].vec_dot_type == vec_dot_type) {
+                                src1_cache_size = MAX(src1_cache_size, cur);
+                            }
                         }
+                        prev_mul_mat = node;
                     } break;
                 case GGML_OP_MUL_MAT_ID:
                     {
@@ -15077,10 +15693,18 @@ struct ggml_cplan ggml_graph_plan(
                         cur += n_as*ids->ne[0]*ids->ne[1]*sizeof(struct mmid_row_mapping) + sizeof(int64_t);
                         // atomic_current_chunk
                         cur += CACHE_LINE_SIZE*n_as + CACHE_LINE_SIZE;
+#if GGML_USE_LLAMAFILE
+                        // gather_b, gather_c
+                        if (ids->ne[1] >= MMID_SGEMM_MIN_ROWS) {
+                            cur += ggml_row_size(vec_dot_type, src1->ne[0])*ids->ne[1] + CACHE_LINE_SIZE;
+                            cur += src0->ne[1]*ids->ne[1]*sizeof(float) + CACHE_LINE_SIZE;
+                        }
+#endif
                     } break;
                 case GGML_OP_OUT_PROD:
                     {
-                        if (ggml_is_quantized(node->src[0]->type)) {
+                        if (ggml_is_quantized(node->src[0]->type) ||
+                            node->src[0]->type == GGML_TYPE_F16 || node->src[0]->type == GGML_TYPE_BF16) {
                             cur = ggml_type_size(GGML_TYPE_F32) * node->src[0]->ne[0] * n_tasks;
                         }
                     } break;
@@ -15115,6 +15739,12 @@ struct ggml_cplan ggml_graph_plan(
                             GGML_ABORT("fatal error");
                         }
                     } break;
+                case GGML_OP_CONV_2D:
+                    {
+                        const int64_t K = node->src[0]->ne[0]*node->src[0]->ne[1]*node->src[0]->ne[2]; // KW*KH*IC
+
+                        cur = ggml_conv_2d_tile_size(node)*ggml_row_size(node->src[0]->type, K);
+                    } break;
                 case GGML_OP_CONV_TRANSPOSE_2D:
                     {
                         const int64_t ne00 = node->src[0]->ne[0]; // W
@@ -15129,6 +15759,12 @@ struct ggml_cplan ggml_graph_plan(
                         cur += sizeof(ggml_fp16_t)*ne00*ne01*ne02*ne03;
                         cur += sizeof(ggml_fp16_t)*ne10*ne11*ne12;
                     } break;
+                case GGML_OP_ARGSORT:
+                    {
+                        const int64_t ne00 = node->src[0]->ne[0];
+
+                        cur = sizeof(uint32_t)*(3*ne00 + CACHE_LINE_SIZE_F32)*n_tasks; // radix sort keys and indices/thread
+                    } break;
                 case GGML_OP_FLASH_ATTN_EXT:
                     {
                         const int64_t ne00 = node->src[0]->ne[0]; // D
@@ -15172,14 +15808,48 @@ struct ggml_cplan ggml_graph_plan(
         work_size += CACHE_LINE_SIZE*(n_threads);
     }
 
-    cplan.threadpool = threadpool;
-    cplan.n_threads  = MIN(max_tasks, n_threads);
-    cplan.work_size  = work_size;
-    cplan.work_data  = NULL;
+    if (src1_cache_size > 0) {
+        work_size = GGML_PAD(work_size, CACHE_LINE_SIZE) + src1_cache_size;
+    }
+
+    cplan.threadpool      = threadpool;
+    cplan.n_threads       = MIN(max_tasks, n_threads);
+    cplan.work_size       = work_size;
+    cplan.work_data       = NULL;
+    cplan.src1_cache_size = src1_cache_size;
 
     return cplan;
 }
 
+// drops the cached src1 of MUL_MAT when a node has written to its data
+static void ggml_mul_mat_src1_cache_update(struct ggml_threadpool * tp, const struct ggml_tensor * node) {
+    const struct ggml_tensor * src1 = tp->src1_cache;
+    if (src1 == NULL) {
+        return;
+    }
+
+    switch (node->op) {
+        case GGML_OP_NONE:
+        case GGML_OP_RESHAPE:
+        case GGML_OP_VIEW:
+        case GGML_OP_PERMUTE:
+        case GGML_OP_TRANSPOSE:
+        case GGML_OP_MUL_MAT:
+            return;
+        default:
+            break;
+    }
+
+    const char * node_begin = (const char *) node->data;
+    const char * node_end   = node_begin + ggml_nbytes(node);
+    const char * src1_begin = (const char *) src1->data;
+    const char * src1_end   = src1_begin + ggml_nbytes(src1);
+
+    if (node_begin < src1_end && src1_begin < node_end) {
+        tp->src1_cache = NULL;
+    }
+}
+
 static thread_ret_t ggml_graph_compute_thread(void * data) {
     struct ggml_compute_state * state = (struct ggml_compute_state *) data;
     struct ggml_threadpool    * tp    = state->threadpool;
@@ -15192,7 +15862,7 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
     struct ggml_compute_params params = {
         /*.ith       =*/ state->ith,
         /*.nth       =*/ atomic_load_explicit(&tp->n_threads_cur, memory_order_relaxed),
-        /*.wsize     =*/ cplan->work_size,
+        /*.wsize     =*/ cplan->work_size - cplan->src1_cache_size,
         /*.wdata     =*/ cplan->work_data,
         /*.threadpool=*/ tp,
     };
@@ -15200,7 +15870,20 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
     for (int node_n = 0; node_n < cgraph->n_nodes && atomic_load_explicit(&tp->abort, memory_order_relaxed) != node_n; node_n++) {
         struct ggml_tensor * node = cgraph->nodes[node_n];
 
-        ggml_compute_forward(&params, node);
+        if (ggml_opt_step_adamw_can_fuse(node)) {
+            // consecutive optimizer steps (one per parameter) are computed together to avoid a barrier for each of them
+            const int node_end = ggml_opt_step_adamw_fused_end(cgraph, node_n);
+            ggml_compute_forward_opt_step_adamw_fused(&params, cgraph, node_n, node_end);
+            node_n = node_end - 1;
+            if (state->ith == 0) {
+                tp->src1_cache = NULL;
+            }
+        } else {
+            ggml_compute_forward(&params, node);
+            if (state->ith == 0) {
+                ggml_mul_mat_src1_cache_update(tp, node);
+            }
+        }
 
         if (state->ith == 0 && cplan->abort_callback &&
                 cplan->abort_callback(cplan->abort_callback_data)) {
@@ -15387,6 +16070,7 @@ static struct ggml_threadpool * ggml_threadpool_new_impl(
         threadpool->n_threads_cur    = tpp->n_threads;
         threadpool->poll             = tpp->poll;
         threadpool->prio             = tpp->prio;
+        threadpool->src1_cache       = NULL;
         threadpool->ec               = GGML_STATUS_SUCCESS;
     }
 
@@ -15461,6 +16145,7 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
         threadpool->cplan            = cplan;
         threadpool->current_chunk    = 0;
         threadpool->abort            = -1;
+        threadpool->src1_cache       = NULL;
         threadpool->ec               = GGML_STATUS_SUCCESS;
     }
 
@@ -55,6 +55,7 @@
 
 #include <atomic>
 #include <array>
+#include <type_traits>
 
 #ifdef _MSC_VER
 #define NOINLINE __declspec(noinline)
@@ -1042,6 +1043,352 @@ class tinyBLAS_Q0_AVX {
 };
 #endif // __AVX__
 
+#if defined(__AVX2__)
+// one K-quant (or IQ4_XS) super-block unpacked into bytes, so that it is decoded
+// once per tile row and reused against every column of the tile.
+// the dot product with a block_q8_K y is then
+//   d * y.d * sum(scales * maddubs(q, y.qs)) + dmin * y.d * sum(mins * y.bsums)
+struct block_k_unpacked {
+    __m256i q[QK_K/32];      // quants as bytes, 32 per vector
+    __m256i scales[QK_K/32]; // int16 scale for each pair of quants, laid out like the result of _mm256_maddubs_epi16
+    __m256i mins;            // int16 min (or zero point) for each group of 16 quants, laid out like block_q8_K.bsums
+    float d;
+    float dmin;              // negated, so that the min term is accumulated with madd
+};
+
+template <typename TA>
+class tinyBLAS_K_AVX {
+  public:
+    tinyBLAS_K_AVX(int64_t k,
+                   const TA *A, int64_t lda,
+                   const block_q8_K *B, int64_t ldb,
+                   float *C, int64_t ldc,
+                   int ith, int nth)
+        : A(A), B(B), C(C), k(k), lda(lda), ldb(ldb), ldc(ldc), ith(ith), nth(nth) {
+        const int8_t kvalues_iq4nl[16] = {
+            -127, -104, -83, -65,
+            -49,  -35,  -22, -10,
+              1,   13,   25,  38,
+             53,   69,   89, 113
+        };
+
+        iq4nlt = _mm_loadu_si128((const __m128i *)kvalues_iq4nl);
+    }
+
+    void matmul(int64_t m, int64_t n) {
+        mnpack(0, m, 0, n);
+    }
+
+  private:
+    // the accumulators are only touched once per super-block, so unlike
+    // tinyBLAS_Q0_AVX the tile size is not limited by the register count
+    void mnpack(int64_t m0, int64_t m, int64_t n0, int64_t n) {
+        int64_t mc, nc, mp, np;
+        switch ((MIN(m - m0, 4) << 4) | MIN(n - n0, 4)) {
+        case 0x44:
+            mc = 4;
+            nc = 4;
+            gemm<4, 4>(m0, m, n0, n);
+            break;
+        case 0x43:
+            mc = 4;
+            nc = 3;
+            gemm<4, 3>(m0, m, n0, n);
+            break;
+        case 0x34:
+            mc = 3;
+            nc = 4;
+            gemm<3, 4>(m0, m, n0, n);
+            break;
+        case 0x33:
+            mc = 3;
+            nc = 3;
+            gemm<3, 3>(m0, m, n0, n);
+            break;
+        case 0x42:
+            mc = 4;
+            nc = 2;
+            gemm<4, 2>(m0, m, n0, n);
+            break;
+        case 0x24:
+            mc = 2;
+            nc = 4;
+            gemm<2, 4>(m0, m, n0, n);
+            break;
+        case 0x32:
+            mc = 3;
+            nc = 2;
+            gemm<3, 2>(m0, m, n0, n);
+            break;
+        case 0x23:
+            mc = 2;
+            nc = 3;
+            gemm<2, 3>(m0, m, n0, n);
+            break;
+        case 0x41:
+            mc = 4;
+            nc = 1;
+            gemm<4, 1>(m0, m, n0, n);
+            break;
+        case 0x14:
+            mc = 1;
+            nc = 4;
+            gemm<1, 4>(m0, m, n0, n);
+            break;
+        case 0x22:
+            mc = 2;
+            nc = 2;
+            gemm<2, 2>(m0, m, n0, n);
+            break;
+        case 0x31:
+            mc = 3;
+            nc = 1;
+            gemm<3, 1>(m0, m, n0, n);
+            break;
+        case 0x13:
+            mc = 1;
+            nc = 3;
+            gemm<1, 3>(m0, m, n0, n);
+            break;
+        case 0x21:
+            mc = 2;
+            nc = 1;
+            gemm<2, 1>(m0, m, n0, n);
+            break;
+        case 0x12:
+            mc = 1;
+            nc = 2;
+            gemm<1, 2>(m0, m, n0, n);
+            break;
+        case 0x11:
+            mc = 1;
+            nc = 1;
+            gemm<1, 1>(m0, m, n0, n);
+            break;
+        default:
+            return;
+        }
+        mp = m0 + (m - m0) / mc * mc;
+        np = n0 + (n - n0) / nc * nc;
+        mnpack(mp, m, n0, np);
+        mnpack(m0, m, np, n);
+    }
+
+    template <int RM, int RN>
+    NOINLINE void gemm(int64_t m0, int64_t m, int64_t n0, int64_t n) {
+        int64_t ytiles = (m - m0) / RM;
+        int64_t xtiles = (n - n0) / RN;
+        int64_t tiles = xtiles * ytiles;
+        int64_t duty = (tiles + nth - 1) / nth;
+        int64_t start = duty * ith;
+        int64_t end = start + duty;
+        if (end > tiles)
+            end = tiles;
+        for (int64_t job = start; job < end; ++job) {
+            int64_t ii = m0 + job / xtiles * RM;
+            int64_t jj = n0 + job % xtiles * RN;
+            __m256 Cv[RN][RM] = {};
+            block_k_unpacked Av[RM];
+            for (int64_t l = 0; l < k; ++l) {
+                for (int64_t i = 0; i < RM; ++i)
+                    unpack(A + lda * (ii + i) + l, Av[i]);
+                for (int64_t j = 0; j < RN; ++j) {
+                    const block_q8_K *b = B + ldb * (jj + j) + l;
+                    __m256i sumi[RM];
+                    for (int64_t i = 0; i < RM; ++i)
+                        sumi[i] = _mm256_setzero_si256();
+                    for (int c = 0; c < QK_K/32; ++c) {
+                        const __m256i bq = _mm256_loadu_si256((const __m256i *)b->qs + c);
+                        for (int64_t i = 0; i < RM; ++i)
+                            sumi[i] = _mm256_add_epi32(sumi[i],
+                                                       _mm256_madd_epi16(dot16(Av[i].q[c], bq), Av[i].scales[c]));
+                    }
+                    for (int64_t i = 0; i < RM; ++i)
+                        Cv[j][i] = madd(_mm256_set1_ps(Av[i].d * b->d), _mm256_cvtepi32_ps(sumi[i]), Cv[j][i]);
+                    if (has_mins) {
+                        const __m256i bsums = _mm256_loadu_si256((const __m256i *)b->bsums);
+                        for (int64_t i = 0; i < RM; ++i)
+                            Cv[j][i] = madd(_mm256_set1_ps(Av[i].dmin * b->d),
+                                            _mm256_cvtepi32_ps(_mm256_madd_epi16(Av[i].mins, bsums)),
+                                            Cv[j][i]);
+                    }
+                }
+            }
+            for (int64_t j = 0; j < RN; ++j)
+                for (int64_t i = 0; i < RM; ++i)
+                    C[ldc * (jj + j) + (ii + i)] = hsum(Cv[j][i]);
+        }
+    }
+
+    // IQ4_XS quants are signed, the others are unpacked as unsigned values with the
+    // zero point folded into the mins
+    static constexpr bool has_mins = !std::is_same<TA, block_iq4_xs>::value;
+
+    static inline __m256i dot16(__m256i a, __m256i b) {
+        if (has_mins)
+            return _mm256_maddubs_epi16(a, b);
+        return _mm256_maddubs_epi16(_mm256_sign_epi8(a, a), _mm256_sign_epi8(b, a));
+    }
+
+    // scale s0 for the first 16 quants of a vector, s1 for the last 16
+    static inline __m256i scale_pair(int s0, int s1) {
+        return MM256_SET_M128I(_mm_set1_epi16(s1), _mm_set1_epi16(s0));
+    }
+
+    // duplicates 8 per-32 mins into 16 per-16 mins
+    static inline __m256i mins_pairs(const uint8_t *mins) {
+        const __m128i x = _mm_loadl_epi64((const __m128i *)mins);
+        return _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(x, x));
+    }
+
+    static inline void scales_k4(const uint8_t *q, uint8_t *sc, uint8_t *mn) {
+        for (int j = 0; j < 4; ++j) {
+            sc[j] = q[j] & 63;
+            mn[j] = q[j + 4] & 63;
+        }
+        for (int j = 4; j < 8; ++j) {
+            sc[j] = (q[j + 4] & 0xF) | ((q[j - 4] >> 6) << 4);
+            mn[j] = (q[j + 4] >>  4) | ((q[j - 0] >> 6) << 4);
+        }
+    }
+
+    inline void unpack(const block_q2_K *x, block_k_unpacked &u) {
+        const __m256i m3 = _mm256_set1_epi8(3);
+        for (int n = 0; n < QK_K/128; ++n) {
+            const __m256i q2 = _mm256_loadu_si256((const __m256i *)(x->qs + 32*n));
+            u.q[4*n + 0] = _mm256_and_si256(q2, m3);
+            u.q[4*n + 1] = _mm256_and_si256(_mm256_srli_epi16(q2, 2), m3);
+            u.q[4*n + 2] = _mm256_and_si256(_mm256_srli_epi16(q2, 4), m3);
+            u.q[4*n + 3] = _mm256_and_si256(_mm256_srli_epi16(q2, 6), m3);
+        }
+        for (int c = 0; c < QK_K/32; ++c)
+            u.scales[c] = scale_pair(x->scales[2*c] & 0xF, x->scales[2*c + 1] & 0xF);
+        u.mins = _mm256_srli_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)x->scales)), 4);
+        u.d    =  unhalf(x->d);
+        u.dmin = -unhalf(x->dmin);
+    }
+
+    inline void unpack(const block_q3_K *x, block_k_unpacked &u) {
+        const uint32_t kmask1 = 0x03030303;
+        const uint32_t kmask2 = 0x0f0f0f0f;
+        uint32_t aux[4];
+        memcpy(aux, x->scales, 12);
+        const uint32_t tmp = aux[2];
+        aux[2] = ((aux[0] >> 4) & kmask2) | (((tmp >> 4) & kmask1) << 4);
+        aux[3] = ((aux[1] >> 4) & kmask2) | (((tmp >> 6) & kmask1) << 4);
+        aux[0] = (aux[0] & kmask2) | (((tmp >> 0) & kmask1) << 4);
+        aux[1] = (aux[1] & kmask2) | (((tmp >> 2) & kmask1) << 4);
+        const int8_t *sc = (const int8_t *)aux;
+
+        // q = (low 2 bits | high bit << 2) - 4, the -4 goes into the mins
+        const __m256i m3 = _mm256_set1_epi8(3);
+        const __m256i m1 = _mm256_set1_epi8(1);
+        const __m256i hm = _mm256_loadu_si256((const __m256i *)x->hmask);
+        for (int n = 0; n < QK_K/128; ++n) {
+            const __m256i q3 = _mm256_loadu_si256((const __m256i *)(x->qs + 32*n));
+            for (int j = 0; j < 4; ++j) {
+                const int c = 4*n + j;
+                const __m256i ql = _mm256_and_si256(_mm256_srli_epi16(q3, 2*j), m3);
+                const __m256i qh = _mm256_and_si256(_mm256_srli_epi16(hm, c), m1);
+                u.q[c] = _mm256_or_si256(ql, _mm256_slli_epi16(qh, 2));
+            }
+        }
+        for (int c = 0; c < QK_K/32; ++c)
+            u.scales[c] = scale_pair(sc[2*c] - 32, sc[2*c + 1] - 32);
+        const __m256i s16 = _mm256_sub_epi16(_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)sc)),
+                                             _mm256_set1_epi16(32));
+        u.mins = _mm256_slli_epi16(s16, 2);
+        u.d    =  unhalf(x->d);
+        u.dmin = -u.d;
+    }
+
+    inline void unpack(const block_q4_K *x, block_k_unpacked &u) {
+        uint8_t sc[8], mn[8];
+        scales_k4(x->scales, sc, mn);
+        const __m256i m4 = _mm256_set1_epi8(15);
+        for (int j = 0; j < QK_K/64; ++j) {
+            const __m256i q4 = _mm256_loadu_si256((const __m256i *)(x->qs + 32*j));
+            u.q[2*j + 0] = _mm256_and_si256(q4, m4);
+            u.q[2*j + 1] = _mm256_and_si256(_mm256_srli_epi16(q4, 4), m4);
+        }
+        for (int c = 0; c < QK_K/32; ++c)
+            u.scales[c] = _mm256_set1_epi16(sc[c]);
+        u.mins = mins_pairs(mn);
+        u.d    =  unhalf(x->d);
+        u.dmin = -unhalf(x->dmin);
+    }
+
+    inline void unpack(const block_q5_K *x, block_k_unpacked &u) {
+        uint8_t sc[8], mn[8];
+        scales_k4(x->scales, sc, mn);
+        const __m256i m4 = _mm256_set1_epi8(15);
+        const __m256i m1 = _mm256_set1_epi8(1);
+        const __m256i qh = _mm256_loadu_si256((const __m256i *)x->qh);
+        for (int j = 0; j < QK_K/64; ++j) {
+            const __m256i q4 = _mm256_loadu_si256((const __m256i *)(x->qs + 32*j));
+            const __m256i h0 = _mm256_and_si256(_mm256_srli_epi16(qh, 2*j + 0), m1);
+            const __m256i h1 = _mm256_and_si256(_mm256_srli_epi16(qh, 2*j + 1), m1);
+            u.q[2*j + 0] = _mm256_or_si256(_mm256_and_si256(q4, m4), _mm256_slli_epi16(h0, 4));
+            u.q[2*j + 1] = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(q4, 4), m4), _mm256_slli_epi16(h1, 4));
+        }
+        for (int c = 0; c < QK_K/32; ++c)
+            u.scales[c] = _mm256_set1_epi16(sc[c]);
+        u.mins = mins_pairs(mn);
+        u.d    =  unhalf(x->d);
+        u.dmin = -unhalf(x->dmin);
+    }
+
+    inline void unpack(const block_q6_K *x, block_k_unpacked &u) {
+        // q = (low 4 bits | high 2 bits << 4) - 32, the -32 goes into the mins
+        const __m256i m4 = _mm256_set1_epi8(15);
+        const __m256i m2 = _mm256_set1_epi8(3);
+        for (int n = 0; n < QK_K/128; ++n) {
+            const __m256i ql0 = _mm256_loadu_si256((const __m256i *)(x->ql + 64*n));
+            const __m256i ql1 = _mm256_loadu_si256((const __m256i *)(x->ql + 64*n + 32));
+            const __m256i qh  = _mm256_loadu_si256((const __m256i *)(x->qh + 32*n));
+            u.q[4*n + 0] = _mm256_or_si256(_mm256_and_si256(ql0, m4),
+                                           _mm256_slli_epi16(_mm256_and_si256(qh, m2), 4));
+            u.q[4*n + 1] = _mm256_or_si256(_mm256_and_si256(ql1, m4),
+                                           _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 2), m2), 4));
+            u.q[4*n + 2] = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql0, 4), m4),
+                                           _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 4), m2), 4));
+            u.q[4*n + 3] = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql1, 4), m4),
+                                           _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 6), m2), 4));
+        }
+        for (int c = 0; c < QK_K/32; ++c)
+            u.scales[c] = scale_pair(x->scales[2*c], x->scales[2*c + 1]);
+        u.mins = _mm256_slli_epi16(_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)x->scales)), 5);
+        u.d    =  unhalf(x->d);
+        u.dmin = -u.d;
+    }
+
+    inline void unpack(const block_iq4_xs *x, block_k_unpacked &u) {
+        const __m128i m4 = _mm_set1_epi8(15);
+        for (int ib = 0; ib < QK_K/32; ++ib) {
+            const __m128i q4 = _mm_loadu_si128((const __m128i *)(x->qs + 16*ib));
+            u.q[ib] = MM256_SET_M128I(_mm_shuffle_epi8(iq4nlt, _mm_and_si128(_mm_srli_epi16(q4, 4), m4)),
+                                      _mm_shuffle_epi8(iq4nlt, _mm_and_si128(q4, m4)));
+            const int ls = ((x->scales_l[ib/2] >> 4*(ib%2)) & 0xf) | (((x->scales_h >> 2*ib) & 3) << 4);
+            u.scales[ib] = _mm256_set1_epi16(ls - 32);
+        }
+        u.mins = _mm256_setzero_si256();
+        u.d    = unhalf(x->d);
+        u.dmin = 0.0f;
+    }
+
+    const TA *const A;
+    const block_q8_K *const B;
+    float *const C;
+    const int64_t k;
+    const int64_t lda;
+    const int64_t ldb;
+    const int64_t ldc;
+    const int ith;
+    const int nth;
+    __m128i iq4nlt;
+};
+#endif // __AVX2__
+
 //PPC Implementation
 #if defined(__MMA__)
 
@@ -2578,6 +2925,102 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
 #endif
     }
 
+    case GGML_TYPE_Q2_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX2__)
+        tinyBLAS_K_AVX<block_q2_K> tb{
+            k, (const block_q2_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q3_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX2__)
+        tinyBLAS_K_AVX<block_q3_K> tb{
+            k, (const block_q3_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q4_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX2__)
+        tinyBLAS_K_AVX<block_q4_K> tb{
+            k, (const block_q4_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q5_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX2__)
+        tinyBLAS_K_AVX<block_q5_K> tb{
+            k, (const block_q5_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q6_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX2__)
+        tinyBLAS_K_AVX<block_q6_K> tb{
+            k, (const block_q6_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_IQ4_XS: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX2__)
+        tinyBLAS_K_AVX<block_iq4_xs> tb{
+            k, (const block_iq4_xs *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
     default:
         return false;
     }
@@ -3201,9 +3201,16 @@ static bool ggml_backend_cuda_device_supports_op(ggml_backend_dev_t dev, const g
         case GGML_OP_POOL_2D:
         case GGML_OP_SUM:
         case GGML_OP_SUM_ROWS:
-        case GGML_OP_ARGSORT:
         case GGML_OP_ACC:
             return true;
+        case GGML_OP_ARGSORT: {
+            // the bitonic sort keeps a whole row, padded to a power of 2, in shared memory
+            int64_t ncols_pad = 1;
+            while (ncols_pad < op->src[0]->ne[0]) {
+                ncols_pad *= 2;
+            }
+            return ncols_pad*sizeof(int) <= ggml_cuda_info().devices[dev_ctx->device].smpb;
+        }
         case GGML_OP_GROUP_NORM:
             return ggml_is_contiguous(op->src[0]);
         case GGML_OP_UPSCALE:
@@ -3235,8 +3242,9 @@ static bool ggml_backend_cuda_device_supports_op(ggml_backend_dev_t dev, const g
         }
         case GGML_OP_CROSS_ENTROPY_LOSS:
         case GGML_OP_CROSS_ENTROPY_LOSS_BACK:
-        case GGML_OP_OPT_STEP_ADAMW:
             return true;
+        case GGML_OP_OPT_STEP_ADAMW:
+            return op->src[2]->type == GGML_TYPE_F32;
         default:
             return false;
     }
@@ -1,3 +1,16 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#   define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "ggml-opt.h"
 
 #include "ggml.h"
@@ -7,12 +20,85 @@
 
 #include <algorithm>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
 #include <cinttypes>
 #include <map>
+#include <mutex>
 #include <random>
+#include <set>
+#include <thread>
 #include <vector>
 
+// read-only mapping of a whole file
+struct ggml_opt_mmap {
+    void * addr = nullptr;
+    size_t size = 0;
+
+    bool map(const char * fname) {
+#ifdef _WIN32
+        HANDLE hfile = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (hfile == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fsize;
+        if (!GetFileSizeEx(hfile, &fsize) || fsize.QuadPart == 0) {
+            CloseHandle(hfile);
+            return false;
+        }
+        HANDLE hmapping = CreateFileMappingA(hfile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(hfile);
+        if (hmapping == nullptr) {
+            return false;
+        }
+        addr = MapViewOfFile(hmapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(hmapping); // the view keeps the mapping alive
+        if (addr == nullptr) {
+            return false;
+        }
+        size = fsize.QuadPart;
+#else
+        int fd = open(fname, O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void * ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd); // the mapping keeps the file open
+        if (ptr == MAP_FAILED) {
+            return false;
+        }
+        addr = ptr;
+        size = st.st_size;
+#endif
+        return true;
+    }
+
+    ~ggml_opt_mmap() {
+        if (addr == nullptr) {
+            return;
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(addr);
+#else
+        munmap(addr, size);
+#endif
+    }
+};
+
+// host copy of a batch of a streaming dataset, shards are already gathered in the order of the permutation
+struct ggml_opt_dataset_batch {
+    int64_t ibatch           = -1; // -1 if the buffer does not contain valid data
+    int64_t shards_per_batch = -1;
+
+    std::vector<float> data;
+    std::vector<float> labels;
+};
+
 struct ggml_opt_dataset {
     struct ggml_context   * ctx    = nullptr;
     ggml_backend_buffer_t   buf    = nullptr;
@@ -25,6 +111,32 @@ struct ggml_opt_dataset {
     size_t  nbs_labels  = -1;
 
     std::vector<int64_t> permutation;
+
+    // streaming datasets read the shards either via read_shard or from the file mappings,
+    // batches are assembled into a double buffer: one buffer is copied to the batch tensors while the other one is prefetched
+    bool                        streaming     = false;
+    ggml_opt_dataset_read_shard read_shard    = nullptr;
+    void                      * read_shard_ud = nullptr;
+    ggml_opt_mmap               mmap_data;
+    ggml_opt_mmap               mmap_labels;
+
+    ggml_opt_dataset_batch  batches[2];
+    std::thread             prefetch_thread;
+    std::mutex              prefetch_mutex;
+    std::condition_variable prefetch_cv;
+    int                     prefetch_ibuf             = -1; // buffer being filled by the prefetch thread, -1 if idle
+    int64_t                 prefetch_ibatch           = -1;
+    int64_t                 prefetch_shards_per_batch = -1;
+    bool                    prefetch_stop             = false;
+};
+
+// results of an asynchronous evaluation that are read back from the backend and added to result by ggml_opt_synchronize,
+// the values are stored in vectors so that their addresses stay valid when the vector of pending results grows
+struct ggml_opt_pending_result {
+    ggml_opt_result_t    result = nullptr;
+    std::vector<float>   loss;     // 1 value
+    std::vector<int32_t> pred;     // ndata values
+    std::vector<int64_t> ncorrect; // 1 value, empty if there are no labels
 };
 
 struct ggml_opt_context {
@@ -59,6 +171,11 @@ struct ggml_opt_context {
     ggml_opt_get_optimizer_params get_opt_pars = nullptr;
     void * get_opt_pars_ud                     = nullptr;
     struct ggml_tensor * adamw_params          = nullptr;
+
+    // state of the asynchronous evaluation
+    std::vector<ggml_opt_pending_result> pending;
+    ggml_backend_t       upload_backend = nullptr; // backend with a queued copy of a batch, nullptr if none
+    ggml_backend_event_t upload_event   = nullptr; // recorded after the copy if the backend supports events
 };
 
 struct ggml_opt_result {
@@ -73,7 +190,7 @@ struct ggml_opt_result {
 
 // ====== Dataset ======
 
-ggml_opt_dataset_t ggml_opt_dataset_init(int64_t ne_datapoint, int64_t ne_label, int64_t ndata, int64_t ndata_shard) {
+static ggml_opt_dataset_t ggml_opt_dataset_init_impl(int64_t ne_datapoint, int64_t ne_label, int64_t ndata, int64_t ndata_shard, bool alloc) {
     GGML_ASSERT(ne_datapoint >  0);
     GGML_ASSERT(ne_label     >= 0);
     GGML_ASSERT(ndata        >  0);
@@ -103,7 +220,9 @@ ggml_opt_dataset_t ggml_opt_dataset_init(int64_t ne_datapoint, int64_t ne_label,
         result->nbs_labels = 0;
     }
 
-    result->buf = ggml_backend_alloc_ctx_tensors_from_buft(result->ctx, ggml_backend_cpu_buffer_type());
+    if (alloc) {
+        result->buf = ggml_backend_alloc_ctx_tensors_from_buft(result->ctx, ggml_backend_cpu_buffer_type());
+    }
 
     const int64_t nshards = ndata/ndata_shard;
     result->permutation.resize(nshards);
@@ -113,7 +232,139 @@ ggml_opt_dataset_t ggml_opt_dataset_init(int64_t ne_datapoint, int64_t ne_label,
     return result;
 }
 
+ggml_opt_dataset_t ggml_opt_dataset_init(int64_t ne_datapoint, int64_t ne_label, int64_t ndata, int64_t ndata_shard) {
+    return ggml_opt_dataset_init_impl(ne_datapoint, ne_label, ndata, ndata_shard, /*alloc =*/ true);
+}
+
+ggml_opt_dataset_t ggml_opt_dataset_init_callback(
+        int64_t                     ne_datapoint,
+        int64_t                     ne_label,
+        int64_t                     ndata,
+        int64_t                     ndata_shard,
+        ggml_opt_dataset_read_shard read_shard,
+        void                      * userdata) {
+    GGML_ASSERT(read_shard);
+
+    ggml_opt_dataset_t result = ggml_opt_dataset_init_impl(ne_datapoint, ne_label, ndata, ndata_shard, /*alloc =*/ false);
+    result->streaming     = true;
+    result->read_shard    = read_shard;
+    result->read_shard_ud = userdata;
+    return result;
+}
+
+ggml_opt_dataset_t ggml_opt_dataset_init_mmap(
+        int64_t      ne_datapoint,
+        int64_t      ne_label,
+        int64_t      ndata,
+        int64_t      ndata_shard,
+        const char * fname_data,
+        const char * fname_labels) {
+    GGML_ASSERT(fname_data);
+    GGML_ASSERT((fname_labels == nullptr) == (ne_label == 0));
+
+    ggml_opt_dataset_t result = ggml_opt_dataset_init_impl(ne_datapoint, ne_label, ndata, ndata_shard, /*alloc =*/ false);
+    result->streaming = true;
+
+    if (!result->mmap_data.map(fname_data) || result->mmap_data.size < ggml_nbytes(result->data)) {
+        GGML_LOG_ERROR("%s: failed to map %s or file too small, need %zu bytes\n", __func__, fname_data, ggml_nbytes(result->data));
+        ggml_opt_dataset_free(result);
+        return nullptr;
+    }
+    result->data->data = result->mmap_data.addr;
+
+    if (!fname_labels) {
+        return result;
+    }
+
+    if (!result->mmap_labels.map(fname_labels) || result->mmap_labels.size < ggml_nbytes(result->labels)) {
+        GGML_LOG_ERROR("%s: failed to map %s or file too small, need %zu bytes\n", __func__, fname_labels, ggml_nbytes(result->labels));
+        ggml_opt_dataset_free(result);
+        return nullptr;
+    }
+    result->labels->data = result->mmap_labels.addr;
+
+    return result;
+}
+
+static void ggml_opt_dataset_assemble_batch(ggml_opt_dataset_t dataset, ggml_opt_dataset_batch & batch, int64_t ibatch, int64_t shards_per_batch) {
+    const int64_t ne_data_shard   = dataset->nbs_data   / sizeof(float);
+    const int64_t ne_labels_shard = dataset->nbs_labels / sizeof(float);
+
+    batch.data.resize(shards_per_batch*ne_data_shard);
+    batch.labels.resize(shards_per_batch*ne_labels_shard);
+
+    for (int64_t ishard_batch = 0; ishard_batch < shards_per_batch; ++ishard_batch) {
+        const int64_t ishard = dataset->permutation[ibatch*shards_per_batch + ishard_batch];
+
+        float * data   = batch.data.data() + ishard_batch*ne_data_shard;
+        float * labels = dataset->labels ? batch.labels.data() + ishard_batch*ne_labels_shard : nullptr;
+
+        if (dataset->read_shard) {
+            if (!dataset->read_shard(dataset->read_shard_ud, ishard, data, labels)) {
+                GGML_ABORT("failed to read shard %" PRId64 " of dataset", ishard);
+            }
+            continue;
+        }
+
+        memcpy(data, (const char *) dataset->data->data + ishard*dataset->nbs_data, dataset->nbs_data);
+        if (labels) {
+            memcpy(labels, (const char *) dataset->labels->data + ishard*dataset->nbs_labels, dataset->nbs_labels);
+        }
+    }
+
+    batch.ibatch           = ibatch;
+    batch.shards_per_batch = shards_per_batch;
+}
+
+static void ggml_opt_dataset_prefetch_loop(ggml_opt_dataset_t dataset) {
+    std::unique_lock<std::mutex> lock(dataset->prefetch_mutex);
+    while (true) {
+        dataset->prefetch_cv.wait(lock, [dataset] { return dataset->prefetch_stop || dataset->prefetch_ibuf >= 0; });
+        if (dataset->prefetch_stop) {
+            return;
+        }
+
+        ggml_opt_dataset_batch & batch = dataset->batches[dataset->prefetch_ibuf];
+        const int64_t ibatch           = dataset->prefetch_ibatch;
+        const int64_t shards_per_batch = dataset->prefetch_shards_per_batch;
+
+        lock.unlock();
+        ggml_opt_dataset_assemble_batch(dataset, batch, ibatch, shards_per_batch);
+        lock.lock();
+
+        dataset->prefetch_ibuf = -1;
+        dataset->prefetch_cv.notify_all();
+    }
+}
+
+// wait until the prefetch thread is idle, afterwards the batch buffers and the permutation can be accessed safely
+static void ggml_opt_dataset_prefetch_wait(ggml_opt_dataset_t dataset) {
+    std::unique_lock<std::mutex> lock(dataset->prefetch_mutex);
+    dataset->prefetch_cv.wait(lock, [dataset] { return dataset->prefetch_ibuf < 0; });
+}
+
+static void ggml_opt_dataset_prefetch_start(ggml_opt_dataset_t dataset, int ibuf, int64_t ibatch, int64_t shards_per_batch) {
+    if (!dataset->prefetch_thread.joinable()) {
+        dataset->prefetch_thread = std::thread(ggml_opt_dataset_prefetch_loop, dataset);
+    }
+
+    std::lock_guard<std::mutex> lock(dataset->prefetch_mutex);
+    dataset->batches[ibuf].ibatch      = -1;
+    dataset->prefetch_ibuf             = ibuf;
+    dataset->prefetch_ibatch           = ibatch;
+    dataset->prefetch_shards_per_batch = shards_per_batch;
+    dataset->prefetch_cv.notify_all();
+}
+
 void ggml_opt_dataset_free(ggml_opt_dataset_t dataset) {
+    if (dataset->prefetch_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(dataset->prefetch_mutex);
+            dataset->prefetch_stop = true;
+            dataset->prefetch_cv.notify_all();
+        }
+        dataset->prefetch_thread.join();
+    }
     ggml_backend_buffer_free(dataset->buf);
     ggml_free(dataset->ctx);
     delete dataset;
@@ -130,6 +381,12 @@ struct ggml_tensor * ggml_opt_dataset_labels(ggml_opt_dataset_t dataset) {
 void ggml_opt_dataset_shuffle(ggml_opt_context_t opt_ctx, ggml_opt_dataset_t dataset, int64_t idata) {
     GGML_ASSERT(idata <= dataset->ndata);
 
+    if (dataset->streaming) {
+        ggml_opt_dataset_prefetch_wait(dataset);
+        dataset->batches[0].ibatch = -1;
+        dataset->batches[1].ibatch = -1;
+    }
+
     if (idata < 0) {
         std::shuffle(dataset->permutation.begin(), dataset->permutation.end(), opt_ctx->rng);
         return;
@@ -140,6 +397,29 @@ void ggml_opt_dataset_shuffle(ggml_opt_context_t opt_ctx, ggml_opt_dataset_t dat
     std::shuffle(dataset->permutation.begin(), dataset->permutation.begin() + ishard_max, opt_ctx->rng);
 }
 
+// returns the host buffer of a streaming dataset that contains batch ibatch and starts prefetching batch ibatch+1
+static const ggml_opt_dataset_batch & ggml_opt_dataset_get_streaming_batch(ggml_opt_dataset_t dataset, int64_t ibatch, int64_t shards_per_batch) {
+    ggml_opt_dataset_prefetch_wait(dataset);
+
+    int ibuf = -1;
+    for (int i = 0; i < 2; ++i) {
+        if (dataset->batches[i].ibatch == ibatch && dataset->batches[i].shards_per_batch == shards_per_batch) {
+            ibuf = i;
+        }
+    }
+    if (ibuf < 0) {
+        ibuf = 0;
+        ggml_opt_dataset_assemble_batch(dataset, dataset->batches[ibuf], ibatch, shards_per_batch);
+    }
+
+    // the next batch is assembled into the other buffer while this one is copied and evaluated
+    if ((ibatch + 2)*shards_per_batch <= int64_t(dataset->permutation.size())) {
+        ggml_opt_dataset_prefetch_start(dataset, 1 - ibuf, ibatch + 1, shards_per_batch);
+    }
+
+    return dataset->batches[ibuf];
+}
+
 void ggml_opt_dataset_get_batch(ggml_opt_dataset_t dataset, struct ggml_tensor * data_batch, struct ggml_tensor * labels_batch, int64_t ibatch) {
     GGML_ASSERT(   data_batch && ggml_is_contiguous(data_batch));
     GGML_ASSERT(!labels_batch || ggml_is_contiguous(labels_batch));
@@ -156,6 +436,15 @@ void ggml_opt_dataset_get_batch(ggml_opt_dataset_t dataset, struct ggml_tensor *
 
     GGML_ASSERT((ibatch + 1)*shards_per_batch <= int64_t(dataset->permutation.size()));
 
+    if (dataset->streaming) {
+        const ggml_opt_dataset_batch & batch = ggml_opt_dataset_get_streaming_batch(dataset, ibatch, shards_per_batch);
+        ggml_backend_tensor_set(data_batch, batch.data.data(), 0, nb_data_batch);
+        if (labels_batch) {
+            ggml_backend_tensor_set(labels_batch, batch.labels.data(), 0, ggml_nbytes(labels_batch));
+        }
+        return;
+    }
+
     for (int64_t ishard_batch = 0; ishard_batch < shards_per_batch; ++ishard_batch) {
         const int64_t ishard = dataset->permutation[ibatch*shards_per_batch + ishard_batch];
 
@@ -171,6 +460,39 @@ void ggml_opt_dataset_get_batch(ggml_opt_dataset_t dataset, struct ggml_tensor *
     }
 }
 
+void ggml_opt_dataset_get_batch_host(ggml_opt_dataset_t dataset, void * data_batch, size_t nb_data_batch, void * labels_batch, int64_t ibatch) {
+    GGML_ASSERT(data_batch);
+    GGML_ASSERT((labels_batch == nullptr) == (dataset->labels == nullptr));
+    GGML_ASSERT(nb_data_batch % dataset->nbs_data == 0);
+
+    const int64_t shards_per_batch = nb_data_batch / dataset->nbs_data;
+
+    GGML_ASSERT((ibatch + 1)*shards_per_batch <= int64_t(dataset->permutation.size()));
+
+    if (dataset->streaming) {
+        const ggml_opt_dataset_batch & batch = ggml_opt_dataset_get_streaming_batch(dataset, ibatch, shards_per_batch);
+        memcpy(data_batch, batch.data.data(), nb_data_batch);
+        if (labels_batch) {
+            memcpy(labels_batch, batch.labels.data(), shards_per_batch*dataset->nbs_labels);
+        }
+        return;
+    }
+
+    for (int64_t ishard_batch = 0; ishard_batch < shards_per_batch; ++ishard_batch) {
+        const int64_t ishard = dataset->permutation[ibatch*shards_per_batch + ishard_batch];
+
+        const char * ptr_data = (const char *) dataset->data->data + ishard*dataset->nbs_data;
+        memcpy((char *) data_batch + ishard_batch*dataset->nbs_data, ptr_data, dataset->nbs_data);
+
+        if (!labels_batch) {
+            continue;
+        }
+
+        const char * ptr_labels = (const char *) dataset->labels->data + ishard*dataset->nbs_labels;
+        memcpy((char *) labels_batch + ishard_batch*dataset->nbs_labels, ptr_labels, dataset->nbs_labels);
+    }
+}
+
 // ====== Model / Context ======
 
 struct ggml_opt_optimizer_params ggml_opt_get_default_optimizer_params(void * userdata) {
@@ -203,6 +525,10 @@ struct ggml_opt_params ggml_opt_default_params(
         /*opt_period      =*/ 1,
         /*get_opt_pars    =*/ ggml_opt_get_default_optimizer_params,
         /*get_opt_pars_ud =*/ nullptr,
+        /*checkpoints     =*/ nullptr,
+        /*n_checkpoints   =*/ 0,
+        /*compute_type    =*/ GGML_TYPE_F32,
+        /*moment_type     =*/ GGML_TYPE_F32,
     };
 }
 
@@ -266,12 +592,126 @@ static ggml_cgraph * dup_graph(ggml_context * ctx, ggml_cgraph * src) {
     return dst;
 }
 
+// make the matrix multiplications in gf use copies of the F32 parameters cast to type, the parameters themselves
+// stay in the graph as sources of the casts and therefore still receive the gradients and the optimizer steps
+static int ggml_opt_cast_params(ggml_context * ctx, ggml_cgraph * gf, ggml_tensor * outputs, ggml_type type) {
+    std::map<ggml_tensor *, bool> castable;
+    for (int i = 0; i < gf->n_nodes; ++i) {
+        ggml_tensor * node = gf->nodes[i];
+        for (int j = 0; j < GGML_MAX_SRC; ++j) {
+            ggml_tensor * src = node->src[j];
+            if (!src || !(src->flags & GGML_TENSOR_FLAG_PARAM)) {
+                continue;
+            }
+            const bool ok = node->op == GGML_OP_MUL_MAT && j == 0 && src->type == GGML_TYPE_F32;
+            castable[src] = castable.find(src) == castable.end() ? ok : castable[src] && ok;
+        }
+    }
+
+    std::map<ggml_tensor *, ggml_tensor *> casts;
+    for (int i = 0; i < gf->n_nodes; ++i) {
+        ggml_tensor * node = gf->nodes[i];
+        if (node->op != GGML_OP_MUL_MAT || !castable[node->src[0]]) {
+            continue;
+        }
+        ggml_tensor * param = node->src[0];
+        if (casts.find(param) == casts.end()) {
+            casts[param] = ggml_cast(ctx, param, type);
+            ggml_format_name(casts[param], "%s (%s)", param->name, ggml_type_name(type));
+        }
+        node->src[0] = casts[param];
+    }
+
+    ggml_graph_clear(gf);
+    ggml_build_forward_expand(gf, outputs);
+
+    return casts.size();
+}
+
+static ggml_tensor * recompute_tensor(
+        std::map<ggml_tensor *, ggml_tensor *> & tensor_map, const std::set<ggml_tensor *> & keep,
+        std::vector<ggml_tensor *> & recomputed, ggml_context * ctx, ggml_tensor * tensor) {
+    if (!tensor || keep.find(tensor) != keep.end()) {
+        return tensor;
+    }
+
+    if (tensor_map.find(tensor) != tensor_map.end()) {
+        return tensor_map[tensor];
+    }
+
+    ggml_tensor * new_tensor = ggml_dup_tensor(ctx, tensor);
+    tensor_map[tensor] = new_tensor;
+
+    new_tensor->op = tensor->op;
+    for (int i = 0; i < GGML_MAX_DIMS; i++) {
+        new_tensor->nb[i] = tensor->nb[i];
+    }
+    memcpy(new_tensor->op_params, tensor->op_params, sizeof(tensor->op_params));
+    ggml_format_name(new_tensor, "%s (recomputed)", tensor->name);
+    new_tensor->view_offs = tensor->view_offs;
+    new_tensor->view_src = recompute_tensor(tensor_map, keep, recomputed, ctx, tensor->view_src);
+    for (int i = 0; i < GGML_MAX_SRC; i++) {
+        new_tensor->src[i] = recompute_tensor(tensor_map, keep, recomputed, ctx, tensor->src[i]);
+    }
+
+    recomputed.push_back(new_tensor);
+    return new_tensor;
+}
+
+// make the backward pass of gb use recomputed copies of all activations of the first n_forward nodes that are not kept,
+// the copies are inserted right before their first use so the allocator can free the original activations early
+static int ggml_opt_recompute_activations(
+        ggml_context * ctx, ggml_cgraph * gb, int n_forward, ggml_tensor ** checkpoints, int n_checkpoints) {
+    std::set<ggml_tensor *> forward;
+    std::set<ggml_tensor *> keep(checkpoints, checkpoints + n_checkpoints);
+    for (int i = 0; i < n_forward; ++i) {
+        ggml_tensor * node = gb->nodes[i];
+        forward.insert(node);
+
+        // tensors that are already allocated or needed outside of the graph cannot be recomputed
+        if (node->data || (node->flags & (GGML_TENSOR_FLAG_INPUT | GGML_TENSOR_FLAG_OUTPUT | GGML_TENSOR_FLAG_PARAM))) {
+            keep.insert(node);
+        }
+    }
+    for (int i = 0; i < gb->n_leafs; ++i) {
+        keep.insert(gb->leafs[i]);
+    }
+
+    std::map<ggml_tensor *, ggml_tensor *> tensor_map;
+    std::vector<ggml_tensor *> nodes(gb->nodes + n_forward, gb->nodes + gb->n_nodes);
+    int n_recomputed = 0;
+
+    gb->n_nodes = n_forward;
+    for (ggml_tensor * node : nodes) {
+        std::vector<ggml_tensor *> recomputed;
+        for (int j = 0; j < GGML_MAX_SRC; ++j) {
+            if (node->src[j] && forward.find(node->src[j]) != forward.end()) {
+                node->src[j] = recompute_tensor(tensor_map, keep, recomputed, ctx, node->src[j]);
+            }
+        }
+        if (node->view_src && forward.find(node->view_src) != forward.end()) {
+            node->view_src = recompute_tensor(tensor_map, keep, recomputed, ctx, node->view_src);
+        }
+
+        GGML_ASSERT(gb->n_nodes + int(recomputed.size()) < gb->size && "graph too small for recomputed tensors");
+        for (ggml_tensor * t : recomputed) {
+            ggml_hash_insert(&gb->visited_hash_set, t);
+            gb->nodes[gb->n_nodes++] = t;
+        }
+        gb->nodes[gb->n_nodes++] = node;
+        n_recomputed += recomputed.size();
+    }
+
+    return n_recomputed;
+}
+
 static void ggml_opt_alloc_graph(ggml_opt_context_t opt_ctx, ggml_cgraph * graph) {
     GGML_ASSERT(graph);
     if (opt_ctx->allocated_graph == graph) {
         return;
     }
 
+    ggml_backend_sched_synchronize(opt_ctx->backend_sched); // the previous graph may still be evaluated asynchronously
     ggml_backend_sched_reset(opt_ctx->backend_sched); // clear allocation of previous graph
 
     {
@@ -312,6 +752,12 @@ ggml_opt_context_t ggml_opt_init(struct ggml_opt_params params) {
     result->gf = ggml_new_graph_custom(result->ctx_compute, GGML_DEFAULT_GRAPH_SIZE, /*grads =*/ true); // Forward pass.
     ggml_build_forward_expand(result->gf, result->outputs);
 
+    GGML_ASSERT(params.compute_type == GGML_TYPE_F32 || params.compute_type == GGML_TYPE_F16 || params.compute_type == GGML_TYPE_BF16);
+    if (params.compute_type != GGML_TYPE_F32) {
+        const int n_cast = ggml_opt_cast_params(result->ctx_compute, result->gf, result->outputs, params.compute_type);
+        GGML_LOG_DEBUG("%s: mixed precision: %d parameters cast to %s\n", __func__, n_cast, ggml_type_name(params.compute_type));
+    }
+
     int n_param = 0;
     for (int i = 0; i < result->gf->n_nodes; ++i) {
         if (result->gf->nodes[i]->flags & GGML_TENSOR_FLAG_PARAM) {
@@ -422,6 +868,20 @@ ggml_opt_context_t ggml_opt_init(struct ggml_opt_params params) {
     result->gb_grad = ggml_graph_dup(result->ctx_compute, result->gf);
     ggml_build_backward_expand(result->ctx_static, result->ctx_compute, result->gb_grad, accumulate);
 
+    if (params.n_checkpoints > 0) {
+        ggml_gallocr_t galloc = ggml_gallocr_new(ggml_backend_cpu_buffer_type());
+        const size_t size_before = ggml_gallocr_measure(galloc, result->gb_grad);
+
+        const int n_recomputed = ggml_opt_recompute_activations(
+            result->ctx_compute, result->gb_grad, result->gf->n_nodes, params.checkpoints, params.n_checkpoints);
+
+        const size_t size_after = ggml_gallocr_measure(galloc, result->gb_grad);
+        ggml_gallocr_free(galloc);
+
+        GGML_LOG_INFO("%s: gradient checkpointing: %d checkpoints, %d recomputed tensors, graph memory %.2f MiB -> %.2f MiB\n",
+            __func__, params.n_checkpoints, n_recomputed, size_before/1024.0/1024.0, size_after/1024.0/1024.0);
+    }
+
     if (params.build_type == GGML_OPT_BUILD_TYPE_GRAD) {
         result->buf_static = ggml_backend_alloc_ctx_tensors(result->ctx_static, ggml_backend_sched_get_backend(result->backend_sched, 0));
         ggml_graph_reset(result->gb_grad);
@@ -429,6 +889,7 @@ ggml_opt_context_t ggml_opt_init(struct ggml_opt_params params) {
     }
 
     GGML_ASSERT(params.build_type == GGML_OPT_BUILD_TYPE_OPT);
+    GGML_ASSERT(params.moment_type == GGML_TYPE_F32 || params.moment_type == GGML_TYPE_BF16);
 
     // gb_opt == graph backward optimize, forward pass, then backward pass to calculate gradients, then optimizer step.
     result->gb_opt = ggml_graph_dup(result->ctx_compute, result->gb_grad);
@@ -442,8 +903,8 @@ ggml_opt_context_t ggml_opt_init(struct ggml_opt_params params) {
         struct ggml_tensor * grad = ggml_graph_get_grad(result->gb_opt, node);
 
         if (node->flags & GGML_TENSOR_FLAG_PARAM) {
-            struct ggml_tensor * m        = ggml_dup_tensor(result->ctx_static, node);
-            struct ggml_tensor * v        = ggml_dup_tensor(result->ctx_static, node);
+            struct ggml_tensor * m        = ggml_new_tensor(result->ctx_static, params.moment_type, GGML_MAX_DIMS, node->ne);
+            struct ggml_tensor * v        = ggml_new_tensor(result->ctx_static, GGML_TYPE_F32,      GGML_MAX_DIMS, node->ne);
             struct ggml_tensor * opt_step = ggml_opt_step_adamw(result->ctx_compute, node, grad, m, v, result->adamw_params);
             ggml_build_forward_expand(result->gb_opt, opt_step);
         }
@@ -463,6 +924,12 @@ void ggml_opt_free(ggml_opt_context_t opt_ctx) {
     if (opt_ctx == nullptr) {
         return;
     }
+    if (!opt_ctx->pending.empty() || opt_ctx->upload_backend) {
+        ggml_backend_sched_synchronize(opt_ctx->backend_sched);
+    }
+    if (opt_ctx->upload_event) {
+        ggml_backend_event_free(opt_ctx->upload_event);
+    }
     ggml_backend_buffer_free(opt_ctx->buf_static);
     ggml_backend_buffer_free(opt_ctx->buf_static_cpu);
     ggml_free(opt_ctx->ctx_static);
@@ -471,6 +938,7 @@ void ggml_opt_free(ggml_opt_context_t opt_ctx) {
 }
 
 void ggml_opt_reset(ggml_opt_context_t opt_ctx, bool optimizer) {
+    ggml_backend_sched_synchronize(opt_ctx->backend_sched); // the tensors are not reset in the order of the queued evaluations
     if (optimizer) {
         ggml_graph_reset(opt_ctx->gb_opt);
         opt_ctx->iter = 1;
@@ -582,6 +1050,31 @@ void ggml_opt_result_accuracy(ggml_opt_result_t result, double * accuracy, doubl
 
 // ====== Computation ======
 
+// backend whose queue can be used to copy the data of a tensor asynchronously, nullptr if there is none
+static ggml_backend_t ggml_opt_tensor_backend(ggml_opt_context_t opt_ctx, const ggml_tensor * tensor) {
+    ggml_backend_buffer_t buf = tensor->view_src ? tensor->view_src->buffer : tensor->buffer;
+    GGML_ASSERT(buf && "tensor not allocated");
+
+    const int n_backends = ggml_backend_sched_get_n_backends(opt_ctx->backend_sched);
+    for (int i = 0; i < n_backends; ++i) {
+        ggml_backend_t backend = ggml_backend_sched_get_backend(opt_ctx->backend_sched, i);
+        if (ggml_backend_get_default_buffer_type(backend) == ggml_backend_buffer_get_type(buf)) {
+            return backend;
+        }
+    }
+    return nullptr;
+}
+
+static void ggml_opt_tensor_get_async(ggml_opt_context_t opt_ctx, const ggml_tensor * tensor, void * data) {
+    ggml_backend_t backend = ggml_opt_tensor_backend(opt_ctx, tensor);
+    if (!backend) {
+        ggml_backend_sched_synchronize(opt_ctx->backend_sched);
+        ggml_backend_tensor_get(tensor, data, 0, ggml_nbytes(tensor));
+        return;
+    }
+    ggml_backend_tensor_get_async(backend, tensor, data, 0, ggml_nbytes(tensor));
+}
+
 static void ggml_opt_eval_graph(ggml_opt_context_t opt_ctx, ggml_cgraph * graph, ggml_opt_result * result) {
     if (graph != opt_ctx->gf) {
         struct ggml_opt_optimizer_params opt_pars = opt_ctx->get_opt_pars(opt_ctx->get_opt_pars_ud);
@@ -610,13 +1103,38 @@ static void ggml_opt_eval_graph(ggml_opt_context_t opt_ctx, ggml_cgraph * graph,
     }
 
     ggml_opt_alloc_graph(opt_ctx, graph);
-    ggml_backend_sched_graph_compute(opt_ctx->backend_sched, opt_ctx->allocated_graph_copy);
+    ggml_backend_sched_graph_compute_async(opt_ctx->backend_sched, opt_ctx->allocated_graph_copy);
     opt_ctx->iter += opt_ctx->allocated_graph == opt_ctx->gb_opt;
 
     if (!result) {
         return;
     }
 
+    GGML_ASSERT(ggml_is_scalar(opt_ctx->loss));
+    GGML_ASSERT(opt_ctx->loss->type == GGML_TYPE_F32);
+    GGML_ASSERT(opt_ctx->pred->type == GGML_TYPE_I32);
+
+    opt_ctx->pending.emplace_back();
+    ggml_opt_pending_result & pending = opt_ctx->pending.back();
+    pending.result = result;
+
+    pending.loss.resize(1);
+    ggml_opt_tensor_get_async(opt_ctx, opt_ctx->loss, pending.loss.data());
+
+    pending.pred.resize(opt_ctx->outputs->ne[1]);
+    ggml_opt_tensor_get_async(opt_ctx, opt_ctx->pred, pending.pred.data());
+
+    if (opt_ctx->labels) {
+        GGML_ASSERT(ggml_is_scalar(opt_ctx->ncorrect));
+        GGML_ASSERT(opt_ctx->ncorrect->type == GGML_TYPE_I64);
+        pending.ncorrect.resize(1);
+        ggml_opt_tensor_get_async(opt_ctx, opt_ctx->ncorrect, pending.ncorrect.data());
+    }
+}
+
+static void ggml_opt_result_add(ggml_opt_context_t opt_ctx, const ggml_opt_pending_result & pending) {
+    ggml_opt_result * result = pending.result;
+
     if (result->ndata == 0) {
         result->loss_per_datapoint = opt_ctx->loss_per_datapoint;
         result->opt_period         = opt_ctx->opt_period;
@@ -625,38 +1143,36 @@ static void ggml_opt_eval_graph(ggml_opt_context_t opt_ctx, ggml_cgraph * graph,
         GGML_ASSERT(result->opt_period         == opt_ctx->opt_period);
     }
 
-    const int64_t ndata = opt_ctx->outputs->ne[1];
+    const int64_t ndata = pending.pred.size();
     GGML_ASSERT(result->ndata == ndata*int64_t(result->loss.size()) && "varying batch size not supported");
     result->ndata += ndata;
 
-    GGML_ASSERT(ggml_is_scalar(opt_ctx->loss));
-    GGML_ASSERT(opt_ctx->loss->type == GGML_TYPE_F32);
-    float loss;
-    ggml_backend_tensor_get(opt_ctx->loss, &loss, 0, ggml_nbytes(opt_ctx->loss));
-    result->loss.push_back(loss);
-
-    GGML_ASSERT(opt_ctx->pred->type == GGML_TYPE_I32);
-    std::vector<int32_t> pred(ndata);
-    ggml_backend_tensor_get(opt_ctx->pred, pred.data(), 0, ggml_nbytes(opt_ctx->pred));
-    result->pred.insert(result->pred.end(), pred.begin(), pred.end());
+    result->loss.push_back(pending.loss[0]);
+    result->pred.insert(result->pred.end(), pending.pred.begin(), pending.pred.end());
 
-    if (!opt_ctx->labels || result->ncorrect < 0) {
+    if (pending.ncorrect.empty() || result->ncorrect < 0) {
         result->ncorrect = -1;
         return;
     }
 
-    GGML_ASSERT(ggml_is_scalar(opt_ctx->ncorrect));
-    GGML_ASSERT(opt_ctx->ncorrect->type == GGML_TYPE_I64);
-    int64_t ncorrect;
-    ggml_backend_tensor_get(opt_ctx->ncorrect, &ncorrect, 0, ggml_nbytes(opt_ctx->ncorrect));
-    result->ncorrect += ncorrect;
+    result->ncorrect += pending.ncorrect[0];
 }
 
 void ggml_opt_forward(ggml_opt_context_t opt_ctx, ggml_opt_result * result) {
-    ggml_opt_eval_graph(opt_ctx, opt_ctx->gf, result);
+    ggml_opt_forward_async(opt_ctx, result);
+    ggml_opt_synchronize(opt_ctx);
 }
 
 void ggml_opt_forward_backward(ggml_opt_context_t opt_ctx, ggml_opt_result * result) {
+    ggml_opt_forward_backward_async(opt_ctx, result);
+    ggml_opt_synchronize(opt_ctx);
+}
+
+void ggml_opt_forward_async(ggml_opt_context_t opt_ctx, ggml_opt_result * result) {
+    ggml_opt_eval_graph(opt_ctx, opt_ctx->gf, result);
+}
+
+void ggml_opt_forward_backward_async(ggml_opt_context_t opt_ctx, ggml_opt_result * result) {
     if (opt_ctx->opt_period == 1) {
         ggml_opt_eval_graph(opt_ctx, opt_ctx->gb_opt, result);
         return;
@@ -672,6 +1188,67 @@ void ggml_opt_forward_backward(ggml_opt_context_t opt_ctx, ggml_opt_result * res
     opt_ctx->opt_i = opt_i_next;
 }
 
+static void ggml_opt_wait_upload(ggml_opt_context_t opt_ctx) {
+    if (!opt_ctx->upload_backend) {
+        return;
+    }
+    if (opt_ctx->upload_event) {
+        ggml_backend_event_synchronize(opt_ctx->upload_event);
+    } else {
+        ggml_backend_synchronize(opt_ctx->upload_backend);
+    }
+    opt_ctx->upload_backend = nullptr;
+}
+
+void ggml_opt_set_batch_async(ggml_opt_context_t opt_ctx, const void * data_batch, const void * labels_batch) {
+    GGML_ASSERT(data_batch);
+    GGML_ASSERT(!labels_batch || opt_ctx->labels);
+
+    ggml_backend_t backend = ggml_opt_tensor_backend(opt_ctx, opt_ctx->inputs);
+    if (labels_batch && ggml_opt_tensor_backend(opt_ctx, opt_ctx->labels) != backend) {
+        backend = nullptr;
+    }
+
+    // the memory of the previous batch is only handed back to the user once its copy is done
+    ggml_opt_wait_upload(opt_ctx);
+
+    if (!backend) {
+        // the copies cannot be queued behind the evaluations, wait for them instead
+        ggml_backend_sched_synchronize(opt_ctx->backend_sched);
+        ggml_backend_tensor_set(opt_ctx->inputs, data_batch, 0, ggml_nbytes(opt_ctx->inputs));
+        if (labels_batch) {
+            ggml_backend_tensor_set(opt_ctx->labels, labels_batch, 0, ggml_nbytes(opt_ctx->labels));
+        }
+        return;
+    }
+
+    ggml_backend_tensor_set_async(backend, opt_ctx->inputs, data_batch, 0, ggml_nbytes(opt_ctx->inputs));
+    if (labels_batch) {
+        ggml_backend_tensor_set_async(backend, opt_ctx->labels, labels_batch, 0, ggml_nbytes(opt_ctx->labels));
+    }
+
+    if (!opt_ctx->upload_event || opt_ctx->upload_backend != backend) {
+        if (opt_ctx->upload_event) {
+            ggml_backend_event_free(opt_ctx->upload_event);
+        }
+        opt_ctx->upload_event = ggml_backend_event_new(ggml_backend_get_device(backend));
+    }
+    if (opt_ctx->upload_event) {
+        ggml_backend_event_record(opt_ctx->upload_event, backend);
+    }
+    opt_ctx->upload_backend = backend;
+}
+
+void ggml_opt_synchronize(ggml_opt_context_t opt_ctx) {
+    ggml_backend_sched_synchronize(opt_ctx->backend_sched);
+    opt_ctx->upload_backend = nullptr;
+
+    for (const ggml_opt_pending_result & pending : opt_ctx->pending) {
+        ggml_opt_result_add(opt_ctx, pending);
+    }
+    opt_ctx->pending.clear();
+}
+
 // ====== High-Level Functions ======
 
 void ggml_opt_epoch(
@@ -697,23 +1274,56 @@ void ggml_opt_epoch(
     GGML_ASSERT(idata_split % ndata_batch == 0);
     const int64_t ibatch_split = idata_split / ndata_batch;
 
+    // the batches are assembled in host memory and uploaded asynchronously:
+    // while batch ibatch is evaluated by the backends batch ibatch+1 is assembled in the other buffer,
+    // the results are only read back once the callbacks need them or at the end of the epoch
+    const size_t nb_data_batch   = ggml_nbytes(inputs);
+    const size_t nb_labels_batch = labels ? ggml_nbytes(labels) : 0;
+    std::vector<uint8_t> buf_data[2];
+    std::vector<uint8_t> buf_labels[2];
+    for (int i = 0; i < 2; ++i) {
+        buf_data[i].resize(nb_data_batch);
+        buf_labels[i].resize(nb_labels_batch);
+    }
+    auto get_batch = [&](int64_t ibatch) {
+        const int ibuf = ibatch % 2;
+        ggml_opt_dataset_get_batch_host(dataset, buf_data[ibuf].data(), nb_data_batch, labels ? buf_labels[ibuf].data() : nullptr, ibatch);
+    };
+    auto set_batch = [&](int64_t ibatch) {
+        const int ibuf = ibatch % 2;
+        ggml_opt_set_batch_async(opt_ctx, buf_data[ibuf].data(), labels ? buf_labels[ibuf].data() : nullptr);
+    };
+
     int64_t ibatch = 0;
+    if (nbatches > 0) {
+        get_batch(0);
+    }
     int64_t t_loop_start = ggml_time_us();
     for (; ibatch < ibatch_split; ++ibatch) {
-        ggml_opt_dataset_get_batch(dataset, inputs, labels, ibatch);
-        ggml_opt_forward_backward(opt_ctx, result_train);
+        set_batch(ibatch);
+        ggml_opt_forward_backward_async(opt_ctx, result_train);
+        if (ibatch + 1 < nbatches) {
+            get_batch(ibatch + 1);
+        }
         if (callback_train) {
+            ggml_opt_synchronize(opt_ctx);
             callback_train(true, opt_ctx, dataset, result_train, ibatch+1, ibatch_split, t_loop_start);
         }
     }
+    ggml_opt_synchronize(opt_ctx);
     t_loop_start = ggml_time_us();
     for (; ibatch < nbatches; ++ibatch) {
-        ggml_opt_dataset_get_batch(dataset, inputs, labels, ibatch);
-        ggml_opt_forward(opt_ctx, result_eval);
+        set_batch(ibatch);
+        ggml_opt_forward_async(opt_ctx, result_eval);
+        if (ibatch + 1 < nbatches) {
+            get_batch(ibatch + 1);
+        }
         if (callback_eval) {
+            ggml_opt_synchronize(opt_ctx);
             callback_eval(false, opt_ctx, dataset, result_eval, ibatch+1-ibatch_split, nbatches-ibatch_split, t_loop_start);
         }
     }
+    ggml_opt_synchronize(opt_ctx);
 }
 
 void ggml_opt_epoch_callback_progress_bar(
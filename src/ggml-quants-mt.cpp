@@ -0,0 +1,74 @@
+#include "ggml.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+bool ggml_quantize_chunk_mt(
+        enum ggml_type   type,
+           const float * src,
+                  void * dst,
+               int64_t   start,
+               int64_t   nrows,
+               int64_t   n_per_row,
+           const float * imatrix,
+                   int   n_threads,
+        ggml_quantize_progress_callback progress_cb,
+                  void * progress_cb_user_data,
+                size_t * size) {
+    GGML_ASSERT(n_threads > 0);
+    GGML_ASSERT(start % n_per_row == 0);
+
+    // initialize the quantization tables once, instead of having the workers wait for each other on it
+    ggml_quantize_init(type);
+
+    // chunks of at least 16k values, so that the overhead of scheduling them is negligible
+    const int64_t min_chunk_size = 32*512;
+    const int64_t chunk_rows     = std::max<int64_t>(1, (min_chunk_size + n_per_row - 1)/n_per_row);
+    const int64_t n_chunks       = (nrows + chunk_rows - 1)/chunk_rows;
+
+    n_threads = (int) std::max<int64_t>(1, std::min<int64_t>(n_threads, n_chunks));
+
+    std::atomic<int64_t> next_chunk{0};
+    std::atomic<size_t>  result{0};
+    std::atomic<bool>    cancelled{false};
+
+    std::mutex progress_mutex;
+    int64_t rows_done = 0;
+
+    auto worker = [&]() {
+        while (!cancelled) {
+            const int64_t chunk = next_chunk++;
+            if (chunk >= n_chunks) {
+                break;
+            }
+            const int64_t first_row   = chunk*chunk_rows;
+            const int64_t chunk_nrows = std::min(chunk_rows, nrows - first_row);
+
+            result += ggml_quantize_chunk(type, src, dst, start + first_row*n_per_row, chunk_nrows, n_per_row, imatrix);
+
+            if (progress_cb) {
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                rows_done += chunk_nrows;
+                if (!cancelled && !progress_cb(rows_done, nrows, progress_cb_user_data)) {
+                    cancelled = true;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(n_threads - 1);
+    for (int i = 1; i < n_threads; ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto & w : workers) {
+        w.join();
+    }
+
+    *size = cancelled ? 0 : result.load();
+    return !cancelled;
+}
@@ -2,11 +2,17 @@
 #include "ggml-impl.h"
 #include "ggml-backend-impl.h"
 
+#include <algorithm>
+#include <cfloat>
 #include <cinttypes>
+#include <cmath>
+#include <condition_variable>
 #include <string>
 #include <vector>
 #include <memory>
 #include <mutex>
+#include <random>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #ifdef _WIN32
@@ -24,7 +30,10 @@
 #  include <netinet/tcp.h>
 #  include <netdb.h>
 #  include <unistd.h>
+#  include <fcntl.h>
+#  include <poll.h>
 #endif
+#include <cerrno>
 #include <cstring>
 
 #ifdef _WIN32
@@ -34,9 +43,22 @@ using ssize_t = __int64;
 typedef int sockfd_t;
 #endif
 
+// a response to an asynchronous command that has not been received yet
+struct rpc_pending_response {
+    void * output;
+    size_t output_size;
+    // if set, the output holds tensor data in transfer_type that is converted to F32 into this pointer
+    float * converted = nullptr;
+    ggml_type transfer_type = GGML_TYPE_F32;
+    std::vector<uint8_t> storage;
+};
+
 // cross-platform socket
 struct socket_t {
     sockfd_t fd;
+    // responses of the pipelined commands, in the order the commands were sent
+    std::vector<rpc_pending_response> pending;
+    size_t pending_output_size = 0;
     socket_t(sockfd_t fd) : fd(fd) {}
     ~socket_t() {
         GGML_PRINT_DEBUG("[%s] closing socket %d\n", __func__, this->fd);
@@ -86,6 +108,15 @@ enum rpc_cmd {
     RPC_CMD_GET_DEVICE_MEMORY,
     RPC_CMD_INIT_TENSOR,
     RPC_CMD_GET_ALLOC_SIZE,
+    RPC_CMD_GRAPH_COMPUTE_DELTA,
+    RPC_CMD_COPY_TENSOR_PEER,
+    RPC_CMD_SET_TENSOR_PEER,
+    RPC_CMD_SET_TENSOR_CONVERTED,
+    RPC_CMD_GET_TENSOR_CONVERTED,
+    RPC_CMD_SET_TENSOR_FROM_FILE,
+    RPC_CMD_BUFFER_EXPORT_PEER,
+    RPC_CMD_SET_TENSOR_COMPRESSED,
+    RPC_CMD_SET_TENSOR_CONVERTED_PEER,
     RPC_CMD_COUNT,
 };
 
@@ -135,12 +166,78 @@ struct rpc_msg_buffer_clear_req {
     uint8_t value;
 };
 
+// allow peer servers to write to a buffer with RPC_CMD_SET_TENSOR_PEER and RPC_CMD_SET_TENSOR_CONVERTED_PEER
+// the writes must carry the token returned for the export, which the owner passes in rpc_msg_copy_tensor_peer_req
+struct rpc_msg_buffer_export_peer_req {
+    uint64_t remote_ptr;
+};
+
+struct rpc_msg_buffer_export_peer_rsp {
+    uint64_t token;
+};
+
+// the tensor data follows the request, see ggml_backend_rpc_buffer_set_tensor
+struct rpc_msg_set_tensor_req {
+    rpc_tensor tensor;
+    uint64_t offset;
+};
+
 struct rpc_msg_get_tensor_req {
     rpc_tensor tensor;
     uint64_t offset;
     uint64_t size;
 };
 
+// tensor data compressed with rpc_lz_compress, the compressed data follows the request
+// size is the size of the data once decompressed, at most RPC_CHUNK_SIZE
+struct rpc_msg_set_tensor_compressed_req {
+    rpc_tensor tensor;
+    uint64_t offset;
+    uint64_t size;
+};
+
+// F32 tensor data sent converted to a smaller type, see ggml_backend_rpc_set_transfer_type
+// offset and size refer to the F32 data, the converted data follows the request
+struct rpc_msg_set_tensor_converted_req {
+    rpc_tensor tensor;
+    uint64_t offset;
+    uint32_t type;
+};
+
+// writes from a peer server, with the token of the export of the buffer, see rpc_msg_buffer_export_peer_req
+struct rpc_msg_set_tensor_peer_req {
+    uint64_t token;
+    rpc_msg_set_tensor_req req;
+};
+
+struct rpc_msg_set_tensor_converted_peer_req {
+    uint64_t token;
+    rpc_msg_set_tensor_converted_req req;
+};
+
+struct rpc_msg_get_tensor_converted_req {
+    rpc_tensor tensor;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t type;
+};
+
+#define RPC_MAX_PATH 1024
+
+// read tensor data from a file on the server host
+struct rpc_msg_set_tensor_from_file_req {
+    rpc_tensor tensor;
+    uint64_t offset;
+    uint64_t file_offset;
+    uint64_t size;
+    uint64_t hash; // rpc_hash of the data, 0 to skip the check
+    char path[RPC_MAX_PATH];
+};
+
+struct rpc_msg_set_tensor_from_file_rsp {
+    uint8_t result;
+};
+
 struct rpc_msg_copy_tensor_req {
     rpc_tensor src;
     rpc_tensor dst;
@@ -150,16 +247,47 @@ struct rpc_msg_copy_tensor_rsp {
     uint8_t result;
 };
 
+#define RPC_MAX_ENDPOINT 256
+
+// default number of clients served concurrently by a server, can be changed with GGML_RPC_MAX_CLIENTS
+// the connections of peer servers are not counted
+#define RPC_MAX_CLIENTS 16
+
+// a copy to a peer server fails if connecting to it or sending to it does not progress for this long
+#define RPC_PEER_TIMEOUT_MS 10000
+
+// copy a tensor of this server to a tensor of the server at dst_endpoint
+// dst_token is the token of the export of the buffer of dst, see rpc_msg_buffer_export_peer_req
+// F32 data is sent converted to type if it is not GGML_TYPE_F32, see ggml_backend_rpc_set_transfer_type
+struct rpc_msg_copy_tensor_peer_req {
+    rpc_tensor src;
+    rpc_tensor dst;
+    char dst_endpoint[RPC_MAX_ENDPOINT];
+    uint32_t type;
+    uint64_t dst_token;
+};
+
 struct rpc_msg_graph_compute_rsp {
     uint8_t result;
 };
 
+struct rpc_msg_graph_compute_delta_rsp {
+    uint8_t cached; // 0 if the server does not have the base graph, the full graph must be sent
+    uint8_t result;
+};
+
 struct rpc_msg_get_device_memory_rsp {
     uint64_t free_mem;
     uint64_t total_mem;
 };
 #pragma pack(pop)
 
+// tensor data that cannot be received into / sent from host memory directly is staged in chunks of this size
+#define RPC_CHUNK_SIZE (4*1024*1024)
+
+// maximum number of asynchronous commands in flight on a connection
+#define RPC_MAX_PENDING 256
+
 // RPC data structures
 
 static ggml_guid_t ggml_backend_rpc_guid() {
@@ -177,12 +305,22 @@ struct ggml_backend_rpc_buffer_type_context {
 struct ggml_backend_rpc_context {
     std::string endpoint;
     std::string name;
+    // type of the F32 tensor data transferred by the async set/get/copy functions
+    ggml_type transfer_type;
+    // names of the tensors whose data is converted, or all the tensors outside of weight buffers,
+    // see ggml_backend_rpc_set_tensor_transfer
+    std::unordered_set<std::string> transfer_names;
+    bool transfer_all;
+    // the last graph sent to the server, subsequent graphs are sent as a delta against it
+    std::vector<uint8_t> last_graph;
 };
 
 struct ggml_backend_rpc_buffer_context {
     std::shared_ptr<socket_t> sock;
     void * base_ptr;
     uint64_t remote_ptr;
+    // token of the export of the buffer for writes from peer servers, 0 if not exported
+    uint64_t peer_token = 0;
 };
 
 // RPC helper functions
@@ -213,7 +351,72 @@ static bool set_reuse_addr(sockfd_t sockfd) {
     return ret == 0;
 }
 
-static std::shared_ptr<socket_t> socket_connect(const char * host, int port) {
+static bool set_timeout(sockfd_t sockfd, int timeout_ms) {
+#ifdef _WIN32
+    DWORD t = timeout_ms;
+#else
+    struct timeval t;
+    t.tv_sec = timeout_ms / 1000;
+    t.tv_usec = (timeout_ms % 1000) * 1000;
+#endif
+    return setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&t, sizeof(t)) == 0 &&
+           setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, (const char *)&t, sizeof(t)) == 0;
+}
+
+// connect without waiting for more than timeout_ms
+static bool connect_timeout(sockfd_t sockfd, const struct sockaddr_in & addr, int timeout_ms) {
+#ifdef _WIN32
+    u_long mode = 1;
+    if (ioctlsocket(sockfd, FIONBIO, &mode) != 0) {
+        return false;
+    }
+    if (connect(sockfd, (const struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        if (WSAGetLastError() != WSAEWOULDBLOCK) {
+            return false;
+        }
+        fd_set wfds;
+        fd_set efds;
+        FD_ZERO(&wfds);
+        FD_ZERO(&efds);
+        FD_SET(sockfd, &wfds);
+        FD_SET(sockfd, &efds);
+        struct timeval tv;
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        if (select(0, NULL, &wfds, &efds, &tv) <= 0 || FD_ISSET(sockfd, &efds)) {
+            return false;
+        }
+    }
+    mode = 0;
+    return ioctlsocket(sockfd, FIONBIO, &mode) == 0;
+#else
+    const int flags = fcntl(sockfd, F_GETFL, 0);
+    if (flags < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return false;
+    }
+    if (connect(sockfd, (const struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        if (errno != EINPROGRESS) {
+            return false;
+        }
+        struct pollfd pfd;
+        pfd.fd = sockfd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            return false;
+        }
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            return false;
+        }
+    }
+    return fcntl(sockfd, F_SETFL, flags) == 0;
+#endif
+}
+
+// with timeout_ms > 0, connecting and each send and receive fail after waiting for that long
+static std::shared_ptr<socket_t> socket_connect(const char * host, int port, int timeout_ms = 0) {
     struct sockaddr_in addr;
     auto sockfd = socket(AF_INET, SOCK_STREAM, 0);
     auto sock_ptr = make_socket(sockfd);
@@ -232,6 +435,12 @@ static std::shared_ptr<socket_t> socket_connect(const char * host, int port) {
         return nullptr;
     }
     memcpy(&addr.sin_addr.s_addr, server->h_addr, server->h_length);
+    if (timeout_ms > 0) {
+        if (!connect_timeout(sock_ptr->fd, addr, timeout_ms) || !set_timeout(sock_ptr->fd, timeout_ms)) {
+            return nullptr;
+        }
+        return sock_ptr;
+    }
     if (connect(sock_ptr->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
         return nullptr;
     }
@@ -273,7 +482,7 @@ static std::shared_ptr<socket_t> create_server_socket(const char * host, int por
     if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
         return nullptr;
     }
-    if (listen(sockfd, 1) < 0) {
+    if (listen(sockfd, SOMAXCONN) < 0) {
         return nullptr;
     }
     return sock;
@@ -345,19 +554,212 @@ static bool parse_endpoint(const std::string & endpoint, std::string & host, int
     return true;
 }
 
+static bool rpc_transfer_type_supported(uint32_t type) {
+    return type == GGML_TYPE_F16 || type == GGML_TYPE_BF16 || type == GGML_TYPE_Q8_0;
+}
+
+// whether [offset, offset + size) of an F32 tensor can be transferred as whole blocks of type
+static bool rpc_can_convert(uint32_t tensor_type, uint32_t type, uint64_t offset, uint64_t size) {
+    return tensor_type == GGML_TYPE_F32 && rpc_transfer_type_supported(type) &&
+           offset % sizeof(float) == 0 && size % (sizeof(float)*ggml_blck_size((ggml_type) type)) == 0;
+}
+
+// whether the F32 values can be converted without turning them into non-finite values (e.g. -INF in a mask)
+static bool rpc_can_convert_data(uint32_t type, const float * data, int64_t n) {
+    // F16 overflows beyond its largest finite value
+    const float max = type == GGML_TYPE_F16 ? 65504.0f : FLT_MAX;
+    for (int64_t i = 0; i < n; i++) {
+        if (!(std::fabs(data[i]) <= max)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// lossless block codec for the uploads of weights, in the format of LZ4 blocks:
+// sequences of | token (4 bits literal length, 4 bits match length - 4) | literal length - 15 (in bytes of 255, if 15) |
+// literals | match offset (2 bytes) | match length - 19 (in bytes of 255, if 15) |
+// the last sequence has only literals
+#define RPC_LZ_MIN_MATCH 4
+#define RPC_LZ_MAX_OFFSET 65535
+#define RPC_LZ_HASH_BITS 14
+
+static bool rpc_lz_put_length(uint8_t * dst, size_t cap, size_t & op, size_t len) {
+    for (; len >= 255; len -= 255) {
+        if (op >= cap) {
+            return false;
+        }
+        dst[op++] = 255;
+    }
+    if (op >= cap) {
+        return false;
+    }
+    dst[op++] = (uint8_t) len;
+    return true;
+}
+
+static bool rpc_lz_put_sequence(uint8_t * dst, size_t cap, size_t & op, const uint8_t * literals, size_t n_literals,
+                                size_t match_len, size_t match_offset) {
+    const size_t ml = match_len > 0 ? match_len - RPC_LZ_MIN_MATCH : 0;
+    if (op >= cap) {
+        return false;
+    }
+    dst[op++] = (uint8_t) ((std::min<size_t>(n_literals, 15) << 4) | std::min<size_t>(ml, 15));
+    if (n_literals >= 15 && !rpc_lz_put_length(dst, cap, op, n_literals - 15)) {
+        return false;
+    }
+    if (n_literals > cap - op) {
+        return false;
+    }
+    memcpy(dst + op, literals, n_literals);
+    op += n_literals;
+    if (match_len == 0) {
+        return true;
+    }
+    if (cap - op < 2) {
+        return false;
+    }
+    dst[op++] = (uint8_t) (match_offset & 0xff);
+    dst[op++] = (uint8_t) (match_offset >> 8);
+    return ml < 15 || rpc_lz_put_length(dst, cap, op, ml - 15);
+}
+
+// returns the compressed size, or 0 if the data does not compress to less than cap bytes
+// the matches are searched less often in data that does not compress, and the compression is abandoned
+// if the data compressed so far did not shrink in the same proportion as required of all of it
+static size_t rpc_lz_compress(const uint8_t * src, size_t n, uint8_t * dst, size_t cap) {
+    GGML_ASSERT(n <= UINT32_MAX);
+    std::vector<uint32_t> table(1 << RPC_LZ_HASH_BITS, UINT32_MAX);
+    size_t op = 0;
+    size_t anchor = 0;
+    size_t ip = 0;
+    size_t n_misses = 0;
+    size_t next_check = 64*1024;
+    while (n >= RPC_LZ_MIN_MATCH && ip <= n - RPC_LZ_MIN_MATCH) {
+        if (ip >= next_check) {
+            // the pending literals count as they will be emitted
+            if ((double) (op + ip - anchor) / ip > (double) cap / n) {
+                return 0;
+            }
+            next_check *= 2;
+        }
+        uint32_t seq;
+        memcpy(&seq, src + ip, sizeof(seq));
+        const uint32_t h = (seq * 2654435761u) >> (32 - RPC_LZ_HASH_BITS);
+        const uint32_t cand = table[h];
+        table[h] = (uint32_t) ip;
+        if (cand != UINT32_MAX && ip - cand <= RPC_LZ_MAX_OFFSET && memcmp(src + cand, src + ip, RPC_LZ_MIN_MATCH) == 0) {
+            size_t len = RPC_LZ_MIN_MATCH;
+            while (ip + len + sizeof(uint64_t) <= n) {
+                uint64_t a;
+                uint64_t b;
+                memcpy(&a, src + cand + len, sizeof(a));
+                memcpy(&b, src + ip + len, sizeof(b));
+                if (a != b) {
+                    break;
+                }
+                len += sizeof(uint64_t);
+            }
+            while (ip + len < n && src[cand + len] == src[ip + len]) {
+                len++;
+            }
+            if (!rpc_lz_put_sequence(dst, cap, op, src + anchor, ip - anchor, len, ip - cand)) {
+                return 0;
+            }
+            ip += len;
+            anchor = ip;
+            n_misses = 0;
+        } else {
+            ip += 1 + (n_misses++ >> 6);
+        }
+    }
+    if (!rpc_lz_put_sequence(dst, cap, op, src + anchor, n - anchor, 0, 0)) {
+        return 0;
+    }
+    return op;
+}
+
+// returns false if the data is corrupted or does not decompress to exactly dst_size bytes
+static bool rpc_lz_decompress(const uint8_t * src, size_t n, uint8_t * dst, size_t dst_size) {
+    auto get_length = [&](size_t & ip, size_t & len) {
+        uint8_t b;
+        do {
+            if (ip >= n) {
+                return false;
+            }
+            b = src[ip++];
+            len += b;
+        } while (b == 255);
+        return true;
+    };
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < n) {
+        const uint8_t token = src[ip++];
+        size_t n_literals = token >> 4;
+        if (n_literals == 15 && !get_length(ip, n_literals)) {
+            return false;
+        }
+        if (n_literals > n - ip || n_literals > dst_size - op) {
+            return false;
+        }
+        memcpy(dst + op, src + ip, n_literals);
+        ip += n_literals;
+        op += n_literals;
+        if (ip == n) {
+            break;
+        }
+        if (n - ip < 2) {
+            return false;
+        }
+        const size_t offset = src[ip] | ((size_t) src[ip + 1] << 8);
+        ip += 2;
+        size_t len = token & 15;
+        if (len == 15 && !get_length(ip, len)) {
+            return false;
+        }
+        len += RPC_LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || len > dst_size - op) {
+            return false;
+        }
+        // the match can overlap the data it produces
+        for (size_t i = 0; i < len; i++) {
+            dst[op + i] = dst[op - offset + i];
+        }
+        op += len;
+    }
+    return op == dst_size;
+}
+
+// FNV-1a, hash can be the result of a previous call to continue hashing
+static uint64_t rpc_hash(const uint8_t * data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
 // RPC request : | rpc_cmd (1 byte) | request_size (8 bytes) | request_data (request_size bytes) |
 // RPC response: | response_size (8 bytes) | response_data (response_size bytes) |
-static bool send_rpc_cmd(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cmd, const void * input, size_t input_size, void * output, size_t output_size) {
+// the request data is sent as the input followed by an optional payload, which is sent directly from its memory
+static bool send_rpc_req(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cmd, const void * input, size_t input_size,
+                         const void * payload, size_t payload_size) {
     uint8_t cmd_byte = cmd;
     if (!send_data(sock->fd, &cmd_byte, sizeof(cmd_byte))) {
         return false;
     }
-    if (!send_data(sock->fd, &input_size, sizeof(input_size))) {
+    uint64_t request_size = input_size + payload_size;
+    if (!send_data(sock->fd, &request_size, sizeof(request_size))) {
         return false;
     }
     if (!send_data(sock->fd, input, input_size)) {
         return false;
     }
+    return send_data(sock->fd, payload, payload_size);
+}
+
+static bool recv_rpc_rsp(const std::shared_ptr<socket_t> & sock, void * output, size_t output_size) {
     // TODO: currently the output_size is always known, do we need support for commands with variable output size?
     // even if we do, we can skip sending output_size from the server for commands with known output size
     uint64_t out_size;
@@ -373,6 +775,69 @@ static bool send_rpc_cmd(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cm
     return true;
 }
 
+// receive the responses of all the pipelined commands
+static bool recv_pending_rsp(const std::shared_ptr<socket_t> & sock) {
+    bool ok = true;
+    for (const auto & rsp : sock->pending) {
+        ok = ok && recv_rpc_rsp(sock, rsp.output, rsp.output_size);
+        if (ok && rsp.converted != nullptr) {
+            const int64_t n = rsp.output_size / ggml_type_size(rsp.transfer_type) * ggml_blck_size(rsp.transfer_type);
+            ggml_get_type_traits(rsp.transfer_type)->to_float(rsp.output, rsp.converted, n);
+        }
+    }
+    sock->pending.clear();
+    sock->pending_output_size = 0;
+    return ok;
+}
+
+// the server processes the commands of a connection in order, so the request is sent before
+// waiting for the responses of the previous asynchronous commands
+static bool send_rpc_cmd(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cmd, const void * input, size_t input_size,
+                         const void * payload, size_t payload_size, void * output, size_t output_size) {
+    if (sock->pending_output_size > 0 && !recv_pending_rsp(sock)) {
+        return false;
+    }
+    if (!send_rpc_req(sock, cmd, input, input_size, payload, payload_size)) {
+        return false;
+    }
+    if (!recv_pending_rsp(sock)) {
+        return false;
+    }
+    return recv_rpc_rsp(sock, output, output_size);
+}
+
+// send a command without waiting for the response, which is received into output by the next
+// synchronous command or by recv_pending_rsp
+// the input and payload are sent before returning, output must remain valid until the response is received
+static bool send_rpc_cmd_async(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cmd, const void * input, size_t input_size,
+                               const void * payload, size_t payload_size, rpc_pending_response && rsp) {
+    // the server blocks while sending a large response that is not being received, and would stop
+    // reading further requests, so only small responses are left in the socket buffers
+    if (sock->pending_output_size > 0 || sock->pending.size() >= RPC_MAX_PENDING) {
+        if (!recv_pending_rsp(sock)) {
+            return false;
+        }
+    }
+    if (!send_rpc_req(sock, cmd, input, input_size, payload, payload_size)) {
+        return false;
+    }
+    sock->pending_output_size += rsp.output_size;
+    sock->pending.push_back(std::move(rsp));
+    return true;
+}
+
+static bool send_rpc_cmd_async(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cmd, const void * input, size_t input_size,
+                               const void * payload, size_t payload_size, void * output, size_t output_size) {
+    rpc_pending_response rsp;
+    rsp.output = output;
+    rsp.output_size = output_size;
+    return send_rpc_cmd_async(sock, cmd, input, input_size, payload, payload_size, std::move(rsp));
+}
+
+static bool send_rpc_cmd(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cmd, const void * input, size_t input_size, void * output, size_t output_size) {
+    return send_rpc_cmd(sock, cmd, input, input_size, nullptr, 0, output, output_size);
+}
+
 // RPC client-side implementation
 
 static std::shared_ptr<socket_t> get_socket(const std::string & endpoint) {
@@ -436,6 +901,8 @@ static void * ggml_backend_rpc_buffer_get_base(ggml_backend_buffer_t buffer) {
 
 static rpc_tensor serialize_tensor(const ggml_tensor * tensor) {
     rpc_tensor result;
+    // zero the padding and the unused name bytes, serialized graphs are compared byte-wise
+    memset(&result, 0, sizeof(result));
     result.id = reinterpret_cast<uint64_t>(tensor);
     result.type = tensor->type;
     if (tensor->buffer) {
@@ -481,16 +948,54 @@ static enum ggml_status ggml_backend_rpc_buffer_init_tensor(ggml_backend_buffer_
     return GGML_STATUS_SUCCESS;
 }
 
+static bool ggml_backend_rpc_is_weights(const ggml_tensor * tensor) {
+    ggml_backend_buffer_t buf = tensor->view_src ? tensor->view_src->buffer : tensor->buffer;
+    return buf != nullptr && ggml_backend_buffer_get_usage(buf) == GGML_BACKEND_BUFFER_USAGE_WEIGHTS;
+}
+
+// send the data in chunks, each one compressed if that makes it smaller, as pipelined commands
+// used for the uploads of weights, the data is sent before returning
+static bool rpc_set_tensor_compressed(const std::shared_ptr<socket_t> & sock, const ggml_tensor * tensor, const void * data, size_t offset, size_t size) {
+    std::vector<uint8_t> compressed(std::min(size, (size_t) RPC_CHUNK_SIZE));
+    for (size_t pos = 0; pos < size; pos += RPC_CHUNK_SIZE) {
+        const size_t n = std::min((size_t) RPC_CHUNK_SIZE, size - pos);
+        const uint8_t * chunk = (const uint8_t *) data + pos;
+        // the server decompresses the chunk in addition to receiving it, so it must be at least 1/32 smaller
+        const size_t n_compressed = rpc_lz_compress(chunk, n, compressed.data(), n - n/32);
+        bool status;
+        if (n_compressed > 0) {
+            rpc_msg_set_tensor_compressed_req request;
+            request.tensor = serialize_tensor(tensor);
+            request.offset = offset + pos;
+            request.size = n;
+            status = send_rpc_cmd_async(sock, RPC_CMD_SET_TENSOR_COMPRESSED, &request, sizeof(request), compressed.data(), n_compressed, nullptr, 0);
+        } else {
+            rpc_msg_set_tensor_req request;
+            request.tensor = serialize_tensor(tensor);
+            request.offset = offset + pos;
+            status = send_rpc_cmd_async(sock, RPC_CMD_SET_TENSOR, &request, sizeof(request), chunk, n, nullptr, 0);
+        }
+        if (!status) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static void ggml_backend_rpc_buffer_set_tensor(ggml_backend_buffer_t buffer, ggml_tensor * tensor, const void * data, size_t offset, size_t size) {
     ggml_backend_rpc_buffer_context * ctx = (ggml_backend_rpc_buffer_context *)buffer->context;
+    if (ggml_backend_rpc_is_weights(tensor)) {
+        // weights are compressed losslessly
+        bool status = rpc_set_tensor_compressed(ctx->sock, tensor, data, offset, size) && recv_pending_rsp(ctx->sock);
+        GGML_ASSERT(status);
+        return;
+    }
     // input serialization format: | rpc_tensor | offset (8 bytes) | data (size bytes) |
-    size_t input_size = sizeof(rpc_tensor) + sizeof(uint64_t) + size;
-    std::vector<uint8_t> input(input_size, 0);
-    rpc_tensor rpc_tensor = serialize_tensor(tensor);
-    memcpy(input.data(), &rpc_tensor, sizeof(rpc_tensor));
-    memcpy(input.data() + sizeof(rpc_tensor), &offset, sizeof(offset));
-    memcpy(input.data() + sizeof(rpc_tensor) + sizeof(offset), data, size);
-    bool status = send_rpc_cmd(ctx->sock, RPC_CMD_SET_TENSOR, input.data(), input.size(), nullptr, 0);
+    // the data is streamed from the caller's memory without an intermediate copy
+    rpc_msg_set_tensor_req request;
+    request.tensor = serialize_tensor(tensor);
+    request.offset = offset;
+    bool status = send_rpc_cmd(ctx->sock, RPC_CMD_SET_TENSOR, &request, sizeof(request), data, size, nullptr, 0);
     GGML_ASSERT(status);
 }
 
@@ -504,14 +1009,49 @@ static void ggml_backend_rpc_buffer_get_tensor(ggml_backend_buffer_t buffer, con
     GGML_ASSERT(status);
 }
 
+// copy between tensors of different servers: the source server sends the data directly to the destination server
+// F32 data is converted to type on the way if it is not GGML_TYPE_F32
+static bool ggml_backend_rpc_copy_tensor_peer(const ggml_tensor * src, ggml_tensor * dst, ggml_type type) {
+    ggml_backend_rpc_buffer_context * src_ctx = (ggml_backend_rpc_buffer_context *)src->buffer->context;
+    ggml_backend_buffer_t dst_buffer = dst->buffer;
+    ggml_backend_rpc_buffer_context * dst_ctx = (ggml_backend_rpc_buffer_context *)dst_buffer->context;
+    const std::string & dst_endpoint = ((ggml_backend_rpc_buffer_type_context *)dst_buffer->buft->context)->endpoint;
+    if (dst_endpoint.size() >= RPC_MAX_ENDPOINT) {
+        return false;
+    }
+    // the commands already sent to the destination server must complete before the copy
+    bool status = recv_pending_rsp(dst_ctx->sock);
+    GGML_ASSERT(status);
+    if (dst_ctx->peer_token == 0) {
+        // peer servers can only write to the buffers that their owner has exported, with the token of the export
+        rpc_msg_buffer_export_peer_req export_request = {dst_ctx->remote_ptr};
+        rpc_msg_buffer_export_peer_rsp export_response;
+        status = send_rpc_cmd(dst_ctx->sock, RPC_CMD_BUFFER_EXPORT_PEER, &export_request, sizeof(export_request), &export_response, sizeof(export_response));
+        GGML_ASSERT(status);
+        dst_ctx->peer_token = export_response.token;
+    }
+    rpc_msg_copy_tensor_peer_req request;
+    memset(&request, 0, sizeof(request));
+    request.src = serialize_tensor(src);
+    request.dst = serialize_tensor(dst);
+    snprintf(request.dst_endpoint, sizeof(request.dst_endpoint), "%s", dst_endpoint.c_str());
+    request.type = type;
+    request.dst_token = dst_ctx->peer_token;
+    rpc_msg_copy_tensor_rsp response;
+    status = send_rpc_cmd(src_ctx->sock, RPC_CMD_COPY_TENSOR_PEER, &request, sizeof(request), &response, sizeof(response));
+    GGML_ASSERT(status);
+    return response.result;
+}
+
 static bool ggml_backend_rpc_buffer_cpy_tensor(ggml_backend_buffer_t buffer, const ggml_tensor * src, ggml_tensor * dst) {
-    // check if src and dst are on the same server
     ggml_backend_buffer_t src_buffer = src->buffer;
+    if (src_buffer->iface.get_base != ggml_backend_rpc_buffer_get_base) {
+        return false;
+    }
     ggml_backend_rpc_buffer_context * src_ctx = (ggml_backend_rpc_buffer_context *)src_buffer->context;
-    ggml_backend_buffer_t dst_buffer = dst->buffer;
-    ggml_backend_rpc_buffer_context * dst_ctx = (ggml_backend_rpc_buffer_context *)dst_buffer->context;
+    ggml_backend_rpc_buffer_context * dst_ctx = (ggml_backend_rpc_buffer_context *)dst->buffer->context;
     if (src_ctx->sock != dst_ctx->sock) {
-        return false;
+        return ggml_backend_rpc_copy_tensor_peer(src, dst, GGML_TYPE_F32);
     }
     ggml_backend_rpc_buffer_context * ctx = (ggml_backend_rpc_buffer_context *)buffer->context;
     rpc_msg_copy_tensor_req request;
@@ -630,9 +1170,116 @@ static void ggml_backend_rpc_free(ggml_backend_t backend) {
     delete backend;
 }
 
+// the data of the tensors selected with ggml_backend_rpc_set_tensor_transfer is converted, by their name or the name
+// of the tensor they are a copy of (src), the data of weights never is
+static bool ggml_backend_rpc_convert_tensor(const ggml_backend_rpc_context * rpc_ctx, const ggml_tensor * tensor, const ggml_tensor * src = nullptr) {
+    if (rpc_ctx->transfer_type == GGML_TYPE_F32 || ggml_backend_rpc_is_weights(tensor) || (src && ggml_backend_rpc_is_weights(src))) {
+        return false;
+    }
+    return rpc_ctx->transfer_all ||
+           rpc_ctx->transfer_names.count(tensor->name) > 0 ||
+           (src && rpc_ctx->transfer_names.count(src->name) > 0);
+}
+
+static void ggml_backend_rpc_set_tensor_async_impl(ggml_backend_t backend, ggml_tensor * tensor, const void * data, size_t offset, size_t size, bool convert) {
+    ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend->context;
+    ggml_backend_buffer_t buf = tensor->view_src ? tensor->view_src->buffer : tensor->buffer;
+    ggml_backend_rpc_buffer_context * ctx = (ggml_backend_rpc_buffer_context *)buf->context;
+    if (ggml_backend_rpc_is_weights(tensor)) {
+        bool status = rpc_set_tensor_compressed(ctx->sock, tensor, data, offset, size);
+        GGML_ASSERT(status);
+        return;
+    }
+    if (convert && rpc_can_convert(tensor->type, rpc_ctx->transfer_type, offset, size) &&
+        rpc_can_convert_data(rpc_ctx->transfer_type, (const float *) data, size / sizeof(float))) {
+        const ggml_type type = rpc_ctx->transfer_type;
+        const int64_t n = size / sizeof(float);
+        std::vector<uint8_t> converted(ggml_row_size(type, n));
+        ggml_get_type_traits(type)->from_float_ref((const float *) data, converted.data(), n);
+
+        rpc_msg_set_tensor_converted_req request;
+        request.tensor = serialize_tensor(tensor);
+        request.offset = offset;
+        request.type = type;
+        bool status = send_rpc_cmd_async(ctx->sock, RPC_CMD_SET_TENSOR_CONVERTED, &request, sizeof(request), converted.data(), converted.size(), nullptr, 0);
+        GGML_ASSERT(status);
+        return;
+    }
+    rpc_msg_set_tensor_req request;
+    request.tensor = serialize_tensor(tensor);
+    request.offset = offset;
+    bool status = send_rpc_cmd_async(ctx->sock, RPC_CMD_SET_TENSOR, &request, sizeof(request), data, size, nullptr, 0);
+    GGML_ASSERT(status);
+}
+
+static void ggml_backend_rpc_set_tensor_async(ggml_backend_t backend, ggml_tensor * tensor, const void * data, size_t offset, size_t size) {
+    ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend->context;
+    ggml_backend_rpc_set_tensor_async_impl(backend, tensor, data, offset, size, ggml_backend_rpc_convert_tensor(rpc_ctx, tensor));
+}
+
+static void ggml_backend_rpc_get_tensor_async(ggml_backend_t backend, const ggml_tensor * tensor, void * data, size_t offset, size_t size) {
+    ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend->context;
+    ggml_backend_buffer_t buf = tensor->view_src ? tensor->view_src->buffer : tensor->buffer;
+    ggml_backend_rpc_buffer_context * ctx = (ggml_backend_rpc_buffer_context *)buf->context;
+    if (ggml_backend_rpc_convert_tensor(rpc_ctx, tensor) && rpc_can_convert(tensor->type, rpc_ctx->transfer_type, offset, size)) {
+        const ggml_type type = rpc_ctx->transfer_type;
+        rpc_pending_response rsp;
+        rsp.storage.resize(ggml_row_size(type, size / sizeof(float)));
+        rsp.output = rsp.storage.data();
+        rsp.output_size = rsp.storage.size();
+        rsp.converted = (float *) data;
+        rsp.transfer_type = type;
+
+        rpc_msg_get_tensor_converted_req request;
+        request.tensor = serialize_tensor(tensor);
+        request.offset = offset;
+        request.size = size;
+        request.type = type;
+        bool status = send_rpc_cmd_async(ctx->sock, RPC_CMD_GET_TENSOR_CONVERTED, &request, sizeof(request), nullptr, 0, std::move(rsp));
+        GGML_ASSERT(status);
+        return;
+    }
+    rpc_msg_get_tensor_req request;
+    request.tensor = serialize_tensor(tensor);
+    request.offset = offset;
+    request.size = size;
+    bool status = send_rpc_cmd_async(ctx->sock, RPC_CMD_GET_TENSOR, &request, sizeof(request), nullptr, 0, data, size);
+    GGML_ASSERT(status);
+}
+
+static bool ggml_backend_rpc_cpy_tensor_async(ggml_backend_t backend_src, ggml_backend_t backend_dst, const ggml_tensor * src, ggml_tensor * dst) {
+    // uploads from host memory (e.g. the graph inputs copied by ggml_backend_sched) are pipelined,
+    // copies from another server (e.g. the activations at a split boundary) are sent by that server
+    ggml_backend_buffer_t src_buf = src->view_src ? src->view_src->buffer : src->buffer;
+    ggml_backend_buffer_t dst_buf = dst->view_src ? dst->view_src->buffer : dst->buffer;
+    if (dst_buf->iface.get_base != ggml_backend_rpc_buffer_get_base) {
+        return false;
+    }
+    const bool src_is_rpc = src_buf->iface.get_base == ggml_backend_rpc_buffer_get_base;
+    if (src_is_rpc && ((ggml_backend_rpc_buffer_context *)src_buf->context)->sock == ((ggml_backend_rpc_buffer_context *)dst_buf->context)->sock) {
+        // copied within the server by ggml_backend_rpc_buffer_cpy_tensor
+        return false;
+    }
+    if (!src_is_rpc && !ggml_backend_buffer_is_host(src_buf)) {
+        return false;
+    }
+    // the data is sent before returning, so it only has to be ready on the source backend
+    ggml_backend_synchronize(backend_src);
+    // the copies made by ggml_backend_sched are converted if the tensor they copy is selected
+    ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend_dst->context;
+    const bool convert = ggml_backend_rpc_convert_tensor(rpc_ctx, dst, src);
+    if (src_is_rpc) {
+        return ggml_backend_rpc_copy_tensor_peer(src, dst, convert ? rpc_ctx->transfer_type : GGML_TYPE_F32);
+    }
+    ggml_backend_rpc_set_tensor_async_impl(backend_dst, dst, src->data, 0, ggml_nbytes(src), convert);
+    return true;
+}
+
 static void ggml_backend_rpc_synchronize(ggml_backend_t backend) {
-    GGML_UNUSED(backend);
-    // this is no-op because we don't have any async operations
+    ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend->context;
+    auto sock = get_socket(rpc_ctx->endpoint);
+    bool status = recv_pending_rsp(sock);
+    GGML_ASSERT(status);
 }
 
 static void add_tensor(ggml_tensor * tensor, std::vector<rpc_tensor> & tensors, std::unordered_set<ggml_tensor*> & visited) {
@@ -672,23 +1319,77 @@ static void serialize_graph(const ggml_cgraph * cgraph, std::vector<uint8_t> & o
     memcpy(out_tensors, tensors.data(), n_tensors * sizeof(rpc_tensor));
 }
 
-static enum ggml_status ggml_backend_rpc_graph_compute(ggml_backend_t backend, ggml_cgraph * cgraph) {
-    ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend->context;
-    std::vector<uint8_t> input;
-    serialize_graph(cgraph, input);
-    rpc_msg_graph_compute_rsp response;
-    auto sock = get_socket(rpc_ctx->endpoint);
-    bool status = send_rpc_cmd(sock, RPC_CMD_GRAPH_COMPUTE, input.data(), input.size(), &response, sizeof(response));
-    GGML_ASSERT(status);
-    return (enum ggml_status)response.result;
+// for decoding, consecutive graphs are usually identical except for a few tensors (e.g. KV cache views)
+// if the graph has the same nodes and tensors as the previous one, only the tensors that changed are sent:
+// | base_hash (8 bytes) | n_changed (4 bytes) | changed (n_changed * (index (4 bytes) | rpc_tensor)) |
+static bool serialize_graph_delta(const std::vector<uint8_t> & prev, const std::vector<uint8_t> & cur, std::vector<uint8_t> & output) {
+    if (prev.size() != cur.size() || prev.empty()) {
+        return false;
+    }
+    uint32_t n_nodes;
+    memcpy(&n_nodes, cur.data(), sizeof(n_nodes));
+    const size_t tensors_offs = sizeof(uint32_t) + n_nodes*sizeof(uint64_t) + sizeof(uint32_t);
+    if (memcmp(prev.data(), cur.data(), tensors_offs) != 0) {
+        return false;
+    }
+    const uint32_t n_tensors = (cur.size() - tensors_offs) / sizeof(rpc_tensor);
+    const rpc_tensor * prev_tensors = (const rpc_tensor *)(prev.data() + tensors_offs);
+    const rpc_tensor * cur_tensors  = (const rpc_tensor *)(cur.data()  + tensors_offs);
+
+    const uint64_t base_hash = rpc_hash(prev.data(), prev.size());
+    uint32_t n_changed = 0;
+    output.resize(sizeof(base_hash) + sizeof(n_changed));
+    memcpy(output.data(), &base_hash, sizeof(base_hash));
+    for (uint32_t i = 0; i < n_tensors; i++) {
+        if (memcmp(&prev_tensors[i], &cur_tensors[i], sizeof(rpc_tensor)) == 0) {
+            continue;
+        }
+        if (prev_tensors[i].id != cur_tensors[i].id) {
+            return false;
+        }
+        n_changed++;
+        if (n_changed > n_tensors/2) {
+            // not worth it
+            return false;
+        }
+        const size_t offs = output.size();
+        output.resize(offs + sizeof(uint32_t) + sizeof(rpc_tensor));
+        memcpy(output.data() + offs, &i, sizeof(i));
+        memcpy(output.data() + offs + sizeof(i), &cur_tensors[i], sizeof(rpc_tensor));
+    }
+    memcpy(output.data() + sizeof(base_hash), &n_changed, sizeof(n_changed));
+    return true;
+}
+
+static enum ggml_status ggml_backend_rpc_graph_compute(ggml_backend_t backend, ggml_cgraph * cgraph) {
+    ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend->context;
+    std::vector<uint8_t> input;
+    serialize_graph(cgraph, input);
+    auto sock = get_socket(rpc_ctx->endpoint);
+    std::vector<uint8_t> delta;
+    if (serialize_graph_delta(rpc_ctx->last_graph, input, delta)) {
+        rpc_msg_graph_compute_delta_rsp response;
+        bool status = send_rpc_cmd(sock, RPC_CMD_GRAPH_COMPUTE_DELTA, delta.data(), delta.size(), &response, sizeof(response));
+        GGML_ASSERT(status);
+        if (response.cached) {
+            rpc_ctx->last_graph = std::move(input);
+            return (enum ggml_status)response.result;
+        }
+        // the server no longer has the base graph (e.g. another backend used the connection), send the full graph
+    }
+    rpc_msg_graph_compute_rsp response;
+    bool status = send_rpc_cmd(sock, RPC_CMD_GRAPH_COMPUTE, input.data(), input.size(), &response, sizeof(response));
+    GGML_ASSERT(status);
+    rpc_ctx->last_graph = std::move(input);
+    return (enum ggml_status)response.result;
 }
 
 static ggml_backend_i ggml_backend_rpc_interface = {
     /* .get_name                = */ ggml_backend_rpc_name,
     /* .free                    = */ ggml_backend_rpc_free,
-    /* .set_tensor_async        = */ NULL,
-    /* .get_tensor_async        = */ NULL,
-    /* .cpy_tensor_async        = */ NULL,
+    /* .set_tensor_async        = */ ggml_backend_rpc_set_tensor_async,
+    /* .get_tensor_async        = */ ggml_backend_rpc_get_tensor_async,
+    /* .cpy_tensor_async        = */ ggml_backend_rpc_cpy_tensor_async,
     /* .synchronize             = */ ggml_backend_rpc_synchronize,
     /* .graph_plan_create       = */ NULL,
     /* .graph_plan_free         = */ NULL,
@@ -733,8 +1434,12 @@ ggml_backend_buffer_type_t ggml_backend_rpc_buffer_type(const char * endpoint) {
 
 ggml_backend_t ggml_backend_rpc_init(const char * endpoint) {
     ggml_backend_rpc_context * ctx = new ggml_backend_rpc_context {
-        /* .endpoint  = */ endpoint,
-        /* .name      = */ "RPC[" + std::string(endpoint) + "]",
+        /* .endpoint      = */ endpoint,
+        /* .name          = */ "RPC[" + std::string(endpoint) + "]",
+        /* .transfer_type    = */ GGML_TYPE_F32,
+        /* .transfer_names   = */ {},
+        /* .transfer_all     = */ false,
+        /* .last_graph       = */ {},
     };
 
     ggml_backend_t backend = new ggml_backend {
@@ -750,6 +1455,53 @@ bool ggml_backend_is_rpc(ggml_backend_t backend) {
     return backend != NULL && ggml_guid_matches(backend->guid, ggml_backend_rpc_guid());
 }
 
+bool ggml_backend_rpc_tensor_set_from_file(struct ggml_tensor * tensor, const char * path, size_t file_offset, size_t offset, size_t size, const void * data) {
+    GGML_ASSERT(tensor->data != NULL && "tensor not allocated");
+    GGML_ASSERT(offset + size <= ggml_nbytes(tensor) && "tensor write out of bounds");
+
+    ggml_backend_buffer_t buf = tensor->view_src ? tensor->view_src->buffer : tensor->buffer;
+    if (buf->iface.get_base != ggml_backend_rpc_buffer_get_base || strlen(path) >= RPC_MAX_PATH) {
+        return false;
+    }
+    ggml_backend_rpc_buffer_context * ctx = (ggml_backend_rpc_buffer_context *)buf->context;
+    rpc_msg_set_tensor_from_file_req request;
+    memset(&request, 0, sizeof(request));
+    request.tensor = serialize_tensor(tensor);
+    request.offset = offset;
+    request.file_offset = file_offset;
+    request.size = size;
+    request.hash = data != nullptr ? std::max<uint64_t>(1, rpc_hash((const uint8_t *) data, size)) : 0;
+    snprintf(request.path, sizeof(request.path), "%s", path);
+    rpc_msg_set_tensor_from_file_rsp response;
+    bool status = send_rpc_cmd(ctx->sock, RPC_CMD_SET_TENSOR_FROM_FILE, &request, sizeof(request), &response, sizeof(response));
+    GGML_ASSERT(status);
+    return response.result;
+}
+
+void ggml_backend_rpc_set_transfer_type(ggml_backend_t backend, enum ggml_type type) {
+    GGML_ASSERT(ggml_backend_is_rpc(backend));
+    GGML_ASSERT(type == GGML_TYPE_F32 || rpc_transfer_type_supported(type));
+
+    ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend->context;
+    rpc_ctx->transfer_type = type;
+}
+
+void ggml_backend_rpc_set_tensor_transfer(ggml_backend_t backend, const char * name, bool convert) {
+    GGML_ASSERT(ggml_backend_is_rpc(backend));
+
+    ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend->context;
+    if (name == nullptr) {
+        rpc_ctx->transfer_all = convert;
+        if (!convert) {
+            rpc_ctx->transfer_names.clear();
+        }
+    } else if (convert) {
+        rpc_ctx->transfer_names.insert(name);
+    } else {
+        rpc_ctx->transfer_names.erase(name);
+    }
+}
+
 static void get_device_memory(const std::shared_ptr<socket_t> & sock, size_t * free, size_t * total) {
     rpc_msg_get_device_memory_rsp response;
     bool status = send_rpc_cmd(sock, RPC_CMD_GET_DEVICE_MEMORY, nullptr, 0, &response, sizeof(response));
@@ -770,9 +1522,104 @@ void ggml_backend_rpc_get_device_memory(const char * endpoint, size_t * free, si
 
 // RPC server-side implementation
 
+// absolute path with symlinks and ".." resolved, empty if the file does not exist
+static std::string rpc_canonical_path(const char * path) {
+#ifdef _WIN32
+    char buf[_MAX_PATH];
+    if (_fullpath(buf, path, sizeof(buf)) == NULL) {
+        return "";
+    }
+    return buf;
+#else
+    char * res = realpath(path, nullptr);
+    if (res == nullptr) {
+        return "";
+    }
+    std::string result(res);
+    free(res);
+    return result;
+#endif
+}
+
+// a buffer exported for writes from peer servers
+struct rpc_peer_export {
+    uint64_t token;
+    // number of peer writes in progress
+    int n_writers;
+};
+
+// state shared by all client sessions of a server
+struct rpc_server_shared {
+    ggml_backend_t backend;
+    size_t free_mem;
+    size_t total_mem;
+
+    // memory allocated by all sessions, accounted against free_mem
+    std::mutex mem_mutex;
+    size_t used_mem = 0;
+
+    // the calls of different sessions into the backend (buffer operations and graph computations) are serialized
+    // socket I/O is done without it, so that a slow client does not block the others
+    std::mutex backend_mutex;
+
+    // files can only be read from this directory (GGML_RPC_FILE_ROOT), empty if reading files is disabled
+    std::string file_root;
+
+    // buffers exported by their session for writes from peer servers
+    // the lock is only held to look up a buffer, a buffer is not freed while a peer is writing to it
+    std::mutex peer_mutex;
+    std::condition_variable peer_cv;
+    std::unordered_map<ggml_backend_buffer_t, rpc_peer_export> peer_buffers;
+
+    // number of client sessions being served, at most max_clients, see rpc_client_slot
+    std::mutex clients_mutex;
+    std::condition_variable clients_cv;
+    int n_clients = 0;
+    int max_clients = RPC_MAX_CLIENTS;
+
+    rpc_server_shared(ggml_backend_t backend, size_t free_mem, size_t total_mem)
+        : backend(backend), free_mem(free_mem), total_mem(total_mem) {
+        const char * root = getenv("GGML_RPC_FILE_ROOT");
+        if (root != nullptr) {
+            file_root = rpc_canonical_path(root);
+        }
+    }
+};
+
+// keeps an exported buffer alive while a peer writes to it
+struct rpc_peer_pin {
+    rpc_server_shared & shared;
+    ggml_backend_buffer_t buffer = nullptr;
+
+    rpc_peer_pin(rpc_server_shared & shared) : shared(shared) {}
+
+    bool pin(ggml_backend_buffer_t buf, uint64_t token) {
+        std::lock_guard<std::mutex> lock(shared.peer_mutex);
+        auto it = shared.peer_buffers.find(buf);
+        if (it == shared.peer_buffers.end() || it->second.token != token) {
+            return false;
+        }
+        it->second.n_writers++;
+        buffer = buf;
+        return true;
+    }
+
+    ~rpc_peer_pin() {
+        if (buffer == nullptr) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(shared.peer_mutex);
+            shared.peer_buffers[buffer].n_writers--;
+        }
+        shared.peer_cv.notify_all();
+    }
+};
+
+// a client session, owns the buffers allocated by the client
 class rpc_server {
 public:
-    rpc_server(ggml_backend_t backend) : backend(backend) {}
+    rpc_server(rpc_server_shared & shared) : backend(shared.backend), shared(shared) {}
     ~rpc_server();
 
     void alloc_buffer(const rpc_msg_alloc_buffer_req & request, rpc_msg_alloc_buffer_rsp & response);
@@ -781,15 +1628,29 @@ public:
     bool buffer_get_base(const rpc_msg_buffer_get_base_req & request, rpc_msg_buffer_get_base_rsp & response);
     bool free_buffer(const rpc_msg_free_buffer_req & request);
     bool buffer_clear(const rpc_msg_buffer_clear_req & request);
-    bool set_tensor(const std::vector<uint8_t> & input);
-    bool get_tensor(const rpc_msg_get_tensor_req & request, std::vector<uint8_t> & response);
+    bool buffer_export_peer(const rpc_msg_buffer_export_peer_req & request, rpc_msg_buffer_export_peer_rsp & response);
+    bool set_tensor(sockfd_t sockfd, uint64_t input_size, bool peer = false);
+    bool get_tensor(sockfd_t sockfd, const rpc_msg_get_tensor_req & request);
+    bool set_tensor_compressed(sockfd_t sockfd, uint64_t input_size);
+    bool set_tensor_converted(sockfd_t sockfd, uint64_t input_size, bool peer = false);
+    bool set_tensor_from_file(const rpc_msg_set_tensor_from_file_req & request, rpc_msg_set_tensor_from_file_rsp & response);
+    bool get_tensor_converted(sockfd_t sockfd, const rpc_msg_get_tensor_converted_req & request);
     bool copy_tensor(const rpc_msg_copy_tensor_req & request, rpc_msg_copy_tensor_rsp & response);
+    bool copy_tensor_peer(const rpc_msg_copy_tensor_peer_req & request, rpc_msg_copy_tensor_rsp & response);
     bool graph_compute(const std::vector<uint8_t> & input, rpc_msg_graph_compute_rsp & response);
+    bool graph_compute_delta(const std::vector<uint8_t> & input, rpc_msg_graph_compute_delta_rsp & response);
     bool init_tensor(const rpc_msg_init_tensor_req & request);
     bool get_alloc_size(const rpc_msg_get_alloc_size_req & request, rpc_msg_get_alloc_size_rsp & response);
+    void get_device_memory(rpc_msg_get_device_memory_rsp & response);
 
 private:
-    ggml_tensor * deserialize_tensor(struct ggml_context * ctx, const rpc_tensor * tensor);
+    // by default only the buffers of this session are accessible
+    ggml_tensor * deserialize_tensor(struct ggml_context * ctx, const rpc_tensor * tensor,
+                                     const std::unordered_set<ggml_backend_buffer_t> * valid_buffers = nullptr);
+    void update_tensor(ggml_tensor * result, const rpc_tensor * tensor,
+                       const std::unordered_set<ggml_backend_buffer_t> * valid_buffers = nullptr);
+    void clear_graph_cache();
+    void unexport_peer(ggml_backend_buffer_t buffer);
     ggml_tensor * create_node(uint64_t id,
                               struct ggml_context * ctx,
                               const std::unordered_map<uint64_t, const rpc_tensor*> & tensor_ptrs,
@@ -797,7 +1658,18 @@ private:
 
 
     ggml_backend_t backend;
+    rpc_server_shared & shared;
     std::unordered_set<ggml_backend_buffer_t> buffers;
+
+    // connections to the peer servers used by copy_tensor_peer
+    std::unordered_map<std::string, std::shared_ptr<socket_t>> peers;
+
+    // the last computed graph, kept so that the next one can be sent as a delta
+    struct ggml_context * graph_ctx = nullptr;
+    struct ggml_cgraph * graph = nullptr;
+    std::vector<uint8_t> graph_input;
+    uint64_t graph_hash = 0;
+    std::unordered_map<uint64_t, ggml_tensor*> graph_tensors;
 };
 
 bool rpc_server::get_alloc_size(const rpc_msg_get_alloc_size_req & request, rpc_msg_get_alloc_size_rsp & response) {
@@ -831,20 +1703,42 @@ bool rpc_server::get_alloc_size(const rpc_msg_get_alloc_size_req & request, rpc_
 }
 
 void rpc_server::alloc_buffer(const rpc_msg_alloc_buffer_req & request, rpc_msg_alloc_buffer_rsp & response) {
-    ggml_backend_buffer_type_t buft = ggml_backend_get_default_buffer_type(backend);
-    ggml_backend_buffer_t buffer = ggml_backend_buft_alloc_buffer(buft, request.size);
     response.remote_ptr = 0;
     response.remote_size = 0;
+    {
+        // reserve the memory before allocating so that concurrent sessions cannot overcommit
+        std::lock_guard<std::mutex> lock(shared.mem_mutex);
+        if (request.size > shared.free_mem || shared.used_mem > shared.free_mem - request.size) {
+            GGML_LOG_ERROR("[%s] size: %" PRIu64 " -> out of memory (used: %zu, free: %zu)\n", __func__, request.size, shared.used_mem, shared.free_mem);
+            return;
+        }
+        shared.used_mem += request.size;
+    }
+    ggml_backend_buffer_type_t buft = ggml_backend_get_default_buffer_type(backend);
+    ggml_backend_buffer_t buffer;
+    {
+        std::lock_guard<std::mutex> backend_lock(shared.backend_mutex);
+        buffer = ggml_backend_buft_alloc_buffer(buft, request.size);
+    }
+    std::lock_guard<std::mutex> lock(shared.mem_mutex);
+    shared.used_mem -= request.size;
     if (buffer != nullptr) {
         response.remote_ptr = reinterpret_cast<uint64_t>(buffer);
         response.remote_size = buffer->size;
         GGML_PRINT_DEBUG("[%s] size: %" PRIu64 " -> remote_ptr: %" PRIx64 ", remote_size: %" PRIu64 "\n", __func__, request.size, response.remote_ptr, response.remote_size);
+        shared.used_mem += buffer->size;
         buffers.insert(buffer);
     } else {
         GGML_LOG_ERROR("[%s] size: %" PRIu64 " -> failed\n", __func__, request.size);
     }
 }
 
+void rpc_server::get_device_memory(rpc_msg_get_device_memory_rsp & response) {
+    std::lock_guard<std::mutex> lock(shared.mem_mutex);
+    response.free_mem = shared.free_mem - std::min(shared.used_mem, shared.free_mem);
+    response.total_mem = shared.total_mem;
+}
+
 void rpc_server::get_alignment(rpc_msg_get_alignment_rsp & response) {
     ggml_backend_buffer_type_t buft = ggml_backend_get_default_buffer_type(backend);
     size_t alignment = ggml_backend_buft_get_alignment(buft);
@@ -878,7 +1772,17 @@ bool rpc_server::free_buffer(const rpc_msg_free_buffer_req & request) {
         GGML_LOG_ERROR("[%s] buffer not found\n", __func__);
         return false;
     }
-    ggml_backend_buffer_free(buffer);
+    {
+        std::lock_guard<std::mutex> lock(shared.mem_mutex);
+        shared.used_mem -= ggml_backend_buffer_get_size(buffer);
+    }
+    unexport_peer(buffer);
+    // the cached graph may reference the buffer
+    clear_graph_cache();
+    {
+        std::lock_guard<std::mutex> backend_lock(shared.backend_mutex);
+        ggml_backend_buffer_free(buffer);
+    }
     buffers.erase(buffer);
     return true;
 }
@@ -890,18 +1794,65 @@ bool rpc_server::buffer_clear(const rpc_msg_buffer_clear_req & request) {
         GGML_LOG_ERROR("[%s] buffer not found\n", __func__);
         return false;
     }
+    std::lock_guard<std::mutex> backend_lock(shared.backend_mutex);
     ggml_backend_buffer_clear(buffer, request.value);
     return true;
 }
 
-ggml_tensor * rpc_server::deserialize_tensor(struct ggml_context * ctx, const rpc_tensor * tensor) {
+bool rpc_server::buffer_export_peer(const rpc_msg_buffer_export_peer_req & request, rpc_msg_buffer_export_peer_rsp & response) {
+    GGML_PRINT_DEBUG("[%s] remote_ptr: %" PRIx64 "\n", __func__, request.remote_ptr);
+    ggml_backend_buffer_t buffer = reinterpret_cast<ggml_backend_buffer_t>(request.remote_ptr);
+    if (buffers.find(buffer) == buffers.end()) {
+        GGML_LOG_ERROR("[%s] buffer not found\n", __func__);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(shared.peer_mutex);
+    auto it = shared.peer_buffers.find(buffer);
+    if (it == shared.peer_buffers.end()) {
+        // a random token, so that only the servers the owner passes it to can write to the buffer
+        static std::random_device rd;
+        uint64_t token = 0;
+        while (token == 0) {
+            token = ((uint64_t) rd() << 32) | rd();
+        }
+        it = shared.peer_buffers.emplace(buffer, rpc_peer_export{token, 0}).first;
+    }
+    response.token = it->second.token;
+    return true;
+}
+
+// stop accepting peer writes to the buffer and wait for the ones in progress
+void rpc_server::unexport_peer(ggml_backend_buffer_t buffer) {
+    std::unique_lock<std::mutex> lock(shared.peer_mutex);
+    auto it = shared.peer_buffers.find(buffer);
+    if (it == shared.peer_buffers.end()) {
+        return;
+    }
+    shared.peer_cv.wait(lock, [&] { return it->second.n_writers == 0; });
+    shared.peer_buffers.erase(it);
+}
+
+ggml_tensor * rpc_server::deserialize_tensor(struct ggml_context * ctx, const rpc_tensor * tensor,
+                                             const std::unordered_set<ggml_backend_buffer_t> * valid_buffers) {
     ggml_tensor * result = ggml_new_tensor_4d(ctx, (ggml_type) tensor->type,
         tensor->ne[0], tensor->ne[1], tensor->ne[2], tensor->ne[3]);
+    update_tensor(result, tensor, valid_buffers);
+    return result;
+}
+
+// overwrite the fields of an existing tensor, the sources are not modified
+void rpc_server::update_tensor(ggml_tensor * result, const rpc_tensor * tensor,
+                               const std::unordered_set<ggml_backend_buffer_t> * valid_buffers) {
+    if (valid_buffers == nullptr) {
+        valid_buffers = &buffers;
+    }
+    result->type = (ggml_type) tensor->type;
     for (uint32_t i = 0; i < GGML_MAX_DIMS; i++) {
+        result->ne[i] = tensor->ne[i];
         result->nb[i] = tensor->nb[i];
     }
     result->buffer = reinterpret_cast<ggml_backend_buffer_t>(tensor->buffer);
-    if (result->buffer && buffers.find(result->buffer) == buffers.end()) {
+    if (result->buffer && valid_buffers->find(result->buffer) == valid_buffers->end()) {
         result->buffer = nullptr;
     }
 
@@ -921,28 +1872,50 @@ ggml_tensor * rpc_server::deserialize_tensor(struct ggml_context * ctx, const rp
     result->flags = tensor->flags;
     result->data = reinterpret_cast<void *>(tensor->data);
     ggml_set_name(result, tensor->name);
-    return result;
 }
 
 
-bool rpc_server::set_tensor(const std::vector<uint8_t> & input) {
+bool rpc_server::set_tensor(sockfd_t sockfd, uint64_t input_size, bool peer) {
     // serialization format: | rpc_tensor | offset (8 bytes) | data (size bytes) |
-    if (input.size() < sizeof(rpc_tensor) + sizeof(uint64_t)) {
+    // the data is received directly into the buffer (or in chunks for non-host buffers) as it arrives
+    // a peer server may write to the buffers exported by any session, the buffer is pinned while receiving
+    // peer writes are prefixed with the token of the export: | token (8 bytes) | rpc_tensor | offset | data |
+    uint64_t token = 0;
+    if (peer) {
+        if (input_size < sizeof(token) || !recv_data(sockfd, &token, sizeof(token))) {
+            return false;
+        }
+        input_size -= sizeof(token);
+    }
+    rpc_msg_set_tensor_req request;
+    if (input_size < sizeof(request)) {
         return false;
     }
-    const rpc_tensor * in_tensor = (const rpc_tensor *)input.data();
-    uint64_t offset;
-    memcpy(&offset, input.data() + sizeof(rpc_tensor), sizeof(offset));
-    const size_t size = input.size() - sizeof(rpc_tensor) - sizeof(offset);
+    if (!recv_data(sockfd, &request, sizeof(request))) {
+        return false;
+    }
+    const rpc_tensor * in_tensor = &request.tensor;
+    const uint64_t offset = request.offset;
+    const size_t size = input_size - sizeof(request);
 
     struct ggml_init_params params {
         /*.mem_size   =*/ ggml_tensor_overhead(),
         /*.mem_buffer =*/ NULL,
         /*.no_alloc   =*/ true,
     };
+    rpc_peer_pin pin(shared);
+    std::unordered_set<ggml_backend_buffer_t> peer_buffer;
+    if (peer) {
+        ggml_backend_buffer_t buffer = reinterpret_cast<ggml_backend_buffer_t>(in_tensor->buffer);
+        if (!pin.pin(buffer, token)) {
+            GGML_LOG_ERROR("[%s] buffer not exported for peer transfer\n", __func__);
+            return false;
+        }
+        peer_buffer.insert(buffer);
+    }
     struct ggml_context * ctx = ggml_init(params);
-    ggml_tensor * tensor = deserialize_tensor(ctx, in_tensor);
-    if (tensor == nullptr) {
+    ggml_tensor * tensor = deserialize_tensor(ctx, in_tensor, peer ? &peer_buffer : nullptr);
+    if (tensor == nullptr || tensor->buffer == nullptr) {
         GGML_LOG_ERROR("[%s] error deserializing tensor\n", __func__);
         ggml_free(ctx);
         return false;
@@ -959,10 +1932,22 @@ bool rpc_server::set_tensor(const std::vector<uint8_t> & input) {
         }
     }
 
-    const void * data = input.data() + sizeof(rpc_tensor) + sizeof(offset);
-    ggml_backend_tensor_set(tensor, data, offset, size);
+    bool ok = true;
+    if (ggml_backend_buffer_is_host(tensor->buffer)) {
+        ok = recv_data(sockfd, (char *) tensor->data + offset, size);
+    } else {
+        std::vector<uint8_t> chunk(std::min(size, (size_t) RPC_CHUNK_SIZE));
+        for (size_t pos = 0; ok && pos < size; pos += chunk.size()) {
+            const size_t n = std::min(chunk.size(), size - pos);
+            ok = recv_data(sockfd, chunk.data(), n);
+            if (ok) {
+                std::lock_guard<std::mutex> backend_lock(shared.backend_mutex);
+                ggml_backend_tensor_set(tensor, chunk.data(), offset + pos, n);
+            }
+        }
+    }
     ggml_free(ctx);
-    return true;
+    return ok;
 }
 
 bool rpc_server::init_tensor(const rpc_msg_init_tensor_req & request) {
@@ -982,6 +1967,7 @@ bool rpc_server::init_tensor(const rpc_msg_init_tensor_req & request) {
     // Call the backend's buffer_init_tensor function
     ggml_backend_buffer_t buffer = tensor->buffer;
     if (buffer && buffer->iface.init_tensor) {
+        std::lock_guard<std::mutex> backend_lock(shared.backend_mutex);
         buffer->iface.init_tensor(buffer, tensor);
     } else {
         GGML_LOG_ERROR("Null buffer for tensor passed to init_tensor function\n");
@@ -999,7 +1985,7 @@ bool rpc_server::init_tensor(const rpc_msg_init_tensor_req & request) {
     return true;
 }
 
-bool rpc_server::get_tensor(const rpc_msg_get_tensor_req & request, std::vector<uint8_t> & response) {
+bool rpc_server::get_tensor(sockfd_t sockfd, const rpc_msg_get_tensor_req & request) {
     struct ggml_init_params params {
         /*.mem_size   =*/ ggml_tensor_overhead(),
         /*.mem_buffer =*/ NULL,
@@ -1026,12 +2012,315 @@ bool rpc_server::get_tensor(const rpc_msg_get_tensor_req & request, std::vector<
         }
     }
 
-    response.resize(request.size, 0);
-    ggml_backend_tensor_get(tensor, response.data(), request.offset, request.size);
+    // the response is streamed from the buffer (or in chunks for non-host buffers)
+    if (!send_data(sockfd, &request.size, sizeof(request.size))) {
+        ggml_free(ctx);
+        return false;
+    }
+    bool ok = true;
+    if (ggml_backend_buffer_is_host(tensor->buffer)) {
+        ok = send_data(sockfd, (const char *) tensor->data + request.offset, request.size);
+    } else {
+        std::vector<uint8_t> chunk(std::min(request.size, (uint64_t) RPC_CHUNK_SIZE));
+        for (uint64_t pos = 0; ok && pos < request.size; pos += chunk.size()) {
+            const size_t n = std::min((uint64_t) chunk.size(), request.size - pos);
+            {
+                std::lock_guard<std::mutex> backend_lock(shared.backend_mutex);
+                ggml_backend_tensor_get(tensor, chunk.data(), request.offset + pos, n);
+            }
+            ok = send_data(sockfd, chunk.data(), n);
+        }
+    }
+    ggml_free(ctx);
+    return ok;
+}
+
+bool rpc_server::set_tensor_compressed(sockfd_t sockfd, uint64_t input_size) {
+    // serialization format: | rpc_msg_set_tensor_compressed_req | data (compressed) |
+    rpc_msg_set_tensor_compressed_req request;
+    if (input_size < sizeof(request)) {
+        return false;
+    }
+    if (!recv_data(sockfd, &request, sizeof(request))) {
+        return false;
+    }
+    const uint64_t compressed_size = input_size - sizeof(request);
+    if (request.size > RPC_CHUNK_SIZE || compressed_size > request.size) {
+        GGML_LOG_ERROR("[%s] invalid chunk size\n", __func__);
+        return false;
+    }
+
+    struct ggml_init_params params {
+        /*.mem_size   =*/ ggml_tensor_overhead(),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+    ggml_tensor * tensor = deserialize_tensor(ctx, &request.tensor);
+    if (tensor == nullptr || tensor->buffer == nullptr) {
+        GGML_LOG_ERROR("[%s] error deserializing tensor\n", __func__);
+        ggml_free(ctx);
+        return false;
+    }
+
+    // sanitize tensor->data
+    {
+        const size_t p0 = (size_t) ggml_backend_buffer_get_base(tensor->buffer);
+        const size_t p1 = p0 + ggml_backend_buffer_get_size(tensor->buffer);
+
+        if (request.tensor.data + request.offset < p0 || request.tensor.data + request.offset >= p1 || request.size > (p1 - request.tensor.data - request.offset)) {
+            GGML_ABORT("[%s] tensor->data out of bounds\n", __func__);
+        }
+    }
+
+    std::vector<uint8_t> compressed(compressed_size);
+    bool ok = recv_data(sockfd, compressed.data(), compressed_size);
+    if (ok) {
+        if (ggml_backend_buffer_is_host(tensor->buffer)) {
+            ok = rpc_lz_decompress(compressed.data(), compressed_size, (uint8_t *) tensor->data + request.offset, request.size);
+        } else {
+            std::vector<uint8_t> data(request.size);
+            ok = rpc_lz_decompress(compressed.data(), compressed_size, data.data(), request.size);
+            if (ok) {
+                std::lock_guard<std::mutex> backend_lock(shared.backend_mutex);
+                ggml_backend_tensor_set(tensor, data.data(), request.offset, request.size);
+            }
+        }
+        if (!ok) {
+            GGML_LOG_ERROR("[%s] invalid compressed data\n", __func__);
+        }
+    }
+    ggml_free(ctx);
+    return ok;
+}
+
+bool rpc_server::set_tensor_converted(sockfd_t sockfd, uint64_t input_size, bool peer) {
+    // serialization format: | rpc_msg_set_tensor_converted_req | data (converted, n_blocks * type_size bytes) |
+    // a peer server may write to the buffers exported by any session, with the token of the export, as in set_tensor
+    uint64_t token = 0;
+    if (peer) {
+        if (input_size < sizeof(token) || !recv_data(sockfd, &token, sizeof(token))) {
+            return false;
+        }
+        input_size -= sizeof(token);
+    }
+    rpc_msg_set_tensor_converted_req request;
+    if (input_size < sizeof(request)) {
+        return false;
+    }
+    if (!recv_data(sockfd, &request, sizeof(request))) {
+        return false;
+    }
+    if (!rpc_transfer_type_supported(request.type)) {
+        GGML_LOG_ERROR("[%s] unsupported transfer type %u\n", __func__, request.type);
+        return false;
+    }
+    const ggml_type type = (ggml_type) request.type;
+    const size_t type_size = ggml_type_size(type);
+    const uint64_t converted_size = input_size - sizeof(request);
+    if (converted_size % type_size != 0) {
+        return false;
+    }
+    const uint64_t size = converted_size / type_size * ggml_blck_size(type) * sizeof(float);
+
+    struct ggml_init_params params {
+        /*.mem_size   =*/ ggml_tensor_overhead(),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+    rpc_peer_pin pin(shared);
+    std::unordered_set<ggml_backend_buffer_t> peer_buffer;
+    if (peer) {
+        ggml_backend_buffer_t buffer = reinterpret_cast<ggml_backend_buffer_t>(request.tensor.buffer);
+        if (!pin.pin(buffer, token)) {
+            GGML_LOG_ERROR("[%s] buffer not exported for peer transfer\n", __func__);
+            return false;
+        }
+        peer_buffer.insert(buffer);
+    }
+    struct ggml_context * ctx = ggml_init(params);
+    ggml_tensor * tensor = deserialize_tensor(ctx, &request.tensor, peer ? &peer_buffer : nullptr);
+    if (tensor == nullptr || tensor->buffer == nullptr || !rpc_can_convert(tensor->type, type, request.offset, size)) {
+        GGML_LOG_ERROR("[%s] invalid tensor\n", __func__);
+        ggml_free(ctx);
+        return false;
+    }
+
+    // sanitize tensor->data
+    {
+        const size_t p0 = (size_t) ggml_backend_buffer_get_base(tensor->buffer);
+        const size_t p1 = p0 + ggml_backend_buffer_get_size(tensor->buffer);
+
+        if (request.tensor.data + request.offset < p0 || request.tensor.data + request.offset >= p1 || size > (p1 - request.tensor.data - request.offset)) {
+            GGML_ABORT("[%s] tensor->data out of bounds\n", __func__);
+        }
+    }
+
+    // convert in chunks as the data arrives
+    const ggml_to_float_t to_float = ggml_get_type_traits(type)->to_float;
+    const bool is_host = ggml_backend_buffer_is_host(tensor->buffer);
+    const size_t chunk_blocks = std::max<size_t>(1, RPC_CHUNK_SIZE / type_size);
+    std::vector<uint8_t> chunk(std::min<uint64_t>(converted_size, chunk_blocks*type_size));
+    std::vector<float> staging(is_host ? 0 : chunk.size() / type_size * ggml_blck_size(type));
+    bool ok = true;
+    for (uint64_t pos = 0; ok && pos < converted_size; pos += chunk.size()) {
+        const size_t n_bytes = std::min<uint64_t>(chunk.size(), converted_size - pos);
+        const int64_t n = n_bytes / type_size * ggml_blck_size(type);
+        const uint64_t offset = request.offset + pos / type_size * ggml_blck_size(type) * sizeof(float);
+        ok = recv_data(sockfd, chunk.data(), n_bytes);
+        if (!ok) {
+            break;
+        }
+        if (is_host) {
+            to_float(chunk.data(), (float *) ((char *) tensor->data + offset), n);
+        } else {
+            to_float(chunk.data(), staging.data(), n);
+            std::lock_guard<std::mutex> backend_lock(shared.backend_mutex);
+            ggml_backend_tensor_set(tensor, staging.data(), offset, n*sizeof(float));
+        }
+    }
+    ggml_free(ctx);
+    return ok;
+}
+
+bool rpc_server::set_tensor_from_file(const rpc_msg_set_tensor_from_file_req & request, rpc_msg_set_tensor_from_file_rsp & response) {
+    response.result = 0;
+
+    const std::string path = rpc_canonical_path(std::string(request.path, strnlen(request.path, sizeof(request.path))).c_str());
+    const std::string & root = shared.file_root;
+    if (root.empty() || path.size() <= root.size() || path.compare(0, root.size(), root) != 0 ||
+        (path[root.size()] != '/' && path[root.size()] != '\\')) {
+        GGML_LOG_ERROR("[%s] reading '%s' is not allowed, set GGML_RPC_FILE_ROOT on the server\n", __func__, request.path);
+        return true;
+    }
+
+    struct ggml_init_params params {
+        /*.mem_size   =*/ ggml_tensor_overhead(),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+    ggml_tensor * tensor = deserialize_tensor(ctx, &request.tensor);
+    if (tensor == nullptr || tensor->buffer == nullptr) {
+        GGML_LOG_ERROR("[%s] error deserializing tensor\n", __func__);
+        ggml_free(ctx);
+        return false;
+    }
+
+    // sanitize tensor->data
+    {
+        const size_t p0 = (size_t) ggml_backend_buffer_get_base(tensor->buffer);
+        const size_t p1 = p0 + ggml_backend_buffer_get_size(tensor->buffer);
+
+        if (request.tensor.data + request.offset < p0 || request.tensor.data + request.offset >= p1 || request.size > (p1 - request.tensor.data - request.offset)) {
+            GGML_ABORT("[%s] tensor->data out of bounds\n", __func__);
+        }
+    }
+    GGML_PRINT_DEBUG("[%s] %s, file_offset: %" PRIu64 ", size: %" PRIu64 "\n", __func__, path.c_str(), request.file_offset, request.size);
+
+    FILE * f = ggml_fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        GGML_LOG_ERROR("[%s] failed to open '%s'\n", __func__, path.c_str());
+        ggml_free(ctx);
+        return true;
+    }
+#ifdef _WIN32
+    bool ok = _fseeki64(f, (__int64) request.file_offset, SEEK_SET) == 0;
+#else
+    bool ok = fseeko(f, (off_t) request.file_offset, SEEK_SET) == 0;
+#endif
+
+    // read directly into host buffers, or in chunks for other buffers
+    const bool is_host = ggml_backend_buffer_is_host(tensor->buffer);
+    std::vector<uint8_t> chunk(is_host ? 0 : std::min<uint64_t>(request.size, RPC_CHUNK_SIZE));
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (uint64_t pos = 0; ok && pos < request.size; pos += RPC_CHUNK_SIZE) {
+        const size_t n = std::min<uint64_t>(RPC_CHUNK_SIZE, request.size - pos);
+        uint8_t * dst = is_host ? (uint8_t *) tensor->data + request.offset + pos : chunk.data();
+        ok = fread(dst, 1, n, f) == n;
+        if (!ok) {
+            break;
+        }
+        if (request.hash != 0) {
+            hash = rpc_hash(dst, n, hash);
+        }
+        if (!is_host) {
+            std::lock_guard<std::mutex> backend_lock(shared.backend_mutex);
+            ggml_backend_tensor_set(tensor, chunk.data(), request.offset + pos, n);
+        }
+    }
+    fclose(f);
     ggml_free(ctx);
+
+    if (!ok) {
+        GGML_LOG_ERROR("[%s] failed to read %" PRIu64 " bytes at offset %" PRIu64 " from '%s'\n", __func__, request.size, request.file_offset, path.c_str());
+        return true;
+    }
+    if (request.hash != 0 && std::max<uint64_t>(1, hash) != request.hash) {
+        GGML_LOG_ERROR("[%s] checksum mismatch for '%s'\n", __func__, path.c_str());
+        return true;
+    }
+    response.result = 1;
     return true;
 }
 
+bool rpc_server::get_tensor_converted(sockfd_t sockfd, const rpc_msg_get_tensor_converted_req & request) {
+    struct ggml_init_params params {
+        /*.mem_size   =*/ ggml_tensor_overhead(),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+    ggml_tensor * tensor = deserialize_tensor(ctx, &request.tensor);
+    if (tensor == nullptr || tensor->buffer == nullptr || !rpc_can_convert(tensor->type, request.type, request.offset, request.size)) {
+        GGML_LOG_ERROR("[%s] invalid tensor or transfer type\n", __func__);
+        ggml_free(ctx);
+        return false;
+    }
+
+    // sanitize tensor->data
+    {
+        const size_t p0 = (size_t) ggml_backend_buffer_get_base(tensor->buffer);
+        const size_t p1 = p0 + ggml_backend_buffer_get_size(tensor->buffer);
+
+        if (request.tensor.data + request.offset < p0 ||
+            request.tensor.data + request.offset >= p1 ||
+            request.size > (p1 - request.tensor.data - request.offset)) {
+                GGML_ABORT("[%s] tensor->data out of bounds\n", __func__);
+        }
+    }
+
+    const ggml_type type = (ggml_type) request.type;
+    const ggml_from_float_t from_float = ggml_get_type_traits(type)->from_float_ref;
+    const int64_t n_total = request.size / sizeof(float);
+    const uint64_t converted_size = ggml_row_size(type, n_total);
+    if (!send_data(sockfd, &converted_size, sizeof(converted_size))) {
+        ggml_free(ctx);
+        return false;
+    }
+
+    // convert and send in chunks
+    const bool is_host = ggml_backend_buffer_is_host(tensor->buffer);
+    const int64_t chunk_n = std::max<int64_t>(1, RPC_CHUNK_SIZE / sizeof(float) / ggml_blck_size(type)) * ggml_blck_size(type);
+    std::vector<float> staging(is_host ? 0 : std::min(n_total, chunk_n));
+    std::vector<uint8_t> chunk(ggml_row_size(type, std::min(n_total, chunk_n)));
+    bool ok = true;
+    for (int64_t i = 0; ok && i < n_total; i += chunk_n) {
+        const int64_t n = std::min(chunk_n, n_total - i);
+        const uint64_t offset = request.offset + i*sizeof(float);
+        const float * x = (const float *) ((const char *) tensor->data + offset);
+        if (!is_host) {
+            std::lock_guard<std::mutex> backend_lock(shared.backend_mutex);
+            ggml_backend_tensor_get(tensor, staging.data(), offset, n*sizeof(float));
+            x = staging.data();
+        }
+        from_float(x, chunk.data(), n);
+        ok = send_data(sockfd, chunk.data(), ggml_row_size(type, n));
+    }
+    ggml_free(ctx);
+    return ok;
+}
+
 bool rpc_server::copy_tensor(const rpc_msg_copy_tensor_req & request, rpc_msg_copy_tensor_rsp & response) {
     struct ggml_init_params params {
         /*.mem_size   =*/ 2*ggml_tensor_overhead(),
@@ -1068,7 +2357,111 @@ bool rpc_server::copy_tensor(const rpc_msg_copy_tensor_req & request, rpc_msg_co
     GGML_PRINT_DEBUG("[%s] src->buffer: %p, dst->buffer: %p\n",
                      __func__, (void*) src->buffer, (void*) dst->buffer);
 
-    response.result = ggml_backend_buffer_copy_tensor(src, dst);
+    {
+        std::lock_guard<std::mutex> backend_lock(shared.backend_mutex);
+        response.result = ggml_backend_buffer_copy_tensor(src, dst);
+    }
+    ggml_free(ctx);
+    return true;
+}
+
+bool rpc_server::copy_tensor_peer(const rpc_msg_copy_tensor_peer_req & request, rpc_msg_copy_tensor_rsp & response) {
+    struct ggml_init_params params {
+        /*.mem_size   =*/ 2*ggml_tensor_overhead(),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+    ggml_tensor * src = deserialize_tensor(ctx, &request.src);
+    if (src == nullptr || src->buffer == nullptr) {
+        GGML_LOG_ERROR("[%s] error deserializing tensor\n", __func__);
+        ggml_free(ctx);
+        return false;
+    }
+    // the destination is only validated by the peer, but it must at least fit the source
+    if (request.dst.type >= GGML_TYPE_COUNT) {
+        GGML_LOG_ERROR("[%s] invalid destination tensor type\n", __func__);
+        ggml_free(ctx);
+        return false;
+    }
+    ggml_tensor * dst = ggml_new_tensor_4d(ctx, (ggml_type) request.dst.type,
+        request.dst.ne[0], request.dst.ne[1], request.dst.ne[2], request.dst.ne[3]);
+    for (uint32_t i = 0; i < GGML_MAX_DIMS; i++) {
+        dst->nb[i] = request.dst.nb[i];
+    }
+    if (ggml_nbytes(src) > ggml_nbytes(dst)) {
+        GGML_LOG_ERROR("[%s] source tensor is larger than the destination tensor\n", __func__);
+        ggml_free(ctx);
+        return false;
+    }
+    const ggml_type type = (ggml_type) request.type;
+    if (type != GGML_TYPE_F32 && !rpc_transfer_type_supported(type)) {
+        GGML_LOG_ERROR("[%s] unsupported transfer type %u\n", __func__, request.type);
+        ggml_free(ctx);
+        return false;
+    }
+    const std::string endpoint(request.dst_endpoint, strnlen(request.dst_endpoint, sizeof(request.dst_endpoint)));
+    GGML_PRINT_DEBUG("[%s] src->buffer: %p, dst endpoint: %s\n", __func__, (void*) src->buffer, endpoint.c_str());
+
+    response.result = 0;
+    auto it = peers.find(endpoint);
+    if (it == peers.end()) {
+        std::string host;
+        int port;
+        std::shared_ptr<socket_t> sock;
+        if (parse_endpoint(endpoint, host, port)) {
+            sock = socket_connect(host.c_str(), port, RPC_PEER_TIMEOUT_MS);
+        }
+        if (sock == nullptr) {
+            GGML_LOG_ERROR("[%s] failed to connect to %s\n", __func__, endpoint.c_str());
+            ggml_free(ctx);
+            return true;
+        }
+        it = peers.emplace(endpoint, sock).first;
+    }
+    auto sock = it->second;
+
+    // send the data in chunks, each one a separate pipelined write at increasing offsets of dst
+    // the chunks are converted to type when they consist of whole blocks of finite F32 values
+    // each write carries the token of the export of the destination buffer
+    rpc_msg_set_tensor_peer_req set_request;
+    set_request.token = request.dst_token;
+    set_request.req.tensor = request.dst;
+    rpc_msg_set_tensor_converted_peer_req converted_request;
+    converted_request.token = request.dst_token;
+    converted_request.req.tensor = request.dst;
+    converted_request.req.type = type;
+    const bool convert = type != GGML_TYPE_F32 && src->type == GGML_TYPE_F32 && request.dst.type == GGML_TYPE_F32;
+    const size_t size = ggml_nbytes(src);
+    const bool is_host = ggml_backend_buffer_is_host(src->buffer);
+    std::vector<uint8_t> chunk(is_host ? 0 : std::min(size, (size_t) RPC_CHUNK_SIZE));
+    std::vector<uint8_t> converted(convert ? ggml_row_size(type, std::min(size, (size_t) RPC_CHUNK_SIZE) / sizeof(float)) : 0);
+    bool ok = true;
+    for (size_t pos = 0; ok && pos < size; pos += RPC_CHUNK_SIZE) {
+        const size_t n = std::min((size_t) RPC_CHUNK_SIZE, size - pos);
+        const void * data = (const char *) src->data + pos;
+        if (!is_host) {
+            std::lock_guard<std::mutex> backend_lock(shared.backend_mutex);
+            ggml_backend_tensor_get(src, chunk.data(), pos, n);
+            data = chunk.data();
+        }
+        if (convert && rpc_can_convert(GGML_TYPE_F32, type, pos, n) && rpc_can_convert_data(type, (const float *) data, n / sizeof(float))) {
+            const int64_t n_values = n / sizeof(float);
+            ggml_get_type_traits(type)->from_float_ref((const float *) data, converted.data(), n_values);
+            converted_request.req.offset = pos;
+            ok = send_rpc_cmd_async(sock, RPC_CMD_SET_TENSOR_CONVERTED_PEER, &converted_request, sizeof(converted_request),
+                                    converted.data(), ggml_row_size(type, n_values), nullptr, 0);
+            continue;
+        }
+        set_request.req.offset = pos;
+        ok = send_rpc_cmd_async(sock, RPC_CMD_SET_TENSOR_PEER, &set_request, sizeof(set_request), data, n, nullptr, 0);
+    }
+    ok = ok && recv_pending_rsp(sock);
+    if (!ok) {
+        GGML_LOG_ERROR("[%s] failed to send the tensor to %s\n", __func__, endpoint.c_str());
+        peers.erase(endpoint);
+    }
+    response.result = ok;
     ggml_free(ctx);
     return true;
 }
@@ -1136,20 +2529,157 @@ bool rpc_server::graph_compute(const std::vector<uint8_t> & input, rpc_msg_graph
         memcpy(&id, &nodes[i], sizeof(id));
         graph->nodes[i] = create_node(id, ctx, tensor_ptrs, tensor_map);
     }
-    ggml_status status = ggml_backend_graph_compute(backend, graph);
+    ggml_status status;
+    {
+        std::lock_guard<std::mutex> lock(shared.backend_mutex);
+        status = ggml_backend_graph_compute(backend, graph);
+    }
+    response.result = status;
+
+    // keep the graph for graph_compute_delta
+    clear_graph_cache();
+    this->graph_ctx     = ctx;
+    this->graph         = graph;
+    this->graph_input   = input;
+    this->graph_hash    = rpc_hash(input.data(), input.size());
+    this->graph_tensors = std::move(tensor_map);
+    return true;
+}
+
+bool rpc_server::graph_compute_delta(const std::vector<uint8_t> & input, rpc_msg_graph_compute_delta_rsp & response) {
+    // serialization format:
+    // | base_hash (8 bytes) | n_changed (4 bytes) | changed (n_changed * (index (4 bytes) | rpc_tensor)) |
+    const size_t entry_size = sizeof(uint32_t) + sizeof(rpc_tensor);
+    if (input.size() < sizeof(uint64_t) + sizeof(uint32_t)) {
+        return false;
+    }
+    uint64_t base_hash;
+    uint32_t n_changed;
+    memcpy(&base_hash, input.data(), sizeof(base_hash));
+    memcpy(&n_changed, input.data() + sizeof(base_hash), sizeof(n_changed));
+    if (input.size() != sizeof(base_hash) + sizeof(n_changed) + (uint64_t) n_changed*entry_size) {
+        return false;
+    }
+    GGML_PRINT_DEBUG("[%s] n_changed: %u\n", __func__, n_changed);
+
+    response.cached = 0;
+    response.result = GGML_STATUS_FAILED;
+    if (graph == nullptr || base_hash != graph_hash) {
+        return true;
+    }
+
+    uint32_t n_nodes;
+    memcpy(&n_nodes, graph_input.data(), sizeof(n_nodes));
+    const size_t tensors_offs = sizeof(uint32_t) + n_nodes*sizeof(uint64_t) + sizeof(uint32_t);
+    const uint32_t n_tensors = (graph_input.size() - tensors_offs) / sizeof(rpc_tensor);
+    rpc_tensor * tensors = (rpc_tensor *)(graph_input.data() + tensors_offs);
+
+    const uint8_t * changed = input.data() + sizeof(base_hash) + sizeof(n_changed);
+
+    // validate the whole delta before modifying the cached graph
+    for (uint32_t i = 0; i < n_changed; i++) {
+        uint32_t index;
+        rpc_tensor tensor;
+        memcpy(&index,  changed + i*entry_size, sizeof(index));
+        memcpy(&tensor, changed + i*entry_size + sizeof(index), sizeof(tensor));
+        if (index >= n_tensors || tensors[index].id != tensor.id) {
+            return true;
+        }
+        for (int j = 0; j < GGML_MAX_SRC; j++) {
+            if (tensor.src[j] != 0 && graph_tensors.find(tensor.src[j]) == graph_tensors.end()) {
+                return true;
+            }
+        }
+        if (tensor.view_src != 0 && graph_tensors.find(tensor.view_src) == graph_tensors.end()) {
+            return true;
+        }
+    }
+
+    for (uint32_t i = 0; i < n_changed; i++) {
+        uint32_t index;
+        memcpy(&index, changed + i*entry_size, sizeof(index));
+        memcpy(&tensors[index], changed + i*entry_size + sizeof(index), sizeof(rpc_tensor));
+
+        const rpc_tensor * tensor = &tensors[index];
+        ggml_tensor * result = graph_tensors.at(tensor->id);
+        update_tensor(result, tensor);
+        for (int j = 0; j < GGML_MAX_SRC; j++) {
+            result->src[j] = tensor->src[j] == 0 ? nullptr : graph_tensors.at(tensor->src[j]);
+        }
+        result->view_src  = tensor->view_src == 0 ? nullptr : graph_tensors.at(tensor->view_src);
+        result->view_offs = tensor->view_offs;
+    }
+    graph_hash = rpc_hash(graph_input.data(), graph_input.size());
+
+    ggml_status status;
+    {
+        std::lock_guard<std::mutex> lock(shared.backend_mutex);
+        status = ggml_backend_graph_compute(backend, graph);
+    }
+    response.cached = 1;
     response.result = status;
-    ggml_free(ctx);
     return true;
 }
 
+void rpc_server::clear_graph_cache() {
+    if (graph_ctx != nullptr) {
+        ggml_free(graph_ctx);
+    }
+    graph_ctx = nullptr;
+    graph = nullptr;
+    graph_input.clear();
+    graph_hash = 0;
+    graph_tensors.clear();
+}
+
 rpc_server::~rpc_server() {
+    clear_graph_cache();
     for (auto buffer : buffers) {
+        unexport_peer(buffer);
+    }
+    std::lock_guard<std::mutex> lock(shared.mem_mutex);
+    std::lock_guard<std::mutex> backend_lock(shared.backend_mutex);
+    for (auto buffer : buffers) {
+        shared.used_mem -= ggml_backend_buffer_get_size(buffer);
         ggml_backend_buffer_free(buffer);
     }
 }
 
-static void rpc_serve_client(ggml_backend_t backend, sockfd_t sockfd, size_t free_mem, size_t total_mem) {
-    rpc_server server(backend);
+// limits the number of client sessions served concurrently to max_clients
+struct rpc_client_slot {
+    rpc_server_shared & shared;
+    bool acquired = false;
+
+    rpc_client_slot(rpc_server_shared & shared) : shared(shared) {}
+
+    void acquire() {
+        std::unique_lock<std::mutex> lock(shared.clients_mutex);
+        shared.clients_cv.wait(lock, [&] { return shared.n_clients < shared.max_clients; });
+        shared.n_clients++;
+        acquired = true;
+    }
+
+    ~rpc_client_slot() {
+        if (!acquired) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(shared.clients_mutex);
+            shared.n_clients--;
+        }
+        shared.clients_cv.notify_one();
+    }
+};
+
+// a connection is either a client session or a peer connection, depending on its first command
+// peer connections are opened by copy_tensor_peer of other servers, they can only write to exported buffers and do
+// not take a client slot, so that servers copying to each other do not wait for each other's slots
+static void rpc_serve_client(rpc_server_shared & shared, sockfd_t sockfd) {
+    // released after the session has freed its buffers
+    rpc_client_slot slot(shared);
+    rpc_server server(shared);
+    bool first = true;
+    bool peer = false;
     while (true) {
         uint8_t cmd;
         if (!recv_data(sockfd, &cmd, 1)) {
@@ -1160,6 +2690,18 @@ static void rpc_serve_client(ggml_backend_t backend, sockfd_t sockfd, size_t fre
             fprintf(stderr, "Unknown command: %d\n", cmd);
             break;
         }
+        const bool peer_cmd = cmd == RPC_CMD_SET_TENSOR_PEER || cmd == RPC_CMD_SET_TENSOR_CONVERTED_PEER;
+        if (first) {
+            peer = peer_cmd;
+            if (!peer) {
+                slot.acquire();
+            }
+            first = false;
+        }
+        if (peer_cmd != peer) {
+            fprintf(stderr, "Unexpected command %d on a %s connection\n", cmd, peer ? "peer" : "client");
+            break;
+        }
         switch (cmd) {
             case RPC_CMD_ALLOC_BUFFER: {
                 rpc_msg_alloc_buffer_req request;
@@ -1247,12 +2789,76 @@ static void rpc_serve_client(ggml_backend_t backend, sockfd_t sockfd, size_t fre
                 }
                 break;
             }
+            case RPC_CMD_BUFFER_EXPORT_PEER: {
+                rpc_msg_buffer_export_peer_req request;
+                if (!recv_msg(sockfd, &request, sizeof(request))) {
+                    return;
+                }
+                rpc_msg_buffer_export_peer_rsp response;
+                if (!server.buffer_export_peer(request, response)) {
+                    return;
+                }
+                if (!send_msg(sockfd, &response, sizeof(response))) {
+                    return;
+                }
+                break;
+            }
             case RPC_CMD_SET_TENSOR: {
-                std::vector<uint8_t> input;
-                if (!recv_msg(sockfd, input)) {
+                uint64_t input_size;
+                if (!recv_data(sockfd, &input_size, sizeof(input_size))) {
+                    return;
+                }
+                if (!server.set_tensor(sockfd, input_size)) {
+                    return;
+                }
+                if (!send_msg(sockfd, nullptr, 0)) {
+                    return;
+                }
+                break;
+            }
+            case RPC_CMD_SET_TENSOR_CONVERTED: {
+                uint64_t input_size;
+                if (!recv_data(sockfd, &input_size, sizeof(input_size))) {
+                    return;
+                }
+                if (!server.set_tensor_converted(sockfd, input_size)) {
+                    return;
+                }
+                if (!send_msg(sockfd, nullptr, 0)) {
+                    return;
+                }
+                break;
+            }
+            case RPC_CMD_GET_TENSOR_CONVERTED: {
+                rpc_msg_get_tensor_converted_req request;
+                if (!recv_msg(sockfd, &request, sizeof(request))) {
+                    return;
+                }
+                if (!server.get_tensor_converted(sockfd, request)) {
+                    return;
+                }
+                break;
+            }
+            case RPC_CMD_SET_TENSOR_FROM_FILE: {
+                rpc_msg_set_tensor_from_file_req request;
+                if (!recv_msg(sockfd, &request, sizeof(request))) {
                     return;
                 }
-                if (!server.set_tensor(input)) {
+                rpc_msg_set_tensor_from_file_rsp response;
+                if (!server.set_tensor_from_file(request, response)) {
+                    return;
+                }
+                if (!send_msg(sockfd, &response, sizeof(response))) {
+                    return;
+                }
+                break;
+            }
+            case RPC_CMD_SET_TENSOR_PEER: {
+                uint64_t input_size;
+                if (!recv_data(sockfd, &input_size, sizeof(input_size))) {
+                    return;
+                }
+                if (!server.set_tensor(sockfd, input_size, true)) {
                     return;
                 }
                 if (!send_msg(sockfd, nullptr, 0)) {
@@ -1260,6 +2866,46 @@ static void rpc_serve_client(ggml_backend_t backend, sockfd_t sockfd, size_t fre
                 }
                 break;
             }
+            case RPC_CMD_SET_TENSOR_CONVERTED_PEER: {
+                uint64_t input_size;
+                if (!recv_data(sockfd, &input_size, sizeof(input_size))) {
+                    return;
+                }
+                if (!server.set_tensor_converted(sockfd, input_size, true)) {
+                    return;
+                }
+                if (!send_msg(sockfd, nullptr, 0)) {
+                    return;
+                }
+                break;
+            }
+            case RPC_CMD_SET_TENSOR_COMPRESSED: {
+                uint64_t input_size;
+                if (!recv_data(sockfd, &input_size, sizeof(input_size))) {
+                    return;
+                }
+                if (!server.set_tensor_compressed(sockfd, input_size)) {
+                    return;
+                }
+                if (!send_msg(sockfd, nullptr, 0)) {
+                    return;
+                }
+                break;
+            }
+            case RPC_CMD_COPY_TENSOR_PEER: {
+                rpc_msg_copy_tensor_peer_req request;
+                if (!recv_msg(sockfd, &request, sizeof(request))) {
+                    return;
+                }
+                rpc_msg_copy_tensor_rsp response;
+                if (!server.copy_tensor_peer(request, response)) {
+                    return;
+                }
+                if (!send_msg(sockfd, &response, sizeof(response))) {
+                    return;
+                }
+                break;
+            }
             case RPC_CMD_INIT_TENSOR: {
                 rpc_msg_init_tensor_req request;
                 if (!recv_msg(sockfd, &request,sizeof(request))) {
@@ -1278,11 +2924,7 @@ static void rpc_serve_client(ggml_backend_t backend, sockfd_t sockfd, size_t fre
                 if (!recv_msg(sockfd, &request, sizeof(request))) {
                     return;
                 }
-                std::vector<uint8_t> response;
-                if (!server.get_tensor(request, response)) {
-                    return;
-                }
-                if (!send_msg(sockfd, response.data(), response.size())) {
+                if (!server.get_tensor(sockfd, request)) {
                     return;
                 }
                 break;
@@ -1315,13 +2957,26 @@ static void rpc_serve_client(ggml_backend_t backend, sockfd_t sockfd, size_t fre
                 }
                 break;
             }
+            case RPC_CMD_GRAPH_COMPUTE_DELTA: {
+                std::vector<uint8_t> input;
+                if (!recv_msg(sockfd, input)) {
+                    return;
+                }
+                rpc_msg_graph_compute_delta_rsp response;
+                if (!server.graph_compute_delta(input, response)) {
+                    return;
+                }
+                if (!send_msg(sockfd, &response, sizeof(response))) {
+                    return;
+                }
+                break;
+            }
             case RPC_CMD_GET_DEVICE_MEMORY: {
                 if (!recv_msg(sockfd, nullptr, 0)) {
                     return;
                 }
                 rpc_msg_get_device_memory_rsp response;
-                response.free_mem = free_mem;
-                response.total_mem = total_mem;
+                server.get_device_memory(response);
                 if (!send_msg(sockfd, &response, sizeof(response))) {
                     return;
                 }
@@ -1356,17 +3011,49 @@ void ggml_backend_rpc_start_server(ggml_backend_t backend, const char * endpoint
         fprintf(stderr, "Failed to create server socket\n");
         return;
     }
+    rpc_server_shared shared(backend, free_mem, total_mem);
+
+    // at most max_clients client sessions are served concurrently, the further ones wait for a slot after their
+    // connection is accepted, see rpc_serve_client
+    const char * max_clients_env = getenv("GGML_RPC_MAX_CLIENTS");
+    if (max_clients_env != nullptr && atoi(max_clients_env) > 0) {
+        shared.max_clients = atoi(max_clients_env);
+    }
+    std::mutex clients_mutex;
+    std::unordered_map<std::thread::id, std::thread> clients;
+    std::vector<std::thread::id> finished;
     while (true) {
+        {
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            // join the threads of the connections that have ended
+            for (auto id : finished) {
+                clients[id].join();
+                clients.erase(id);
+            }
+            finished.clear();
+        }
         auto client_socket = socket_accept(server_socket->fd);
         if (client_socket == nullptr) {
             fprintf(stderr, "Failed to accept client connection\n");
-            return;
+            break;
         }
         printf("Accepted client connection, free_mem=%zu, total_mem=%zu\n", free_mem, total_mem);
         fflush(stdout);
-        rpc_serve_client(backend, client_socket->fd, free_mem, total_mem);
-        printf("Client connection closed\n");
-        fflush(stdout);
+        // serve each client in its own thread with its own session
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        std::thread thread([&shared, &clients_mutex, &finished, client_socket]() {
+            rpc_serve_client(shared, client_socket->fd);
+            printf("Client connection closed\n");
+            fflush(stdout);
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            finished.push_back(std::this_thread::get_id());
+        });
+        auto id = thread.get_id();
+        clients.emplace(id, std::move(thread));
+    }
+    // wait for the sessions still running
+    for (auto & client : clients) {
+        client.second.join();
     }
 #ifdef _WIN32
     WSACleanup();
@@ -1413,7 +3100,7 @@ static void ggml_backend_rpc_device_get_props(ggml_backend_dev_t dev, struct ggm
     props->type        = ggml_backend_rpc_device_get_type(dev);
     ggml_backend_rpc_device_get_memory(dev, &props->memory_free, &props->memory_total);
     props->caps = {
-        /* .async                 = */ false,
+        /* .async                 = */ true,
         /* .host_buffer           = */ false,
         /* .buffer_from_host_ptr  = */ false,
         /* .events                = */ false,
@@ -8681,8 +8681,9 @@ static bool ggml_backend_vk_device_supports_op(ggml_backend_dev_t dev, const ggm
         case GGML_OP_POOL_2D:
         case GGML_OP_RWKV_WKV6:
         case GGML_OP_LEAKY_RELU:
-        case GGML_OP_OPT_STEP_ADAMW:
             return true;
+        case GGML_OP_OPT_STEP_ADAMW:
+            return op->src[2]->type == GGML_TYPE_F32;
         default:
             return false;
     }
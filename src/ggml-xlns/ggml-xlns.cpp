@@ -194,7 +194,7 @@ static bool ggml_backend_xlns_device_supports_op(ggml_backend_dev_t dev, const s
             return ggml_is_contiguous(src0) &&
                    ggml_is_contiguous(src1) &&
                    src1->type == GGML_TYPE_F32 &&
-                   (src0->type == GGML_TYPE_F32 || ggml_get_type_traits(src0->type)->to_float != NULL);
+                   src0->type == GGML_TYPE_F32; // the kernel reads src0 as F32
         }
     default:
         return false;
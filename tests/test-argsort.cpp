@@ -0,0 +1,163 @@
+// compares ARGSORT with std::stable_sort, and SAMPLE_TOP_P with draws computed by hand, on the CPU backend
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <vector>
+
+static std::vector<int32_t> argsort_ref(const float * x, int64_t n, ggml_sort_order order) {
+    std::vector<int32_t> idx(n);
+    std::iota(idx.begin(), idx.end(), 0);
+    if (order == GGML_SORT_ORDER_ASC) {
+        std::stable_sort(idx.begin(), idx.end(), [&](int32_t a, int32_t b) { return x[a] < x[b]; });
+    } else {
+        std::stable_sort(idx.begin(), idx.end(), [&](int32_t a, int32_t b) { return x[a] > x[b]; });
+    }
+    return idx;
+}
+
+static bool test_argsort(const char * desc, const std::vector<float> & data, int64_t ncols, ggml_sort_order order, int n_threads) {
+    const int64_t nrows = data.size()/ncols;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ 2*data.size()*sizeof(float) + 2*1024*1024 + 3*ncols*n_threads*sizeof(uint32_t),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ false,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+
+    struct ggml_tensor * a = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ncols, nrows);
+    memcpy(a->data, data.data(), ggml_nbytes(a));
+
+    struct ggml_tensor * out = ggml_argsort(ctx, a, order);
+    struct ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, out);
+    ggml_graph_compute_with_ctx(ctx, gf, n_threads);
+
+    bool ok = true;
+    for (int64_t i = 0; ok && i < nrows; i++) {
+        const std::vector<int32_t> expected = argsort_ref(data.data() + i*ncols, ncols, order);
+        ok = memcmp(expected.data(), (const int32_t *) out->data + i*ncols, ncols*sizeof(int32_t)) == 0;
+    }
+    printf("argsort %s, %s, n_threads = %d: %s\n", desc, order == GGML_SORT_ORDER_ASC ? "asc" : "desc", n_threads, ok ? "OK" : "FAILED");
+
+    ggml_free(ctx);
+    return ok;
+}
+
+// draws one id from probs/ids with ggml_sample_top_p for each u
+static std::vector<int32_t> sample_top_p(const std::vector<float> & probs, const std::vector<int32_t> & ids, float p, const std::vector<float> & u) {
+    const int64_t k = probs.size();
+    const int64_t n = u.size();
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ 1024*1024,
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ false,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+
+    // the same probabilities and ids in every row, one row per u
+    struct ggml_tensor * a  = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, k, n);
+    struct ggml_tensor * id = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, k, n);
+    struct ggml_tensor * r  = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n);
+    for (int64_t i = 0; i < n; i++) {
+        memcpy((float   *) a->data  + i*k, probs.data(), k*sizeof(float));
+        memcpy((int32_t *) id->data + i*k, ids.data(),   k*sizeof(int32_t));
+    }
+    memcpy(r->data, u.data(), n*sizeof(float));
+
+    struct ggml_tensor * out = ggml_sample_top_p(ctx, a, id, r, p);
+    struct ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, out);
+    ggml_graph_compute_with_ctx(ctx, gf, 2);
+
+    std::vector<int32_t> result((const int32_t *) out->data, (const int32_t *) out->data + n);
+    ggml_free(ctx);
+    return result;
+}
+
+static bool test_sample_top_p(const char * desc, const std::vector<float> & probs, const std::vector<int32_t> & ids, float p,
+                              const std::vector<float> & u, const std::vector<int32_t> & expected) {
+    const std::vector<int32_t> result = sample_top_p(probs, ids, p, u);
+    const bool ok = result == expected;
+    printf("sample_top_p %s, p = %.2f: %s\n", desc, p, ok ? "OK" : "FAILED");
+    if (!ok) {
+        for (size_t i = 0; i < u.size(); i++) {
+            printf("  u = %.8f: expected %d, got %d\n", u[i], expected[i], result[i]);
+        }
+    }
+    return ok;
+}
+
+int main(void) {
+    std::mt19937 rng(1234);
+
+    int n_failed = 0;
+
+    for (ggml_sort_order order : { GGML_SORT_ORDER_ASC, GGML_SORT_ORDER_DESC }) {
+        for (int n_threads : { 1, 3 }) {
+            // many ties, negative values and both zeros
+            {
+                const float values[] = { -0.0f, 0.0f, 1.0f, -1.0f, 2.5f, -2.5f, INFINITY, -INFINITY };
+                std::uniform_int_distribution<int> dist(0, 7);
+                std::vector<float> data(37*8);
+                for (auto & x : data) {
+                    x = values[dist(rng)];
+                }
+                n_failed += !test_argsort("ties and +-0, 37 x 8", data, 37, order, n_threads);
+            }
+            // the width of the vocabulary of GPT-2
+            {
+                std::normal_distribution<float> dist(0.0f, 10.0f);
+                std::vector<float> data(50257*2);
+                for (auto & x : data) {
+                    x = dist(rng);
+                }
+                // ties in a wide row
+                for (size_t i = 0; i < data.size(); i += 7) {
+                    data[i] = 1.0f;
+                }
+                n_failed += !test_argsort("random, 50257 x 2", data, 50257, order, n_threads);
+            }
+        }
+    }
+
+    // probabilities sorted in descending order with their ids, the cumulative sums are 0.5, 0.75, 0.875, 1
+    const std::vector<float>   probs = { 0.5f, 0.25f, 0.125f, 0.125f };
+    const std::vector<int32_t> ids   = { 7, 3, 9, 1 };
+    const float u_max = nextafterf(1.0f, 0.0f);
+
+    // p = 1 keeps all of the elements
+    n_failed += !test_sample_top_p("all", probs, ids, 1.0f,
+        { 0.0f, 0.49f, 0.5f, 0.74f, 0.8f, 0.9f, u_max },
+        { 7,    7,     3,    3,     9,    1,    1     });
+    // 0.75 keeps the first two elements, whose probabilities are renormalized to 2/3 and 1/3
+    n_failed += !test_sample_top_p("prefix", probs, ids, 0.75f,
+        { 0.0f, 0.66f, 0.67f, 0.9f, u_max },
+        { 7,    7,     3,     3,    3     });
+    // a prefix of one element, even for u close to 1
+    n_failed += !test_sample_top_p("first", probs, ids, 0.5f,
+        { 0.0f, 0.5f, u_max },
+        { 7,    7,    7     });
+    // a single element per row (k = 1)
+    n_failed += !test_sample_top_p("k = 1", { 1.0f }, { 42 }, 0.9f,
+        { 0.0f, 0.5f, u_max },
+        { 42,   42,   42    });
+    // probabilities that do not sum exactly to 1: u close to 1 must still draw an element of the row
+    n_failed += !test_sample_top_p("rounded sum", { 0.6f, 0.3f, 0.0999f }, { 5, 6, 8 }, 1.0f,
+        { 0.0f, 0.95f, u_max },
+        { 5,    8,     8     });
+
+    if (n_failed > 0) {
+        printf("%d tests failed\n", n_failed);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
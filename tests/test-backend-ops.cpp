@@ -2696,6 +2696,47 @@ struct test_im2col : public test_case {
     }
 };
 
+// GGML_OP_CONV_2D
+struct test_conv_2d : public test_case {
+    const ggml_type type_kernel;
+    const std::array<int64_t, 4> ne_input;
+    const std::array<int64_t, 4> ne_kernel;
+    // stride
+    const int s0;
+    const int s1;
+    // padding
+    const int p0;
+    const int p1;
+    // dilation
+    const int d0;
+    const int d1;
+
+    std::string vars() override {
+        return VARS_TO_STR9(type_kernel, ne_input, ne_kernel, s0, s1, p0, p1, d0, d1);
+    }
+
+    test_conv_2d(ggml_type type_kernel = GGML_TYPE_F16,
+            std::array<int64_t, 4> ne_input = {10, 10, 3, 1}, // [input_width, input_height, input_channels, batch]
+            std::array<int64_t, 4> ne_kernel = {3, 3, 3, 4}, // [kernel_width, kernel_height, input_channels, output_channels]
+            int s0 = 1, int s1 = 1,
+            int p0 = 1, int p1 = 1,
+            int d0 = 1, int d1 = 1)
+        : type_kernel(type_kernel), ne_input(ne_input), ne_kernel(ne_kernel), s0(s0), s1(s1), p0(p0), p1(p1), d0(d0), d1(d1) {}
+
+    ggml_tensor * build_graph(ggml_context * ctx) override {
+        ggml_tensor * input = ggml_new_tensor(ctx, GGML_TYPE_F32, 4, ne_input.data());
+        ggml_set_name(input, "input");
+
+        ggml_tensor * kernel = ggml_new_tensor(ctx, type_kernel, 4, ne_kernel.data());
+        ggml_set_name(kernel, "kernel");
+
+        ggml_tensor * out = ggml_conv_2d_direct(ctx, kernel, input, s0, s1, p0, p1, d0, d1);
+        ggml_set_name(out, "out");
+
+        return out;
+    }
+};
+
 // GGML_OP_CONCAT
 struct test_concat : public test_case {
     const ggml_type type;
@@ -2803,6 +2844,47 @@ struct test_argsort : public test_case {
     }
 };
 
+// GGML_OP_SAMPLE_TOP_P
+struct test_sample_top_p : public test_case {
+    const int64_t k;
+    const int64_t n;
+    const float p;
+
+    std::string vars() override {
+        return VARS_TO_STR3(k, n, p);
+    }
+
+    test_sample_top_p(int64_t k = 40, int64_t n = 8, float p = 0.9f)
+        : k(k), n(n), p(p) {}
+
+    ggml_tensor * build_graph(ggml_context * ctx) override {
+        ggml_tensor * a = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, k, n);
+        ggml_set_name(a, "a");
+
+        // probabilities sorted in descending order, as produced by top-k + softmax
+        ggml_tensor * ids   = ggml_top_k(ctx, a, k);
+        ggml_tensor * probs = ggml_soft_max(ctx, ggml_reshape_2d(ctx, ggml_get_rows(ctx, ggml_reshape_3d(ctx, a, 1, k, n), ids), k, n));
+
+        ggml_tensor * u = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n);
+        ggml_set_name(u, "u");
+
+        ggml_tensor * out = ggml_sample_top_p(ctx, probs, ids, u, p);
+        ggml_set_name(out, "out");
+
+        return out;
+    }
+
+    void initialize_tensors(ggml_context * ctx) override {
+        for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != NULL; t = ggml_get_next_tensor(ctx, t)) {
+            if (strcmp(ggml_get_name(t), "u") == 0) {
+                init_tensor_uniform(t, 0.0f, 1.0f);
+            } else {
+                init_tensor_uniform(t, -5.0f, 5.0f);
+            }
+        }
+    }
+};
+
 // GGML_OP_SUM
 struct test_sum : public test_case {
     const ggml_type type;
@@ -3873,6 +3955,13 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
     // test_cases.emplace_back(new test_im2col(GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_F16, {1024, 1024, 256, 1}, {3, 3, 256, 1}, 1, 1, 1, 1, 1, 1, true));
     // test_cases.emplace_back(new test_im2col(GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_F32, {1024, 1024, 256, 1}, {3, 3, 256, 1}, 1, 1, 1, 1, 1, 1, true));
 
+    for (ggml_type type_kernel : {GGML_TYPE_F32, GGML_TYPE_F16}) {
+        test_cases.emplace_back(new test_conv_2d(type_kernel));
+        test_cases.emplace_back(new test_conv_2d(type_kernel, {13, 11, 5, 2}, {3, 3, 5, 7}, 2, 1, 1, 0, 1, 2));
+        test_cases.emplace_back(new test_conv_2d(type_kernel, {16, 16, 8, 1}, {1, 1, 8, 20}, 1, 1, 0, 0, 1, 1));
+        test_cases.emplace_back(new test_conv_2d(type_kernel, {32, 32, 3, 1}, {16, 16, 3, 8}, 16, 16, 0, 0, 1, 1));
+    }
+
     test_cases.emplace_back(new test_conv_transpose_1d());
     test_cases.emplace_back(new test_conv_transpose_1d({3,2,1,1}, {2,3,2,1}, 3, 0, 1));
     test_cases.emplace_back(new test_conv_transpose_1d({3,2,1,1}, {2,3,2,1}, 2, 0, 1));
@@ -4279,8 +4368,13 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
         test_cases.emplace_back(new test_argsort(GGML_TYPE_F32, {8, 1, 1, 1}, order));
         test_cases.emplace_back(new test_argsort(GGML_TYPE_F32, {16, 10, 10, 10}, order));
         test_cases.emplace_back(new test_argsort(GGML_TYPE_F32, {60, 10, 10, 10}, order)); // qwen
+        test_cases.emplace_back(new test_argsort(GGML_TYPE_F32, {50257, 2, 1, 1}, order)); // gpt-2 vocab
     }
 
+    test_cases.emplace_back(new test_sample_top_p());
+    test_cases.emplace_back(new test_sample_top_p(40, 8, 1.0f));
+    test_cases.emplace_back(new test_sample_top_p(1, 4, 0.5f));
+
     test_cases.emplace_back(new test_sum());
     test_cases.emplace_back(new test_sum_rows());
     test_cases.emplace_back(new test_mean());
@@ -4364,6 +4458,15 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_perf() {
     test_cases.emplace_back(new test_argmax(GGML_TYPE_F32, {32, 10, 1, 1}));
     test_cases.emplace_back(new test_argmax(GGML_TYPE_F32, {1024, 10, 1, 1}));
     test_cases.emplace_back(new test_argmax(GGML_TYPE_F32, {32000, 512, 1, 1}));
+    test_cases.emplace_back(new test_argmax(GGML_TYPE_F32, {151936, 1, 1, 1}));
+
+    test_cases.emplace_back(new test_sum(GGML_TYPE_F32, {4096, 4096, 1, 1}));
+
+    test_cases.emplace_back(new test_repeat(GGML_TYPE_F32, {4096, 1, 1, 1}, {1, 512, 1, 1}));
+    test_cases.emplace_back(new test_repeat(GGML_TYPE_F32, {64, 64, 32, 1}, {2, 1, 1, 4}));
+
+    test_cases.emplace_back(new test_pool2d(GGML_OP_POOL_MAX, GGML_TYPE_F32, {416, 416, 16, 1}, 2, 2, 2, 2, 0, 0));
+    test_cases.emplace_back(new test_pool2d(GGML_OP_POOL_AVG, GGML_TYPE_F32, {56, 56, 256, 1}, 3, 3, 1, 1, 1, 1));
 
     for (int bs : {1, 2, 3, 4, 5, 8, 512}) {
         for (ggml_type type_a : all_types) {
@@ -4385,6 +4488,11 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_perf() {
         }
     }
 
+    // yolov3-tiny and sam encoder neck
+    test_cases.emplace_back(new test_conv_2d(GGML_TYPE_F16, {208, 208,  16, 1}, {3, 3,  16,  32}, 1, 1, 1, 1, 1, 1));
+    test_cases.emplace_back(new test_conv_2d(GGML_TYPE_F16, { 26,  26, 128, 1}, {3, 3, 128, 256}, 1, 1, 1, 1, 1, 1));
+    test_cases.emplace_back(new test_conv_2d(GGML_TYPE_F16, { 64,  64, 256, 1}, {3, 3, 256, 256}, 1, 1, 1, 1, 1, 1));
+
     return test_cases;
 }
 
@@ -169,6 +169,13 @@ struct ggml_cgraph * build_graph(const test_model& model) {
     ggml_set_name(conv2d_res, "conv2d_res");
     ggml_build_forward_expand(gf, conv2d_res);
 
+    // im2col-free convolution, should match conv2d_res
+    if (ggml_backend_is_cpu(model.backend)) {
+        struct ggml_tensor* conv2d_direct_res = ggml_conv_2d_direct(ctx0, model.a, model.b, s0, s1, p0, p1, d0, d1);
+        ggml_set_name(conv2d_direct_res, "conv2d_direct_res");
+        ggml_build_forward_expand(gf, conv2d_direct_res);
+    }
+
     ggml_free(ctx0);
     return gf;
 }
@@ -216,12 +223,15 @@ int main(void)
 
     struct ggml_tensor * im2col_res = NULL;
     struct ggml_tensor * conv2d_res = NULL;
+    struct ggml_tensor * conv2d_direct_res = NULL;
 
     for(int i = 0; i < ggml_graph_n_nodes(gf_res); ++i) {
         if(strcmp(ggml_get_name(ggml_graph_node(gf_res, i)), "im2col_res") == 0) {
             im2col_res = ggml_graph_node(gf_res, i);
         } else if(strcmp(ggml_get_name(ggml_graph_node(gf_res, i)), "conv2d_res") == 0) {
             conv2d_res = ggml_graph_node(gf_res, i);
+        } else if(strcmp(ggml_get_name(ggml_graph_node(gf_res, i)), "conv2d_direct_res") == 0) {
+            conv2d_direct_res = ggml_graph_node(gf_res, i);
         }
     }
 
@@ -382,6 +392,20 @@ int main(void)
 
     printf("ggml_conv2d (%d): %s\n", (int) ggml_nelements(conv2d_res), passed && (ggml_nelements(conv2d_res) == n_conv2d_test) ? "\033[32mPASSED\033[0m" : "\033[31mFAILED\033[0m");
 
+    if (conv2d_direct_res) {
+        std::vector<float> conv2d_direct_data(ggml_nelements(conv2d_direct_res));
+        ggml_backend_tensor_get(conv2d_direct_res, conv2d_direct_data.data(), 0, ggml_nbytes(conv2d_direct_res));
+
+        passed = ggml_nelements(conv2d_direct_res) == n_conv2d_test;
+        for(int i = 0; passed && i < n_conv2d_test; i++) {
+            if(conv2d_direct_data[i] != expected_conv2d[i]) {
+                passed = false;
+            }
+        }
+
+        printf("ggml_conv2d_direct (%d): %s\n", (int) ggml_nelements(conv2d_direct_res), passed ? "\033[32mPASSED\033[0m" : "\033[31mFAILED\033[0m");
+    }
+
     ggml_free(model.ctx);
 
     ggml_backend_buffer_free(model.buffer);
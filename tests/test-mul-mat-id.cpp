@@ -0,0 +1,116 @@
+// compares MUL_MAT_ID with a reference computed with the vec_dot of the type
+// the routing gives some experts enough rows to be computed with llamafile_sgemm in GGML_LLAMAFILE builds,
+// and others only a few rows or none, which use the vec_dot path
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static double nmse(const float * a, const float * b, size_t n) {
+    double mse = 0.0;
+    double ref = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        mse += (a[i] - b[i])*(a[i] - b[i]);
+        ref += b[i]*b[i];
+    }
+    return mse/ref;
+}
+
+static bool test_mul_mat_id(ggml_type type, int n_threads, std::mt19937 & rng) {
+    const int64_t K        = 512;
+    const int64_t M        = 13; // not a multiple of the sgemm tile sizes
+    const int64_t n_expert = 4;
+    const int64_t n_used   = 2;
+    const int64_t n_tokens = 64;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ 32*1024*1024,
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ false,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    struct ggml_tensor * as = ggml_new_tensor_3d(ctx, type, K, M, n_expert);
+    {
+        std::vector<float> w(K*M*n_expert);
+        for (auto & x : w) {
+            x = dist(rng);
+        }
+        ggml_quantize_chunk(type, w.data(), as->data, 0, M*n_expert, K, nullptr);
+    }
+
+    struct ggml_tensor * b = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, K, 1, n_tokens);
+    for (int64_t i = 0; i < K*n_tokens; i++) {
+        ((float *) b->data)[i] = dist(rng);
+    }
+
+    // expert 0 gets all the tokens, expert 1 gets 40 of them, experts 2 and 3 get a few
+    struct ggml_tensor * ids = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, n_used, n_tokens);
+    for (int64_t t = 0; t < n_tokens; t++) {
+        ((int32_t *) ids->data)[t*n_used + 0] = 0;
+        ((int32_t *) ids->data)[t*n_used + 1] = t < 40 ? 1 : t < 45 ? 2 : 3;
+    }
+
+    struct ggml_tensor * out = ggml_mul_mat_id(ctx, as, b, ids);
+    struct ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, out);
+    ggml_graph_compute_with_ctx(ctx, gf, n_threads);
+
+    // reference
+    const auto * traits = ggml_get_type_traits_cpu(type);
+    const ggml_type vec_dot_type = traits->vec_dot_type;
+    const size_t row_size   = ggml_row_size(type, K);
+    const size_t row_size_b = ggml_row_size(vec_dot_type, K);
+
+    std::vector<uint8_t> qb(row_size_b*n_tokens);
+    for (int64_t t = 0; t < n_tokens; t++) {
+        ggml_get_type_traits_cpu(vec_dot_type)->from_float((const float *) b->data + t*K, qb.data() + t*row_size_b, K);
+    }
+
+    std::vector<float> expected(M*n_used*n_tokens);
+    for (int64_t t = 0; t < n_tokens; t++) {
+        for (int64_t e = 0; e < n_used; e++) {
+            const int32_t id = ((const int32_t *) ids->data)[t*n_used + e];
+            for (int64_t i = 0; i < M; i++) {
+                const char * row = (const char *) as->data + (id*M + i)*row_size;
+                traits->vec_dot(K, &expected[(t*n_used + e)*M + i], 0, row, 0, qb.data() + t*row_size_b, 0, 1);
+            }
+        }
+    }
+
+    const double err = nmse((const float *) out->data, expected.data(), expected.size());
+    const bool ok = err < 1e-8;
+    printf("%s, n_threads = %d: nmse = %.3e %s\n", ggml_type_name(type), n_threads, err, ok ? "OK" : "FAILED");
+
+    ggml_free(ctx);
+    return ok;
+}
+
+int main(void) {
+    // initializes the FP16 tables used by vec_dot
+    ggml_cpu_init();
+
+    const ggml_type types[] = { GGML_TYPE_Q4_0, GGML_TYPE_Q8_0, GGML_TYPE_Q4_K, GGML_TYPE_Q6_K };
+
+    std::mt19937 rng(1234);
+
+    int n_failed = 0;
+    for (ggml_type type : types) {
+        for (int n_threads : { 1, 4 }) {
+            n_failed += !test_mul_mat_id(type, n_threads, rng);
+        }
+    }
+
+    if (n_failed > 0) {
+        printf("%d tests failed\n", n_failed);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,107 @@
+// Q, K and V projections sharing their src1, which is overwritten in place between the K and V MUL_MATs
+// the graph is computed with and without the src1 cache of the CPU backend, the results must be the same
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+struct test_graph {
+    struct ggml_context * ctx;
+    struct ggml_cgraph  * gf;
+    struct ggml_tensor  * x;
+    struct ggml_tensor  * out[3];
+};
+
+static test_graph build_graph(ggml_type type, int64_t K, int64_t M, int64_t N, std::mt19937 & rng) {
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ 16*1024*1024,
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ false,
+    };
+    test_graph g;
+    g.ctx = ggml_init(params);
+
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<float> data(K*M);
+
+    struct ggml_tensor * w[3];
+    for (int i = 0; i < 3; i++) {
+        w[i] = ggml_new_tensor_2d(g.ctx, type, K, M);
+        for (auto & v : data) {
+            v = dist(rng);
+        }
+        ggml_quantize_chunk(type, data.data(), w[i]->data, 0, M, K, nullptr);
+    }
+
+    g.x = ggml_new_tensor_2d(g.ctx, GGML_TYPE_F32, K, N);
+    for (int64_t i = 0; i < K*N; i++) {
+        ((float *) g.x->data)[i] = dist(rng);
+    }
+
+    g.gf = ggml_new_graph(g.ctx);
+
+    // the nodes are added in this order: Q, K, x *= 0.5 (in place), V
+    g.out[0] = ggml_mul_mat(g.ctx, w[0], g.x);
+    ggml_build_forward_expand(g.gf, g.out[0]);
+    g.out[1] = ggml_mul_mat(g.ctx, w[1], g.x);
+    ggml_build_forward_expand(g.gf, g.out[1]);
+    ggml_build_forward_expand(g.gf, ggml_scale_inplace(g.ctx, g.x, 0.5f));
+    g.out[2] = ggml_mul_mat(g.ctx, w[2], g.x);
+    ggml_build_forward_expand(g.gf, g.out[2]);
+
+    return g;
+}
+
+// returns false if the graph was expected to use the src1 cache but does not
+static bool compute(test_graph & g, bool use_cache, int n_threads) {
+    struct ggml_cplan cplan = ggml_graph_plan(g.gf, n_threads, nullptr);
+    if (use_cache && cplan.src1_cache_size == 0) {
+        return false;
+    }
+    if (!use_cache) {
+        // disables the cache, the work buffer keeps its size
+        cplan.src1_cache_size = 0;
+    }
+    std::vector<uint8_t> work(cplan.work_size);
+    cplan.work_data = work.data();
+    return ggml_graph_compute(g.gf, &cplan) == GGML_STATUS_SUCCESS;
+}
+
+int main(void) {
+    const ggml_type types[] = { GGML_TYPE_Q4_0, GGML_TYPE_Q8_0, GGML_TYPE_Q4_K };
+    const int64_t K = 512;
+    const int64_t M = 16;
+    const int64_t N = 5;
+
+    int n_failed = 0;
+    for (ggml_type type : types) {
+        for (int n_threads : { 1, 4 }) {
+            // the same seed gives the same weights and inputs for both graphs
+            std::mt19937 rng0(42);
+            std::mt19937 rng1(42);
+            test_graph ref = build_graph(type, K, M, N, rng0);
+            test_graph res = build_graph(type, K, M, N, rng1);
+
+            bool ok = compute(ref, false, n_threads) && compute(res, true, n_threads);
+            for (int i = 0; ok && i < 3; i++) {
+                ok = memcmp(ref.out[i]->data, res.out[i]->data, ggml_nbytes(ref.out[i])) == 0;
+            }
+            printf("%s, n_threads = %d: %s\n", ggml_type_name(type), n_threads, ok ? "OK" : "FAILED");
+            n_failed += !ok;
+
+            ggml_free(ref.ctx);
+            ggml_free(res.ctx);
+        }
+    }
+
+    if (n_failed > 0) {
+        printf("%d tests failed\n", n_failed);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
@@ -4,8 +4,11 @@
 #include "ggml-cpu.h"
 #include "ggml-opt.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cinttypes>
+#include <cstdio>
+#include <cstring>
 #include <random>
 #include <string>
 #include <thread>
@@ -167,14 +170,32 @@ static void helper_after_test(
     ntest++;
 }
 
-static std::pair<int, int> test_dataset(ggml_backend_sched_t backend_sched, ggml_backend_t backend, const bool shuffle) {
+// Writes the same values as helper_get_ctx_data for a streaming dataset, userdata is a pointer to ndata_shard.
+static bool helper_read_shard(void * userdata, int64_t ishard, float * data, float * labels) {
+    const int64_t ndata_shard = *(const int64_t *) userdata;
+
+    for (int64_t idata_shard = 0; idata_shard < ndata_shard; ++idata_shard) {
+        const int64_t idata = ishard*ndata_shard + idata_shard;
+        for (int64_t id = 0; id < ne_datapoint; ++id) {
+            data[  idata_shard*ne_datapoint + id] =     16*idata + id;
+        }
+        for (int64_t il = 0; il < ne_label;     ++il) {
+            labels[idata_shard*ne_label     + il] = 16*(16*idata + il);
+        }
+    }
+    return true;
+}
+
+static std::pair<int, int> test_dataset(ggml_backend_sched_t backend_sched, ggml_backend_t backend, const bool shuffle, const bool streaming) {
     int ntest = 0;
     int npass = 0;
 
     struct helper_ctx_data cd = helper_get_ctx_data(backend_sched, backend);
 
     for (int64_t ndata_shard = 1; ndata_shard <= ndata; ++ndata_shard) {
-        ggml_opt_dataset_t dataset = cd.datasets_supervised[ndata_shard-1];
+        ggml_opt_dataset_t dataset = streaming ?
+            ggml_opt_dataset_init_callback(ne_datapoint, ne_label, ndata, ndata_shard, helper_read_shard, &ndata_shard) :
+            cd.datasets_supervised[ndata_shard-1];
 
         if (shuffle) {
             ggml_opt_dataset_shuffle(cd.opt_ctx, dataset, -1);
@@ -233,8 +254,85 @@ static std::pair<int, int> test_dataset(ggml_backend_sched_t backend_sched, ggml
                 }
             }
 
-            printf("  %s(shuffle=%s, ndata_shard=%" PRId64 ", ndata_batch=%" PRId64 "): ",
-                   __func__, shuffle ? "yes" : "no", ndata_shard, ndata_batch);
+            printf("  %s(shuffle=%s, streaming=%s, ndata_shard=%" PRId64 ", ndata_batch=%" PRId64 "): ",
+                   __func__, shuffle ? "yes" : "no", streaming ? "yes" : "no", ndata_shard, ndata_batch);
+            if (subtest_ok) {
+                printf("\033[1;32mOK\033[0m\n");
+                npass++;
+            } else {
+                printf("\033[1;31mFAIL\033[0m\n");
+            }
+            ntest++;
+        }
+
+        if (streaming) {
+            ggml_opt_dataset_free(dataset);
+        }
+    }
+
+    helper_free_ctx_data(cd);
+
+    return std::make_pair(npass, ntest);
+}
+
+// Writes the in-memory datasets to files, maps them as streaming datasets and compares the batches of both.
+static std::pair<int, int> test_dataset_mmap(ggml_backend_sched_t backend_sched, ggml_backend_t backend) {
+    int ntest = 0;
+    int npass = 0;
+
+    struct helper_ctx_data cd = helper_get_ctx_data(backend_sched, backend);
+
+    const char * fname_data   = "test-opt-dataset-data.bin";
+    const char * fname_labels = "test-opt-dataset-labels.bin";
+
+    for (int64_t ndata_shard = 1; ndata_shard <= ndata; ++ndata_shard) {
+        ggml_opt_dataset_t dataset = cd.datasets_supervised[ndata_shard-1];
+
+        bool write_ok = true;
+        for (const auto & [tensor, fname] : {
+                std::make_pair(ggml_opt_dataset_data(dataset),   fname_data),
+                std::make_pair(ggml_opt_dataset_labels(dataset), fname_labels)}) {
+            std::vector<float> values(ggml_nelements(tensor));
+            ggml_backend_tensor_get(tensor, values.data(), 0, ggml_nbytes(tensor));
+
+            FILE * f = fopen(fname, "wb");
+            write_ok = write_ok && f && fwrite(values.data(), sizeof(float), values.size(), f) == values.size();
+            if (f) {
+                fclose(f);
+            }
+        }
+
+        ggml_opt_dataset_t dataset_mmap = write_ok ?
+            ggml_opt_dataset_init_mmap(ne_datapoint, ne_label, ndata, ndata_shard, fname_data, fname_labels) : nullptr;
+
+        for (int64_t ndata_batch = 1; ndata_batch <= ndata; ++ndata_batch) {
+            if (ndata_batch % ndata_shard != 0) {
+                continue;
+            }
+            bool subtest_ok = dataset_mmap != nullptr;
+
+            struct ggml_tensor *   data_batch =   cd.data_batch[ndata_batch-1];
+            struct ggml_tensor * labels_batch = cd.labels_batch[ndata_batch-1];
+
+            std::vector<float>   data(ggml_nelements(  data_batch));
+            std::vector<float> labels(ggml_nelements(labels_batch));
+            std::vector<float>   data_mmap(data.size());
+            std::vector<float> labels_mmap(labels.size());
+
+            const int64_t nbatches = ndata / ndata_batch;
+            for (int64_t ibatch = 0; subtest_ok && ibatch < nbatches; ++ibatch) {
+                ggml_opt_dataset_get_batch(dataset, data_batch, labels_batch, ibatch);
+                ggml_backend_tensor_get(  data_batch,   data.data(), 0, ggml_nbytes(  data_batch));
+                ggml_backend_tensor_get(labels_batch, labels.data(), 0, ggml_nbytes(labels_batch));
+
+                ggml_opt_dataset_get_batch(dataset_mmap, data_batch, labels_batch, ibatch);
+                ggml_backend_tensor_get(  data_batch,   data_mmap.data(), 0, ggml_nbytes(  data_batch));
+                ggml_backend_tensor_get(labels_batch, labels_mmap.data(), 0, ggml_nbytes(labels_batch));
+
+                subtest_ok = data == data_mmap && labels == labels_mmap;
+            }
+
+            printf("  %s(ndata_shard=%" PRId64 ", ndata_batch=%" PRId64 "): ", __func__, ndata_shard, ndata_batch);
             if (subtest_ok) {
                 printf("\033[1;32mOK\033[0m\n");
                 npass++;
@@ -243,8 +341,15 @@ static std::pair<int, int> test_dataset(ggml_backend_sched_t backend_sched, ggml
             }
             ntest++;
         }
+
+        if (dataset_mmap) {
+            ggml_opt_dataset_free(dataset_mmap);
+        }
     }
 
+    remove(fname_data);
+    remove(fname_labels);
+
     helper_free_ctx_data(cd);
 
     return std::make_pair(npass, ntest);
@@ -464,6 +569,64 @@ static std::pair<int, int> test_epoch_vs_fit(ggml_backend_sched_t backend_sched,
     return std::make_pair(npass, ntest);
 }
 
+static std::pair<int, int> test_epoch_vs_sync(ggml_backend_sched_t backend_sched, ggml_backend_t backend) {
+    int ntest = 0;
+    int npass = 0;
+
+    // ggml_opt_epoch evaluates the batches asynchronously, the results must be the same as for synchronous evaluation.
+
+    float  weights_epoch;
+    float  weights_sync;
+    double loss_epoch;
+    double loss_sync;
+    int64_t ndata_epoch;
+    int64_t ndata_sync;
+
+    {
+        struct helper_ctx_data cd = helper_get_ctx_data(backend_sched, backend, /*init_opt_ctx =*/ true);
+        ggml_opt_dataset_t dataset = cd.dataset_unsupervised;
+
+        for (int epoch = 0; epoch < 2; ++epoch) {
+            ggml_opt_epoch(cd.opt_ctx, dataset, cd.result, nullptr, ndata, nullptr, nullptr);
+        }
+
+        ggml_backend_tensor_get(cd.weights, &weights_epoch, 0, ggml_nbytes(cd.weights));
+        ggml_opt_result_loss(cd.result, &loss_epoch, nullptr);
+        ggml_opt_result_ndata(cd.result, &ndata_epoch);
+        helper_free_ctx_data(cd);
+    }
+    {
+        struct helper_ctx_data cd = helper_get_ctx_data(backend_sched, backend, /*init_opt_ctx =*/ true);
+        ggml_opt_dataset_t dataset = cd.dataset_unsupervised;
+        struct ggml_tensor * inputs = ggml_opt_inputs(cd.opt_ctx);
+
+        for (int epoch = 0; epoch < 2; ++epoch) {
+            for (int64_t ibatch = 0; ibatch < ndata/inputs->ne[1]; ++ibatch) {
+                ggml_opt_dataset_get_batch(dataset, inputs, nullptr, ibatch);
+                ggml_opt_forward_backward(cd.opt_ctx, cd.result);
+            }
+        }
+
+        ggml_backend_tensor_get(cd.weights, &weights_sync, 0, ggml_nbytes(cd.weights));
+        ggml_opt_result_loss(cd.result, &loss_sync, nullptr);
+        ggml_opt_result_ndata(cd.result, &ndata_sync);
+        helper_free_ctx_data(cd);
+    }
+
+    const bool subtest_ok = weights_epoch == weights_sync && loss_epoch == loss_sync && ndata_epoch == ndata_sync;
+
+    printf("  %s(): ", __func__);
+    if (subtest_ok) {
+        printf("\033[1;32mOK\033[0m\n");
+        npass++;
+    } else {
+        printf("\033[1;31mFAIL\033[0m\n");
+    }
+    ntest++;
+
+    return std::make_pair(npass, ntest);
+}
+
 static void helper_after_test_idata_split(
         const char * func, const bool high_level, const int epoch,
         const std::string subtest, const bool subtest_ok, int & ntest, int & npass) {
@@ -775,12 +938,310 @@ static std::pair<int, int> test_regression(ggml_backend_sched_t backend_sched, g
     return std::make_pair(npass, ntest);
 }
 
+static std::pair<int, int> test_checkpointing(ggml_backend_sched_t backend_sched, ggml_backend_t backend) {
+    int ntest = 0;
+    int npass = 0;
+
+    // Fit f(x) = 0.5*((a*x)^2 + b)^2 with and without gradient checkpointing, the results should be the same.
+
+    constexpr int64_t ndata_checkpointing = 64;
+    constexpr int     nepoch              = 4;
+
+    ggml_opt_dataset_t dataset = ggml_opt_dataset_init(1, 1, ndata_checkpointing, 1);
+
+    float * data   = ggml_get_data_f32(ggml_opt_dataset_data(  dataset));
+    float * labels = ggml_get_data_f32(ggml_opt_dataset_labels(dataset));
+
+    for (int64_t idata = 0; idata < ndata_checkpointing; ++idata) {
+        const float x = -1.0f + 2.0f*idata/(ndata_checkpointing - 1);
+        data[idata]   = x;
+        labels[idata] = 0.5f*(x*x + 0.5f)*(x*x + 0.5f);
+    }
+
+    float ab_fit[2][2];
+    for (bool checkpointing : {false, true}) {
+        struct ggml_context * ctx_static;
+        struct ggml_context * ctx_compute;
+        {
+            struct ggml_init_params params = {
+                /*.mem_size   =*/ 3*ggml_tensor_overhead(),
+                /*.mem_buffer =*/ nullptr,
+                /*.no_alloc   =*/ true,
+            };
+            ctx_static = ggml_init(params);
+        }
+        {
+            struct ggml_init_params params = {
+                /*.mem_size   =*/ GGML_DEFAULT_GRAPH_SIZE*ggml_tensor_overhead() + 3*ggml_graph_overhead(),
+                /*.mem_buffer =*/ nullptr,
+                /*.no_alloc   =*/ true,
+            };
+            ctx_compute = ggml_init(params);
+        }
+
+        struct ggml_tensor * x = ggml_new_tensor_2d(ctx_static, GGML_TYPE_F32, 1, ndata_checkpointing/4);
+        ggml_set_name(x, "x");
+
+        struct ggml_tensor * a = ggml_new_tensor_1d(ctx_static, GGML_TYPE_F32, 1);
+        ggml_set_name(a, "a");
+        ggml_set_param(ctx_static, a);
+
+        struct ggml_tensor * b = ggml_new_tensor_1d(ctx_static, GGML_TYPE_F32, 1);
+        ggml_set_name(b, "b");
+        ggml_set_param(ctx_static, b);
+
+        struct ggml_tensor * ax  = ggml_mul(ctx_compute, x, a);
+        struct ggml_tensor * ax2 = ggml_sqr(ctx_compute, ax);
+        struct ggml_tensor * f   = ggml_scale(ctx_compute, ggml_sqr(ctx_compute, ggml_add(ctx_compute, ax2, b)), 0.5f);
+        ggml_set_name(f, "f");
+
+        ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors(ctx_static, backend);
+        const float a0 = 0.5f;
+        const float b0 = 0.0f;
+        ggml_backend_tensor_set(a, &a0, 0, sizeof(float));
+        ggml_backend_tensor_set(b, &b0, 0, sizeof(float));
+
+        struct ggml_opt_params opt_params = ggml_opt_default_params(backend_sched, ctx_compute, x, f, GGML_OPT_LOSS_TYPE_MEAN_SQUARED_ERROR);
+        opt_params.get_opt_pars = helper_get_regression_opt_pars;
+        if (checkpointing) {
+            opt_params.checkpoints   = &ax2; // ax and the sum with b are recomputed
+            opt_params.n_checkpoints = 1;
+        }
+        ggml_opt_context_t opt_ctx = ggml_opt_init(opt_params);
+
+        for (int epoch = 0; epoch < nepoch; ++epoch) {
+            ggml_opt_epoch(opt_ctx, dataset, nullptr, nullptr, -1, nullptr, nullptr);
+        }
+
+        ggml_backend_tensor_get(a, &ab_fit[checkpointing][0], 0, sizeof(float));
+        ggml_backend_tensor_get(b, &ab_fit[checkpointing][1], 0, sizeof(float));
+
+        ggml_opt_free(opt_ctx);
+        ggml_backend_buffer_free(buf);
+        ggml_free(ctx_static);
+        ggml_free(ctx_compute);
+    }
+
+    {
+        // The weights must have changed, otherwise the comparison is meaningless.
+        const bool subtest_ok = ab_fit[0][1] != 0.0f &&
+            almost_equal(ab_fit[0][0], ab_fit[1][0], 1e-6) && almost_equal(ab_fit[0][1], ab_fit[1][1], 1e-6);
+        printf("  %s(subtest=weights): ", __func__);
+        if (subtest_ok) {
+            printf("\033[1;32mOK\033[0m\n");
+            npass++;
+        } else {
+            printf("\033[1;31mFAIL\033[0m\n");
+        }
+        ntest++;
+    }
+
+    ggml_opt_dataset_free(dataset);
+
+    return std::make_pair(npass, ntest);
+}
+
+static std::pair<int, int> test_mixed_precision(
+        ggml_backend_sched_t backend_sched, ggml_backend_t backend, enum ggml_type compute_type, enum ggml_type moment_type) {
+    int ntest = 0;
+    int npass = 0;
+
+    // Test for regression with f(x) = w0*x0 + w1*x1 + b where the matrix multiplication uses w cast to compute_type
+    // and the optimizer momenta are stored as moment_type.
+
+    constexpr int64_t ndata_regression = 200;
+    constexpr float w0_true = 1.2f;
+    constexpr float w1_true = -0.7f;
+    constexpr float b_true  = 3.4f;
+
+    ggml_opt_dataset_t dataset = ggml_opt_dataset_init(2, 1, ndata_regression, ndata_regression);
+
+    float * data   = ggml_get_data_f32(ggml_opt_dataset_data(  dataset));
+    float * labels = ggml_get_data_f32(ggml_opt_dataset_labels(dataset));
+
+    for (int64_t idata = 0; idata < ndata_regression; ++idata) {
+        const float x0 = -1.0f + 2.0f*(idata % 20)/19;
+        const float x1 = -1.0f + 2.0f*(idata / 20)/9;
+
+        data[2*idata + 0] = x0;
+        data[2*idata + 1] = x1;
+        labels[idata]     = w0_true*x0 + w1_true*x1 + b_true;
+    }
+
+    struct ggml_context * ctx_static;
+    struct ggml_context * ctx_compute;
+    {
+        struct ggml_init_params params = {
+            /*.mem_size   =*/ 3*ggml_tensor_overhead(),
+            /*.mem_buffer =*/ nullptr,
+            /*.no_alloc   =*/ true,
+        };
+        ctx_static = ggml_init(params);
+    }
+    {
+        struct ggml_init_params params = {
+            /*.mem_size   =*/ GGML_DEFAULT_GRAPH_SIZE*ggml_tensor_overhead() + 3*ggml_graph_overhead(),
+            /*.mem_buffer =*/ nullptr,
+            /*.no_alloc   =*/ true,
+        };
+        ctx_compute = ggml_init(params);
+    }
+
+    struct ggml_tensor * x = ggml_new_tensor_2d(ctx_static, GGML_TYPE_F32, 2, ndata_regression);
+    ggml_set_name(x, "x");
+
+    struct ggml_tensor * w = ggml_new_tensor_2d(ctx_static, GGML_TYPE_F32, 2, 1);
+    ggml_set_name(w, "w");
+    ggml_set_param(ctx_static, w);
+
+    struct ggml_tensor * b = ggml_new_tensor_1d(ctx_static, GGML_TYPE_F32, 1);
+    ggml_set_name(b, "b");
+    ggml_set_param(ctx_static, b);
+
+    struct ggml_tensor * f = ggml_add(ctx_compute, ggml_mul_mat(ctx_compute, w, x), b);
+    ggml_set_name(f, "f");
+
+    ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors(ctx_static, backend);
+    const float w0[2] = {1.0f, 0.0f};
+    const float b0    = 3.0f;
+    ggml_backend_tensor_set(w, w0, 0, sizeof(w0));
+    ggml_backend_tensor_set(b, &b0, 0, sizeof(float));
+
+    struct ggml_opt_params opt_params = ggml_opt_default_params(backend_sched, ctx_compute, x, f, GGML_OPT_LOSS_TYPE_MEAN_SQUARED_ERROR);
+    opt_params.get_opt_pars = helper_get_regression_opt_pars;
+    opt_params.compute_type = compute_type;
+    opt_params.moment_type  = moment_type;
+    ggml_opt_context_t opt_ctx = ggml_opt_init(opt_params);
+
+    for (int epoch = 0; epoch < 100; ++epoch) {
+        ggml_opt_epoch(opt_ctx, dataset, nullptr, nullptr, -1, nullptr, nullptr);
+    }
+
+    {
+        float w_fit[2];
+        ggml_backend_tensor_get(w, w_fit, 0, sizeof(w_fit));
+        float b_fit;
+        ggml_backend_tensor_get(b, &b_fit, 0, sizeof(float));
+        const bool subtest_ok = almost_equal(w_fit[0], w0_true, 2e-2) && almost_equal(w_fit[1], w1_true, 2e-2) &&
+            almost_equal(b_fit, b_true, 2e-2);
+        printf("  %s(compute_type=%s, moment_type=%s, subtest=weights): ",
+            __func__, ggml_type_name(compute_type), ggml_type_name(moment_type));
+        if (subtest_ok) {
+            printf("\033[1;32mOK\033[0m\n");
+            npass++;
+        } else {
+            printf("\033[1;31mFAIL\033[0m\n");
+        }
+        ntest++;
+    }
+
+    ggml_opt_free(opt_ctx);
+    ggml_backend_buffer_free(buf);
+    ggml_free(ctx_static);
+    ggml_free(ctx_compute);
+    ggml_opt_dataset_free(dataset);
+
+    return std::make_pair(npass, ntest);
+}
+
+// Test that the optimizer momenta decay over many steps once the gradient is zero: a single step with gradient 1 is
+// followed by 999 steps with gradient 0, v must then be (1 - beta2)*beta2^999 and m must have decayed to almost 0.
+static std::pair<int, int> test_moment_decay(ggml_backend_t backend, enum ggml_type moment_type) {
+    int ntest = 0;
+    int npass = 0;
+
+    constexpr int64_t ne     = 64;
+    constexpr int     nsteps = 1000;
+    constexpr float   beta1  = 0.9f;
+    constexpr float   beta2  = 0.999f;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ 6*ggml_tensor_overhead() + ggml_graph_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+
+    struct ggml_tensor * w = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, ne);
+    ggml_set_param(ctx, w);
+    struct ggml_tensor * g            = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, ne);
+    struct ggml_tensor * m            = ggml_new_tensor_1d(ctx, moment_type,   ne);
+    struct ggml_tensor * v            = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, ne);
+    struct ggml_tensor * adamw_params = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 7);
+    struct ggml_tensor * step         = ggml_opt_step_adamw(ctx, w, g, m, v, adamw_params);
+
+    if (!ggml_backend_supports_op(backend, step)) {
+        ggml_free(ctx);
+        return std::make_pair(0, 0);
+    }
+
+    struct ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, step);
+
+    ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors(ctx, backend);
+    ggml_backend_buffer_clear(buf, 0);
+
+    // alpha, beta1, beta2, eps, wd, beta1h, beta2h
+    const float pars[7] = { 1e-3f, beta1, beta2, 1e-8f, 0.0f, 1.0f, 1.0f };
+    ggml_backend_tensor_set(adamw_params, pars, 0, sizeof(pars));
+
+    std::vector<float> grad(ne, 1.0f);
+    ggml_backend_tensor_set(g, grad.data(), 0, ggml_nbytes(g));
+    ggml_backend_graph_compute(backend, gf);
+
+    std::fill(grad.begin(), grad.end(), 0.0f);
+    ggml_backend_tensor_set(g, grad.data(), 0, ggml_nbytes(g));
+    for (int i = 1; i < nsteps; ++i) {
+        ggml_backend_graph_compute(backend, gf);
+    }
+
+    std::vector<float> v_result(ne);
+    ggml_backend_tensor_get(v, v_result.data(), 0, ggml_nbytes(v));
+    std::vector<uint8_t> m_data(ggml_nbytes(m));
+    ggml_backend_tensor_get(m, m_data.data(), 0, m_data.size());
+    std::vector<float> m_result(ne);
+    if (moment_type == GGML_TYPE_F32) {
+        memcpy(m_result.data(), m_data.data(), m_data.size());
+    } else {
+        ggml_bf16_to_fp32_row((const ggml_bf16_t *) m_data.data(), m_result.data(), ne);
+    }
+
+    const double v_expected = (1.0 - beta2)*pow(beta2, nsteps - 1);
+
+    bool subtest_ok = true;
+    for (int64_t i = 0; i < ne; ++i) {
+        subtest_ok = subtest_ok && almost_equal(v_result[i], v_expected, 1e-3*v_expected);
+        subtest_ok = subtest_ok && fabsf(m_result[i]) < 1e-30f;
+    }
+
+    printf("  %s(moment_type=%s): ", __func__, ggml_type_name(moment_type));
+    if (subtest_ok) {
+        printf("\033[1;32mOK\033[0m\n");
+        npass++;
+    } else {
+        printf("\033[1;31mFAIL\033[0m\n");
+    }
+    ntest++;
+
+    ggml_backend_buffer_free(buf);
+    ggml_free(ctx);
+
+    return std::make_pair(npass, ntest);
+}
+
 static std::pair<int, int> test_backend(ggml_backend_sched_t backend_sched, ggml_backend_t backend) {
     int npass = 0;
     int ntest = 0;
 
-    for (bool shuffle : {false, true}) {
-        std::pair<int, int> partial = test_dataset(backend_sched, backend, shuffle);
+    for (bool streaming : {false, true}) {
+        for (bool shuffle : {false, true}) {
+            std::pair<int, int> partial = test_dataset(backend_sched, backend, shuffle, streaming);
+            npass += partial.first;
+            ntest += partial.second;
+        }
+    }
+    {
+        std::pair<int, int> partial = test_dataset_mmap(backend_sched, backend);
         npass += partial.first;
         ntest += partial.second;
     }
@@ -805,6 +1266,11 @@ static std::pair<int, int> test_backend(ggml_backend_sched_t backend_sched, ggml
         npass += partial.first;
         ntest += partial.second;
     }
+    {
+        std::pair<int, int> partial = test_epoch_vs_sync(backend_sched, backend);
+        npass += partial.first;
+        ntest += partial.second;
+    }
     for (bool high_level : {false, true}){
         std::pair<int, int> partial = test_idata_split(backend_sched, backend, high_level);
         npass += partial.first;
@@ -822,6 +1288,26 @@ static std::pair<int, int> test_backend(ggml_backend_sched_t backend_sched, ggml
         npass += partial.first;
         ntest += partial.second;
     }
+    {
+        std::pair<int, int> partial = test_checkpointing(backend_sched, backend);
+        npass += partial.first;
+        ntest += partial.second;
+    }
+    for (enum ggml_type compute_type : {GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_BF16}) {
+        for (enum ggml_type moment_type : {GGML_TYPE_F32, GGML_TYPE_BF16}) {
+            if (compute_type == GGML_TYPE_F32 && moment_type == GGML_TYPE_F32) {
+                continue; // same as test_regression
+            }
+            std::pair<int, int> partial = test_mixed_precision(backend_sched, backend, compute_type, moment_type);
+            npass += partial.first;
+            ntest += partial.second;
+        }
+    }
+    for (enum ggml_type moment_type : {GGML_TYPE_F32, GGML_TYPE_BF16}) {
+        std::pair<int, int> partial = test_moment_decay(backend, moment_type);
+        npass += partial.first;
+        ntest += partial.second;
+    }
 
     return std::make_pair(npass, ntest);
 }
@@ -7,6 +7,7 @@
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include <string>
 #include <vector>
 
@@ -98,6 +99,57 @@ static float dot_product_error(const ggml_type_traits * qfns, const ggml_type_tr
     return fabsf(result - dot_ref) / test_size;
 }
 
+// Multi-threaded quantization must give the same result as the single-threaded one
+static bool quantize_mt_matches(ggml_type type) {
+    const int64_t n_per_row = 256;
+    const int64_t nrows     = 200; // several chunks
+    const int64_t start     = 3*n_per_row;
+
+    std::vector<float> data(nrows*n_per_row);
+    generate_data(2.0, data.size(), data.data());
+
+    std::vector<float> imatrix(n_per_row, 1.0f);
+    const float * im = ggml_quantize_requires_imatrix(type) ? imatrix.data() : nullptr;
+
+    const size_t row_size = ggml_row_size(type, n_per_row);
+    std::vector<uint8_t> q_st(row_size*nrows);
+    std::vector<uint8_t> q_mt(row_size*nrows);
+
+    const int64_t rows = nrows - start/n_per_row;
+    const size_t size_st = ggml_quantize_chunk   (type, data.data(), q_st.data(), start, rows, n_per_row, im);
+    size_t size_mt = 0;
+    const bool done = ggml_quantize_chunk_mt(type, data.data(), q_mt.data(), start, rows, n_per_row, im, 4, nullptr, nullptr, &size_mt);
+
+    return done && size_st == size_mt && memcmp(q_st.data(), q_mt.data(), q_st.size()) == 0;
+}
+
+static bool cancel_after_first_chunk(int64_t rows_done, int64_t nrows, void * user_data) {
+    (void) rows_done;
+    (void) nrows;
+    (void) user_data;
+    return false;
+}
+
+// A cancelled quantization must be told apart from one that has no rows to quantize
+static bool quantize_mt_cancel() {
+    const int64_t n_per_row = 256;
+    const int64_t nrows     = 200;
+
+    std::vector<float> data(nrows*n_per_row);
+    generate_data(2.0, data.size(), data.data());
+    std::vector<uint8_t> q(ggml_row_size(GGML_TYPE_Q4_0, n_per_row)*nrows);
+
+    size_t size = 1;
+    const bool empty_done = ggml_quantize_chunk_mt(GGML_TYPE_Q4_0, data.data(), q.data(), 0, 0, n_per_row, nullptr, 4, nullptr, nullptr, &size);
+    if (!empty_done || size != 0) {
+        return false;
+    }
+
+    size = 1;
+    const bool cancelled_done = ggml_quantize_chunk_mt(GGML_TYPE_Q4_0, data.data(), q.data(), 0, nrows, n_per_row, nullptr, 4, cancel_after_first_chunk, nullptr, &size);
+    return !cancelled_done && size == 0;
+}
+
 int main(int argc, char * argv[]) {
     bool verbose = false;
     const size_t test_size = 32 * 128;
@@ -181,6 +233,22 @@ int main(int argc, char * argv[]) {
             if (failed || verbose) {
                 printf("%5s dot product error:              %s (%f)\n", ggml_type_name(type), RESULT_STR[failed], vec_dot_error);
             }
+
+            if (type != GGML_TYPE_Q8_1 && type != GGML_TYPE_Q8_K) {
+                failed = !quantize_mt_matches(type);
+                num_failed += failed;
+                if (failed || verbose) {
+                    printf("%5s multi-threaded quantization:    %s\n", ggml_type_name(type), RESULT_STR[failed]);
+                }
+            }
+        }
+    }
+
+    {
+        const bool failed = !quantize_mt_cancel();
+        num_failed += failed;
+        if (failed || verbose) {
+            printf("multi-threaded quantization cancel: %s\n", RESULT_STR[failed]);
         }
     }
 
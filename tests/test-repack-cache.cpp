@@ -0,0 +1,137 @@
+// round trip of the repack cache: the weights are repacked and saved to the cache, then loaded again from it
+// the repacked data must be byte for byte the same, also after the cache is closed, and a tensor whose data has been
+// replaced must not be served from the cache
+#include "ggml.h"
+#include "ggml-cpu.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static ggml_backend_buffer_type_t get_extra_buft(const char * name) {
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+    auto get_extra_bufts = (ggml_backend_dev_get_extra_bufts_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_dev_get_extra_bufts");
+    if (!get_extra_bufts) {
+        return nullptr;
+    }
+    for (ggml_backend_buffer_type_t * buft = get_extra_bufts(dev); buft && *buft; ++buft) {
+        if (strcmp(ggml_backend_buft_name(*buft), name) == 0) {
+            return *buft;
+        }
+    }
+    return nullptr;
+}
+
+// loads the weights into the repacking buffer type, with the cache at cache_path if it is not NULL,
+// and returns their repacked data, which is read after the cache is closed
+// returns false if the weights are not repacked on this CPU
+static bool load(ggml_backend_buffer_type_t buft, ggml_type type, int64_t K, int64_t M, const char * cache_path, uint64_t model_key,
+                 const std::vector<std::vector<uint8_t>> & weights, std::vector<std::vector<uint8_t>> & repacked) {
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ weights.size()*ggml_tensor_overhead(),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+    std::vector<ggml_tensor *> tensors;
+    for (size_t i = 0; i < weights.size(); i++) {
+        ggml_tensor * t = ggml_new_tensor_2d(ctx, type, K, M);
+        ggml_format_name(t, "blk.%zu.weight", i);
+        tensors.push_back(t);
+    }
+    ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors_from_buft(ctx, buft);
+
+    bool ok = tensors[0]->extra != nullptr;
+    if (cache_path) {
+        ggml_backend_cpu_repack_cache_open(cache_path, model_key);
+    }
+    for (size_t i = 0; ok && i < tensors.size(); i++) {
+        ggml_backend_tensor_set(tensors[i], weights[i].data(), 0, weights[i].size());
+    }
+    if (cache_path) {
+        ggml_backend_cpu_repack_cache_close();
+    }
+    repacked.clear();
+    for (size_t i = 0; ok && i < tensors.size(); i++) {
+        // the buffer is in host memory, but the repacking buffer type cannot read tensors back
+        const uint8_t * data = (const uint8_t *) tensors[i]->data;
+        repacked.emplace_back(data, data + ggml_nbytes(tensors[i]));
+    }
+
+    ggml_backend_buffer_free(buf);
+    ggml_free(ctx);
+    return ok;
+}
+
+int main(void) {
+    ggml_backend_buffer_type_t buft = get_extra_buft("CPU_AARCH64");
+    if (!buft) {
+        printf("CPU_AARCH64 buffer type not available, skipping\n");
+        return 0;
+    }
+    const ggml_type type = GGML_TYPE_Q4_K;
+    const int64_t K = 512;
+    const int64_t M = 16;
+    const uint64_t model_key = 0x1234;
+    const std::string path = "test-repack-cache.bin";
+    remove(path.c_str());
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<float> w(K*M);
+    auto random_weights = [&](std::vector<uint8_t> & data) {
+        for (auto & x : w) {
+            x = dist(rng);
+        }
+        data.resize(ggml_row_size(type, K)*M);
+        ggml_quantize_chunk(type, w.data(), data.data(), 0, M, K, nullptr);
+    };
+    std::vector<std::vector<uint8_t>> weights(2);
+    for (auto & data : weights) {
+        random_weights(data);
+    }
+
+    // save
+    std::vector<std::vector<uint8_t>> expected;
+    const bool repacked = load(buft, type, K, M, path.c_str(), model_key, weights, expected);
+    if (!repacked) {
+        printf("%s not repacked on this CPU, skipping\n", ggml_type_name(type));
+        remove(path.c_str());
+        return 0;
+    }
+
+    int n_failed = 0;
+
+    // reload, every tensor comes from the cache
+    std::vector<std::vector<uint8_t>> result;
+    load(buft, type, K, M, path.c_str(), model_key, weights, result);
+    size_t n_hits = ggml_backend_cpu_repack_cache_n_hits();
+    bool ok = n_hits == weights.size() && result == expected;
+    printf("reload: %zu cache hits, %s\n", n_hits, ok ? "OK" : "FAILED");
+    n_failed += !ok;
+
+    // replace the data of one tensor, it must be repacked again instead of being taken from the cache
+    random_weights(weights[1]);
+    std::vector<std::vector<uint8_t>> changed;
+    load(buft, type, K, M, nullptr, 0, weights, changed);
+
+    load(buft, type, K, M, path.c_str(), model_key, weights, result);
+    n_hits = ggml_backend_cpu_repack_cache_n_hits();
+    ok = n_hits == 1 && result[0] == expected[0] && result[1] == changed[1] && result[1] != expected[1];
+    printf("changed tensor: %zu cache hits, %s\n", n_hits, ok ? "OK" : "FAILED");
+    n_failed += !ok;
+
+    remove(path.c_str());
+
+    if (n_failed > 0) {
+        printf("%d tests failed\n", n_failed);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,147 @@
+// compares mul_mat with weights repacked by the CPU_AARCH64 buffer type against the plain CPU buffer
+// the src1 row counts are odd so that the gemm kernels also have to handle a partial group of rows
+#include "ggml.h"
+#include "ggml-cpu.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static ggml_backend_buffer_type_t get_extra_buft(const char * name) {
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+    auto get_extra_bufts = (ggml_backend_dev_get_extra_bufts_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_dev_get_extra_bufts");
+    if (!get_extra_bufts) {
+        return nullptr;
+    }
+    for (ggml_backend_buffer_type_t * buft = get_extra_bufts(dev); buft && *buft; ++buft) {
+        if (strcmp(ggml_backend_buft_name(*buft), name) == 0) {
+            return *buft;
+        }
+    }
+    return nullptr;
+}
+
+static double nmse(const std::vector<float> & a, const std::vector<float> & b) {
+    double mse = 0.0;
+    double ref = 0.0;
+    for (size_t i = 0; i < a.size(); i++) {
+        mse += (a[i] - b[i])*(a[i] - b[i]);
+        ref += b[i]*b[i];
+    }
+    return mse/ref;
+}
+
+// computes src1 x weights^T with the weights in a buffer of type buft
+// returns false if the weights were expected to be repacked but are not
+static bool mul_mat(ggml_backend_t backend, ggml_backend_buffer_type_t buft, bool repacked, ggml_type type,
+                    const std::vector<uint8_t> & weights, const std::vector<float> & src1,
+                    int64_t K, int64_t M, int64_t N, std::vector<float> & out) {
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ 3*ggml_tensor_overhead() + ggml_graph_overhead(),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+    struct ggml_context * ctx_w = ggml_init(params);
+    struct ggml_context * ctx   = ggml_init(params);
+
+    struct ggml_tensor * a = ggml_new_tensor_2d(ctx_w, type, K, M);
+    ggml_set_name(a, "weights");
+    struct ggml_tensor * b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, K, N);
+    struct ggml_tensor * c = ggml_mul_mat(ctx, a, b);
+
+    ggml_backend_buffer_t buf_w = ggml_backend_alloc_ctx_tensors_from_buft(ctx_w, buft);
+    ggml_backend_buffer_t buf   = ggml_backend_alloc_ctx_tensors(ctx, backend);
+
+    bool ok = !repacked || a->extra != nullptr;
+    if (ok) {
+        ggml_backend_tensor_set(a, weights.data(), 0, weights.size());
+        ggml_backend_tensor_set(b, src1.data(), 0, ggml_nbytes(b));
+
+        struct ggml_cgraph * gf = ggml_new_graph(ctx);
+        ggml_build_forward_expand(gf, c);
+        ggml_backend_graph_compute(backend, gf);
+
+        out.resize(ggml_nelements(c));
+        ggml_backend_tensor_get(c, out.data(), 0, ggml_nbytes(c));
+    }
+
+    ggml_backend_buffer_free(buf);
+    ggml_backend_buffer_free(buf_w);
+    ggml_free(ctx);
+    ggml_free(ctx_w);
+    return ok;
+}
+
+int main(void) {
+    ggml_backend_t backend = ggml_backend_cpu_init();
+    ggml_backend_cpu_set_n_threads(backend, 2);
+
+    ggml_backend_buffer_type_t buft_repack = get_extra_buft("CPU_AARCH64");
+    if (!buft_repack) {
+        printf("CPU_AARCH64 buffer type not available, skipping\n");
+        ggml_backend_free(backend);
+        return 0;
+    }
+
+    const ggml_type types[] = { GGML_TYPE_Q4_K, GGML_TYPE_Q6_K, GGML_TYPE_Q8_0 };
+    // the weights are repacked in groups of 8 rows
+    const int64_t Ms[] = { 8, 24, 40 };
+    const int64_t Ns[] = { 1, 3, 5, 7, 13 };
+    const int64_t K = 512;
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    int n_failed = 0;
+    for (ggml_type type : types) {
+        bool skipped = false;
+        for (int64_t M : Ms) {
+            std::vector<float> w(K*M);
+            for (auto & x : w) {
+                x = dist(rng);
+            }
+            std::vector<uint8_t> weights(ggml_row_size(type, K)*M);
+            ggml_quantize_chunk(type, w.data(), weights.data(), 0, M, K, nullptr);
+
+            for (int64_t N : Ns) {
+                std::vector<float> src1(K*N);
+                for (auto & x : src1) {
+                    x = dist(rng);
+                }
+
+                std::vector<float> expected;
+                std::vector<float> result;
+                mul_mat(backend, ggml_backend_cpu_buffer_type(), false, type, weights, src1, K, M, N, expected);
+                if (!mul_mat(backend, buft_repack, true, type, weights, src1, K, M, N, result)) {
+                    skipped = true;
+                    break;
+                }
+
+                const double err = nmse(result, expected);
+                const bool ok = err < 1e-8;
+                printf("%s: M = %3lld, N = %2lld: nmse = %.3e %s\n", ggml_type_name(type), (long long) M, (long long) N, err, ok ? "OK" : "FAILED");
+                n_failed += !ok;
+            }
+            if (skipped) {
+                break;
+            }
+        }
+        if (skipped) {
+            printf("%s: not repacked on this CPU, skipping\n", ggml_type_name(type));
+        }
+    }
+
+    ggml_backend_free(backend);
+
+    if (n_failed > 0) {
+        printf("%d tests failed\n", n_failed);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
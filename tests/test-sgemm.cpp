@@ -0,0 +1,127 @@
+// compares mul_mat, which uses llamafile_sgemm in GGML_LLAMAFILE builds, with the vec_dot of the type
+// m, n and k are not multiples of the tile sizes so that the edge tiles are covered as well
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static double nmse(const std::vector<float> & a, const std::vector<float> & b) {
+    double mse = 0.0;
+    double ref = 0.0;
+    for (size_t i = 0; i < a.size(); i++) {
+        mse += (a[i] - b[i])*(a[i] - b[i]);
+        ref += b[i]*b[i];
+    }
+    return mse/ref;
+}
+
+// dst[j*m + i] = dot(row i of the weights, row j of src1), with src1 converted to the vec_dot_type of the weights
+static void mul_mat_vec_dot(ggml_type type, const std::vector<uint8_t> & weights, const std::vector<float> & src1,
+                            int64_t k, int64_t m, int64_t n, std::vector<float> & dst) {
+    const auto * traits = ggml_get_type_traits_cpu(type);
+    const ggml_type vec_dot_type = traits->vec_dot_type;
+    const size_t row_size   = ggml_row_size(type, k);
+    const size_t row_size_y = ggml_row_size(vec_dot_type, k);
+
+    std::vector<uint8_t> y(row_size_y*n);
+    for (int64_t j = 0; j < n; j++) {
+        ggml_get_type_traits_cpu(vec_dot_type)->from_float(src1.data() + j*k, y.data() + j*row_size_y, k);
+    }
+
+    dst.resize(m*n);
+    for (int64_t j = 0; j < n; j++) {
+        for (int64_t i = 0; i < m; i++) {
+            traits->vec_dot(k, &dst[j*m + i], 0, weights.data() + i*row_size, 0, y.data() + j*row_size_y, 0, 1);
+        }
+    }
+}
+
+static void mul_mat_graph(ggml_type type, const std::vector<uint8_t> & weights, const std::vector<float> & src1,
+                          int64_t k, int64_t m, int64_t n, std::vector<float> & dst) {
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ weights.size() + 2*src1.size()*sizeof(float) + m*n*sizeof(float) + 1024*1024,
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ false,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+
+    struct ggml_tensor * a = ggml_new_tensor_2d(ctx, type, k, m);
+    struct ggml_tensor * b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, k, n);
+    memcpy(a->data, weights.data(), weights.size());
+    memcpy(b->data, src1.data(), ggml_nbytes(b));
+
+    struct ggml_tensor * c = ggml_mul_mat(ctx, a, b);
+    struct ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, c);
+    ggml_graph_compute_with_ctx(ctx, gf, 2);
+
+    dst.assign((const float *) c->data, (const float *) c->data + m*n);
+    ggml_free(ctx);
+}
+
+int main(void) {
+    // initializes the FP16 tables used by vec_dot
+    ggml_cpu_init();
+
+    if (!ggml_cpu_has_llamafile()) {
+        printf("llamafile sgemm not available, skipping\n");
+        return 0;
+    }
+
+    const ggml_type types[] = {
+        GGML_TYPE_Q2_K, GGML_TYPE_Q3_K, GGML_TYPE_Q4_K, GGML_TYPE_Q5_K, GGML_TYPE_Q6_K, GGML_TYPE_IQ4_XS,
+    };
+    // the largest tiles are 4x4, k is a number of super-blocks of 256 values
+    const int64_t ms[] = { 1, 7, 13 };
+    const int64_t ns[] = { 1, 5, 11 };
+    const int64_t ks[] = { 256, 3*256 };
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    int n_failed = 0;
+    for (ggml_type type : types) {
+        for (int64_t k : ks) {
+            for (int64_t m : ms) {
+                std::vector<float> w(k*m);
+                for (auto & x : w) {
+                    x = dist(rng);
+                }
+                std::vector<uint8_t> weights(ggml_row_size(type, k)*m);
+                ggml_quantize_chunk(type, w.data(), weights.data(), 0, m, k, nullptr);
+
+                for (int64_t n : ns) {
+                    std::vector<float> src1(k*n);
+                    for (auto & x : src1) {
+                        x = dist(rng);
+                    }
+
+                    std::vector<float> expected;
+                    std::vector<float> result;
+                    mul_mat_vec_dot(type, weights, src1, k, m, n, expected);
+                    mul_mat_graph(type, weights, src1, k, m, n, result);
+
+                    const double err = nmse(result, expected);
+                    const bool ok = err < 1e-8;
+                    if (!ok) {
+                        printf("%s: m = %2lld, n = %2lld, k = %3lld: nmse = %.3e FAILED\n", ggml_type_name(type),
+                            (long long) m, (long long) n, (long long) k, err);
+                    }
+                    n_failed += !ok;
+                }
+            }
+        }
+        printf("%s: done\n", ggml_type_name(type));
+    }
+
+    if (n_failed > 0) {
+        printf("%d tests failed\n", n_failed);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}